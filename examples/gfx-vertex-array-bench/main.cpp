@@ -0,0 +1,234 @@
+#include <iostream>
+#include <chrono>
+#include <vector>
+
+#define SDL_MAIN_HANDLED
+#include <SDL2/SDL.h>
+
+#include <glad/glad.h>
+
+#include "gfx/renderer.h"
+
+// Counts the GL calls issued per draw by the GL backend.
+// The first frame creates the vertex arrays, the next frames only bind them.
+
+constexpr uint32_t NB_MESHES = 1000;
+constexpr uint32_t NB_FRAMES = 100;
+
+static uint64_t s_gl_calls = 0;
+
+// replaces a glad function pointer with a wrapper counting the calls
+template<auto Ptr>
+struct GLHook;
+
+template<typename R, typename... Args, R(APIENTRYP* Ptr)(Args...)>
+struct GLHook<Ptr> {
+  static inline R(APIENTRYP original)(Args...) = nullptr;
+
+  static R APIENTRY call(Args... args) {
+    ++s_gl_calls;
+    return original(args...);
+  }
+
+  static void install() {
+    original = *Ptr;
+    *Ptr = &call;
+  }
+};
+
+static void install_gl_hooks() {
+  GLHook<&glad_glGenVertexArrays>::install();
+  GLHook<&glad_glBindVertexArray>::install();
+  GLHook<&glad_glBindBuffer>::install();
+  GLHook<&glad_glVertexAttribPointer>::install();
+  GLHook<&glad_glVertexAttribDivisor>::install();
+  GLHook<&glad_glEnableVertexAttribArray>::install();
+  GLHook<&glad_glActiveTexture>::install();
+  GLHook<&glad_glBindTexture>::install();
+  GLHook<&glad_glUseProgram>::install();
+  GLHook<&glad_glUniform1i>::install();
+  GLHook<&glad_glUniform1fv>::install();
+  GLHook<&glad_glUniform2fv>::install();
+  GLHook<&glad_glUniform3fv>::install();
+  GLHook<&glad_glUniform4fv>::install();
+  GLHook<&glad_glUniformMatrix4fv>::install();
+  GLHook<&glad_glBindBufferRange>::install();
+  GLHook<&glad_glEnable>::install();
+  GLHook<&glad_glDisable>::install();
+  GLHook<&glad_glCullFace>::install();
+  GLHook<&glad_glDrawArraysInstanced>::install();
+  GLHook<&glad_glDrawElementsInstancedBaseVertex>::install();
+}
+
+struct BenchShader {
+  static inline const char* VERTEX = "#version 330 core\n"
+    "layout (location = 0) in vec3 a_pos;\n"
+    "layout (location = 1) in vec4 a_color;\n"
+    "layout (location = 2) in vec2 a_uv;\n"
+    "layout (location = 3) in vec3 a_normal;\n"
+    "uniform mat4 u_mvp;\n"
+    "out vec4 io_color;\n"
+    "void main()\n"
+    "{\n"
+    "   io_color = a_color * vec4(a_normal * 0.5 + 0.5, 1.0) + vec4(a_uv, 0.0, 0.0);\n"
+    "   gl_Position = u_mvp * vec4(a_pos, 1.0);\n"
+    "}\0";
+
+  static inline const char* FRAGMENT = "#version 330 core\n"
+    "in vec4 io_color;\n"
+    "out vec4 FragColor;\n"
+    "void main()\n"
+    "{\n"
+    "   FragColor = io_color;\n"
+    "}\n\0";
+
+  struct Uniforms {
+    float mvp[16];
+  };
+
+  static gfx::ShaderDesc desc() {
+    return gfx::ShaderDesc{
+      .vertex_src = VERTEX,
+      .fragment_src = FRAGMENT,
+      .uniforms_layout = gfx::UniformBlockLayout {
+        .uniforms = {
+          gfx::UniformDesc {
+            .name = "u_mvp",
+            .type = gfx::UniformType::MAT4,
+          }
+        },
+      },
+    };
+  }
+};
+
+int main(int, char**) {
+  SDL_SetMainReady();
+  if (SDL_Init(SDL_INIT_VIDEO) < 0) {
+    std::cerr << "Failed to initialize SDL. Error: " << SDL_GetError() << std::endl;
+    return 1;
+  }
+
+  SDL_GL_SetAttribute(SDL_GL_CONTEXT_MAJOR_VERSION, 3);
+  SDL_GL_SetAttribute(SDL_GL_CONTEXT_MINOR_VERSION, 3);
+  SDL_GL_SetAttribute(SDL_GL_CONTEXT_PROFILE_MASK, SDL_GL_CONTEXT_PROFILE_CORE);
+
+  SDL_Window* window = SDL_CreateWindow(
+    "Molten Engine - vertex array bench",
+    SDL_WINDOWPOS_UNDEFINED,
+    SDL_WINDOWPOS_UNDEFINED,
+    256,
+    256,
+    SDL_WINDOW_OPENGL | SDL_WINDOW_HIDDEN
+  );
+  if (!window) {
+    std::cerr << "Failed to initialize SDL window. Error: " << SDL_GetError() << std::endl;
+    return 1;
+  }
+
+  SDL_GLContext gl_context = SDL_GL_CreateContext(window);
+  if (!gl_context) {
+    std::cerr << "Failed to initialize GL context. Error: " << SDL_GetError() << std::endl;
+    return 1;
+  }
+  SDL_GL_SetSwapInterval(0);
+
+  gfx::Renderer renderer;
+  renderer.init(gfx::InitInfo{ window });
+
+  install_gl_hooks();
+
+  gfx::Shader shader = renderer.new_shader(BenchShader::desc());
+
+  gfx::VertexLayout layout;
+  layout.attributes[0].format = gfx::AttributeFormat::FLOAT3;
+  layout.attributes[1].format = gfx::AttributeFormat::FLOAT4;
+  layout.attributes[2].format = gfx::AttributeFormat::FLOAT2;
+  layout.attributes[3].format = gfx::AttributeFormat::FLOAT3;
+
+  gfx::Pipeline pipe = renderer.new_pipeline(
+    gfx::PipelineDesc{
+      .shader = shader,
+      .layout = layout,
+      .index_type = gfx::IndexType::UINT16,
+      .primitive_type = gfx::PrimitiveType::TRIANGLES,
+      .cull = gfx::CullMode::NONE,
+    }
+  );
+
+  float vertices[] = {
+    // pos                color                    uv           normal
+    -0.01f, -0.01f, 0.0f,  1.0f, 0.0f, 0.0f, 1.0f,  0.0f, 0.0f,  0.0f, 0.0f, 1.0f,
+     0.01f, -0.01f, 0.0f,  0.0f, 1.0f, 0.0f, 1.0f,  1.0f, 0.0f,  0.0f, 0.0f, 1.0f,
+     0.0f,   0.01f, 0.0f,  0.0f, 0.0f, 1.0f, 1.0f,  0.5f, 1.0f,  0.0f, 0.0f, 1.0f,
+  };
+  uint16_t indices[] = { 0, 1, 2 };
+
+  // one vertex and index buffer per mesh, like distinct voxel models
+  std::vector<gfx::Bindings> meshes;
+  meshes.reserve(NB_MESHES);
+  for (uint32_t i = 0; i < NB_MESHES; ++i) {
+    meshes.push_back(gfx::Bindings{
+      .vertex_buffer = renderer.new_buffer(gfx::BufferDesc{ gfx::MAKE_MEMORY(vertices), gfx::BufferType::VERTEX_BUFFER }),
+      .index_buffer = renderer.new_buffer(gfx::BufferDesc{ gfx::MAKE_MEMORY(indices), gfx::BufferType::INDEX_BUFFER }),
+    });
+  }
+
+  BenchShader::Uniforms uniforms = {
+    1.0f, 0.0f, 0.0f, 0.0f,
+    0.0f, 1.0f, 0.0f, 0.0f,
+    0.0f, 0.0f, 1.0f, 0.0f,
+    0.0f, 0.0f, 0.0f, 1.0f,
+  };
+
+  uint64_t first_frame_calls = 0;
+  uint64_t steady_calls = 0;
+  double steady_ns = 0.0;
+
+  for (uint32_t frame = 0; frame < NB_FRAMES; ++frame) {
+    renderer.begin_default_render_pass(
+      gfx::PassAction{
+        gfx::ColorAction {
+          .color = gfx::Color(0.0f, 0.0f, 0.0f, 1.0f),
+        }
+      }
+    );
+
+    s_gl_calls = 0;
+    auto start = std::chrono::high_resolution_clock::now();
+
+    renderer.set_pipeline(pipe);
+    for (const gfx::Bindings& bind : meshes) {
+      renderer.set_bindings(bind);
+      renderer.set_uniforms(gfx::MAKE_MEMORY(uniforms));
+      renderer.draw(0, 3, 1);
+    }
+
+    auto end = std::chrono::high_resolution_clock::now();
+    if (frame == 0) {
+      first_frame_calls = s_gl_calls;
+    } else {
+      steady_calls += s_gl_calls;
+      steady_ns += (double)std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+    }
+
+    renderer.end_render_pass();
+    renderer.submit();
+    SDL_GL_SwapWindow(window);
+  }
+
+  double steady_frames = NB_FRAMES - 1;
+  std::cout << "meshes: " << NB_MESHES << ", frames: " << NB_FRAMES << std::endl;
+  std::cout << "first frame (vertex arrays created): "
+    << (double)first_frame_calls / NB_MESHES << " GL calls/draw" << std::endl;
+  std::cout << "next frames (vertex arrays cached): "
+    << (double)steady_calls / (steady_frames * NB_MESHES) << " GL calls/draw, "
+    << steady_ns / (steady_frames * NB_MESHES) << " ns/draw" << std::endl;
+
+  renderer.shutdown();
+  SDL_GL_DeleteContext(gl_context);
+  SDL_DestroyWindow(window);
+  SDL_Quit();
+
+  return 0;
+}
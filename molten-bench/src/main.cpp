@@ -0,0 +1,123 @@
+#include <iostream>
+#include <chrono>
+#include <cstdlib>
+#include <new>
+#include <fstream>
+
+#include "deferred_voxel_renderer.h"
+#include "gfx/software.h"
+
+// Runs DeferredVoxelRenderer::render on the null backend: the engine side CPU cost of a frame, without GPU.
+// molten-bench-soft runs it on the software backend and writes the last frame to molten-bench.ppm
+// usage: molten-bench [frames] [voxel edits per frame]
+
+constexpr uint32_t DEFAULT_FRAMES = 1000;
+// voxels carved per frame, their bricks are re-uploaded through update_texture
+constexpr uint32_t DEFAULT_VOXEL_EDITS = 1;
+// the first frames grow the command buffers and the caches
+constexpr uint32_t WARMUP_FRAMES = 10;
+
+static uint64_t s_allocations = 0;
+
+void* operator new(size_t size) {
+  ++s_allocations;
+  if (void* ptr = std::malloc(size > 0 ? size : 1))
+    return ptr;
+  throw std::bad_alloc();
+}
+
+void operator delete(void* ptr) noexcept {
+  std::free(ptr);
+}
+
+void operator delete(void* ptr, size_t) noexcept {
+  std::free(ptr);
+}
+
+int main(int argc, char** argv) {
+  uint32_t nb_frames = argc > 1 ? (uint32_t)std::atoi(argv[1]) : DEFAULT_FRAMES;
+  uint32_t nb_voxel_edits = argc > 2 ? (uint32_t)std::atoi(argv[2]) : DEFAULT_VOXEL_EDITS;
+  if (nb_frames == 0) {
+    std::cerr << "usage: molten-bench [frames] [voxel edits per frame]" << std::endl;
+    return 1;
+  }
+
+  core::DeferredVoxelRenderer renderer;
+  bool initialized = renderer.init(
+    gfx::InitInfo{
+      .submit_mode = gfx::SubmitMode::DEFERRED,
+      .width = 1024,
+      .height = 680,
+    }
+  );
+  if (!initialized) {
+    std::cerr << "Failed to initialize the renderer" << std::endl;
+    return 1;
+  }
+
+  for (uint32_t frame = 0; frame < WARMUP_FRAMES; ++frame) {
+    renderer.render();
+  }
+
+#if defined(GFX_USE_NULL)
+  gfx::reset_null_stats();
+#endif
+  uint64_t allocations = s_allocations;
+  auto start = std::chrono::high_resolution_clock::now();
+
+  glm::uvec3 voxel_dim = renderer.voxel_dim();
+  for (uint32_t frame = 0; frame < nb_frames; ++frame) {
+    // walks the model with a stride prime with its size, the edits spread over the bricks
+    for (uint32_t i = 0; i < nb_voxel_edits; i++) {
+      uint32_t edit = (frame * nb_voxel_edits + i) * 7919;
+      renderer.set_voxel(glm::uvec3(edit % voxel_dim.x, (edit / voxel_dim.x) % voxel_dim.y, (edit / (voxel_dim.x * voxel_dim.y)) % voxel_dim.z), 0);
+    }
+    renderer.render();
+  }
+
+  auto end = std::chrono::high_resolution_clock::now();
+  allocations = s_allocations - allocations;
+  double ns = (double)std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+
+  double frames = nb_frames;
+  std::cout << "frames: " << nb_frames << std::endl;
+  std::cout << "cpu: " << ns / frames << " ns/frame, " << (double)allocations / frames << " allocations/frame" << std::endl;
+  for (const gfx::PassTiming& timing : renderer.pass_timings()) {
+    std::cout << "pass " << timing.name << ": " << timing.gpu_ms << " ms" << std::endl;
+  }
+  const core::RenderGraphStats& graph = renderer.graph_stats();
+  std::cout << "render graph: " << graph.passes - graph.culled_passes << "/" << graph.passes << " passes, "
+    << graph.transient_textures << " transient textures in " << graph.physical_textures << " textures" << std::endl;
+
+#if defined(GFX_USE_NULL)
+  const gfx::NullStats& stats = gfx::get_null_stats();
+  std::cout << "backend: " << (double)stats.commands / frames << " commands/frame, "
+    << (double)stats.draws / frames << " draws/frame, "
+    << (double)stats.instances / frames << " instances/frame" << std::endl;
+  std::cout << "state changes: " << (double)stats.pipeline_changes / frames << " pipelines/frame, "
+    << (double)stats.bindings_changes / frames << " bindings/frame, "
+    << (double)stats.uniform_updates / frames << " uniforms/frame" << std::endl;
+  std::cout << "uploads: " << (double)stats.bytes_uploaded / frames << " bytes/frame" << std::endl;
+  std::cout << "invalid calls: " << stats.invalid_calls << std::endl;
+
+  renderer.shutdown();
+
+  return stats.invalid_calls == 0 ? 0 : 1;
+#else
+  // the last frame as a binary PPM, the rows of the image go up
+  gfx::SoftImage image = gfx::get_soft_image();
+  std::ofstream ppm("molten-bench.ppm", std::ios::binary);
+  ppm << "P6\n" << image.width << " " << image.height << "\n255\n";
+  for (uint32_t y = image.height; y-- > 0;) {
+    const uint8_t* row = image.data + (size_t)y * image.width * 4;
+    for (uint32_t x = 0; x < image.width; x++) {
+      ppm.write((const char*)row + x * 4, 3);
+    }
+  }
+  std::cout << "last frame written to molten-bench.ppm" << std::endl;
+
+  renderer.shutdown();
+
+  return 0;
+#endif
+}
@@ -0,0 +1,3 @@
+# writes the content of INPUT as a raw string literal named VARIABLE in OUTPUT
+file(READ ${INPUT} source)
+file(WRITE ${OUTPUT} "#pragma once\n\nstatic const char ${VARIABLE}[] = R\"glsl(${source})glsl\";\n")
@@ -0,0 +1,58 @@
+set(MOLTEN_EMBED_SHADER_SOURCE ${CMAKE_CURRENT_LIST_DIR}/embed_shader_source.cmake)
+set(MOLTEN_SHADER_TABLE_TEMPLATE ${CMAKE_CURRENT_LIST_DIR}/shader_blobs.cpp.in)
+
+# Validates the GLSL shaders of shader_dir and compiles them to OpenGL and Vulkan SPIR-V with glslangValidator.
+# The SPIR-V blobs and the GLSL sources are embedded in target with a generated table read by core::find_shader_blob.
+function(molten_embed_shaders target shader_dir)
+  file(GLOB shaders CONFIGURE_DEPENDS ${shader_dir}/*.vert ${shader_dir}/*.frag)
+  set(gen_dir ${CMAKE_CURRENT_BINARY_DIR}/${target}_shader_blobs)
+  file(MAKE_DIRECTORY ${gen_dir})
+
+  if (NOT GLSL_VALIDATOR)
+    message(WARNING "glslangValidator not found, the shaders are embedded without SPIR-V and compiled at run time")
+  endif()
+
+  set(SHADER_INCLUDES "")
+  set(SHADER_ENTRIES "")
+  set(outputs "")
+  foreach(shader ${shaders})
+    get_filename_component(name ${shader} NAME)
+    string(MAKE_C_IDENTIFIER ${name} id)
+
+    # the source is kept for the GL contexts without GL_ARB_gl_spirv
+    set(source_header ${gen_dir}/${id}_src.h)
+    add_custom_command(
+      OUTPUT ${source_header}
+      COMMAND ${CMAKE_COMMAND} -DINPUT=${shader} -DOUTPUT=${source_header} -DVARIABLE=${id}_src -P ${MOLTEN_EMBED_SHADER_SOURCE}
+      DEPENDS ${shader} ${MOLTEN_EMBED_SHADER_SOURCE}
+      COMMENT "Embedding ${name}"
+      VERBATIM
+    )
+    list(APPEND outputs ${source_header})
+    string(APPEND SHADER_INCLUDES "#include \"${id}_src.h\"\n")
+
+    if (GLSL_VALIDATOR)
+      set(gl_header ${gen_dir}/${id}_gl.h)
+      set(vk_header ${gen_dir}/${id}_vk.h)
+      add_custom_command(
+        OUTPUT ${gl_header} ${vk_header}
+        COMMAND ${GLSL_VALIDATOR} -G --vn ${id}_gl -o ${gl_header} ${shader}
+        COMMAND ${GLSL_VALIDATOR} -V --vn ${id}_vk -o ${vk_header} ${shader}
+        DEPENDS ${shader}
+        COMMENT "Compiling ${name} to SPIR-V"
+        VERBATIM
+      )
+      list(APPEND outputs ${gl_header} ${vk_header})
+      string(APPEND SHADER_INCLUDES "#include \"${id}_gl.h\"\n#include \"${id}_vk.h\"\n")
+      string(APPEND SHADER_ENTRIES "    { \"${name}\", ${id}_src, { ${id}_gl, sizeof(${id}_gl), ${id}_vk, sizeof(${id}_vk) } },\n")
+    else()
+      string(APPEND SHADER_ENTRIES "    { \"${name}\", ${id}_src, {} },\n")
+    endif()
+  endforeach()
+
+  set(table ${gen_dir}/shader_blobs.cpp)
+  configure_file(${MOLTEN_SHADER_TABLE_TEMPLATE} ${table} @ONLY)
+
+  target_sources(${target} PRIVATE ${table} ${outputs})
+  target_include_directories(${target} PRIVATE ${gen_dir})
+endfunction()
@@ -1,16 +1,25 @@
 #pragma once
 
+#include "gfx/renderer.h"
+
 typedef struct SDL_Window SDL_Window;
 
 namespace core {
   struct InitInfo {
     SDL_Window* window = nullptr;
+    // frame pacing of the Vulkan backend, see gfx::InitInfo
+    uint32_t frames_in_flight = 2;
+    gfx::PresentMode present_mode = gfx::PresentMode::FIFO;
+    float render_scale = 1.0f;
   };
 
   class Engine {
   public:
-    void init(const InitInfo& info);
+    // returns false when the renderer can't be initialized
+    bool init(const InitInfo& info);
     void shutdown();
     void tick();
+    // edits the voxel model, 0 empties the voxel, returns false outside of the model
+    bool set_voxel(uint32_t x, uint32_t y, uint32_t z, uint8_t palette_index);
   };
 }
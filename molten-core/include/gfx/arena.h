@@ -0,0 +1,53 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <memory>
+#include <vector>
+
+namespace gfx {
+  constexpr size_t DEFAULT_ARENA_BLOCK_SIZE = 64 * 1024;
+
+  /*!
+  * Linear allocator made of fixed size blocks.
+  * Allocations are never freed individually and never move, reset() makes all the blocks available again.
+  * An arena is not thread safe: use one arena per thread.
+  */
+  class Arena {
+  public:
+    explicit Arena(size_t block_size = DEFAULT_ARENA_BLOCK_SIZE);
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+    Arena(Arena&&) = default;
+    Arena& operator=(Arena&&) = default;
+
+    void* alloc(size_t size, size_t alignment = alignof(max_align_t));
+
+    template<typename T>
+    T* copy(const T* src, size_t count) {
+      if (count == 0)
+        return nullptr;
+      T* dst = static_cast<T*>(alloc(sizeof(T) * count, alignof(T)));
+      std::uninitialized_copy(src, src + count, dst);
+      return dst;
+    }
+
+    // makes the whole memory available again, allocated blocks are kept
+    void reset();
+
+    size_t used() const { return _used; }
+    size_t capacity() const;
+
+  private:
+    struct Block {
+      std::unique_ptr<uint8_t[]> data;
+      size_t size;
+    };
+
+    std::vector<Block> _blocks;
+    size_t _block_size;
+    size_t _current_block = 0;
+    size_t _offset = 0;
+    size_t _used = 0;
+  };
+}
@@ -0,0 +1,168 @@
+#pragma once
+
+#include "gfx/renderer.h"
+#include "gfx/arena.h"
+
+#include <stdint.h>
+#include <vector>
+#include <optional>
+
+namespace gfx {
+  // sort key layout (msb to lsb):
+  // | pass: 12 | epoch: 12 | stage: 2 | pipeline: 12 | texture: 14 | buffer: 12 |
+  // pass keeps the passes in recording order, epoch keeps draws on the right side of a viewport/scissor change,
+  // stage orders begin pass < state < draws < end pass and the remaining bits batch draws by state
+  using SortKey = uint64_t;
+
+  constexpr uint32_t SORT_KEY_PASS_BITS = 12;
+  constexpr uint32_t SORT_KEY_EPOCH_BITS = 12;
+  constexpr uint32_t SORT_KEY_STAGE_BITS = 2;
+  constexpr uint32_t SORT_KEY_PIPELINE_BITS = 12;
+  constexpr uint32_t SORT_KEY_TEXTURE_BITS = 14;
+  // the slot index of the buffer handle, the generation is not needed to batch
+  constexpr uint32_t SORT_KEY_BUFFER_BITS = 12;
+
+  static_assert(
+    SORT_KEY_PASS_BITS + SORT_KEY_EPOCH_BITS + SORT_KEY_STAGE_BITS +
+    SORT_KEY_PIPELINE_BITS + SORT_KEY_TEXTURE_BITS + SORT_KEY_BUFFER_BITS == 64,
+    "Sort key must use exactly 64 bits"
+  );
+  static_assert(MAX_PASSES <= (1 << SORT_KEY_PASS_BITS), "MAX_PASSES does not fit in the sort key");
+  static_assert(MAX_BUFFERS <= (1 << SORT_KEY_BUFFER_BITS), "MAX_BUFFERS does not fit in the sort key");
+
+  enum class CommandStage : uint8_t {
+    BEGIN_PASS,
+    STATE,
+    DRAW,
+    END_PASS,
+  };
+
+  enum class CommandType : uint8_t {
+    BEGIN_PASS,
+    END_PASS,
+    SET_VIEWPORT,
+    SET_SCISSOR,
+    DRAW,
+  };
+
+  enum class CommandBufferLevel {
+    PRIMARY, // owns the passes of a frame
+    SECONDARY, // only records draws, executed inside a pass of a primary buffer
+  };
+
+  SortKey make_sort_key(uint32_t pass, uint32_t epoch, CommandStage stage, Pipeline pipe, Texture tex, Buffer buffer);
+
+  // COMMANDS
+  // all commands are PODs, variable sized data (pass actions, bindings, uniforms) lives in the command buffer arena
+  struct BindingsCommand {
+    Buffer vertex_buffer;
+    Buffer index_buffer;
+    bool has_index_buffer;
+    uint32_t num_textures;
+    const TextureBinding* textures;
+    uint32_t vertex_buffer_offset;
+    uint32_t index_buffer_offset;
+    Buffer instance_buffer;
+    bool has_instance_buffer;
+    uint32_t instance_buffer_offset;
+  };
+
+  struct PassCommand {
+    RenderPass pass;
+    bool is_default;
+    const PassAction* action;
+  };
+
+  struct RectCommand {
+    uint32_t x;
+    uint32_t y;
+    uint32_t width;
+    uint32_t height;
+  };
+
+  struct IndirectCommand {
+    Buffer args;
+    uint32_t offset;
+    uint32_t draw_count;
+    uint32_t stride;
+  };
+
+  struct DrawCommand {
+    Pipeline pipeline;
+    uint32_t first_element;
+    uint32_t num_elements;
+    uint32_t num_instances;
+    int32_t base_vertex;
+    uint32_t uniforms_size;
+    const void* uniforms;
+    const BindingsCommand* bindings;
+    const IndirectCommand* indirect; // the draw arguments are read from a buffer when set
+  };
+
+  struct Command {
+    SortKey key;
+    CommandType type;
+    union {
+      PassCommand pass;
+      RectCommand rect;
+      DrawCommand draw;
+    };
+  };
+
+  bool same_bindings(const BindingsCommand& a, const BindingsCommand& b);
+
+  /*!
+  * Records renderer calls as sortable commands.
+  * Draws capture the pipeline, bindings and uniforms set before them so they can be reordered freely inside their pass.
+  */
+  class CommandBuffer {
+  public:
+    explicit CommandBuffer(CommandBufferLevel level = CommandBufferLevel::PRIMARY);
+
+    void begin_render_pass(std::optional<RenderPass> pass, const PassAction& action);
+    void end_render_pass();
+    void set_pipeline(Pipeline pipe);
+    void set_bindings(const Bindings& bind);
+    void set_uniforms(const Memory& mem);
+    void draw(uint32_t first_element, uint32_t num_elements, uint32_t num_instances, int32_t base_vertex);
+    void multi_draw_indirect(Buffer args, uint32_t offset, uint32_t draw_count, uint32_t stride);
+    void set_viewport(const Rect& rect);
+    void set_scissor(const Rect& rect);
+    // executes a secondary buffer at the current position of this primary buffer
+    // the secondary buffer is read at sort() time and can be recorded until then
+    void execute(CommandBuffer& secondary);
+
+    // merges the executed secondary buffers then stable sort by key, commands with equal keys keep their recording order
+    void sort();
+    // resets the buffer and its executed secondary buffers for the next frame, keeps the allocated memory
+    void clear();
+
+    bool empty() const { return _commands.empty(); }
+    CommandBufferLevel level() const { return _level; }
+    const std::vector<Command>& commands() const { return _commands; }
+
+  private:
+    struct Secondary {
+      CommandBuffer* buffer;
+      SortKey key_prefix;
+    };
+
+    void push_rect(CommandType type, const Rect& rect);
+    // captures the current pipeline, bindings and uniforms in the draw
+    void push_draw(DrawCommand draw);
+
+    CommandBufferLevel _level;
+    Arena _arena;
+    std::vector<Command> _commands;
+    std::vector<Secondary> _secondaries;
+
+    // recording state
+    uint32_t _pass = 0;
+    uint32_t _epoch = 0;
+    bool _in_pass = false;
+    Pipeline _pipeline = 0;
+    const BindingsCommand* _bindings = nullptr;
+    const void* _uniforms = nullptr;
+    uint32_t _uniforms_size = 0;
+  };
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+#include "gfx/renderer.h"
+#include "gfx/command_buffer.h"
+
+namespace gfx {
+  /*!
+  * Draw commands recorded outside of the thread owning the renderer.
+  * Each list owns its own arena so several threads can each fill a list at the same time.
+  * A list is executed with Renderer::execute_command_list and reset by the renderer once it has been submitted.
+  */
+  class CommandList {
+  public:
+    void set_pipeline(Pipeline pipe);
+    void set_bindings(const Bindings& bind);
+    void set_uniforms(const Memory& mem);
+    void draw(uint32_t first_element, uint32_t num_elements, uint32_t num_instances, int32_t base_vertex = 0);
+    void draw_indirect(Buffer args, uint32_t offset = 0);
+    void multi_draw_indirect(Buffer args, uint32_t offset, uint32_t draw_count, uint32_t stride = 0);
+
+  private:
+    friend class Renderer;
+
+    CommandBuffer _buffer{ CommandBufferLevel::SECONDARY };
+  };
+}
@@ -4,9 +4,13 @@
 #include <vector>
 #include <string>
 #include <optional>
+#include <functional>
 
+// GFX_USE_NULL and GFX_USE_SOFTWARE are defined by the build of the headless targets, see MoltenGfxNull and MoltenGfxSoft
+// GFX_USE_VULKAN is defined by the build of MoltenGfxVk
+#if !defined(GFX_USE_NULL) && !defined(GFX_USE_SOFTWARE) && !defined(GFX_USE_VULKAN)
 #define GFX_USE_OPENGL
-//#define GFX_USE_VULKAN
+#endif
 
 struct SDL_Window;
 
@@ -15,13 +19,35 @@ namespace gfx {
   constexpr size_t MAX_VERTEX_BUFFERS = 8;
   constexpr size_t MAX_ATTRIBUTES = 16;
   constexpr size_t MAX_PASSES = 4096;
+  constexpr uint32_t MAX_BUFFERS = 4096;
+  constexpr uint32_t MAX_TEXTURES = 4096;
+  constexpr uint32_t MAX_SHADERS = 4096;
+  constexpr uint32_t MAX_RENDER_PASSES = 32;
+  constexpr uint32_t MAX_PIPELINES = 4096;
+  constexpr uint32_t MAX_SAMPLERS = 256;
+  // destroyed resources are released once the GPU is done with the frames using them
+  constexpr uint32_t MAX_FRAMES_IN_FLIGHT = 3;
+  // render passes timed per frame, the passes after are not timed
+  constexpr uint32_t MAX_TIMED_PASSES = 32;
+  // name of the default render pass in the pass timings
+  constexpr const char* DEFAULT_PASS_NAME = "default";
 
   // DEFINES
+  // handles are generation << HANDLE_INDEX_BITS | slot index, the slot index is used by the backends tables
   using Buffer = uint32_t;
   using Texture = uint32_t;
   using Shader = uint32_t;
   using RenderPass = uint32_t;
   using Pipeline = uint32_t;
+  using Sampler = uint32_t;
+
+  constexpr uint32_t HANDLE_INDEX_BITS = 16;
+  constexpr uint32_t HANDLE_INDEX_MASK = (1 << HANDLE_INDEX_BITS) - 1;
+  constexpr uint32_t INVALID_HANDLE = 0;
+
+  constexpr uint32_t make_handle(uint32_t index, uint16_t generation) { return ((uint32_t)generation << HANDLE_INDEX_BITS) | index; }
+  constexpr uint32_t handle_index(uint32_t handle) { return handle & HANDLE_INDEX_MASK; }
+  constexpr uint16_t handle_generation(uint32_t handle) { return (uint16_t)(handle >> HANDLE_INDEX_BITS); }
 
   // ENUMS
   enum class ShaderStage {
@@ -42,6 +68,24 @@ namespace gfx {
     DEPTH,
   };
 
+  enum class Filter {
+    NEAREST,
+    LINEAR,
+  };
+
+  enum class MipmapFilter {
+    NONE, // only the first level is sampled
+    NEAREST,
+    LINEAR,
+  };
+
+  enum class Wrap {
+    REPEAT,
+    MIRRORED_REPEAT,
+    CLAMP_TO_EDGE,
+    CLAMP_TO_BORDER,
+  };
+
   enum class PrimitiveType {
     POINTS,
     LINES,
@@ -51,6 +95,7 @@ namespace gfx {
   };
 
   enum class AttributeFormat {
+    NONE,
     FLOAT2,
     FLOAT3,
     FLOAT4,
@@ -59,6 +104,18 @@ namespace gfx {
   enum class BufferType {
     VERTEX_BUFFER,
     INDEX_BUFFER,
+    INDIRECT_BUFFER, // arguments of draw_indirect and multi_draw_indirect
+  };
+
+  enum class BufferUsage {
+    IMMUTABLE, // filled once at creation
+    DYNAMIC, // updated a few times, the draws of a frame see the last update
+    STREAM, // rewritten every frame, each frame writes its own region of the buffer
+  };
+
+  enum class VertexStep {
+    PER_VERTEX, // read from Bindings::vertex_buffer
+    PER_INSTANCE, // read from Bindings::instance_buffer
   };
 
   enum class IndexType {
@@ -78,8 +135,9 @@ namespace gfx {
   };
 
   enum class Action {
-    NOTHING,
+    NOTHING, // the pass starts from the previous content
     CLEAR,
+    DONT_CARE, // the previous content is not needed, the Vulkan backend drops it instead of loading it
   };
 
   enum class CullMode {
@@ -88,9 +146,33 @@ namespace gfx {
     BACK,
   };
 
+  // how the frames wait for the display, only used by the Vulkan backend
+  enum class PresentMode {
+    FIFO, // vsync, the frames queue up behind the display
+    MAILBOX, // vsync without queue, a newer frame replaces the waiting one
+    IMMEDIATE, // no vsync, can tear
+  };
+
+  enum class SubmitMode {
+    IMMEDIATE, // calls are forwarded to the backend right away
+    DEFERRED, // calls are recorded, sorted by state and replayed at submit
+  };
+
   // STRUCTS
   struct InitInfo {
     SDL_Window* window = nullptr;
+    SubmitMode submit_mode = SubmitMode::IMMEDIATE;
+    // linked shaders and Vulkan pipelines are cached in this directory and reused by the next runs, empty disables the cache
+    std::string shader_cache_dir;
+    // frames the CPU records ahead of the GPU, in [1, MAX_FRAMES_IN_FLIGHT]: fewer frames lower the latency, more frames keep the GPU busy
+    uint32_t frames_in_flight = 2;
+    // falls back to FIFO when the surface does not support the mode
+    PresentMode present_mode = PresentMode::FIFO;
+    // size of the default framebuffer of the Vulkan backend relative to the window, the frames are scaled to the window when presented
+    float render_scale = 1.0f;
+    // size of the default framebuffer of the software backend without window, the window size otherwise
+    uint32_t width = 0;
+    uint32_t height = 0;
   };
 
   struct Memory {
@@ -127,16 +209,51 @@ namespace gfx {
     StencilAction stencil_action;
   };
 
+  struct TextureBinding {
+    Texture texture = INVALID_HANDLE;
+    Sampler sampler = INVALID_HANDLE; // without sampler the texture is sampled with its own parameters
+
+    TextureBinding() = default;
+    TextureBinding(Texture texture) : texture(texture) {}
+    TextureBinding(Texture texture, Sampler sampler) : texture(texture), sampler(sampler) {}
+
+    bool operator==(const TextureBinding& other) const = default;
+  };
+
   struct Bindings {
     Buffer vertex_buffer;
     std::optional<Buffer> index_buffer;
-    std::vector<Texture> textures;
+    std::vector<TextureBinding> textures;
+    // byte offsets added to the buffers, e.g. the offsets returned by append_buffer
+    uint32_t vertex_buffer_offset = 0;
+    uint32_t index_buffer_offset = 0;
+    // stream of the PER_INSTANCE attributes
+    std::optional<Buffer> instance_buffer;
+    uint32_t instance_buffer_offset = 0;
+  };
+
+  // arguments of the indirect draws, same layout as the GL and Vulkan indirect commands
+  struct DrawIndirectArgs {
+    uint32_t num_elements;
+    uint32_t num_instances;
+    uint32_t first_element;
+    uint32_t first_instance;
+  };
+
+  struct DrawIndexedIndirectArgs {
+    uint32_t num_elements;
+    uint32_t num_instances;
+    uint32_t first_element; // relative to the start of the index buffer, Bindings::index_buffer_offset is ignored
+    int32_t base_vertex;
+    uint32_t first_instance;
   };
 
   struct VertexAttribute {
-    int32_t index;
-    size_t stride;
-    AttributeFormat format;
+    int32_t index = 0;
+    size_t stride = 0;
+    AttributeFormat format = AttributeFormat::NONE; // attributes after the first NONE are ignored
+    VertexStep step = VertexStep::PER_VERTEX;
+    uint32_t step_rate = 1; // number of instances using the same PER_INSTANCE element
   };
 
   struct VertexLayout {
@@ -153,9 +270,11 @@ namespace gfx {
   };
 
   // OBJECT CREATION STRUCTS
+  // DYNAMIC and STREAM buffers can be created without data, mem.size is their capacity
   struct BufferDesc {
     Memory mem;
     BufferType type;
+    BufferUsage usage = BufferUsage::IMMUTABLE;
   };
 
   struct TextureDesc {
@@ -168,11 +287,58 @@ namespace gfx {
     uint32_t depth = 0;
   };
 
+  // samplers with the same description share their backend object
+  struct SamplerDesc {
+    Filter min_filter = Filter::NEAREST;
+    Filter mag_filter = Filter::NEAREST;
+    MipmapFilter mip_filter = MipmapFilter::NONE;
+    Wrap wrap_u = Wrap::CLAMP_TO_EDGE;
+    Wrap wrap_v = Wrap::CLAMP_TO_EDGE;
+    Wrap wrap_w = Wrap::CLAMP_TO_EDGE;
+    uint32_t max_anisotropy = 1; // clamped to the device limit, 1 disables anisotropic filtering
+
+    bool operator==(const SamplerDesc& other) const = default;
+  };
+
+  // SPIR-V modules of a shader stage, the memory must stay valid as long as the shader, like the embedded blobs
+  struct ShaderBinary {
+    const uint32_t* gl_spirv = nullptr; // OpenGL semantics
+    size_t gl_spirv_size = 0; // in bytes
+    const uint32_t* vk_spirv = nullptr; // Vulkan semantics
+    size_t vk_spirv_size = 0; // in bytes
+  };
+
+  // stages of the software backend, see gfx/software.h
+  struct SoftVertexIn;
+  struct SoftVertexOut;
+  struct SoftFragmentIn;
+  struct SoftFragmentOut;
+  using SoftVertexShader = std::function<void(const SoftVertexIn&, SoftVertexOut&)>;
+  // returns false to discard the fragment
+  using SoftFragmentShader = std::function<bool(const SoftFragmentIn&, SoftFragmentOut&)>;
+
+  // C++ callables standing in for the GLSL stages on the software backend, ignored by the other backends
+  // they are called from the rasterizer threads at the same time and must not write shared state
+  struct SoftShaderDesc {
+    SoftVertexShader vertex;
+    SoftFragmentShader fragment; // a pass without fragment stage only writes the depth
+    uint32_t num_varyings = 0; // floats of SoftVertexOut::varyings used by the stages
+    uint32_t num_flat_varyings = 0; // floats of SoftVertexOut::flat_varyings used by the stages
+  };
+
   struct ShaderDesc {
     const char* vertex_src = nullptr;
     const char* fragment_src = nullptr;
+    // used instead of the sources when the backend can, the GL backend needs GL_ARB_gl_spirv
+    // SPIR-V shaders bind their textures and uniform block in the shader: the names are not reflected
+    ShaderBinary vertex_binary;
+    ShaderBinary fragment_binary;
+    SoftShaderDesc soft;
     UniformBlockLayout uniforms_layout;
     std::vector<std::string> texture_names;
+    // compiled in the background: new_shader returns right away and the pipelines using the shader
+    // draw with their fallback until is_shader_ready returns true
+    bool async = false;
   };
 
   struct PipelineDesc {
@@ -181,11 +347,31 @@ namespace gfx {
     IndexType index_type = IndexType::UINT16;
     PrimitiveType primitive_type = PrimitiveType::TRIANGLES;
     CullMode cull = CullMode::NONE;
+    // drawn instead of this pipeline while its async shader is not ready, the draws are skipped without fallback
+    // the fallback pipeline takes the same vertex layout, uniforms and textures
+    Pipeline fallback = INVALID_HANDLE;
   };
 
   struct RenderPassDesc {
     std::vector<Texture> colors;
     std::optional<Texture> depth;
+    std::string name; // reported by get_pass_timings
+  };
+
+  // time spent by the GPU between the begin and the end of a render pass, the clears included
+  struct PassTiming {
+    std::string name;
+    double gpu_ms;
+  };
+
+  // texels of a mip level, height and depth are ignored by the dimensions a texture does not have
+  struct TextureRegion {
+    uint32_t x = 0;
+    uint32_t y = 0;
+    uint32_t z = 0;
+    uint32_t width = 0;
+    uint32_t height = 1;
+    uint32_t depth = 1;
   };
 
   struct Rect {
@@ -197,6 +383,39 @@ namespace gfx {
     Rect(uint32_t x, uint32_t y, uint32_t width, uint32_t height) : x(x), y(y), width(width), height(height) {}
   };
 
+  class CommandList;
+
+  // counters of the null backend since the last reset_null_stats
+  struct NullStats {
+    uint64_t frames = 0;
+    uint64_t commands = 0; // every call received by the backend
+    uint64_t passes = 0;
+    uint64_t draws = 0;
+    uint64_t instances = 0;
+    uint64_t pipeline_changes = 0;
+    uint64_t bindings_changes = 0;
+    uint64_t uniform_updates = 0;
+    uint64_t viewport_changes = 0; // viewports and scissors
+    uint64_t bytes_uploaded = 0; // buffers, textures and uniforms
+    uint64_t invalid_calls = 0; // unknown handles and calls out of order
+  };
+
+#if defined(GFX_USE_NULL)
+  const NullStats& get_null_stats();
+  void reset_null_stats();
+#endif
+
+  // pipelines created by the Vulkan backend since init, the hits skip the driver compilation
+  struct PipelineCacheStats {
+    uint64_t hits = 0;
+    uint64_t misses = 0; // the pipelines created without feedback from the driver count as misses
+    double creation_ms = 0.0; // CPU time spent creating the pipelines
+  };
+
+#if defined(GFX_USE_VULKAN)
+  const PipelineCacheStats& get_pipeline_cache_stats();
+#endif
+
   /*!
   * Backend agnostic Renderer
   */
@@ -210,22 +429,60 @@ namespace gfx {
     void set_pipeline(Pipeline pipe);
     void set_bindings(Bindings bind);
     void set_uniforms(const Memory& mem);
-    void draw(uint32_t first_element, uint32_t num_elements, uint32_t num_instances);
+    // first_element is a vertex for non indexed pipelines, an index otherwise
+    // base_vertex is added to the indices of indexed draws
+    void draw(uint32_t first_element, uint32_t num_elements, uint32_t num_instances, int32_t base_vertex = 0);
+    // draws with arguments read from an INDIRECT_BUFFER at a byte offset
+    // the buffer holds DrawIndirectArgs for non indexed pipelines, DrawIndexedIndirectArgs otherwise
+    void draw_indirect(Buffer args, uint32_t offset = 0);
+    // draws draw_count times with consecutive arguments, stride is the byte distance between them, 0 when tightly packed
+    // the GL backend with multi draw indirect can't draw indexed from STREAM index buffers
+    void multi_draw_indirect(Buffer args, uint32_t offset, uint32_t draw_count, uint32_t stride = 0);
     void set_viewport(const Rect& rect);
     void set_scissor(const Rect& rect);
+    // executes a list recorded by another thread inside the current render pass
+    // in SubmitMode::DEFERRED the lists are merged at submit, in the order of the calls, and can be recorded until then
+    // in SubmitMode::IMMEDIATE the list is replayed right away, except on Vulkan where it is recorded by a worker thread
+    // into a secondary command buffer: the list must not be touched until the render pass ends
+    void execute_command_list(CommandList& list);
     void submit();
 
     Buffer new_buffer(const BufferDesc& desc);
+    // replaces the content of a DYNAMIC or STREAM buffer from its start
+    // the update is not recorded: in SubmitMode::DEFERRED all the draws of the frame see the last one
+    // in SubmitMode::IMMEDIATE the draws already issued read the memory the GL backend rewrites in place for STREAM buffers:
+    // whatever the mode, it rejects the update of a STREAM buffer already updated or appended to this frame
+    bool update_buffer(Buffer buffer, const Memory& mem);
+    // writes after the data already appended to a DYNAMIC or STREAM buffer this frame
+    // returns the byte offset to put in Bindings, nullopt when the buffer is full
+    std::optional<uint32_t> append_buffer(Buffer buffer, const Memory& mem);
     Texture new_texture(const TextureDesc& desc);
+    // uploads tightly packed texels into a region of a mip level, the other mip levels are left untouched
+    // the copy goes through a staging ring and does not wait for the GPU, the update is not recorded in SubmitMode::DEFERRED
+    bool update_texture(Texture texture, const TextureRegion& region, uint32_t mip, const Memory& mem);
     Shader new_shader(const ShaderDesc& desc);
+    Sampler new_sampler(const SamplerDesc& desc);
     RenderPass new_render_pass(const RenderPassDesc& desc);
     Pipeline new_pipeline(const PipelineDesc& desc);
+    // false while an async shader is compiling, never blocks
+    bool is_shader_ready(Shader shader);
+    // false while the pipeline draws with its fallback
+    bool is_pipeline_ready(Pipeline pipe);
+    // render passes of the last frame whose timings reached the CPU, in the order they began
+    // the timings are read a few frames after their submit so reading them never waits for the GPU
+    // empty until the first results arrive, on the software backend the timings are the CPU time of the passes
+    const std::vector<PassTiming>& get_pass_timings();
+
+    // the handle is invalid right away, the resource is released MAX_FRAMES_IN_FLIGHT submits later
+    // so the draws already recorded or in flight can still use it
+    void destroy_buffer(Buffer buffer);
+    void destroy_texture(Texture texture);
+    void destroy_shader(Shader shader);
+    void destroy_render_pass(RenderPass pass);
+    void destroy_pipeline(Pipeline pipe);
+    void destroy_sampler(Sampler sampler);
 
   private:
-    uint32_t _buffer_id = 0;
-    uint32_t _texture_id = 0;
-    uint32_t _shader_id = 0;
-    uint32_t _render_pass_id = 0;
-    uint32_t _pipeline_id = 0;
+    SubmitMode _submit_mode = SubmitMode::IMMEDIATE;
   };
 }
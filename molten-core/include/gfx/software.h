@@ -0,0 +1,74 @@
+#pragma once
+
+#include "gfx/renderer.h"
+
+#include <stdint.h>
+#include <optional>
+
+// C++ shader stages of the software backend, selected with GFX_USE_SOFTWARE, see SoftShaderDesc
+namespace gfx {
+  constexpr uint32_t MAX_SOFT_VARYINGS = 32;
+  constexpr uint32_t MAX_SOFT_FLAT_VARYINGS = 32;
+  constexpr uint32_t MAX_SOFT_TEXTURES = 8;
+  constexpr uint32_t MAX_SOFT_COLOR_TARGETS = 8;
+
+  // a texture bound to a draw, texels are tightly packed and the rows go from bottom to top like GL
+  // only the first mip level is stored
+  struct SoftTexture {
+    const uint8_t* data = nullptr;
+    TextureType type = TextureType::TEXTURE_2D;
+    TextureFormat format = TextureFormat::RGBA8;
+    uint32_t width = 0;
+    uint32_t height = 1;
+    uint32_t depth = 1;
+    SamplerDesc sampler;
+  };
+
+  struct SoftVertexIn {
+    // attribute i of the pipeline layout, read from the vertex or instance buffer
+    const float* attributes[MAX_ATTRIBUTES];
+    // memory of the last set_uniforms, nullptr without uniforms
+    const void* uniforms;
+    uint32_t vertex_id;
+    uint32_t instance_id;
+  };
+
+  struct SoftVertexOut {
+    float position[4]; // clip space, like gl_Position
+    float varyings[MAX_SOFT_VARYINGS]; // interpolated across the triangle, perspective correct
+    float flat_varyings[MAX_SOFT_FLAT_VARYINGS]; // taken from the last vertex of the triangle, like GL flat outputs
+  };
+
+  struct SoftFragmentIn {
+    float frag_coord[4]; // like gl_FragCoord: window position of the pixel center, depth, 1 / w
+    const float* varyings;
+    const float* flat_varyings;
+    const void* uniforms;
+    const SoftTexture* textures; // in the order of Bindings::textures
+    uint32_t num_textures;
+  };
+
+  struct SoftFragmentOut {
+    float colors[MAX_SOFT_COLOR_TARGETS][4]; // one per color target of the pass, converted to the target format
+  };
+
+  // filters and wraps like the GL samplers, the result is (r, g, b, a) with the missing channels set like GL
+  // the texture coordinates not used by the texture type are ignored
+  void soft_sample(const SoftTexture& texture, float u, float v, float w, float out[4]);
+  // texel of the first mip level, (0, 0, 0, 0) outside of the texture
+  void soft_fetch(const SoftTexture& texture, int32_t x, int32_t y, int32_t z, float out[4]);
+
+  // content of a render target of the software backend, rows go from bottom to top like glReadPixels
+  struct SoftImage {
+    const uint8_t* data = nullptr;
+    TextureFormat format = TextureFormat::RGBA8;
+    uint32_t width = 0;
+    uint32_t height = 0;
+  };
+
+#if defined(GFX_USE_SOFTWARE)
+  // the default framebuffer without texture, RGBA8
+  // the data is written by the render passes and stays valid until the texture is destroyed
+  SoftImage get_soft_image(std::optional<Texture> texture = std::nullopt);
+#endif
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <stdint.h>
+
+// PROFILE_ZONE("name") times the enclosing scope on the calling thread.
+// The zones are compiled out unless MOLTEN_PROFILE is defined, see the MOLTEN_PROFILER cmake option.
+// The names are not copied: use string literals.
+#if defined(MOLTEN_PROFILE)
+#define PROFILE_CONCAT_IMPL(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_IMPL(a, b)
+#define PROFILE_ZONE(name) ::core::ProfileZone PROFILE_CONCAT(profile_zone_, __LINE__)(name)
+#define PROFILE_THREAD_NAME(name) ::core::set_profile_thread_name(name)
+#else
+#define PROFILE_ZONE(name) ((void)0)
+#define PROFILE_THREAD_NAME(name) ((void)0)
+#endif
+
+namespace core {
+  // zones kept per thread, the oldest are overwritten
+  constexpr uint32_t PROFILE_RING_SIZE = 32 * 1024;
+
+  struct ProfileEvent {
+    const char* name;
+    uint64_t begin_ns;
+    uint64_t end_ns;
+  };
+
+  /*!
+  * Records a zone in the ring of its thread when it goes out of scope.
+  * Each thread writes its own ring without lock, only the first zone of a thread takes a lock to register the ring.
+  */
+  class ProfileZone {
+  public:
+    explicit ProfileZone(const char* name);
+    ~ProfileZone();
+    ProfileZone(const ProfileZone&) = delete;
+    ProfileZone& operator=(const ProfileZone&) = delete;
+
+  private:
+    const char* _name;
+    uint64_t _begin_ns;
+  };
+
+  // shown instead of the thread id in the trace
+  void set_profile_thread_name(const char* name);
+
+  // writes the zones still in the rings as Chrome trace_event JSON, opened with chrome://tracing or Perfetto
+  // can be called while the other threads record, the zones they overwrite during the copy are dropped
+  // returns false without MOLTEN_PROFILE or when the file can't be written
+  bool write_profile_trace(const char* path);
+}
@@ -1,5 +1,7 @@
 #pragma once
 
+#include "gfx/renderer.h"
+
 #include <string>
 
 namespace core {
@@ -8,4 +10,14 @@ namespace core {
   };
 
   Shader load_shader(const char* path);
+
+  // shader embedded at build time by molten_embed_shaders
+  struct ShaderBlob {
+    const char* name; // file name, e.g. gbuffer.vert
+    const char* source;
+    gfx::ShaderBinary binary; // empty when glslangValidator was not found
+  };
+
+  // returns nullptr when no shader with this file name was embedded
+  const ShaderBlob* find_shader_blob(const char* name);
 }
\ No newline at end of file
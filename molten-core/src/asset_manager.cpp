@@ -1,4 +1,5 @@
 #include "asset_manager.h"
+#include "profiler.h"
 
 namespace core {
   void AssetManager::init() {
@@ -6,6 +7,7 @@ namespace core {
   }
 
   VoxSceneId AssetManager::new_vox_scene(const char* path) {
+    PROFILE_ZONE("AssetManager::new_vox_scene");
     VoxScene scene;
     scene.load(path);
     uint32_t slot_index = _vox_scene_pool.alloc_index();
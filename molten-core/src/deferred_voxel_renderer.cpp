@@ -3,74 +3,147 @@
 #include "deferred_voxel_renderer.h"
 #include "shapes.h"
 #include "shader.h"
+#include "gfx/software.h"
+#include "profiler.h"
 
 // todo remove
 #include "vox_scene.h"
 #include "ogt_vox.h"
 
+#include <algorithm>
+#include <iostream>
+
 #define GLM_ENABLE_EXPERIMENTAL
 #include <glm/glm.hpp>
 #include <glm/gtx/euler_angles.hpp>
 #include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/type_ptr.hpp>
 
 namespace core {
-  struct GBufferPass {
-    static GPURenderPass create(gfx::Renderer& renderer, uint32_t width, uint32_t height) {
-      gfx::TextureDesc target_desc{
-        .type = gfx::TextureType::TEXTURE_2D,
-        .format = gfx::TextureFormat::RGB8,
-        .width = width,
-        .height = height,
-      };
-
-      gfx::Texture pos_target = renderer.new_texture(
-        target_desc
-      );
+  // size of the gbuffer targets
+  constexpr uint32_t GBUFFER_WIDTH = 1024;
+  constexpr uint32_t GBUFFER_HEIGHT = 680;
+
+  // the shaders are embedded by molten_embed_shaders, a shader missing from the build is reported
+  static const ShaderBlob* find_shader(const char* name) {
+    const ShaderBlob* blob = core::find_shader_blob(name);
+    if (!blob)
+      std::cout << "Shader " << name << " was not embedded" << std::endl;
+    return blob;
+  }
 
-      gfx::Texture normal_target = renderer.new_texture(
-        target_desc
-      );
+  struct GBufferPipeline {
+    struct Uniforms {
+      glm::mat4 view;
+      glm::mat4 proj;
+    };
 
-      gfx::Texture color_target = renderer.new_texture(
-        target_desc
+    static constexpr int MAX_RAY_STEPS = 64;
+
+    // software backend version of gbuffer.vert
+    // varyings: ray_pos, ray_dir, flat varyings: model, model_dim
+    static void soft_vertex(const gfx::SoftVertexIn& in, gfx::SoftVertexOut& out) {
+      const Uniforms& uniforms = *(const Uniforms*)in.uniforms;
+      glm::vec3 pos = glm::make_vec3(in.attributes[0]);
+      glm::mat4 model = glm::mat4(
+        glm::make_vec4(in.attributes[4]),
+        glm::make_vec4(in.attributes[5]),
+        glm::make_vec4(in.attributes[6]),
+        glm::make_vec4(in.attributes[7])
       );
+      glm::vec3 model_dim = glm::make_vec3(in.attributes[8]);
+
+      glm::vec4 cam_pos = glm::vec4(-uniforms.view[3][0], -uniforms.view[3][1], -uniforms.view[3][2], 1.0f);
+      glm::vec3 ray_pos = (glm::vec3(glm::inverse(model) * cam_pos) + glm::vec3(0.5f)) * model_dim;
+      glm::vec3 ray_dir = ((pos + glm::vec3(0.5f)) * model_dim) - ray_pos;
+      glm::vec4 position = uniforms.proj * uniforms.view * model * glm::vec4(pos, 1.0f);
+
+      std::copy_n(glm::value_ptr(position), 4, out.position);
+      std::copy_n(glm::value_ptr(ray_pos), 3, out.varyings);
+      std::copy_n(glm::value_ptr(ray_dir), 3, out.varyings + 3);
+      std::copy_n(glm::value_ptr(model), 16, out.flat_varyings);
+      std::copy_n(glm::value_ptr(model_dim), 3, out.flat_varyings + 16);
+    }
 
-      std::vector<gfx::Texture> targets = { pos_target, normal_target, color_target };
-
-      gfx::RenderPass gbuffer_pass = renderer.new_render_pass(
-        gfx::RenderPassDesc{
-          .colors = targets,
+    // software backend version of gbuffer.frag, voxels are fetched directly since the sampler is nearest with border
+    static bool soft_fragment(const gfx::SoftFragmentIn& in, gfx::SoftFragmentOut& out) {
+      glm::vec3 ray_pos = glm::make_vec3(in.varyings);
+      glm::vec3 ray_dir = glm::normalize(glm::make_vec3(in.varyings + 3));
+      glm::mat4 model = glm::make_mat4(in.flat_varyings);
+      glm::vec3 model_dim = glm::make_vec3(in.flat_varyings + 16);
+
+      // slab test against the model box
+      glm::vec3 inv_dir = 1.0f / ray_dir;
+      glm::vec3 t0 = (glm::vec3(0.0f) - ray_pos) * inv_dir;
+      glm::vec3 t1 = (model_dim - ray_pos) * inv_dir;
+      glm::vec3 t_near = glm::min(t0, t1);
+      glm::vec3 t_far = glm::max(t0, t1);
+      float t_min = std::max(t_near.x, std::max(t_near.y, t_near.z));
+      float t_max = std::min(t_far.x, std::min(t_far.y, t_far.z));
+      if (t_min > t_max)
+        return false;
+
+      glm::vec3 ray_start = ray_pos + ray_dir * (t_min + 0.0005f);
+      glm::ivec3 map_pos = glm::ivec3(glm::floor(ray_start));
+      glm::vec3 delta_dist = glm::abs(1.0f / ray_dir);
+      glm::vec3 dir_sign = glm::sign(ray_dir);
+      glm::ivec3 ray_step = glm::ivec3(dir_sign);
+      glm::vec3 side_dist = (dir_sign * (glm::vec3(map_pos) - ray_pos) + (dir_sign * 0.5f) + 0.5f) * delta_dist;
+
+      glm::bvec3 mask = glm::bvec3(false);
+      float voxel_color[4];
+      for (int i = 0; i < MAX_RAY_STEPS; i++) {
+        gfx::soft_fetch(in.textures[0], map_pos.x, map_pos.y, map_pos.z, voxel_color);
+        if (voxel_color[0] > 0.0f) {
+          glm::vec3 tex_coord = (glm::vec3(map_pos) * 2.0f + 1.0f) / (2.0f * model_dim);
+          glm::vec3 normal = glm::vec3(model * glm::vec4(glm::vec3(mask), 1.0f));
+          glm::vec3 pos = glm::vec3(model * glm::vec4(tex_coord, 1.0f));
+          std::copy_n(glm::value_ptr(pos), 3, out.colors[0]);
+          std::copy_n(glm::value_ptr(normal), 3, out.colors[1]);
+          for (int c = 0; c < 3; c++) {
+            out.colors[2][c] = voxel_color[c] * 100.0f;
+          }
+          return true;
         }
-      );
 
-      return GPURenderPass{
-        .targets = targets,
-        .rpass = gbuffer_pass,
-      };
+        mask = glm::lessThanEqual(side_dist, glm::min(glm::vec3(side_dist.y, side_dist.z, side_dist.x), glm::vec3(side_dist.z, side_dist.x, side_dist.y)));
+        side_dist += glm::vec3(mask) * delta_dist;
+        map_pos += glm::ivec3(glm::vec3(mask)) * ray_step;
+      }
+      return false;
     }
-  };
 
-  struct GBufferPipeline {
-    struct Uniforms {
-      glm::mat4 model;
-      glm::mat4 view;
-      glm::mat4 proj;
-      glm::vec3 model_dim;
-    };
+    // software backend version of gbuffer_fallback.frag
+    static bool soft_fallback_fragment(const gfx::SoftFragmentIn& in, gfx::SoftFragmentOut& out) {
+      glm::vec3 normal = -glm::normalize(glm::make_vec3(in.varyings + 3));
+      float center_voxel[4];
+      gfx::soft_sample(in.textures[0], 0.5f, 0.5f, 0.5f, center_voxel);
+      std::fill_n(out.colors[0], 3, 0.0f);
+      std::copy_n(glm::value_ptr(normal), 3, out.colors[1]);
+      std::fill_n(out.colors[2], 3, 0.5f + 0.5f * center_voxel[0]);
+      return true;
+    }
 
-    static GPUPipeline create(gfx::Renderer& renderer) {
-      Shader vs = core::load_shader("assets/shaders/gbuffer.vert");
-      Shader fs = core::load_shader("assets/shaders/gbuffer.frag");
+    static std::optional<GPUPipeline> create(gfx::Renderer& renderer) {
+      const ShaderBlob* vs = find_shader("gbuffer.vert");
+      const ShaderBlob* fs = find_shader("gbuffer.frag");
+      const ShaderBlob* fallback_fs = find_shader("gbuffer_fallback.frag");
+      if (!vs || !fs || !fallback_fs)
+        return std::nullopt;
 
       gfx::ShaderDesc desc{
-        .vertex_src = vs.code.c_str(),
-        .fragment_src = fs.code.c_str(),
+        .vertex_src = vs->source,
+        .fragment_src = fs->source,
+        .vertex_binary = vs->binary,
+        .fragment_binary = fs->binary,
+        .soft = gfx::SoftShaderDesc{
+          .vertex = soft_vertex,
+          .fragment = soft_fragment,
+          .num_varyings = 6,
+          .num_flat_varyings = 19,
+        },
         .uniforms_layout = gfx::UniformBlockLayout {
           .uniforms = {
-            gfx::UniformDesc {
-              .name = "u_model",
-              .type = gfx::UniformType::MAT4,
-            },
             gfx::UniformDesc {
               .name = "u_view",
               .type = gfx::UniformType::MAT4,
@@ -79,15 +152,19 @@ namespace core {
               .name = "u_proj",
               .type = gfx::UniformType::MAT4,
             },
-            gfx::UniformDesc {
-              .name = "u_model_dim",
-              .type = gfx::UniformType::FLOAT3,
-            },
           },
         },
         .texture_names = { "u_vox_model" },
       };
 
+      // the ray marching shader links in the background, the proxies are drawn flat until it is ready
+      gfx::ShaderDesc fallback_desc = desc;
+      fallback_desc.fragment_src = fallback_fs->source;
+      fallback_desc.fragment_binary = fallback_fs->binary;
+      fallback_desc.soft.fragment = soft_fallback_fragment;
+      gfx::Shader fallback_shader = renderer.new_shader(fallback_desc);
+
+      desc.async = true;
       gfx::Shader shader = renderer.new_shader(desc);
 
       gfx::VertexLayout layout;
@@ -95,16 +172,24 @@ namespace core {
       layout.attributes[1].format = gfx::AttributeFormat::FLOAT4;
       layout.attributes[2].format = gfx::AttributeFormat::FLOAT2;
       layout.attributes[3].format = gfx::AttributeFormat::FLOAT3;
+      // VoxelInstance, the model matrix takes one attribute per column
+      for (uint32_t i = 4; i < 9; i++) {
+        layout.attributes[i].format = i < 8 ? gfx::AttributeFormat::FLOAT4 : gfx::AttributeFormat::FLOAT3;
+        layout.attributes[i].step = gfx::VertexStep::PER_INSTANCE;
+      }
 
-      gfx::Pipeline pip = renderer.new_pipeline(
-        gfx::PipelineDesc{
-          .shader = shader,
-          .layout = layout,
-          .index_type = gfx::IndexType::UINT16,
-          .primitive_type = gfx::PrimitiveType::TRIANGLE_STRIP,
-          .cull = gfx::CullMode::BACK,
-        }
-      );
+      gfx::PipelineDesc pip_desc{
+        .shader = fallback_shader,
+        .layout = layout,
+        .index_type = gfx::IndexType::UINT16,
+        .primitive_type = gfx::PrimitiveType::TRIANGLE_STRIP,
+        .cull = gfx::CullMode::BACK,
+      };
+      gfx::Pipeline fallback_pip = renderer.new_pipeline(pip_desc);
+
+      pip_desc.shader = shader;
+      pip_desc.fallback = fallback_pip;
+      gfx::Pipeline pip = renderer.new_pipeline(pip_desc);
 
       return GPUPipeline{
         .shader = shader,
@@ -114,13 +199,35 @@ namespace core {
   };
 
   struct ScreenQuadPipeline {
-    static GPUPipeline create(gfx::Renderer& renderer) {
-      Shader vs = core::load_shader("assets/shaders/screen_quad.vert");
-      Shader fs = core::load_shader("assets/shaders/screen_quad.frag");
+    // software backend version of screen_quad.vert, varyings: uv
+    static void soft_vertex(const gfx::SoftVertexIn& in, gfx::SoftVertexOut& out) {
+      std::copy_n(in.attributes[0], 3, out.position);
+      out.position[3] = 1.0f;
+      std::copy_n(in.attributes[1], 2, out.varyings);
+    }
+
+    // software backend version of screen_quad.frag
+    static bool soft_fragment(const gfx::SoftFragmentIn& in, gfx::SoftFragmentOut& out) {
+      gfx::soft_sample(in.textures[0], in.varyings[0], in.varyings[1], 0.0f, out.colors[0]);
+      return true;
+    }
+
+    static std::optional<GPUPipeline> create(gfx::Renderer& renderer) {
+      const ShaderBlob* vs = find_shader("screen_quad.vert");
+      const ShaderBlob* fs = find_shader("screen_quad.frag");
+      if (!vs || !fs)
+        return std::nullopt;
 
       gfx::ShaderDesc desc{
-        .vertex_src = vs.code.c_str(),
-        .fragment_src = fs.code.c_str(),
+        .vertex_src = vs->source,
+        .fragment_src = fs->source,
+        .vertex_binary = vs->binary,
+        .fragment_binary = fs->binary,
+        .soft = gfx::SoftShaderDesc{
+          .vertex = soft_vertex,
+          .fragment = soft_fragment,
+          .num_varyings = 2,
+        },
         .texture_names = { "u_tex" },
       };
 
@@ -190,15 +297,20 @@ namespace core {
     }
   };
 
-  void DeferredVoxelRenderer::init(const gfx::InitInfo& info) {
+  bool DeferredVoxelRenderer::init(const gfx::InitInfo& info) {
     _renderer.init(info);
 
     // create pipelines
-    _gbuffer_pip = GBufferPipeline::create(_renderer);
-    _screen_quad_pip = ScreenQuadPipeline::create(_renderer);
+    std::optional<GPUPipeline> gbuffer_pip = GBufferPipeline::create(_renderer);
+    std::optional<GPUPipeline> screen_quad_pip = ScreenQuadPipeline::create(_renderer);
+    if (!gbuffer_pip || !screen_quad_pip) {
+      _renderer.shutdown();
+      return false;
+    }
+    _gbuffer_pip = gbuffer_pip.value();
+    _screen_quad_pip = screen_quad_pip.value();
 
-    // create render pass
-    _gbuffer_pass = GBufferPass::create(_renderer, 1024, 680);
+    _graph.init(_renderer);
 
     // create meshes
     _cube = Cube::create(_renderer);
@@ -214,36 +326,101 @@ namespace core {
       model->size_z,
     };
 
+    _voxel_dim = glm::uvec3(model->size_x, model->size_y, model->size_z);
+    _voxels.assign(model->voxel_data, model->voxel_data + (size_t)_voxel_dim.x * _voxel_dim.y * _voxel_dim.z);
+    glm::uvec3 bricks = (_voxel_dim + VOXEL_BRICK_SIZE - 1u) / VOXEL_BRICK_SIZE;
+    _edited_bricks.assign((size_t)bricks.x * bricks.y * bricks.z, false);
+
     vox_texture = _renderer.new_texture(
       gfx::TextureDesc{
-        .mem = (uint8_t*)model->voxel_data,
+        .mem = _voxels.data(),
         .type = gfx::TextureType::TEXTURE_3D,
         .format = gfx::TextureFormat::R8,
+        // the ray marching reads the first level only, bricks updates do not have to rebuild the mips
+        .generate_mip_maps = false,
         .width = model->size_x,
         .height = model->size_y,
         .depth = model->size_z,
       }
     );
 
+    // one instance per placement of the model in the scene, positioned relative to the first one
+    const ogt_vox_instance* first_instance = nullptr;
+    float model_scale = 1.0f / std::max(model_dim.x, std::max(model_dim.y, model_dim.z));
+    for (uint32_t i = 0; i < vox_scene.ogt_scene->num_instances; i++) {
+      const ogt_vox_instance& instance = vox_scene.ogt_scene->instances[i];
+      if (instance.model_index != 0)
+        continue;
+      if (!first_instance)
+        first_instance = &instance;
+
+      glm::vec3 position = glm::vec3(
+        instance.transform.m30 - first_instance->transform.m30,
+        instance.transform.m32 - first_instance->transform.m32,
+        instance.transform.m31 - first_instance->transform.m31
+      ) * model_scale;
+      _instances.push_back(VoxelInstance{
+        .model = glm::translate(glm::mat4(1.0f), position),
+        .model_dim = model_dim,
+      });
+    }
+    if (_instances.empty()) {
+      _instances.push_back(VoxelInstance{
+        .model = glm::mat4(1.0f),
+        .model_dim = model_dim,
+      });
+    }
+    _frame_instances.resize(_instances.size());
+
+    _instance_buffer = _renderer.new_buffer(
+      gfx::BufferDesc{
+        .mem = gfx::Memory{ nullptr, _instances.size() * sizeof(VoxelInstance) },
+        .type = gfx::BufferType::VERTEX_BUFFER,
+        .usage = gfx::BufferUsage::STREAM,
+      }
+    );
+
+    // samplers: voxels are fetched one by one, the gbuffer is filtered when resolved on screen
+    _volume_sampler = _renderer.new_sampler(
+      gfx::SamplerDesc{
+        .min_filter = gfx::Filter::NEAREST,
+        .mag_filter = gfx::Filter::NEAREST,
+        .wrap_u = gfx::Wrap::CLAMP_TO_BORDER,
+        .wrap_v = gfx::Wrap::CLAMP_TO_BORDER,
+        .wrap_w = gfx::Wrap::CLAMP_TO_BORDER,
+      }
+    );
+    _gbuffer_sampler = _renderer.new_sampler(
+      gfx::SamplerDesc{
+        .min_filter = gfx::Filter::LINEAR,
+        .mag_filter = gfx::Filter::LINEAR,
+      }
+    );
+
     // bindings
     _cube_bind = {
       .vertex_buffer = _cube.vbuffer,
       .index_buffer = _cube.ibuffer,
-      .textures = { vox_texture },
+      .textures = { { vox_texture, _volume_sampler } },
+      .instance_buffer = _instance_buffer,
     };
 
+    // the normal target is resolved by the graph every frame
     _quad_bind = {
       .vertex_buffer = _quad.vbuffer,
-      .textures = { _gbuffer_pass.targets[1] },
+      .textures = { { gfx::INVALID_HANDLE, _gbuffer_sampler } },
     };
+
+    return true;
   }
 
   void DeferredVoxelRenderer::render() {
+    PROFILE_ZONE("DeferredVoxelRenderer::render");
     rotation.x += 0.01f;
     rotation.y += 0.03f;
-    glm::mat4 model = glm::eulerAngleY(rotation.y) * glm::eulerAngleX(rotation.x);
+    glm::mat4 rotation_mat = glm::eulerAngleY(rotation.y) * glm::eulerAngleX(rotation.x);
     //glm::mat4 model = glm::mat4(1.0);
-    glm::mat4 proj = glm::perspective(glm::radians(60.0f), (float)1024.0f / 680.0f, 0.01f, 10.0f);
+    glm::mat4 proj = glm::perspective(glm::radians(60.0f), (float)GBUFFER_WIDTH / GBUFFER_HEIGHT, 0.01f, 10.0f);
     glm::mat4 view = glm::lookAt(
       glm::vec3(0.0f, 0.0f, 1.5f),
       glm::vec3(0.0f, 0.0f, 0.0f),
@@ -251,43 +428,114 @@ namespace core {
     );
 
     GBufferPipeline::Uniforms uniforms{
-      .model = model,
       .view = view,
       .proj = proj,
-      .model_dim = model_dim
     };
 
-    _renderer.begin_render_pass(
-      _gbuffer_pass.rpass,
+    for (size_t i = 0; i < _instances.size(); i++) {
+      _frame_instances[i] = VoxelInstance{
+        .model = _instances[i].model * rotation_mat,
+        .model_dim = _instances[i].model_dim,
+      };
+    }
+    _renderer.update_buffer(_instance_buffer, gfx::Memory{ _frame_instances.data(), _frame_instances.size() * sizeof(VoxelInstance) });
+    upload_edited_bricks();
+
+    RGTexture normal_target;
+    RGTexture vox_model = _graph.import(vox_texture);
+    // position, normal and color targets, only the normal target is sampled by the screen pass
+    _graph.add_pass("gbuffer",
       gfx::PassAction{
         gfx::ColorAction {
           .color = gfx::Color(0.1f, 0.1f, 0.1f, 1.0f),
         }
+      },
+      [&](RGPassBuilder& builder) {
+        RGTextureDesc target_desc{
+          .format = gfx::TextureFormat::RGB8,
+          .width = GBUFFER_WIDTH,
+          .height = GBUFFER_HEIGHT,
+        };
+        normal_target = builder.create(target_desc);
+        builder.read(vox_model);
+        builder.write(builder.create(target_desc));
+        builder.write(normal_target);
+        builder.write(builder.create(target_desc));
+      },
+      [&](gfx::Renderer& renderer, const RenderGraph&) {
+        renderer.set_pipeline(_gbuffer_pip.pipeline);
+        renderer.set_bindings(_cube_bind);
+        renderer.set_uniforms(gfx::MAKE_MEMORY(uniforms));
+        renderer.draw(0, 14, (uint32_t)_instances.size());
       }
     );
 
-    _renderer.set_pipeline(_gbuffer_pip.pipeline);
-    _renderer.set_bindings(_cube_bind);
-    _renderer.set_uniforms(gfx::MAKE_MEMORY(uniforms));
-    _renderer.draw(0, 14, 1);
-    _renderer.end_render_pass();
-
-    _renderer.begin_default_render_pass(
+    _graph.add_pass("screen",
       gfx::PassAction{
         gfx::ColorAction {
           .color = gfx::Color(0.0f, 0.0f, 0.0f, 1.0f),
         }
+      },
+      [&](RGPassBuilder& builder) {
+        builder.read(normal_target);
+        builder.write(RG_BACKBUFFER);
+      },
+      [&](gfx::Renderer& renderer, const RenderGraph& graph) {
+        _quad_bind.textures[0].texture = graph.texture(normal_target);
+        renderer.set_pipeline(_screen_quad_pip.pipeline);
+        renderer.set_bindings(_quad_bind);
+        renderer.draw(0, 4, 1);
       }
     );
-    _renderer.set_pipeline(_screen_quad_pip.pipeline);
-    _renderer.set_bindings(_quad_bind);
-    _renderer.draw(0, 4, 1);
-    _renderer.end_render_pass();
 
+    _graph.execute();
     _renderer.submit();
   }
 
+  bool DeferredVoxelRenderer::set_voxel(const glm::uvec3& pos, uint8_t palette_index) {
+    if (glm::any(glm::greaterThanEqual(pos, _voxel_dim)))
+      return false;
+    _voxels[pos.x + ((size_t)pos.z * _voxel_dim.y + pos.y) * _voxel_dim.x] = palette_index;
+
+    glm::uvec3 bricks = (_voxel_dim + VOXEL_BRICK_SIZE - 1u) / VOXEL_BRICK_SIZE;
+    glm::uvec3 brick = pos / VOXEL_BRICK_SIZE;
+    uint32_t index = brick.x + (brick.z * bricks.y + brick.y) * bricks.x;
+    if (!_edited_bricks[index]) {
+      _edited_bricks[index] = true;
+      _edited_brick_list.push_back(index);
+    }
+    return true;
+  }
+
+  void DeferredVoxelRenderer::upload_edited_bricks() {
+    glm::uvec3 bricks = (_voxel_dim + VOXEL_BRICK_SIZE - 1u) / VOXEL_BRICK_SIZE;
+    for (uint32_t index : _edited_brick_list) {
+      glm::uvec3 origin = glm::uvec3(index % bricks.x, (index / bricks.x) % bricks.y, index / (bricks.x * bricks.y)) * VOXEL_BRICK_SIZE;
+      glm::uvec3 size = glm::min(glm::uvec3(VOXEL_BRICK_SIZE), _voxel_dim - origin);
+
+      // the rows of the brick are packed for the upload
+      _brick_voxels.resize((size_t)size.x * size.y * size.z);
+      uint8_t* dst = _brick_voxels.data();
+      for (uint32_t z = 0; z < size.z; z++) {
+        for (uint32_t y = 0; y < size.y; y++) {
+          const uint8_t* src = &_voxels[origin.x + ((size_t)(origin.z + z) * _voxel_dim.y + origin.y + y) * _voxel_dim.x];
+          dst = std::copy_n(src, size.x, dst);
+        }
+      }
+
+      update_voxels(gfx::TextureRegion{ origin.x, origin.y, origin.z, size.x, size.y, size.z }, _brick_voxels.data());
+      _edited_bricks[index] = false;
+    }
+    _edited_brick_list.clear();
+  }
+
+  void DeferredVoxelRenderer::update_voxels(const gfx::TextureRegion& brick, const uint8_t* voxels) {
+    size_t size = (size_t)brick.width * brick.height * brick.depth;
+    _renderer.update_texture(vox_texture, brick, 0, gfx::Memory{ const_cast<uint8_t*>(voxels), size });
+  }
+
   void DeferredVoxelRenderer::shutdown() {
+    _graph.shutdown();
     _renderer.shutdown();
   }
 }
\ No newline at end of file
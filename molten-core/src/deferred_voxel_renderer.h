@@ -2,6 +2,7 @@
 
 #include "gfx/renderer.h"
 #include "gpu_resources.h"
+#include "render_graph.h"
 
 // todo: remove
 #define GLM_ENABLE_EXPERIMENTAL
@@ -10,12 +11,33 @@
 #include <glm/gtc/matrix_transform.hpp>
 
 namespace core {
+  // per-instance data of the gbuffer cube proxy
+  struct VoxelInstance {
+    glm::mat4 model;
+    glm::vec3 model_dim;
+  };
+  static_assert(sizeof(VoxelInstance) == 19 * sizeof(float), "VoxelInstance must match the tightly packed instance attributes");
+
+  // edge of the cubes of voxels re-uploaded after an edit
+  constexpr uint32_t VOXEL_BRICK_SIZE = 8;
+
   class DeferredVoxelRenderer {
   public:
-    void init(const gfx::InitInfo& info);
+    // returns false when the pipelines can't be created, the renderer is shut down
+    bool init(const gfx::InitInfo& info);
     void shutdown();
 
     void render();
+    // changes a voxel of the model, 0 empties it, the bricks edited are re-uploaded by the next render
+    // returns false outside of the model
+    bool set_voxel(const glm::uvec3& pos, uint8_t palette_index);
+    glm::uvec3 voxel_dim() const { return _voxel_dim; }
+    // re-uploads a brick of the voxel model, voxels holds one palette index per voxel of the region
+    void update_voxels(const gfx::TextureRegion& brick, const uint8_t* voxels);
+    // gbuffer raymarch and screen quad timings, see gfx::Renderer::get_pass_timings
+    const std::vector<gfx::PassTiming>& pass_timings() { return _renderer.get_pass_timings(); }
+    // passes culled and gbuffer targets aliased by the last frame
+    const RenderGraphStats& graph_stats() const { return _graph.stats(); }
 
   private:
     gfx::Renderer _renderer;
@@ -23,7 +45,8 @@ namespace core {
     GPUPipeline _gbuffer_pip;
     GPUPipeline _screen_quad_pip;
 
-    GPURenderPass _gbuffer_pass;
+    // the gbuffer targets are transient textures of the graph
+    RenderGraph _graph;
 
     GPUMesh _cube;
     GPUMesh _quad;
@@ -31,9 +54,26 @@ namespace core {
     gfx::Bindings _cube_bind;
     gfx::Bindings _quad_bind;
 
+    gfx::Sampler _volume_sampler;
+    gfx::Sampler _gbuffer_sampler;
+
+    // all the instances of a voxel model are drawn in one call
+    std::vector<VoxelInstance> _instances;
+    std::vector<VoxelInstance> _frame_instances;
+    gfx::Buffer _instance_buffer;
+
     // todo: remove
     glm::vec2 rotation;
     gfx::Texture vox_texture;
     glm::vec3 model_dim;
+
+    void upload_edited_bricks();
+
+    // CPU copy of the voxel model, x first then y then z
+    std::vector<uint8_t> _voxels;
+    glm::uvec3 _voxel_dim;
+    std::vector<bool> _edited_bricks;
+    std::vector<uint32_t> _edited_brick_list;
+    std::vector<uint8_t> _brick_voxels;
   };
 }
@@ -2,22 +2,38 @@
 
 #include "asset_manager.h"
 #include "deferred_voxel_renderer.h"
+#include "profiler.h"
 
 
 namespace core {
   static AssetManager s_asset_manager;
   static DeferredVoxelRenderer s_renderer;
 
-  void Engine::init(const InitInfo& info) {
+  bool Engine::init(const InitInfo& info) {
+    PROFILE_THREAD_NAME("main");
     s_asset_manager.init();
-    s_renderer.init(gfx::InitInfo{ info.window });
+    return s_renderer.init(
+      gfx::InitInfo{
+        .window = info.window,
+        .submit_mode = gfx::SubmitMode::DEFERRED,
+        .shader_cache_dir = "shader_cache",
+        .frames_in_flight = info.frames_in_flight,
+        .present_mode = info.present_mode,
+        .render_scale = info.render_scale,
+      }
+    );
   }
 
   void Engine::shutdown() {
     s_renderer.shutdown();
   }
 
+  bool Engine::set_voxel(uint32_t x, uint32_t y, uint32_t z, uint8_t palette_index) {
+    return s_renderer.set_voxel(glm::uvec3(x, y, z), palette_index);
+  }
+
   void Engine::tick() {
+    PROFILE_ZONE("Engine::tick");
     s_renderer.render();
   }
 }
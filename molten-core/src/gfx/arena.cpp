@@ -0,0 +1,49 @@
+#include "gfx/arena.h"
+
+#include <algorithm>
+#include <assert.h>
+
+namespace gfx {
+  Arena::Arena(size_t block_size) : _block_size(block_size) {
+  }
+
+  void* Arena::alloc(size_t size, size_t alignment) {
+    assert((alignment & (alignment - 1)) == 0 && "Arena alignment must be a power of two");
+
+    while (_current_block < _blocks.size()) {
+      Block& block = _blocks[_current_block];
+      uintptr_t base = (uintptr_t)block.data.get();
+      uintptr_t aligned = (base + _offset + alignment - 1) & ~(uintptr_t)(alignment - 1);
+      size_t end = (size_t)(aligned - base) + size;
+      if (end <= block.size) {
+        _offset = end;
+        _used += size;
+        return (void*)aligned;
+      }
+      // go to the next block
+      ++_current_block;
+      _offset = 0;
+    }
+
+    // no block left, allocate a new one big enough for this allocation
+    size_t block_size = std::max(_block_size, size + alignment);
+    _blocks.push_back(Block{ std::unique_ptr<uint8_t[]>(new uint8_t[block_size]), block_size });
+    _current_block = _blocks.size() - 1;
+    _offset = 0;
+    return alloc(size, alignment);
+  }
+
+  void Arena::reset() {
+    _current_block = 0;
+    _offset = 0;
+    _used = 0;
+  }
+
+  size_t Arena::capacity() const {
+    size_t total = 0;
+    for (const Block& block : _blocks) {
+      total += block.size;
+    }
+    return total;
+  }
+}
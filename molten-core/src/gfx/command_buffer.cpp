@@ -0,0 +1,221 @@
+#include "gfx/command_buffer.h"
+
+#include <algorithm>
+#include <cstring>
+#include <assert.h>
+
+namespace gfx {
+  constexpr uint32_t EPOCH_MAX = (1 << SORT_KEY_EPOCH_BITS) - 1;
+  constexpr uint32_t UNIFORMS_ALIGNMENT = 16;
+  // bits of the key owned by the secondary buffers, the pass and epoch come from the primary buffer
+  constexpr uint32_t SORT_KEY_DRAW_BITS = SORT_KEY_PIPELINE_BITS + SORT_KEY_TEXTURE_BITS + SORT_KEY_BUFFER_BITS;
+  constexpr SortKey SORT_KEY_DRAW_MASK = (SortKey(1) << SORT_KEY_DRAW_BITS) - 1;
+
+  SortKey make_sort_key(uint32_t pass, uint32_t epoch, CommandStage stage, Pipeline pipe, Texture tex, Buffer buffer) {
+    auto field = [](uint64_t value, uint32_t bits) {
+      return value & ((uint64_t(1) << bits) - 1);
+    };
+
+    SortKey key = field(pass, SORT_KEY_PASS_BITS);
+    key = (key << SORT_KEY_EPOCH_BITS) | field(epoch, SORT_KEY_EPOCH_BITS);
+    key = (key << SORT_KEY_STAGE_BITS) | field((uint64_t)stage, SORT_KEY_STAGE_BITS);
+    key = (key << SORT_KEY_PIPELINE_BITS) | field(pipe, SORT_KEY_PIPELINE_BITS);
+    key = (key << SORT_KEY_TEXTURE_BITS) | field(tex, SORT_KEY_TEXTURE_BITS);
+    key = (key << SORT_KEY_BUFFER_BITS) | field(buffer, SORT_KEY_BUFFER_BITS);
+    return key;
+  }
+
+  bool same_bindings(const BindingsCommand& a, const BindingsCommand& b) {
+    if (a.vertex_buffer != b.vertex_buffer ||
+      a.has_index_buffer != b.has_index_buffer ||
+      (a.has_index_buffer && a.index_buffer != b.index_buffer) ||
+      a.num_textures != b.num_textures ||
+      a.vertex_buffer_offset != b.vertex_buffer_offset ||
+      a.index_buffer_offset != b.index_buffer_offset ||
+      a.has_instance_buffer != b.has_instance_buffer ||
+      (a.has_instance_buffer && (a.instance_buffer != b.instance_buffer || a.instance_buffer_offset != b.instance_buffer_offset))) {
+      return false;
+    }
+    return std::equal(a.textures, a.textures + a.num_textures, b.textures);
+  }
+
+  CommandBuffer::CommandBuffer(CommandBufferLevel level) : _level(level) {
+  }
+
+  void CommandBuffer::begin_render_pass(std::optional<RenderPass> pass, const PassAction& action) {
+    assert(_level == CommandBufferLevel::PRIMARY && "Render passes can only be recorded in a primary command buffer");
+    assert(!_in_pass && "begin_render_pass called inside a render pass");
+    assert(_pass + 1 < MAX_PASSES && "Too many render passes recorded in a frame");
+
+    ++_pass;
+    _epoch = 0;
+    _in_pass = true;
+
+    Command cmd;
+    cmd.key = make_sort_key(_pass, 0, CommandStage::BEGIN_PASS, 0, 0, 0);
+    cmd.type = CommandType::BEGIN_PASS;
+    cmd.pass = PassCommand{
+      .pass = pass.value_or(0),
+      .is_default = !pass.has_value(),
+      .action = _arena.copy(&action, 1),
+    };
+    _commands.push_back(cmd);
+  }
+
+  void CommandBuffer::end_render_pass() {
+    assert(_level == CommandBufferLevel::PRIMARY && "Render passes can only be recorded in a primary command buffer");
+    _in_pass = false;
+
+    Command cmd;
+    cmd.key = make_sort_key(_pass, EPOCH_MAX, CommandStage::END_PASS, 0, 0, 0);
+    cmd.type = CommandType::END_PASS;
+    cmd.pass = PassCommand{};
+    _commands.push_back(cmd);
+  }
+
+  void CommandBuffer::set_pipeline(Pipeline pipe) {
+    _pipeline = pipe;
+    // uniforms are tied to the pipeline shader
+    _uniforms = nullptr;
+    _uniforms_size = 0;
+  }
+
+  void CommandBuffer::set_bindings(const Bindings& bind) {
+    BindingsCommand cmd{
+      .vertex_buffer = bind.vertex_buffer,
+      .index_buffer = bind.index_buffer.value_or(0),
+      .has_index_buffer = bind.index_buffer.has_value(),
+      .num_textures = (uint32_t)bind.textures.size(),
+      .textures = bind.textures.data(),
+      .vertex_buffer_offset = bind.vertex_buffer_offset,
+      .index_buffer_offset = bind.index_buffer_offset,
+      .instance_buffer = bind.instance_buffer.value_or(0),
+      .has_instance_buffer = bind.instance_buffer.has_value(),
+      .instance_buffer_offset = bind.instance_buffer_offset,
+    };
+
+    // reuse the previous bindings when nothing changed
+    if (_bindings && same_bindings(*_bindings, cmd))
+      return;
+
+    cmd.textures = _arena.copy(bind.textures.data(), bind.textures.size());
+    _bindings = _arena.copy(&cmd, 1);
+  }
+
+  void CommandBuffer::set_uniforms(const Memory& mem) {
+    void* data = _arena.alloc(mem.size, UNIFORMS_ALIGNMENT);
+    std::memcpy(data, mem.data, mem.size);
+
+    _uniforms = data;
+    _uniforms_size = (uint32_t)mem.size;
+  }
+
+  void CommandBuffer::draw(uint32_t first_element, uint32_t num_elements, uint32_t num_instances, int32_t base_vertex) {
+    push_draw(DrawCommand{
+      .first_element = first_element,
+      .num_elements = num_elements,
+      .num_instances = num_instances,
+      .base_vertex = base_vertex,
+      .indirect = nullptr,
+    });
+  }
+
+  void CommandBuffer::multi_draw_indirect(Buffer args, uint32_t offset, uint32_t draw_count, uint32_t stride) {
+    IndirectCommand indirect{
+      .args = args,
+      .offset = offset,
+      .draw_count = draw_count,
+      .stride = stride,
+    };
+    push_draw(DrawCommand{
+      .indirect = _arena.copy(&indirect, 1),
+    });
+  }
+
+  void CommandBuffer::set_viewport(const Rect& rect) {
+    push_rect(CommandType::SET_VIEWPORT, rect);
+  }
+
+  void CommandBuffer::set_scissor(const Rect& rect) {
+    push_rect(CommandType::SET_SCISSOR, rect);
+  }
+
+  void CommandBuffer::execute(CommandBuffer& secondary) {
+    assert(_level == CommandBufferLevel::PRIMARY && "Only a primary command buffer can execute another one");
+    assert(secondary._level == CommandBufferLevel::SECONDARY && "Only a secondary command buffer can be executed");
+    assert(_in_pass && "execute called outside of a render pass");
+
+    _secondaries.push_back(Secondary{
+      .buffer = &secondary,
+      .key_prefix = make_sort_key(_pass, _epoch, CommandStage::DRAW, 0, 0, 0),
+    });
+  }
+
+  void CommandBuffer::sort() {
+    // secondary buffers are merged in execution order, the stable sort keeps it for equal keys
+    for (const Secondary& secondary : _secondaries) {
+      for (const Command& cmd : secondary.buffer->_commands) {
+        Command merged = cmd;
+        merged.key = secondary.key_prefix | (cmd.key & SORT_KEY_DRAW_MASK);
+        _commands.push_back(merged);
+      }
+    }
+
+    std::stable_sort(_commands.begin(), _commands.end(), [](const Command& a, const Command& b) {
+      return a.key < b.key;
+    });
+  }
+
+  void CommandBuffer::clear() {
+    for (const Secondary& secondary : _secondaries) {
+      secondary.buffer->clear();
+    }
+    _secondaries.clear();
+    _commands.clear();
+    _arena.reset();
+
+    _pass = 0;
+    _epoch = 0;
+    _in_pass = false;
+    _pipeline = 0;
+    _bindings = nullptr;
+    _uniforms = nullptr;
+    _uniforms_size = 0;
+  }
+
+  void CommandBuffer::push_draw(DrawCommand draw) {
+    assert((_in_pass || _level == CommandBufferLevel::SECONDARY) && "draw called outside of a render pass");
+    assert(_bindings && "draw called without bindings");
+
+    draw.pipeline = _pipeline;
+    draw.uniforms_size = _uniforms_size;
+    draw.uniforms = _uniforms;
+    draw.bindings = _bindings;
+
+    Texture tex = _bindings->num_textures > 0 ? _bindings->textures[0].texture : 0;
+
+    Command cmd;
+    cmd.key = make_sort_key(_pass, _epoch, CommandStage::DRAW, _pipeline, tex, _bindings->vertex_buffer);
+    cmd.type = CommandType::DRAW;
+    cmd.draw = draw;
+    _commands.push_back(cmd);
+  }
+
+  void CommandBuffer::push_rect(CommandType type, const Rect& rect) {
+    assert(_level == CommandBufferLevel::PRIMARY && "Viewport and scissor can only be recorded in a primary command buffer");
+
+    Command cmd;
+    if (_in_pass) {
+      // draws recorded after this command must stay after it, EPOCH_MAX is kept for the end of the pass
+      assert(_epoch + 1 < EPOCH_MAX && "Too many viewport and scissor changes recorded in a render pass");
+      ++_epoch;
+      cmd.key = make_sort_key(_pass, _epoch, CommandStage::STATE, 0, 0, 0);
+    } else {
+      // outside of a pass: stays between the previous and the next pass
+      cmd.key = make_sort_key(_pass, EPOCH_MAX, CommandStage::END_PASS, 0, 0, 0);
+    }
+    cmd.type = type;
+    cmd.rect = RectCommand{ rect.x, rect.y, rect.width, rect.height };
+    _commands.push_back(cmd);
+  }
+}
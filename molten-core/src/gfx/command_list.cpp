@@ -0,0 +1,27 @@
+#include "gfx/command_list.h"
+
+namespace gfx {
+  void CommandList::set_pipeline(Pipeline pipe) {
+    _buffer.set_pipeline(pipe);
+  }
+
+  void CommandList::set_bindings(const Bindings& bind) {
+    _buffer.set_bindings(bind);
+  }
+
+  void CommandList::set_uniforms(const Memory& mem) {
+    _buffer.set_uniforms(mem);
+  }
+
+  void CommandList::draw(uint32_t first_element, uint32_t num_elements, uint32_t num_instances, int32_t base_vertex) {
+    _buffer.draw(first_element, num_elements, num_instances, base_vertex);
+  }
+
+  void CommandList::draw_indirect(Buffer args, uint32_t offset) {
+    _buffer.multi_draw_indirect(args, offset, 1, 0);
+  }
+
+  void CommandList::multi_draw_indirect(Buffer args, uint32_t offset, uint32_t draw_count, uint32_t stride) {
+    _buffer.multi_draw_indirect(args, offset, draw_count, stride);
+  }
+}
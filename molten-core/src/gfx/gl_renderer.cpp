@@ -1,38 +1,285 @@
 #include "gl_renderer.h"
 
 #include "gl_utils.h"
+#include "profiler.h"
 
 #include <iostream>
+#include <fstream>
+#include <filesystem>
+#include <algorithm>
+#include <cstring>
+#include <cmath>
 
 #include <SDL2/SDL.h>
 
+// GL_KHR_parallel_shader_compile is not part of the generated loader
+#ifndef GL_COMPLETION_STATUS_KHR
+#define GL_COMPLETION_STATUS_KHR 0x91B1
+#endif
+
 namespace gfx {
-  void GLBuffer::create(const BufferDesc& desc) {
+  using MaxShaderCompilerThreadsProc = void (APIENTRYP)(GLuint count);
+
+  // glSpecializeShader, or its ARB variant, when SPIR-V shaders are supported
+  static PFNGLSPECIALIZESHADERPROC s_specialize_shader = nullptr;
+  // glMultiDraw*Indirect are core in GL 4.3 or come from GL_ARB_multi_draw_indirect, the indirect buffers get a CPU copy otherwise
+  static bool s_multi_draw_indirect = false;
+  // core in GL 4.6, the ARB and EXT extensions use the same enums
+  static bool s_anisotropic_filtering = false;
+
+  // entry point of the SPIR-V modules, part of the program cache key
+  static const char* SPIRV_ENTRY_POINT = "main";
+
+  static bool use_spirv(const ShaderDesc& desc) {
+    return s_specialize_shader && desc.vertex_binary.gl_spirv && desc.fragment_binary.gl_spirv;
+  }
+
+  static GLuint create_spirv_shader(GLenum type, const ShaderBinary& binary) {
+    GLuint shader = glCreateShader(type);
+    glShaderBinary(1, &shader, GL_SHADER_BINARY_FORMAT_SPIR_V, binary.gl_spirv, (GLsizei)binary.gl_spirv_size);
+    s_specialize_shader(shader, SPIRV_ENTRY_POINT, 0, nullptr, nullptr);
+    return shader;
+  }
+
+  void GLBufferRing::create(uint32_t seg_size, GLint align) {
+    alignment = align;
+    segment_size = (seg_size + alignment - 1) / alignment * alignment;
+    frame = 0;
+    offset = 0;
+
+    GLsizeiptr size = (GLsizeiptr)segment_size * FRAMES_IN_FLIGHT;
     glGenBuffers(1, &id);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, id);
+    if (GLAD_GL_VERSION_4_4) {
+      GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+      glBufferStorage(GL_COPY_WRITE_BUFFER, size, nullptr, flags);
+      mapped = (uint8_t*)glMapBufferRange(GL_COPY_WRITE_BUFFER, 0, size, flags);
+    } else {
+      glBufferData(GL_COPY_WRITE_BUFFER, size, nullptr, GL_STREAM_DRAW);
+      mapped = nullptr;
+    }
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+  }
+
+  void GLBufferRing::destroy() {
+    if (mapped) {
+      glBindBuffer(GL_COPY_WRITE_BUFFER, id);
+      glUnmapBuffer(GL_COPY_WRITE_BUFFER);
+      glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+      mapped = nullptr;
+    }
+    glDeleteBuffers(1, &id);
+  }
+
+  std::optional<GLintptr> GLBufferRing::push(const void* data, uint32_t size, uint32_t reserve_size) {
+    uint32_t aligned_offset = (offset + alignment - 1) / alignment * alignment;
+    if (aligned_offset + reserve_size > segment_size)
+      return std::nullopt;
+
+    GLintptr buffer_offset = segment_offset() + aligned_offset;
+    if (mapped) {
+      std::memcpy(mapped + buffer_offset, data, size);
+    } else {
+      glBindBuffer(GL_COPY_WRITE_BUFFER, id);
+      glBufferSubData(GL_COPY_WRITE_BUFFER, buffer_offset, size, data);
+      glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    }
+    offset = aligned_offset + reserve_size;
+
+    return buffer_offset;
+  }
+
+  void GLBufferRing::begin_frame(uint32_t new_frame) {
+    frame = new_frame;
+    offset = 0;
+  }
+
+  void GLPassTimer::create() {
+    for (auto& frame_queries : queries) {
+      glGenQueries(MAX_TIMED_PASSES, frame_queries.data());
+    }
+    for (auto& frame_names : names) {
+      frame_names.clear();
+    }
+    timings.clear();
+    frame = 0;
+    timing = false;
+  }
+
+  void GLPassTimer::destroy() {
+    for (auto& frame_queries : queries) {
+      glDeleteQueries(MAX_TIMED_PASSES, frame_queries.data());
+    }
+  }
+
+  void GLPassTimer::begin_pass(const char* name) {
+    std::vector<std::string>& frame_names = names[frame];
+    if (frame_names.size() == MAX_TIMED_PASSES)
+      return;
+    glBeginQuery(GL_TIME_ELAPSED, queries[frame][frame_names.size()]);
+    frame_names.emplace_back(name);
+    timing = true;
+  }
 
-    GLenum gl_buffer_type = get_gl_buffer_type(desc.type);
+  void GLPassTimer::end_pass() {
+    if (!timing)
+      return;
+    glEndQuery(GL_TIME_ELAPSED);
+    timing = false;
+  }
 
-    glBindBuffer(gl_buffer_type, id);
-    glBufferData(gl_buffer_type, desc.mem.size, desc.mem.data, GL_STATIC_DRAW);
+  void GLPassTimer::begin_frame(uint32_t new_frame) {
+    // a pass left open is not timed
+    end_pass();
+    frame = new_frame;
+    std::vector<std::string>& frame_names = names[frame];
+    if (frame_names.empty())
+      return;
 
-    glBindBuffer(gl_buffer_type, 0);
+    // the queries end in order, the last one tells if the whole frame is available
+    GLuint available = GL_FALSE;
+    glGetQueryObjectuiv(queries[frame][frame_names.size() - 1], GL_QUERY_RESULT_AVAILABLE, &available);
+    if (available) {
+      timings.resize(frame_names.size());
+      for (size_t i = 0; i < frame_names.size(); i++) {
+        GLuint64 elapsed_ns = 0;
+        glGetQueryObjectui64v(queries[frame][i], GL_QUERY_RESULT, &elapsed_ns);
+        timings[i].name = frame_names[i];
+        timings[i].gpu_ms = (double)elapsed_ns / 1e6;
+      }
+    }
+    frame_names.clear();
+  }
+
+  void GLBuffer::create(const BufferDesc& desc) {
+    type = desc.type;
+    usage = desc.usage;
+    size = (uint32_t)desc.mem.size;
+    append_offset = 0;
+
+    if (usage == BufferUsage::STREAM) {
+      ring.create(size, STREAM_BUFFER_ALIGNMENT);
+      id = ring.id;
+      if (type == BufferType::INDIRECT_BUFFER && !s_multi_draw_indirect)
+        shadow.resize((size_t)ring.segment_size * FRAMES_IN_FLIGHT);
+      if (desc.mem.data)
+        update(desc.mem);
+      return;
+    }
+
+    if (type == BufferType::INDIRECT_BUFFER && !s_multi_draw_indirect) {
+      shadow.resize(size);
+      write_shadow(0, desc.mem.data, desc.mem.size);
+    }
+
+    glGenBuffers(1, &id);
+
+    // upload through the copy target: the element array binding is part of the bound vertex array
+    // and the array buffer binding is cached by the renderer state
+    glBindBuffer(GL_COPY_WRITE_BUFFER, id);
+    if (usage == BufferUsage::IMMUTABLE && GLAD_GL_VERSION_4_4) {
+      glBufferStorage(GL_COPY_WRITE_BUFFER, desc.mem.size, desc.mem.data, 0);
+    } else {
+      GLenum gl_usage = usage == BufferUsage::IMMUTABLE ? GL_STATIC_DRAW : GL_DYNAMIC_DRAW;
+      glBufferData(GL_COPY_WRITE_BUFFER, desc.mem.size, desc.mem.data, gl_usage);
+    }
+
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
   }
 
   void GLBuffer::destroy() {
+    shadow = {};
+    if (usage == BufferUsage::STREAM) {
+      ring.destroy();
+      return;
+    }
     glDeleteBuffers(1, &id);
   }
 
+  bool GLBuffer::update(const Memory& mem) {
+    if (usage == BufferUsage::IMMUTABLE) {
+      std::cout << "Can't update an IMMUTABLE buffer" << std::endl;
+      return false;
+    }
+    if (mem.size > size) {
+      std::cout << "Buffer update of " << mem.size << " bytes is bigger than the buffer size " << size << std::endl;
+      return false;
+    }
+
+    if (usage == BufferUsage::STREAM) {
+      // the segment is persistently mapped and the draws already issued this frame read it: it is only written once
+      if (ring.offset != 0) {
+        std::cout << "STREAM buffer was already written this frame, append to it instead" << std::endl;
+        return false;
+      }
+      ring.push(mem.data, (uint32_t)mem.size, (uint32_t)mem.size);
+    } else {
+      glBindBuffer(GL_COPY_WRITE_BUFFER, id);
+      glBufferSubData(GL_COPY_WRITE_BUFFER, 0, mem.size, mem.data);
+      glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    }
+    write_shadow(base_offset(), mem.data, mem.size);
+    append_offset = (uint32_t)mem.size;
+    return true;
+  }
+
+  std::optional<uint32_t> GLBuffer::append(const Memory& mem) {
+    if (usage == BufferUsage::IMMUTABLE) {
+      std::cout << "Can't append to an IMMUTABLE buffer" << std::endl;
+      return std::nullopt;
+    }
+
+    if (usage == BufferUsage::STREAM) {
+      std::optional<GLintptr> offset = ring.push(mem.data, (uint32_t)mem.size, (uint32_t)mem.size);
+      if (!offset) {
+        std::cout << "STREAM buffer of " << size << " bytes is full for this frame" << std::endl;
+        return std::nullopt;
+      }
+      write_shadow(offset.value(), mem.data, mem.size);
+      return (uint32_t)(offset.value() - ring.segment_offset());
+    }
+
+    uint32_t offset = (append_offset + STREAM_BUFFER_ALIGNMENT - 1) / STREAM_BUFFER_ALIGNMENT * STREAM_BUFFER_ALIGNMENT;
+    if (offset + mem.size > size) {
+      std::cout << "DYNAMIC buffer of " << size << " bytes is full for this frame" << std::endl;
+      return std::nullopt;
+    }
+    glBindBuffer(GL_COPY_WRITE_BUFFER, id);
+    glBufferSubData(GL_COPY_WRITE_BUFFER, offset, mem.size, mem.data);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    write_shadow(offset, mem.data, mem.size);
+    append_offset = offset + (uint32_t)mem.size;
+    return offset;
+  }
+
+  void GLBuffer::write_shadow(GLintptr offset, const void* data, size_t data_size) {
+    if (shadow.empty() || !data)
+      return;
+    std::memcpy(shadow.data() + offset, data, data_size);
+  }
+
+  void GLBuffer::begin_frame(uint32_t frame) {
+    append_offset = 0;
+    if (usage == BufferUsage::STREAM)
+      ring.begin_frame(frame);
+  }
+
   void GLTexture::create(const TextureDesc& desc) {
     glGenTextures(1, &id);
 
     target = get_gl_texture_target(desc.type);
-    GLenum format = get_gl_texture_format(desc.format);
-    GLenum pixel_type = get_gl_texture_pixel_type(desc.format);
+    type = desc.type;
+    format = get_gl_texture_format(desc.format);
+    pixel_type = get_gl_texture_pixel_type(desc.format);
+    texel_size = get_gl_texture_texel_size(desc.format);
+    width = desc.width;
+    height = std::max(desc.height, 1u);
+    depth = std::max(desc.depth, 1u);
     GLenum internal_format = get_gl_texture_internal_format(desc.format);
 
     glBindTexture(target, id);
 
-    // todo: config this
+    // sampling state used when the texture is bound without a sampler
     glTexParameteri(target, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
     glTexParameteri(target, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
     glTexParameteri(target, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_BORDER);
@@ -55,8 +302,12 @@ namespace gfx {
       break;
     }
     
-    if(desc.generate_mip_maps)
+    mip_levels = 1;
+    if (desc.generate_mip_maps) {
       glGenerateMipmap(target);
+      uint32_t max_extent = std::max({ width, desc.type != TextureType::TEXTURE_1D ? height : 1u, desc.type == TextureType::TEXTURE_3D ? depth : 1u, 1u });
+      mip_levels = (uint32_t)std::floor(std::log2(max_extent)) + 1;
+    }
 
     glBindTexture(target, 0);
   }
@@ -65,60 +316,457 @@ namespace gfx {
     glDeleteTextures(1, &id);
   }
 
-  void GLShader::create(const ShaderDesc& desc) {
-    // create shaders + compile
-    GLuint vs = glCreateShader(GL_VERTEX_SHADER);
-    glShaderSource(vs, 1, &desc.vertex_src, NULL);
-    glCompileShader(vs);
+  void GLTexture::upload(const TextureRegion& region, uint32_t mip, const void* pixels) const {
+    switch (type) {
+      using enum TextureType;
+      case TEXTURE_1D: {
+        glTexSubImage1D(target, mip, region.x, region.width, format, pixel_type, pixels);
+      }
+      break;
+      case TEXTURE_2D: {
+        glTexSubImage2D(target, mip, region.x, region.y, region.width, region.height, format, pixel_type, pixels);
+      }
+      break;
+      case TEXTURE_3D: {
+        glTexSubImage3D(target, mip, region.x, region.y, region.z, region.width, region.height, region.depth, format, pixel_type, pixels);
+      }
+      break;
+    }
+  }
+
+  // bump when the layout of the cache files changes
+  constexpr uint32_t PROGRAM_CACHE_VERSION = 1;
+  constexpr uint32_t PROGRAM_CACHE_MAGIC = 0x4d504243; // MPBC
+
+  struct GLProgramCacheHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t key;
+    GLenum format;
+    uint32_t length;
+  };
+
+  static uint64_t hash_string(uint64_t hash, const char* str) {
+    for (; str && *str; ++str) {
+      hash = (hash ^ (uint8_t)*str) * 1099511628211ull;
+    }
+    // separator so ("ab", "c") and ("a", "bc") differ
+    return (hash ^ 0xff) * 1099511628211ull;
+  }
+
+  void GLProgramCache::init(const std::string& dir) {
+    directory = dir;
+    enabled = false;
+    if (directory.empty() || !GLAD_GL_VERSION_4_1)
+      return;
 
+    GLint num_formats = 0;
+    glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &num_formats);
+    if (num_formats == 0)
+      return;
+
+    std::error_code error;
+    std::filesystem::create_directories(directory, error);
+    if (error) {
+      std::cout << "Can't create the shader cache directory " << directory << ": " << error.message() << std::endl;
+      return;
+    }
+
+    // the binaries are only valid for the driver that produced them
+    uint64_t hash = 14695981039346656037ull ^ PROGRAM_CACHE_VERSION;
+    hash = hash_string(hash, (const char*)glGetString(GL_VENDOR));
+    hash = hash_string(hash, (const char*)glGetString(GL_RENDERER));
+    hash = hash_string(hash, (const char*)glGetString(GL_VERSION));
+    driver_hash = hash;
+    enabled = true;
+  }
+
+  static uint64_t hash_bytes(uint64_t hash, const void* data, size_t size) {
+    const uint8_t* bytes = (const uint8_t*)data;
+    for (size_t i = 0; i < size; i++) {
+      hash = (hash ^ bytes[i]) * 1099511628211ull;
+    }
+    return (hash ^ size) * 1099511628211ull;
+  }
+
+  uint64_t GLProgramCache::make_key(const ShaderDesc& desc) const {
+    // the sources are ignored when the modules are used, a binary only shader has none
+    if (use_spirv(desc)) {
+      uint64_t hash = hash_string(driver_hash, "spirv");
+      hash = hash_bytes(hash, desc.vertex_binary.gl_spirv, desc.vertex_binary.gl_spirv_size);
+      hash = hash_bytes(hash, desc.fragment_binary.gl_spirv, desc.fragment_binary.gl_spirv_size);
+      return hash_string(hash, SPIRV_ENTRY_POINT);
+    }
+    uint64_t hash = hash_string(driver_hash, desc.vertex_src);
+    return hash_string(hash, desc.fragment_src);
+  }
+
+  static std::filesystem::path get_program_cache_path(const std::string& directory, uint64_t key) {
+    char name[32];
+    snprintf(name, sizeof(name), "%016llx.bin", (unsigned long long)key);
+    return std::filesystem::path(directory) / name;
+  }
+
+  GLuint GLProgramCache::load(uint64_t key) const {
+    if (!enabled)
+      return 0;
+
+    std::ifstream file(get_program_cache_path(directory, key), std::ios::binary);
+    if (!file)
+      return 0;
+
+    GLProgramCacheHeader header;
+    if (!file.read((char*)&header, sizeof(header)) ||
+      header.magic != PROGRAM_CACHE_MAGIC || header.version != PROGRAM_CACHE_VERSION || header.key != key) {
+      return 0;
+    }
+    std::vector<char> binary(header.length);
+    if (!file.read(binary.data(), binary.size()))
+      return 0;
+
+    GLuint program = glCreateProgram();
+    glProgramBinary(program, header.format, binary.data(), (GLsizei)binary.size());
+    GLint success = 0;
+    glGetProgramiv(program, GL_LINK_STATUS, &success);
+    if (!success) {
+      // stale binary, compiled again and replaced by the caller
+      glDeleteProgram(program);
+      return 0;
+    }
+    return program;
+  }
+
+  void GLProgramCache::store(uint64_t key, GLuint program) const {
+    if (!enabled)
+      return;
+
+    GLint length = 0;
+    glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+    if (length <= 0)
+      return;
+
+    GLProgramCacheHeader header{
+      .magic = PROGRAM_CACHE_MAGIC,
+      .version = PROGRAM_CACHE_VERSION,
+      .key = key,
+      .format = 0,
+      .length = 0,
+    };
+    std::vector<char> binary(length);
+    glGetProgramBinary(program, length, &length, &header.format, binary.data());
+    header.length = (uint32_t)length;
+
+    // written next to the final file then renamed so a crash never leaves a truncated binary
+    std::filesystem::path path = get_program_cache_path(directory, key);
+    std::filesystem::path tmp_path = path;
+    tmp_path += ".tmp";
+    {
+      std::ofstream file(tmp_path, std::ios::binary | std::ios::trunc);
+      if (!file.write((const char*)&header, sizeof(header)) || !file.write(binary.data(), header.length)) {
+        std::cout << "Can't write the shader cache file " << tmp_path.string() << std::endl;
+        return;
+      }
+    }
+    std::error_code error;
+    std::filesystem::rename(tmp_path, path, error);
+  }
+
+  void GLProgramBuild::begin(const ShaderDesc& desc, bool retrievable) {
+    if (use_spirv(desc)) {
+      // no GLSL parsing, the driver only specializes the modules compiled at build time
+      vs = create_spirv_shader(GL_VERTEX_SHADER, desc.vertex_binary);
+      fs = create_spirv_shader(GL_FRAGMENT_SHADER, desc.fragment_binary);
+    } else {
+      // create shaders + compile
+      vs = glCreateShader(GL_VERTEX_SHADER);
+      glShaderSource(vs, 1, &desc.vertex_src, NULL);
+      glCompileShader(vs);
+
+      fs = glCreateShader(GL_FRAGMENT_SHADER);
+      glShaderSource(fs, 1, &desc.fragment_src, NULL);
+      glCompileShader(fs);
+    }
+
+    // create program + attach and link
+    // the status is only checked in end() so the driver can compile in the background
+    program = glCreateProgram();
+    if (retrievable)
+      glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+    glAttachShader(program, vs);
+    glAttachShader(program, fs);
+    glLinkProgram(program);
+  }
+
+  bool GLProgramBuild::is_complete() const {
+    GLint complete = GL_FALSE;
+    glGetProgramiv(program, GL_COMPLETION_STATUS_KHR, &complete);
+    return complete == GL_TRUE;
+  }
+
+  GLuint GLProgramBuild::end() {
     int  success;
     char infoLog[512];
+    bool linked = true;
+
     glGetShaderiv(vs, GL_COMPILE_STATUS, &success);
     if (!success) {
       glGetShaderInfoLog(vs, 512, NULL, infoLog);
       std::cout << "ERROR::SHADER::VERTEX::COMPILATION_FAILED\n" << infoLog << std::endl;
-      glDeleteShader(vs);
-      return;
+      linked = false;
     }
 
-    GLuint fs = glCreateShader(GL_FRAGMENT_SHADER);
-    glShaderSource(fs, 1, &desc.fragment_src, NULL);
-    glCompileShader(fs);
-
     glGetShaderiv(fs, GL_COMPILE_STATUS, &success);
     if (!success) {
       glGetShaderInfoLog(fs, 512, NULL, infoLog);
       std::cout << "ERROR::SHADER::FRAGMENT::COMPILATION_FAILED\n" << infoLog << std::endl;
-      glDeleteShader(fs);
-      glDeleteShader(fs);
-      return;
+      linked = false;
     }
 
-    // create program + attach and link
-    id = glCreateProgram();
-    glAttachShader(id, vs);
-    glAttachShader(id, fs);
-    glLinkProgram(id);
-
-    glGetProgramiv(id, GL_LINK_STATUS, &success);
-    if (!success) {
-      glGetProgramInfoLog(id, 512, NULL, infoLog);
-      std::cout << "ERROR::SHADER::LINK_FAILED\n" << infoLog << std::endl;
-      glDeleteShader(fs);
-      glDeleteShader(fs);
-      glDeleteProgram(id);
-      return;
+    if (linked) {
+      glGetProgramiv(program, GL_LINK_STATUS, &success);
+      if (!success) {
+        glGetProgramInfoLog(program, 512, NULL, infoLog);
+        std::cout << "ERROR::SHADER::LINK_FAILED\n" << infoLog << std::endl;
+        linked = false;
+      }
     }
 
     // delete shaders as they are already attached to the program and we don't need them anymore
     glDeleteShader(vs);
     glDeleteShader(fs);
+    vs = 0;
+    fs = 0;
+    if (!linked) {
+      glDeleteProgram(program);
+      program = 0;
+    }
+    return program;
+  }
+
+  void GLShaderCompiler::init(SDL_Window* window, const GLProgramCache* cache) {
+    _window = window;
+    _cache = cache;
+    _context = nullptr;
+    _stop = false;
+
+    const char* max_threads_name = nullptr;
+    if (SDL_GL_ExtensionSupported("GL_KHR_parallel_shader_compile"))
+      max_threads_name = "glMaxShaderCompilerThreadsKHR";
+    else if (SDL_GL_ExtensionSupported("GL_ARB_parallel_shader_compile"))
+      max_threads_name = "glMaxShaderCompilerThreadsARB";
+    _parallel = max_threads_name != nullptr;
+
+    if (_parallel) {
+      // let the driver pick its number of compiler threads
+      auto max_threads = (MaxShaderCompilerThreadsProc)SDL_GL_GetProcAddress(max_threads_name);
+      if (max_threads)
+        max_threads(0xFFFFFFFF);
+    }
+  }
+
+  void GLShaderCompiler::shutdown() {
+    if (_thread.joinable()) {
+      {
+        std::lock_guard lock(_mutex);
+        _stop = true;
+      }
+      _wake.notify_one();
+      _thread.join();
+    }
+    _jobs.clear();
+    if (_context) {
+      SDL_GL_DeleteContext(_context);
+      _context = nullptr;
+    }
+  }
+
+  void GLShaderCompiler::compile(const std::shared_ptr<GLShaderJob>& job) {
+    job->done = false;
+    job->cancelled = false;
+
+    if (_parallel) {
+      job->build.begin(job->desc, _cache->enabled);
+      return;
+    }
+
+    if (!_thread.joinable() && !start_worker()) {
+      // no worker thread: compiles right away
+      job->build.begin(job->desc, _cache->enabled);
+      if (job->build.end())
+        _cache->store(job->cache_key, job->build.program);
+      job->done = true;
+      return;
+    }
+
+    {
+      std::lock_guard lock(_mutex);
+      _jobs.push_back(job);
+    }
+    _wake.notify_one();
+  }
+
+  bool GLShaderCompiler::is_done(GLShaderJob& job) {
+    if (_parallel) {
+      if (!job.done && job.build.is_complete()) {
+        if (job.build.end())
+          _cache->store(job.cache_key, job.build.program);
+        job.done = true;
+      }
+      return job.done;
+    }
 
-    int uniform_idx = 0;
+    std::lock_guard lock(_mutex);
+    return job.done;
+  }
+
+  void GLShaderCompiler::cancel(GLShaderJob& job) {
+    if (_parallel || _context == nullptr) {
+      glDeleteShader(job.build.vs);
+      glDeleteShader(job.build.fs);
+      glDeleteProgram(job.build.program);
+      return;
+    }
+
+    std::lock_guard lock(_mutex);
+    if (job.done)
+      glDeleteProgram(job.build.program);
+    else
+      job.cancelled = true;
+  }
+
+  bool GLShaderCompiler::start_worker() {
+    // the worker context shares its objects with the render context, creating it makes it current
+    SDL_GLContext render_context = SDL_GL_GetCurrentContext();
+    SDL_GL_SetAttribute(SDL_GL_SHARE_WITH_CURRENT_CONTEXT, 1);
+    _context = SDL_GL_CreateContext(_window);
+    SDL_GL_SetAttribute(SDL_GL_SHARE_WITH_CURRENT_CONTEXT, 0);
+    SDL_GL_MakeCurrent(_window, render_context);
+
+    if (!_context) {
+      std::cout << "Can't create the shader compiler context: " << SDL_GetError() << std::endl;
+      return false;
+    }
+    _thread = std::thread(&GLShaderCompiler::run_worker, this);
+    return true;
+  }
+
+  void GLShaderCompiler::run_worker() {
+    PROFILE_THREAD_NAME("shader compiler");
+    SDL_GL_MakeCurrent(_window, _context);
+
+    std::unique_lock lock(_mutex);
+    while (true) {
+      _wake.wait(lock, [this] { return _stop || !_jobs.empty(); });
+      if (_stop)
+        break;
+
+      std::shared_ptr<GLShaderJob> job = std::move(_jobs.front());
+      _jobs.pop_front();
+      if (job->cancelled)
+        continue;
+      lock.unlock();
+
+      GLuint program = 0;
+      {
+        PROFILE_ZONE("GLShaderCompiler::compile");
+        job->build.begin(job->desc, _cache->enabled);
+        program = job->build.end();
+        if (program)
+          _cache->store(job->cache_key, program);
+        // the render context can only use the program once this context is done with it
+        glFinish();
+      }
+
+      lock.lock();
+      if (job->cancelled) {
+        glDeleteProgram(program);
+        job->build.program = 0;
+      }
+      job->done = true;
+    }
+
+    SDL_GL_MakeCurrent(_window, nullptr);
+  }
+
+  void GLShader::create(const ShaderDesc& desc, const GLProgramCache& cache, GLShaderCompiler& compiler) {
+    if (!use_spirv(desc) && (!desc.vertex_src || !desc.fragment_src)) {
+      std::cout << "ERROR::SHADER::NO_SOURCES\nthe shader has no GLSL sources and the context can't use its SPIR-V modules" << std::endl;
+      id = 0;
+      spirv = false;
+      ready = false;
+      return;
+    }
+
+    uint64_t key = cache.enabled ? cache.make_key(desc) : 0;
+    // a cached program is ready right away, even for async shaders
+    id = cache.load(key);
+    ready = false;
+    spirv = use_spirv(desc);
+
+    if (!id && desc.async) {
+      job = std::make_shared<GLShaderJob>();
+      job->desc = desc;
+      // binary only shaders have no sources
+      if (desc.vertex_src) {
+        job->vertex_src = desc.vertex_src;
+        job->desc.vertex_src = job->vertex_src.c_str();
+      }
+      if (desc.fragment_src) {
+        job->fragment_src = desc.fragment_src;
+        job->desc.fragment_src = job->fragment_src.c_str();
+      }
+      auto copy_spirv = [](std::vector<uint32_t>& copy, ShaderBinary& binary) {
+        if (!binary.gl_spirv)
+          return;
+        copy.assign(binary.gl_spirv, binary.gl_spirv + binary.gl_spirv_size / sizeof(uint32_t));
+        binary.gl_spirv = copy.data();
+      };
+      copy_spirv(job->vertex_spirv, job->desc.vertex_binary);
+      copy_spirv(job->fragment_spirv, job->desc.fragment_binary);
+      job->cache_key = key;
+      compiler.compile(job);
+      return;
+    }
+
+    if (!id) {
+      GLProgramBuild build;
+      build.begin(desc, cache.enabled);
+      id = build.end();
+      if (!id)
+        return;
+      cache.store(key, id);
+    }
+
+    reflect(desc);
+    ready = true;
+  }
+
+  bool GLShader::update(GLShaderCompiler& compiler) {
+    if (!job)
+      return true;
+    if (!compiler.is_done(*job))
+      return false;
+
+    id = job->build.program;
+    if (id) {
+      reflect(job->desc);
+      ready = true;
+    }
+    job.reset();
+    return true;
+  }
+
+  void GLShader::reflect(const ShaderDesc& desc) {
+    if (desc.uniforms_layout.uniforms.size() > MAX_UNIFORMS) {
+      std::cout << "ERROR::SHADER::TOO_MANY_UNIFORMS\n" << desc.uniforms_layout.uniforms.size() << " > " << (int)MAX_UNIFORMS << std::endl;
+      return;
+    }
+
+    uniforms_layout.num_uniforms = 0;
     uint16_t offset = 0;
     for (const UniformDesc& uniform_desc : desc.uniforms_layout.uniforms) {
       GLint loc = glGetUniformLocation(id, uniform_desc.name.c_str());
-      uniforms_layout.uniforms[uniform_idx++] = GLUniform{
+      uniforms_layout.uniforms[uniforms_layout.num_uniforms++] = GLUniform{
         .loc = loc,
         .type = uniform_desc.type,
         .offset = offset,
@@ -126,13 +774,123 @@ namespace gfx {
       offset += get_gl_uniform_type_size(uniform_desc.type);
     }
 
+    if (spirv) {
+      // the texture units are given by the bindings declared in the shader
+      init_spirv_uniform_block();
+      shader_textures.assign(desc.texture_names.size(), GLShaderTexture{ -1 });
+      return;
+    }
+
+    init_uniform_block(desc);
+
+    // samplers are assigned to fixed texture units once, bindings only bind the textures
+    glUseProgram(id);
     shader_textures.reserve(desc.texture_names.size());
     for (const std::string& texture_name : desc.texture_names) {
-      shader_textures.push_back({
-          glGetUniformLocation(id, texture_name.c_str())
-        }
-      );
+      GLint loc = glGetUniformLocation(id, texture_name.c_str());
+      glUniform1i(loc, (GLint)shader_textures.size());
+      shader_textures.push_back({ loc });
+    }
+    glUseProgram(0);
+  }
+
+  void GLShader::init_uniform_block(const ShaderDesc& desc) {
+    uniforms_layout.use_block = false;
+    uniforms_layout.block_size = 0;
+
+    uint8_t nb_uniforms = uniforms_layout.num_uniforms;
+    if (nb_uniforms == 0)
+      return;
+
+    std::array<const char*, MAX_UNIFORMS> names;
+    for (uint8_t i = 0; i < nb_uniforms; ++i) {
+      names[i] = desc.uniforms_layout.uniforms[i].name.c_str();
+    }
+
+    std::array<GLuint, MAX_UNIFORMS> indices;
+    glGetUniformIndices(id, nb_uniforms, names.data(), indices.data());
+    for (uint8_t i = 0; i < nb_uniforms; ++i) {
+      // uniforms outside of a block can be optimized out, block members can't
+      if (indices[i] == GL_INVALID_INDEX)
+        return;
+    }
+
+    std::array<GLint, MAX_UNIFORMS> block_indices;
+    std::array<GLint, MAX_UNIFORMS> gl_offsets;
+    glGetActiveUniformsiv(id, nb_uniforms, indices.data(), GL_UNIFORM_BLOCK_INDEX, block_indices.data());
+    glGetActiveUniformsiv(id, nb_uniforms, indices.data(), GL_UNIFORM_OFFSET, gl_offsets.data());
+
+    GLint block_index = block_indices[0];
+    if (block_index < 0)
+      return;
+
+    for (uint8_t i = 0; i < nb_uniforms; ++i) {
+      if (block_indices[i] != block_index) {
+        std::cout << "ERROR::SHADER::UNIFORM_BLOCK::ALL_UNIFORMS_MUST_BE_IN_THE_SAME_BLOCK\n" << names[i] << std::endl;
+        return;
+      }
+    }
+
+    // std140 validation: the memory layout given to set_uniforms is copied as is in the block
+    bool valid = true;
+    uint16_t std140_offset = 0;
+    for (uint8_t i = 0; i < nb_uniforms; ++i) {
+      const GLUniform& uniform = uniforms_layout.uniforms[i];
+      uint16_t alignment = get_std140_alignment(uniform.type);
+      std140_offset = (std140_offset + alignment - 1) / alignment * alignment;
+
+      if (gl_offsets[i] != std140_offset) {
+        std::cout << "ERROR::SHADER::UNIFORM_BLOCK::NOT_STD140\n" << names[i]
+          << " is at offset " << gl_offsets[i] << " in the block, std140 expects " << std140_offset
+          << ". Declare the block with layout(std140)" << std::endl;
+        valid = false;
+      } else if (uniform.offset != std140_offset) {
+        std::cout << "ERROR::SHADER::UNIFORM_BLOCK::STD140_MISMATCH\n" << names[i]
+          << " is at offset " << uniform.offset << " in the uniforms memory, std140 expects " << std140_offset
+          << ". Add padding to the uniforms struct" << std::endl;
+        valid = false;
+      }
+
+      std140_offset += get_std140_size(uniform.type);
+    }
+
+    if (!valid)
+      return;
+
+    GLint block_size = 0;
+    glGetActiveUniformBlockiv(id, block_index, GL_UNIFORM_BLOCK_DATA_SIZE, &block_size);
+    glUniformBlockBinding(id, block_index, UNIFORM_BLOCK_BINDING);
+
+    uniforms_layout.use_block = true;
+    uniforms_layout.block_size = block_size;
+  }
+
+  void GLShader::init_spirv_uniform_block() {
+    uniforms_layout.use_block = false;
+    uniforms_layout.block_size = 0;
+
+    if (uniforms_layout.num_uniforms == 0)
+      return;
+
+    // SPIR-V programs have no names to validate the block members, the block is only checked to be bound at the right place
+    GLint num_blocks = 0;
+    glGetProgramInterfaceiv(id, GL_UNIFORM_BLOCK, GL_ACTIVE_RESOURCES, &num_blocks);
+    if (num_blocks != 1) {
+      std::cout << "ERROR::SHADER::SPIRV::UNIFORMS_MUST_BE_IN_ONE_BLOCK\n" << num_blocks << " uniform blocks" << std::endl;
+      return;
+    }
+
+    const GLenum props[] = { GL_BUFFER_BINDING, GL_BUFFER_DATA_SIZE };
+    GLint values[2] = {};
+    glGetProgramResourceiv(id, GL_UNIFORM_BLOCK, 0, 2, props, 2, NULL, values);
+    if (values[0] != (GLint)UNIFORM_BLOCK_BINDING) {
+      std::cout << "ERROR::SHADER::SPIRV::UNIFORM_BLOCK_BINDING\n" << "Declare the block with layout(std140, binding = "
+        << UNIFORM_BLOCK_BINDING << ")" << std::endl;
+      return;
     }
+
+    uniforms_layout.use_block = true;
+    uniforms_layout.block_size = values[1];
   }
 
   void GLShader::destroy() {
@@ -168,15 +926,12 @@ namespace gfx {
   }
 
   void GLRenderer::init(const InitInfo& info) {
+    PROFILE_ZONE("GLRenderer::init");
     if (!gladLoadGLLoader((GLADloadproc)SDL_GL_GetProcAddress)) {
       std::cout << "Failed to initialize GLAD" << std::endl;
       return;
     }
 
-    // global vao creation
-    glGenVertexArrays(1, &_state.global_vao);
-    glBindVertexArray(_state.global_vao);
-
     // get the default framebuffer binding
     glGetIntegerv(GL_FRAMEBUFFER_BINDING, (GLint*)&_state.default_framebuffer);
 
@@ -186,20 +941,79 @@ namespace gfx {
     glPixelStorei(GL_PACK_ALIGNMENT, 1);
     glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
 
+    GLint uniform_alignment = 0;
+    glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &uniform_alignment);
+    _uniform_ring.create(UNIFORM_RING_FRAME_SIZE, uniform_alignment);
+    _texture_upload_ring.create(TEXTURE_UPLOAD_RING_FRAME_SIZE, STREAM_BUFFER_ALIGNMENT);
+    _frame_fences.fill(nullptr);
+    _frame_index = 0;
+    _pass_timer.create();
+
+    _max_anisotropy = 1.0f;
+    s_anisotropic_filtering = GLAD_GL_VERSION_4_6 ||
+      SDL_GL_ExtensionSupported("GL_ARB_texture_filter_anisotropic") || SDL_GL_ExtensionSupported("GL_EXT_texture_filter_anisotropic");
+    if (s_anisotropic_filtering)
+      glGetFloatv(GL_MAX_TEXTURE_MAX_ANISOTROPY, &_max_anisotropy);
+
+    // the extension shares the entry points of the core version, glad only loads them for GL 4.3
+    s_multi_draw_indirect = GLAD_GL_VERSION_4_3;
+    if (!s_multi_draw_indirect && SDL_GL_ExtensionSupported("GL_ARB_multi_draw_indirect")) {
+      glad_glMultiDrawArraysIndirect = (PFNGLMULTIDRAWARRAYSINDIRECTPROC)SDL_GL_GetProcAddress("glMultiDrawArraysIndirect");
+      glad_glMultiDrawElementsIndirect = (PFNGLMULTIDRAWELEMENTSINDIRECTPROC)SDL_GL_GetProcAddress("glMultiDrawElementsIndirect");
+      s_multi_draw_indirect = glad_glMultiDrawArraysIndirect && glad_glMultiDrawElementsIndirect;
+    }
+
+    // SPIR-V shaders are core in GL 4.6
+    s_specialize_shader = nullptr;
+    if (GLAD_GL_VERSION_4_6)
+      s_specialize_shader = glSpecializeShader;
+    else if (SDL_GL_ExtensionSupported("GL_ARB_gl_spirv"))
+      s_specialize_shader = (PFNGLSPECIALIZESHADERPROC)SDL_GL_GetProcAddress("glSpecializeShaderARB");
+
+    _program_cache.init(info.shader_cache_dir);
+    _shader_compiler.init(info.window, &_program_cache);
+
     //glEnable(GL_BLEND);
     //glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
   }
 
   void GLRenderer::shutdown() {
-    // destroys the global VAO
-    glDeleteVertexArrays(1, &_state.global_vao);
+    PROFILE_ZONE("GLRenderer::shutdown");
+    _shader_compiler.shutdown();
+    _pending_shaders.clear();
+
+    for (GLsync& fence : _frame_fences) {
+      if (fence) {
+        glDeleteSync(fence);
+        fence = nullptr;
+      }
+    }
+    _uniform_ring.destroy();
+    _texture_upload_ring.destroy();
+    _pass_timer.destroy();
+
+    // destroys the cached vertex arrays
+    _state.bind_vertex_array(0, 0);
+    for (auto& [key, vao] : _vertex_arrays) {
+      glDeleteVertexArrays(1, &vao.id);
+    }
+    _vertex_arrays.clear();
+    _vertex_layouts.clear();
+
+    for (auto& [desc, sampler_id] : _sampler_cache) {
+      glDeleteSamplers(1, &sampler_id);
+    }
+    _sampler_cache.clear();
   }
 
   void GLRenderer::begin_render_pass(std::optional<RenderPass> pass, const PassAction& action) {
+    PROFILE_ZONE("GLRenderer::begin_render_pass");
     if (!pass) {
+      _pass_timer.begin_pass(DEFAULT_PASS_NAME);
       glBindFramebuffer(GL_FRAMEBUFFER, _state.default_framebuffer);
     } else {
-      const GLRenderPass& rpass = _render_passes[pass.value()];
+      const GLRenderPass& rpass = _render_passes[handle_index(pass.value())];
+      _pass_timer.begin_pass(rpass.name.c_str());
       glBindFramebuffer(GL_FRAMEBUFFER, rpass.fb_id);
       // enables MRT
       glDrawBuffers((GLsizei)rpass.attachments.color_atts.size(), rpass.attachments.color_atts.data());
@@ -221,11 +1035,22 @@ namespace gfx {
   }
 
   void GLRenderer::end_render_pass() {
+    PROFILE_ZONE("GLRenderer::end_render_pass");
     glBindFramebuffer(GL_FRAMEBUFFER, _state.default_framebuffer);
+    _pass_timer.end_pass();
   }
 
   void GLRenderer::set_pipeline(Pipeline pipe) {
-    _state.current_pip = &_pipelines[pipe];
+    PROFILE_ZONE("GLRenderer::set_pipeline");
+    GLPipeline* pip = &_pipelines[handle_index(pipe)];
+    // draws with the fallback while the shader compiles, the draws are skipped without fallback
+    if (!pip->shader->ready) {
+      GLPipeline* fallback = pip->fallback != INVALID_HANDLE ? &_pipelines[handle_index(pip->fallback)] : nullptr;
+      pip = fallback && fallback->shader && fallback->shader->ready ? fallback : nullptr;
+    }
+    _state.current_pip = pip;
+    if (!pip)
+      return;
 
     glUseProgram(_state.current_pip->shader->id);
 
@@ -239,20 +1064,48 @@ namespace gfx {
   }
 
   void GLRenderer::set_bindings(Bindings bind) {
+    PROFILE_ZONE("GLRenderer::set_bindings");
     const GLPipeline* pip = _state.current_pip;
+    if (!pip)
+      return;
     const GLShader* shader = pip->shader;
 
+    GLuint index_buffer_id = 0;
     if (bind.index_buffer.has_value()) {
-      GLBuffer& index_buffer = _buffers[bind.index_buffer.value()];
-      _state.bind_buffer(GL_ELEMENT_ARRAY_BUFFER, index_buffer.id);
+      const GLBuffer& index_buffer = _buffers[handle_index(bind.index_buffer.value())];
+      index_buffer_id = index_buffer.id;
+      _state.index_base = index_buffer.base_offset();
+      _state.index_offset = _state.index_base + bind.index_buffer_offset;
     }
-    
-    GLBuffer& vertex_buffer = _buffers[bind.vertex_buffer];
-    _state.bind_buffer(GL_ARRAY_BUFFER, vertex_buffer.id);
-    for (int i = 0; i < MAX_ATTRIBUTES; i++) {
-      const GLVertexAttribute& attr = pip->attributes[i];
-      glVertexAttribPointer(i, attr.size, attr.type, GL_FALSE, (GLsizei)attr.stride, (const GLvoid*)attr.offset);
-      glEnableVertexAttribArray(i);
+
+    if (pip->use_instance_buffer && !bind.instance_buffer.has_value()) {
+      std::cout << "Pipeline has per-instance attributes but the bindings have no instance buffer" << std::endl;
+      return;
+    }
+
+    const GLBuffer& vertex_buffer = _buffers[handle_index(bind.vertex_buffer)];
+    GLintptr vertex_offset = vertex_buffer.base_offset() + bind.vertex_buffer_offset;
+    GLuint instance_buffer_id = 0;
+    GLintptr instance_offset = 0;
+    if (pip->use_instance_buffer) {
+      const GLBuffer& instance_buffer = _buffers[handle_index(bind.instance_buffer.value())];
+      instance_buffer_id = instance_buffer.id;
+      instance_offset = instance_buffer.base_offset() + bind.instance_buffer_offset;
+    }
+
+    GLVertexArray& vao = get_vertex_array(*pip, vertex_buffer.id, instance_buffer_id, index_buffer_id);
+    _state.bind_vertex_array(vao.id, index_buffer_id);
+
+    // only streamed or appended data moves the attributes
+    if (vao.vertex_offset != vertex_offset || vao.instance_offset != instance_offset) {
+      for (uint32_t i = 0; i < pip->num_attributes; i++) {
+        const GLVertexAttribute& attr = pip->attributes[i];
+        GLintptr offset = attr.divisor > 0 ? instance_offset : vertex_offset;
+        _state.bind_buffer(GL_ARRAY_BUFFER, attr.divisor > 0 ? instance_buffer_id : vertex_buffer.id);
+        glVertexAttribPointer(attr.index, attr.size, attr.type, GL_FALSE, (GLsizei)attr.stride, (const GLvoid*)(attr.offset + offset));
+      }
+      vao.vertex_offset = vertex_offset;
+      vao.instance_offset = instance_offset;
     }
 
     if (bind.textures.size() > shader->shader_textures.size()) {
@@ -260,20 +1113,38 @@ namespace gfx {
       return;
     }
 
-    int texture_idx = 0;
-    for (Texture tex : bind.textures) {
-      const GLTexture& gl_texture = _textures[tex];
-      glActiveTexture(GL_TEXTURE0 + texture_idx);
-      glBindTexture(gl_texture.target, gl_texture.id);
-      glUniform1i(shader->shader_textures[texture_idx].uniform_loc, texture_idx);
+    uint8_t texture_idx = 0;
+    for (const TextureBinding& tex : bind.textures) {
+      const GLTexture& gl_texture = _textures[handle_index(tex.texture)];
+      _state.bind_texture(texture_idx, gl_texture.target, gl_texture.id);
+      GLuint sampler_id = tex.sampler != INVALID_HANDLE ? _samplers[handle_index(tex.sampler)].id : 0;
+      _state.bind_sampler(texture_idx, sampler_id);
       ++texture_idx;
     }
   }
 
   void GLRenderer::set_uniforms(const Memory& mem) {
+    PROFILE_ZONE("GLRenderer::set_uniforms");
+     if (!_state.current_pip)
+       return;
      const GLUniformBlockLayout& uniform_layout = _state.current_pip->shader->uniforms_layout;
 
-     for (const GLUniform& gl_uniform : uniform_layout.uniforms) {
+     if (uniform_layout.use_block) {
+       // one copy and one bind for the whole block
+       uint32_t reserve_size = std::max((uint32_t)mem.size, (uint32_t)uniform_layout.block_size);
+       std::optional<GLintptr> offset = _uniform_ring.push(mem.data, (uint32_t)mem.size, reserve_size);
+       if (!offset) {
+         std::cout << "Uniform ring is full, increase UNIFORM_RING_FRAME_SIZE" << std::endl;
+         return;
+       }
+       glBindBufferRange(GL_UNIFORM_BUFFER, UNIFORM_BLOCK_BINDING, _uniform_ring.id, offset.value(), uniform_layout.block_size);
+       return;
+     }
+
+     for (uint8_t i = 0; i < uniform_layout.num_uniforms; ++i) {
+       const GLUniform& gl_uniform = uniform_layout.uniforms[i];
+       if (gl_uniform.loc < 0)
+         continue;
        GLfloat* float_ptr = (GLfloat*)((uint8_t*)mem.data + gl_uniform.offset);
        switch (gl_uniform.type) {
          using enum UniformType;
@@ -309,60 +1180,253 @@ namespace gfx {
      }
   }
 
-  void GLRenderer::draw(uint32_t first_element, uint32_t num_elements, uint32_t num_instances) {
+  void GLRenderer::draw(uint32_t first_element, uint32_t num_elements, uint32_t num_instances, int32_t base_vertex) {
+    PROFILE_ZONE("GLRenderer::draw");
+    if (!_state.current_pip)
+      return;
+
     GLenum primitive = _state.current_pip->primitive_type;
     GLenum i_type = _state.current_pip->index_type;
 
-    if (num_instances > 0) {
-      if (i_type == GL_NONE) {
-        glDrawArrays(primitive, first_element, num_elements);
+    if (num_instances == 0)
+      return;
+
+    if (i_type == GL_NONE) {
+      glDrawArraysInstanced(primitive, first_element, num_elements, num_instances);
+    } else {
+      GLintptr offset = _state.index_offset + (GLintptr)first_element * _state.current_pip->index_size;
+      glDrawElementsInstancedBaseVertex(primitive, num_elements, i_type, (const GLvoid*)offset, num_instances, base_vertex);
+    }
+  }
+
+  void GLRenderer::multi_draw_indirect(Buffer h, uint32_t offset, uint32_t draw_count, uint32_t stride) {
+    PROFILE_ZONE("GLRenderer::multi_draw_indirect");
+    const GLPipeline* pip = _state.current_pip;
+    if (!pip)
+      return;
+    const GLBuffer& args = _buffers[handle_index(h)];
+    GLintptr args_offset = args.base_offset() + offset;
+    bool indexed = pip->index_type != GL_NONE;
+    if (draw_count == 0)
+      return;
+
+    uint32_t args_size = indexed ? sizeof(DrawIndexedIndirectArgs) : sizeof(DrawIndirectArgs);
+    if (stride == 0)
+      stride = args_size;
+    if (stride < args_size) {
+      std::cout << "Indirect draw stride " << stride << " is smaller than the arguments" << std::endl;
+      return;
+    }
+    if ((uint64_t)offset + (uint64_t)(draw_count - 1) * stride + args_size > args.size) {
+      std::cout << "Indirect draws read past the end of the arguments buffer" << std::endl;
+      return;
+    }
+
+    if (s_multi_draw_indirect) {
+      // the first elements are relative to the start of the index buffer, it can't be moved without rebinding it
+      if (indexed && _state.index_base != 0) {
+        std::cout << "Indexed indirect draws need an index buffer at offset 0, STREAM index buffers are not supported" << std::endl;
+        return;
+      }
+      _state.bind_buffer(GL_DRAW_INDIRECT_BUFFER, args.id);
+      if (indexed) {
+        glMultiDrawElementsIndirect(pip->primitive_type, pip->index_type, (const GLvoid*)args_offset, draw_count, stride);
+      } else {
+        glMultiDrawArraysIndirect(pip->primitive_type, (const GLvoid*)args_offset, draw_count, stride);
+      }
+      return;
+    }
+
+    // no multi draw indirect: one draw per arguments read from the CPU copy of the buffer
+    if (args.shadow.empty()) {
+      std::cout << "Indirect draws need a buffer created as INDIRECT_BUFFER" << std::endl;
+      return;
+    }
+
+    for (uint32_t i = 0; i < draw_count; i++) {
+      const uint8_t* cmd = args.shadow.data() + args_offset + (size_t)i * stride;
+      if (indexed) {
+        DrawIndexedIndirectArgs draw;
+        std::memcpy(&draw, cmd, sizeof(draw));
+        if (draw.num_instances == 0)
+          continue;
+        // Bindings::index_buffer_offset is ignored like by the native draws, the frame data of STREAM buffers is not
+        const GLvoid* indices = (const GLvoid*)(_state.index_base + (GLintptr)draw.first_element * pip->index_size);
+        if (GLAD_GL_VERSION_4_2) {
+          glDrawElementsInstancedBaseVertexBaseInstance(pip->primitive_type, draw.num_elements, pip->index_type, indices,
+            draw.num_instances, draw.base_vertex, draw.first_instance);
+        } else if (draw.first_instance == 0) {
+          glDrawElementsInstancedBaseVertex(pip->primitive_type, draw.num_elements, pip->index_type, indices,
+            draw.num_instances, draw.base_vertex);
+        } else {
+          std::cout << "Indirect draws with a first instance need GL 4.2" << std::endl;
+        }
       } else {
-        glDrawElements(primitive, num_elements, i_type, (const GLvoid*)0);
+        DrawIndirectArgs draw;
+        std::memcpy(&draw, cmd, sizeof(draw));
+        if (draw.num_instances == 0)
+          continue;
+        if (GLAD_GL_VERSION_4_2) {
+          glDrawArraysInstancedBaseInstance(pip->primitive_type, draw.first_element, draw.num_elements,
+            draw.num_instances, draw.first_instance);
+        } else if (draw.first_instance == 0) {
+          glDrawArraysInstanced(pip->primitive_type, draw.first_element, draw.num_elements, draw.num_instances);
+        } else {
+          std::cout << "Indirect draws with a first instance need GL 4.2" << std::endl;
+        }
       }
     }
   }
 
   void GLRenderer::set_viewport(const Rect& rect) {
+    PROFILE_ZONE("GLRenderer::set_viewport");
     glViewport(rect.x, rect.y, rect.width, rect.height);
   }
 
   void GLRenderer::set_scissor(const Rect& rect) {
+    PROFILE_ZONE("GLRenderer::set_scissor");
     glScissor(rect.x, rect.y, rect.width, rect.height);
   }
 
   void GLRenderer::submit() {
+    PROFILE_ZONE("GLRenderer::submit");
+    // fence the frame then wait for the GPU to release the segments of the next frame
+    if (_frame_fences[_frame_index])
+      glDeleteSync(_frame_fences[_frame_index]);
+    _frame_fences[_frame_index] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+    _frame_index = (_frame_index + 1) % FRAMES_IN_FLIGHT;
+    GLsync& next_fence = _frame_fences[_frame_index];
+    if (next_fence) {
+      GLenum status;
+      while ((status = glClientWaitSync(next_fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000)) == GL_TIMEOUT_EXPIRED) {
+        std::cout << "Frame fence not signaled after 1s, waiting again" << std::endl;
+      }
+      // the fence is dropped, the frame reuses its segments without waiting
+      if (status == GL_WAIT_FAILED)
+        std::cout << "Frame fence wait failed: " << glGetError() << std::endl;
+      glDeleteSync(next_fence);
+      next_fence = nullptr;
+    }
+    // the frame that used the queries of this slot is done
+    _pass_timer.begin_frame(_frame_index);
+
+    // async shaders linked during this frame are used from the next one
+    std::erase_if(_pending_shaders, [this](Shader h) {
+      return _shaders[handle_index(h)].update(_shader_compiler);
+    });
+
+    _uniform_ring.begin_frame(_frame_index);
+    _texture_upload_ring.begin_frame(_frame_index);
+    for (Buffer h : _stream_buffers) {
+      _buffers[handle_index(h)].begin_frame(_frame_index);
+    }
+
+    // the index buffer is unbound with its vertex array
+    _state.bind_vertex_array(0, 0);
     _state.bind_buffer(GL_ARRAY_BUFFER, 0);
-    _state.bind_buffer(GL_ELEMENT_ARRAY_BUFFER, 0);
 
     for (int i = 0; i < MAX_SHADER_TEXTURES; ++i) {
       CachedTexture& cached_tex = _state.textures[i];
       _state.bind_texture(i, cached_tex.target, 0);
+      _state.bind_sampler(i, 0);
     }
   }
 
   bool GLRenderer::new_buffer(Buffer h, const BufferDesc& desc) {
-    GLBuffer& buffer = _buffers[h];
+    PROFILE_ZONE("GLRenderer::new_buffer");
+    if (desc.usage == BufferUsage::IMMUTABLE && !desc.mem.data) {
+      std::cout << "IMMUTABLE buffers must be created with their data" << std::endl;
+      return false;
+    }
+
+    GLBuffer& buffer = _buffers[handle_index(h)];
     buffer.create(desc);
+    if (buffer.usage != BufferUsage::IMMUTABLE)
+      _stream_buffers.push_back(h);
 
     return true;
   }
 
+  bool GLRenderer::update_buffer(Buffer h, const Memory& mem) {
+    PROFILE_ZONE("GLRenderer::update_buffer");
+    return _buffers[handle_index(h)].update(mem);
+  }
+
+  std::optional<uint32_t> GLRenderer::append_buffer(Buffer h, const Memory& mem) {
+    PROFILE_ZONE("GLRenderer::append_buffer");
+    return _buffers[handle_index(h)].append(mem);
+  }
+
   bool GLRenderer::new_texture(Texture h, const TextureDesc& desc) {
-    GLTexture& texture = _textures[h];
+    PROFILE_ZONE("GLRenderer::new_texture");
+    GLTexture& texture = _textures[handle_index(h)];
     texture.create(desc);
 
     return true;
   }
 
+  bool GLRenderer::update_texture(Texture h, const TextureRegion& region, uint32_t mip, const Memory& mem) {
+    PROFILE_ZONE("GLRenderer::update_texture");
+    const GLTexture& texture = _textures[handle_index(h)];
+    if (mip >= texture.mip_levels) {
+      std::cout << "Texture has no mip level " << mip << std::endl;
+      return false;
+    }
+
+    TextureRegion texels = region;
+    if (texture.type != TextureType::TEXTURE_3D) {
+      texels.z = 0;
+      texels.depth = 1;
+    }
+    if (texture.type == TextureType::TEXTURE_1D) {
+      texels.y = 0;
+      texels.height = 1;
+    }
+
+    uint32_t mip_width = std::max(texture.width >> mip, 1u);
+    uint32_t mip_height = std::max(texture.height >> mip, 1u);
+    uint32_t mip_depth = std::max(texture.depth >> mip, 1u);
+    if (texels.x + texels.width > mip_width || texels.y + texels.height > mip_height || texels.z + texels.depth > mip_depth) {
+      std::cout << "Texture update region is outside of mip level " << mip << std::endl;
+      return false;
+    }
+
+    size_t size = (size_t)texels.width * texels.height * texels.depth * texture.texel_size;
+    if (mem.size < size) {
+      std::cout << "Texture update of " << mem.size << " bytes is smaller than its region of " << size << " bytes" << std::endl;
+      return false;
+    }
+
+    _state.bind_texture(0, texture.target, texture.id);
+
+    // the texels are copied to the upload ring then read by the GPU from there, the call does not wait for the transfer
+    std::optional<GLintptr> offset = _texture_upload_ring.push(mem.data, (uint32_t)size, (uint32_t)size);
+    if (offset) {
+      glBindBuffer(GL_PIXEL_UNPACK_BUFFER, _texture_upload_ring.id);
+      texture.upload(texels, mip, (const GLvoid*)offset.value());
+      glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    } else {
+      // the ring is full for this frame: upload from client memory, the driver may stall
+      texture.upload(texels, mip, mem.data);
+    }
+
+    return true;
+  }
+
   bool GLRenderer::new_shader(Shader h, const ShaderDesc& desc) {
-    GLShader& shader = _shaders[h];
-    shader.create(desc);
+    PROFILE_ZONE("GLRenderer::new_shader");
+    GLShader& shader = _shaders[handle_index(h)];
+    shader.create(desc, _program_cache, _shader_compiler);
+    if (shader.job)
+      _pending_shaders.push_back(h);
 
     return true;
   }
 
   bool GLRenderer::new_render_pass(RenderPass h, const RenderPassDesc& desc) {
-    GLRenderPass& pass = _render_passes[h];
+    PROFILE_ZONE("GLRenderer::new_render_pass");
+    GLRenderPass& pass = _render_passes[handle_index(h)];
 
     std::vector<GLuint> textures_ids;
     std::vector<GLenum> color_atts;
@@ -370,12 +1434,12 @@ namespace gfx {
     color_atts.reserve(desc.colors.size());
     int att_idx = 0;
     for (Texture color_tex : desc.colors) {
-      textures_ids.push_back(_textures[color_tex].id);
+      textures_ids.push_back(_textures[handle_index(color_tex)].id);
       color_atts.push_back(GL_COLOR_ATTACHMENT0 + att_idx++);
     }
     std::optional<GLint> depth_att;
     if (desc.depth.has_value()) {
-      GLuint depth_att = _textures[desc.depth.value()].id;
+      GLuint depth_att = _textures[handle_index(desc.depth.value())].id;
     }
 
     GLFramebufferAttachments attachments{
@@ -385,35 +1449,150 @@ namespace gfx {
     };
 
     pass.create(attachments, _state.default_framebuffer);
+    pass.name = desc.name;
 
     return true;
   }
 
   bool GLRenderer::new_pipeline(Pipeline h, const PipelineDesc& desc) {
-    GLPipeline& pipe = _pipelines[h];
-    pipe.shader = &_shaders[desc.shader];
+    PROFILE_ZONE("GLRenderer::new_pipeline");
+    GLPipeline& pipe = _pipelines[handle_index(h)];
+    pipe.shader_id = desc.shader;
+    pipe.shader = &_shaders[handle_index(desc.shader)];
+    pipe.fallback = desc.fallback;
     pipe.index_type = get_gl_index_type(desc.index_type);
+    pipe.index_size = get_gl_type_size(pipe.index_type);
     pipe.cull_mode = get_gl_cull_mode(desc.cull);
     pipe.primitive_type = get_gl_primitive_type(desc.primitive_type);
 
-    size_t offset = 0;
-    for (int i = 0; i < MAX_ATTRIBUTES; i++) {
+    // per-vertex and per-instance attributes are interleaved in their own buffer
+    size_t vertex_stride = 0;
+    size_t instance_stride = 0;
+    pipe.num_attributes = 0;
+    pipe.use_instance_buffer = false;
+    for (uint32_t i = 0; i < MAX_ATTRIBUTES; i++) {
       const VertexAttribute& attr = desc.layout.attributes[i];
+      if (attr.format == AttributeFormat::NONE)
+        break;
+      bool per_instance = attr.step == VertexStep::PER_INSTANCE;
+      size_t& stride = per_instance ? instance_stride : vertex_stride;
       GLVertexAttribute& gl_attr = pipe.attributes[i];
+      gl_attr.index = i;
       gl_attr.type = get_gl_attribute_type(attr.format);
       gl_attr.size = get_gl_attribute_size(attr.format);
-      gl_attr.offset = offset;
-      offset += get_gl_type_size(gl_attr.type) * gl_attr.size;
+      gl_attr.offset = stride;
+      gl_attr.divisor = per_instance ? std::max(attr.step_rate, 1u) : 0;
+      stride += get_gl_type_size(gl_attr.type) * gl_attr.size;
+      pipe.use_instance_buffer |= per_instance;
+      ++pipe.num_attributes;
     }
 
-    for (int i = 0; i < MAX_ATTRIBUTES; i++) {
-      const VertexAttribute& attr = desc.layout.attributes[i];
+    for (uint32_t i = 0; i < pipe.num_attributes; i++) {
       GLVertexAttribute& gl_attr = pipe.attributes[i];
-      gl_attr.stride = offset;
+      gl_attr.stride = gl_attr.divisor > 0 ? instance_stride : vertex_stride;
+    }
+    pipe.layout_id = intern_vertex_layout(pipe);
+
+    return true;
+  }
+
+  bool GLRenderer::new_sampler(Sampler h, const SamplerDesc& desc) {
+    PROFILE_ZONE("GLRenderer::new_sampler");
+    GLSampler& sampler = _samplers[handle_index(h)];
+
+    auto it = _sampler_cache.find(desc);
+    if (it != _sampler_cache.end()) {
+      sampler.id = it->second;
+      return true;
+    }
+
+    glGenSamplers(1, &sampler.id);
+    glSamplerParameteri(sampler.id, GL_TEXTURE_MIN_FILTER, get_gl_min_filter(desc.min_filter, desc.mip_filter));
+    glSamplerParameteri(sampler.id, GL_TEXTURE_MAG_FILTER, get_gl_mag_filter(desc.mag_filter));
+    glSamplerParameteri(sampler.id, GL_TEXTURE_WRAP_S, get_gl_wrap(desc.wrap_u));
+    glSamplerParameteri(sampler.id, GL_TEXTURE_WRAP_T, get_gl_wrap(desc.wrap_v));
+    glSamplerParameteri(sampler.id, GL_TEXTURE_WRAP_R, get_gl_wrap(desc.wrap_w));
+    if (desc.max_anisotropy > 1 && s_anisotropic_filtering) {
+      GLfloat anisotropy = std::min((GLfloat)desc.max_anisotropy, _max_anisotropy);
+      glSamplerParameterf(sampler.id, GL_TEXTURE_MAX_ANISOTROPY, anisotropy);
     }
+    _sampler_cache.emplace(desc, sampler.id);
 
     return true;
   }
+
+  void GLRenderer::destroy_buffer(Buffer h) {
+    PROFILE_ZONE("GLRenderer::destroy_buffer");
+    GLBuffer& buffer = _buffers[handle_index(h)];
+    destroy_vertex_arrays(buffer.id);
+    if (_state.vertex_buffer == buffer.id)
+      _state.vertex_buffer = 0;
+    if (_state.indirect_buffer == buffer.id)
+      _state.indirect_buffer = 0;
+    if (buffer.usage != BufferUsage::IMMUTABLE)
+      std::erase(_stream_buffers, h);
+
+    buffer.destroy();
+    buffer = {};
+  }
+
+  void GLRenderer::destroy_texture(Texture h) {
+    PROFILE_ZONE("GLRenderer::destroy_texture");
+    GLTexture& texture = _textures[handle_index(h)];
+    // the texture is unbound by the deletion
+    for (CachedTexture& cached_tex : _state.textures) {
+      if (cached_tex.id == texture.id)
+        cached_tex.id = 0;
+    }
+
+    texture.destroy();
+    texture = {};
+  }
+
+  bool GLRenderer::is_shader_ready(Shader h) {
+    PROFILE_ZONE("GLRenderer::is_shader_ready");
+    GLShader& shader = _shaders[handle_index(h)];
+    if (shader.job && shader.update(_shader_compiler))
+      std::erase(_pending_shaders, h);
+    return shader.ready;
+  }
+
+  bool GLRenderer::is_pipeline_ready(Pipeline h) {
+    PROFILE_ZONE("GLRenderer::is_pipeline_ready");
+    return is_shader_ready(_pipelines[handle_index(h)].shader_id);
+  }
+
+  void GLRenderer::destroy_shader(Shader h) {
+    PROFILE_ZONE("GLRenderer::destroy_shader");
+    GLShader& shader = _shaders[handle_index(h)];
+    if (shader.job) {
+      _shader_compiler.cancel(*shader.job);
+      std::erase(_pending_shaders, h);
+    }
+    shader.destroy();
+    shader = {};
+  }
+
+  void GLRenderer::destroy_render_pass(RenderPass h) {
+    PROFILE_ZONE("GLRenderer::destroy_render_pass");
+    GLRenderPass& pass = _render_passes[handle_index(h)];
+    pass.destroy();
+    pass = {};
+  }
+
+  void GLRenderer::destroy_pipeline(Pipeline h) {
+    PROFILE_ZONE("GLRenderer::destroy_pipeline");
+    GLPipeline& pipe = _pipelines[handle_index(h)];
+    if (_state.current_pip == &pipe)
+      _state.current_pip = nullptr;
+    pipe = {};
+  }
+
+  void GLRenderer::destroy_sampler(Sampler h) {
+    PROFILE_ZONE("GLRenderer::destroy_sampler");
+    // the sampler object stays in the cache for the samplers sharing it
+    _samplers[handle_index(h)] = {};
+  }
   void GLRenderer::GLState::bind_buffer(GLenum target, GLuint buffer_id) {
     switch (target) {
       case GL_ARRAY_BUFFER: {
@@ -430,13 +1609,130 @@ namespace gfx {
         }
       }
       break;
+      case GL_DRAW_INDIRECT_BUFFER: {
+        if (buffer_id != indirect_buffer) {
+          glBindBuffer(GL_DRAW_INDIRECT_BUFFER, buffer_id);
+          indirect_buffer = buffer_id;
+        }
+      }
+      break;
     }
   }
   void GLRenderer::GLState::bind_texture(uint8_t slot, GLenum target, GLuint tex_id) {
     if (target != textures[slot].target || tex_id != textures[slot].id) {
+      glActiveTexture(GL_TEXTURE0 + slot);
       glBindTexture(target, tex_id);
       textures[slot] = CachedTexture{ target, tex_id };
     }
   }
+
+  void GLRenderer::GLState::bind_sampler(uint8_t slot, GLuint sampler_id) {
+    if (sampler_id != samplers[slot]) {
+      glBindSampler(slot, sampler_id);
+      samplers[slot] = sampler_id;
+    }
+  }
+
+  void GLRenderer::GLState::bind_vertex_array(GLuint vao, GLuint vao_index_buffer) {
+    if (vao != vertex_array) {
+      glBindVertexArray(vao);
+      vertex_array = vao;
+      // the element array binding is stored in the vertex array
+      index_buffer = vao_index_buffer;
+    }
+  }
+
+  uint32_t GLRenderer::intern_vertex_layout(const GLPipeline& pip) {
+    // FNV-1a hash of the vertex layout, only compared to skip the layouts that differ
+    uint64_t hash = 14695981039346656037ull;
+    auto hash_value = [&hash](uint64_t value) {
+      hash = (hash ^ value) * 1099511628211ull;
+    };
+    hash_value(pip.num_attributes);
+    for (uint32_t i = 0; i < pip.num_attributes; i++) {
+      const GLVertexAttribute& attr = pip.attributes[i];
+      hash_value(attr.size);
+      hash_value(attr.type);
+      hash_value(attr.offset);
+      hash_value(attr.stride);
+      hash_value(attr.divisor);
+    }
+
+    for (uint32_t id = 0; id < _vertex_layouts.size(); id++) {
+      const GLVertexLayout& layout = _vertex_layouts[id];
+      if (layout.hash == hash && layout.num_attributes == pip.num_attributes &&
+        std::equal(pip.attributes, pip.attributes + pip.num_attributes, layout.attributes))
+        return id;
+    }
+
+    GLVertexLayout layout = {};
+    layout.hash = hash;
+    layout.num_attributes = pip.num_attributes;
+    std::copy_n(pip.attributes, pip.num_attributes, layout.attributes);
+    _vertex_layouts.push_back(layout);
+    return (uint32_t)_vertex_layouts.size() - 1;
+  }
+
+  size_t GLRenderer::VertexArrayKeyHash::operator()(const VertexArrayKey& key) const {
+    uint64_t hash = 14695981039346656037ull;
+    hash = (hash ^ key.layout_id) * 1099511628211ull;
+    hash = (hash ^ key.vertex_buffer) * 1099511628211ull;
+    hash = (hash ^ key.instance_buffer) * 1099511628211ull;
+    hash = (hash ^ key.index_buffer) * 1099511628211ull;
+    return (size_t)hash;
+  }
+
+  void GLRenderer::destroy_vertex_arrays(GLuint buffer) {
+    std::erase_if(_vertex_arrays, [this, buffer](const auto& entry) {
+      const VertexArrayKey& key = entry.first;
+      if (key.vertex_buffer != buffer && key.instance_buffer != buffer && key.index_buffer != buffer)
+        return false;
+      if (_state.vertex_array == entry.second.id)
+        _state.bind_vertex_array(0, 0);
+      glDeleteVertexArrays(1, &entry.second.id);
+      return true;
+    });
+  }
+
+  size_t GLRenderer::SamplerDescHash::operator()(const SamplerDesc& desc) const {
+    uint64_t hash = 14695981039346656037ull;
+    auto hash_value = [&hash](uint64_t value) {
+      hash = (hash ^ value) * 1099511628211ull;
+    };
+    hash_value((uint64_t)desc.min_filter);
+    hash_value((uint64_t)desc.mag_filter);
+    hash_value((uint64_t)desc.mip_filter);
+    hash_value((uint64_t)desc.wrap_u);
+    hash_value((uint64_t)desc.wrap_v);
+    hash_value((uint64_t)desc.wrap_w);
+    hash_value(desc.max_anisotropy);
+    return (size_t)hash;
+  }
+
+  GLRenderer::GLVertexArray& GLRenderer::get_vertex_array(const GLPipeline& pip, GLuint vertex_buffer, GLuint instance_buffer, GLuint index_buffer) {
+    VertexArrayKey key{ pip.layout_id, vertex_buffer, instance_buffer, index_buffer };
+    auto it = _vertex_arrays.find(key);
+    if (it != _vertex_arrays.end())
+      return it->second;
+
+    // first use of this layout with these buffers: record the vertex array state once
+    GLuint vao;
+    glGenVertexArrays(1, &vao);
+    glBindVertexArray(vao);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, index_buffer);
+    _state.vertex_array = vao;
+    _state.index_buffer = index_buffer;
+
+    for (uint32_t i = 0; i < pip.num_attributes; i++) {
+      const GLVertexAttribute& attr = pip.attributes[i];
+      _state.bind_buffer(GL_ARRAY_BUFFER, attr.divisor > 0 ? instance_buffer : vertex_buffer);
+      glVertexAttribPointer(attr.index, attr.size, attr.type, GL_FALSE, (GLsizei)attr.stride, (const GLvoid*)attr.offset);
+      glEnableVertexAttribArray(attr.index);
+      if (attr.divisor > 0)
+        glVertexAttribDivisor(attr.index, attr.divisor);
+    }
+
+    return _vertex_arrays.emplace(key, GLVertexArray{ vao, 0, 0 }).first->second;
+  }
 }
 
@@ -4,30 +4,110 @@
 
 #include <array>
 #include <optional>
+#include <unordered_map>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
 #include <glad/glad.h>
 
+struct SDL_Window;
+
 namespace gfx {
-  constexpr uint32_t MAX_BUFFERS = 4096;
-  constexpr uint32_t MAX_TEXTURES = 4096;
-  constexpr uint32_t MAX_SHADERS = 4096;
-  constexpr uint32_t MAX_RENDER_PASSES = 32;
-  constexpr uint32_t MAX_PIPELINES = 4096;
   constexpr uint8_t MAX_UNIFORMS = 16;
   constexpr uint8_t MAX_SHADER_TEXTURES = 16;
+  constexpr uint32_t FRAMES_IN_FLIGHT = MAX_FRAMES_IN_FLIGHT;
+  constexpr uint32_t UNIFORM_RING_FRAME_SIZE = 4 * 1024 * 1024;
+  constexpr uint32_t TEXTURE_UPLOAD_RING_FRAME_SIZE = 8 * 1024 * 1024;
+  constexpr GLuint UNIFORM_BLOCK_BINDING = 0;
+  constexpr GLint STREAM_BUFFER_ALIGNMENT = 16;
+
+  /*!
+  * Buffer split in one segment per frame in flight.
+  * Data is appended in the segment of the current frame, the segments are protected by the renderer frame fences
+  * so a segment is only written again once the GPU is done with it: no orphaning and no stall.
+  * The buffer is persistently mapped when GL 4.4 is available, updated with glBufferSubData otherwise.
+  */
+  struct GLBufferRing {
+    void create(uint32_t segment_size, GLint alignment);
+    void destroy();
+    // copies the data in the current segment and reserves reserve_size bytes, returns the offset in the buffer
+    std::optional<GLintptr> push(const void* data, uint32_t size, uint32_t reserve_size);
+    // starts writing in the segment of the given frame
+    void begin_frame(uint32_t frame);
+    GLintptr segment_offset() const { return (GLintptr)frame * segment_size; }
+
+    GLuint id;
+    uint8_t* mapped;
+    GLint alignment;
+    uint32_t segment_size;
+    uint32_t frame;
+    uint32_t offset;
+  };
+
+  /*!
+  * GL_TIME_ELAPSED queries around the render passes, one set of queries per frame in flight.
+  * A set is read when the renderer comes back to its frame, once the frame fence is signaled:
+  * the results are there and reading them never stalls the pipeline.
+  */
+  struct GLPassTimer {
+    void create();
+    void destroy();
+    void begin_pass(const char* name);
+    void end_pass();
+    // publishes the timings recorded in the set of the frame then records the new frame in it
+    void begin_frame(uint32_t frame);
+
+    std::array<std::array<GLuint, MAX_TIMED_PASSES>, FRAMES_IN_FLIGHT> queries;
+    std::array<std::vector<std::string>, FRAMES_IN_FLIGHT> names; // passes timed by each set
+    std::vector<PassTiming> timings;
+    uint32_t frame;
+    bool timing; // a query is running
+  };
 
   struct GLBuffer {
     void create(const BufferDesc& desc);
     void destroy();
+    // replaces the buffer content
+    bool update(const Memory& mem);
+    // writes after the data already appended this frame, returns the offset relative to base_offset()
+    std::optional<uint32_t> append(const Memory& mem);
+    void begin_frame(uint32_t frame);
+    // start of the data of the current frame
+    GLintptr base_offset() const { return usage == BufferUsage::STREAM ? ring.segment_offset() : 0; }
+    void write_shadow(GLintptr offset, const void* data, size_t data_size);
 
     GLuint id;
+    BufferType type;
+    BufferUsage usage;
+    uint32_t size;
+    uint32_t append_offset;
+    GLBufferRing ring; // STREAM buffers only
+    // copy of an INDIRECT_BUFFER read by the draw loop used when multi draw indirect is not available
+    std::vector<uint8_t> shadow;
   };
 
   struct GLTexture {
     void create(const TextureDesc& desc);
     void destroy();
+    // copies texels from client memory or, when pixels is an offset, from the bound pixel unpack buffer
+    void upload(const TextureRegion& region, uint32_t mip, const void* pixels) const;
 
     GLenum target;
     GLuint id;
+    TextureType type;
+    GLenum format;
+    GLenum pixel_type;
+    uint32_t texel_size;
+    uint32_t width;
+    uint32_t height;
+    uint32_t depth;
+    uint32_t mip_levels; // levels allocated by glGenerateMipmap, 1 without mips
+  };
+
+  struct GLSampler {
+    GLuint id; // shared by the samplers with the same description
   };
 
   struct GLUniform {
@@ -38,18 +118,109 @@ namespace gfx {
 
   struct GLUniformBlockLayout {
     std::array<GLUniform, MAX_UNIFORMS> uniforms;
+    uint8_t num_uniforms;
+    bool use_block; // uniforms are declared in a std140 uniform block and uploaded through the uniform ring
+    GLuint block_size;
   };
 
   struct GLShaderTexture {
     GLint uniform_loc;
   };
 
+  /*!
+  * On-disk cache of linked programs.
+  * Programs are stored with glGetProgramBinary under a hash of their sources, or of their SPIR-V modules, and of the driver strings:
+  * a driver update changes the keys and a binary rejected by glProgramBinary is compiled again.
+  */
+  struct GLProgramCache {
+    void init(const std::string& dir);
+    uint64_t make_key(const ShaderDesc& desc) const;
+    // returns 0 when the program is not cached or its binary is stale
+    GLuint load(uint64_t key) const;
+    void store(uint64_t key, GLuint program) const;
+
+    std::string directory;
+    uint64_t driver_hash;
+    bool enabled;
+  };
+
+  struct GLProgramBuild {
+    // issues the compilation and the link, the driver may run them in the background
+    // SPIR-V modules are used instead of the sources when the context supports them
+    void begin(const ShaderDesc& desc, bool retrievable);
+    // true once the link is done, needs GL_KHR_parallel_shader_compile
+    bool is_complete() const;
+    // waits for the link and checks it, returns the program or 0 on errors
+    GLuint end();
+
+    GLuint program;
+    GLuint vs;
+    GLuint fs;
+  };
+
+  struct GLShaderJob {
+    // the description is copied as the compilation outlives it, its sources and modules point at the copies
+    std::string vertex_src;
+    std::string fragment_src;
+    std::vector<uint32_t> vertex_spirv;
+    std::vector<uint32_t> fragment_spirv;
+    ShaderDesc desc;
+    uint64_t cache_key;
+    GLProgramBuild build;
+    // guarded by the compiler mutex when the worker thread compiles
+    bool done;
+    bool cancelled;
+  };
+
+  /*!
+  * Compiles the async shaders without blocking the render thread.
+  * With GL_KHR_parallel_shader_compile the driver compiles in its own threads and the render thread polls the link,
+  * otherwise a worker thread compiles in a context sharing its objects with the render context.
+  */
+  class GLShaderCompiler {
+  public:
+    void init(SDL_Window* window, const GLProgramCache* cache);
+    void shutdown();
+    void compile(const std::shared_ptr<GLShaderJob>& job);
+    // true once the program of the job is linked or failed, the program is 0 on errors
+    bool is_done(GLShaderJob& job);
+    // the program of the job is deleted, now or when the worker thread is done with it
+    void cancel(GLShaderJob& job);
+
+  private:
+    bool start_worker();
+    void run_worker();
+
+    SDL_Window* _window;
+    const GLProgramCache* _cache;
+    bool _parallel;
+
+    // worker thread, started with the first async shader
+    void* _context; // SDL_GLContext
+    std::thread _thread;
+    std::mutex _mutex;
+    std::condition_variable _wake;
+    std::deque<std::shared_ptr<GLShaderJob>> _jobs;
+    bool _stop;
+  };
+
   struct GLShader {
-    void create(const ShaderDesc& desc);
+    void create(const ShaderDesc& desc, const GLProgramCache& cache, GLShaderCompiler& compiler);
+    // finishes an async shader once its program is linked, returns false while it is still compiling
+    bool update(GLShaderCompiler& compiler);
+    // reads the uniforms and samplers locations of the linked program
+    void reflect(const ShaderDesc& desc);
     void destroy();
+    // detects a uniform block holding the uniforms and validates its std140 layout
+    void init_uniform_block(const ShaderDesc& desc);
+    // SPIR-V programs can't be reflected by name, their uniforms are the only block of the program
+    void init_spirv_uniform_block();
     GLUniformBlockLayout uniforms_layout;
     std::vector<GLShaderTexture> shader_textures;
     GLuint id;
+    bool spirv; // created from the SPIR-V modules of the description
+    bool ready; // async shaders are ready once linked and reflected
+    std::shared_ptr<GLShaderJob> job; // async compilation in flight
   };
 
   struct GLVertexAttribute {
@@ -58,6 +229,9 @@ namespace gfx {
     GLenum type;
     size_t stride;
     size_t offset;
+    GLuint divisor; // 0 for per-vertex attributes, per-instance attributes are read from the instance buffer
+
+    bool operator==(const GLVertexAttribute& other) const = default;
   };
 
   struct GLFramebufferAttachments {
@@ -72,13 +246,19 @@ namespace gfx {
 
     GLFramebufferAttachments attachments;
     GLuint fb_id;
+    std::string name;
   };
 
   struct GLPipeline {
     Shader shader_id;
     GLShader* shader;
+    Pipeline fallback; // drawn while the shader is not ready
     GLVertexAttribute attributes[MAX_ATTRIBUTES];
+    uint32_t num_attributes;
+    bool use_instance_buffer;
+    uint32_t layout_id; // pipelines with the same vertex layout share their vertex arrays
     GLenum index_type;
+    uint32_t index_size;
     GLenum primitive_type;
     GLenum cull_mode;
   };
@@ -92,16 +272,31 @@ namespace gfx {
     void set_pipeline(Pipeline pipe);
     void set_bindings(Bindings bind);
     void set_uniforms(const Memory& mem);
-    void draw(uint32_t first_element, uint32_t num_elements, uint32_t num_instances);
+    void draw(uint32_t first_element, uint32_t num_elements, uint32_t num_instances, int32_t base_vertex);
+    void multi_draw_indirect(Buffer args, uint32_t offset, uint32_t draw_count, uint32_t stride);
     void set_viewport(const Rect& rect);
     void set_scissor(const Rect& rect);
     void submit();
 
     bool new_buffer(Buffer h, const BufferDesc& desc);
+    bool update_buffer(Buffer h, const Memory& mem);
+    std::optional<uint32_t> append_buffer(Buffer h, const Memory& mem);
     bool new_texture(Texture h, const TextureDesc& desc);
+    bool update_texture(Texture h, const TextureRegion& region, uint32_t mip, const Memory& mem);
     bool new_shader(Shader h, const ShaderDesc& desc);
     bool new_render_pass(RenderPass h, const RenderPassDesc& desc);
     bool new_pipeline(Pipeline h, const PipelineDesc& desc);
+    bool new_sampler(Sampler h, const SamplerDesc& desc);
+    bool is_shader_ready(Shader h);
+    bool is_pipeline_ready(Pipeline h);
+    void destroy_buffer(Buffer h);
+    void destroy_texture(Texture h);
+    void destroy_shader(Shader h);
+    void destroy_render_pass(RenderPass h);
+    void destroy_pipeline(Pipeline h);
+    void destroy_sampler(Sampler h);
+
+    const std::vector<PassTiming>& pass_timings() const { return _pass_timer.timings; }
 
   private:
     std::array<GLBuffer, MAX_BUFFERS> _buffers;
@@ -109,6 +304,62 @@ namespace gfx {
     std::array<GLShader, MAX_SHADERS> _shaders;
     std::array<GLRenderPass, MAX_RENDER_PASSES> _render_passes;
     std::array<GLPipeline, MAX_PIPELINES> _pipelines;
+    std::array<GLSampler, MAX_SAMPLERS> _samplers;
+    GLProgramCache _program_cache;
+    GLShaderCompiler _shader_compiler;
+    std::vector<Shader> _pending_shaders; // async shaders still compiling
+    GLBufferRing _uniform_ring;
+    GLBufferRing _texture_upload_ring; // pixel unpack buffer of the texture updates
+    std::vector<Buffer> _stream_buffers;
+
+    // one fence per frame in flight, protects the segments of the buffer rings
+    std::array<GLsync, FRAMES_IN_FLIGHT> _frame_fences;
+    uint32_t _frame_index;
+    GLPassTimer _pass_timer;
+
+    // distinct vertex layouts of the pipelines, indexed by GLPipeline::layout_id and kept until shutdown
+    struct GLVertexLayout {
+      uint64_t hash;
+      uint32_t num_attributes;
+      GLVertexAttribute attributes[MAX_ATTRIBUTES];
+    };
+    uint32_t intern_vertex_layout(const GLPipeline& pip);
+    std::vector<GLVertexLayout> _vertex_layouts;
+
+    // vertex arrays are created once per (vertex layout, vertex buffer, instance buffer, index buffer)
+    struct VertexArrayKey {
+      uint32_t layout_id;
+      GLuint vertex_buffer;
+      GLuint instance_buffer;
+      GLuint index_buffer;
+
+      bool operator==(const VertexArrayKey& other) const = default;
+    };
+
+    struct VertexArrayKeyHash {
+      size_t operator()(const VertexArrayKey& key) const;
+    };
+
+    struct GLVertexArray {
+      GLuint id;
+      // offsets the attributes currently point at
+      GLintptr vertex_offset;
+      GLintptr instance_offset;
+    };
+
+    GLVertexArray& get_vertex_array(const GLPipeline& pip, GLuint vertex_buffer, GLuint instance_buffer, GLuint index_buffer);
+    // GL reuses the names of deleted buffers, the vertex arrays using a deleted buffer must go with it
+    void destroy_vertex_arrays(GLuint buffer);
+
+    std::unordered_map<VertexArrayKey, GLVertexArray, VertexArrayKeyHash> _vertex_arrays;
+
+    // sampler objects are created once per description and kept until shutdown
+    struct SamplerDescHash {
+      size_t operator()(const SamplerDesc& desc) const;
+    };
+
+    std::unordered_map<SamplerDesc, GLuint, SamplerDescHash> _sampler_cache;
+    GLfloat _max_anisotropy;
 
     struct CachedTexture {
       GLenum target;
@@ -119,14 +370,20 @@ namespace gfx {
     struct GLState {
       GLPipeline* current_pip;
       std::array<CachedTexture, MAX_SHADER_TEXTURES> textures;
+      std::array<GLuint, MAX_SHADER_TEXTURES> samplers;
       GLuint vertex_buffer;
       GLuint index_buffer;
-      GLuint global_vao;
+      GLintptr index_base; // start of the current frame data of the index buffer
+      GLintptr index_offset; // index_base plus Bindings::index_buffer_offset
+      GLuint indirect_buffer;
+      GLuint vertex_array;
       GLuint default_framebuffer;
       CullMode cull_mode;
 
       void bind_buffer(GLenum target, GLuint buffer_id);
       void bind_texture(uint8_t slot, GLenum target, GLuint tex_id);
+      void bind_sampler(uint8_t slot, GLuint sampler_id);
+      void bind_vertex_array(GLuint vao, GLuint vao_index_buffer);
     };
 
     GLState _state;
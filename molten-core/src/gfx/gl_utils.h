@@ -34,6 +34,16 @@ namespace gfx {
     return GL_NONE;
   }
 
+  uint32_t get_gl_texture_texel_size(TextureFormat format) {
+    switch (format) {
+    case TextureFormat::R8: return 1;
+    case TextureFormat::RGB8: return 3;
+    case TextureFormat::RGBA8: return 4;
+    case TextureFormat::DEPTH: return 4;
+    }
+    return 0;
+  }
+
   GLenum get_gl_texture_internal_format(TextureFormat format) {
     switch (format) {
     case TextureFormat::R8: return GL_R8;
@@ -44,6 +54,33 @@ namespace gfx {
     return GL_NONE;
   }
 
+  GLenum get_gl_min_filter(Filter filter, MipmapFilter mip_filter) {
+    switch (mip_filter) {
+    case MipmapFilter::NONE: return filter == Filter::LINEAR ? GL_LINEAR : GL_NEAREST;
+    case MipmapFilter::NEAREST: return filter == Filter::LINEAR ? GL_LINEAR_MIPMAP_NEAREST : GL_NEAREST_MIPMAP_NEAREST;
+    case MipmapFilter::LINEAR: return filter == Filter::LINEAR ? GL_LINEAR_MIPMAP_LINEAR : GL_NEAREST_MIPMAP_LINEAR;
+    }
+    return GL_NONE;
+  }
+
+  GLenum get_gl_mag_filter(Filter filter) {
+    switch (filter) {
+    case Filter::NEAREST: return GL_NEAREST;
+    case Filter::LINEAR: return GL_LINEAR;
+    }
+    return GL_NONE;
+  }
+
+  GLenum get_gl_wrap(Wrap wrap) {
+    switch (wrap) {
+    case Wrap::REPEAT: return GL_REPEAT;
+    case Wrap::MIRRORED_REPEAT: return GL_MIRRORED_REPEAT;
+    case Wrap::CLAMP_TO_EDGE: return GL_CLAMP_TO_EDGE;
+    case Wrap::CLAMP_TO_BORDER: return GL_CLAMP_TO_BORDER;
+    }
+    return GL_NONE;
+  }
+
   GLenum get_gl_primitive_type(PrimitiveType type) {
     switch (type) {
     case PrimitiveType::POINTS: return GL_POINTS;
@@ -57,6 +94,7 @@ namespace gfx {
 
   GLenum get_gl_attribute_type(AttributeFormat format) {
     switch (format) {
+    case AttributeFormat::NONE: return GL_NONE;
     case AttributeFormat::FLOAT2: return GL_FLOAT;
     case AttributeFormat::FLOAT3: return GL_FLOAT;
     case AttributeFormat::FLOAT4: return GL_FLOAT;
@@ -66,6 +104,7 @@ namespace gfx {
 
   uint32_t get_gl_attribute_size(AttributeFormat format) {
     switch (format) {
+    case AttributeFormat::NONE: return 0;
     case AttributeFormat::FLOAT2: return 2;
     case AttributeFormat::FLOAT3: return 3;
     case AttributeFormat::FLOAT4: return 4;
@@ -76,6 +115,8 @@ namespace gfx {
   uint32_t get_gl_type_size(GLenum type) {
     switch (type) {
     case GL_FLOAT: return 4;
+    case GL_UNSIGNED_SHORT: return 2;
+    case GL_UNSIGNED_INT: return 4;
     }
     return 0;
   }
@@ -84,6 +125,7 @@ namespace gfx {
     switch (type) {
       case BufferType::VERTEX_BUFFER: return GL_ARRAY_BUFFER;
       case BufferType::INDEX_BUFFER: return GL_ELEMENT_ARRAY_BUFFER;
+      case BufferType::INDIRECT_BUFFER: return GL_DRAW_INDIRECT_BUFFER;
     }
     return GL_NONE;
   }
@@ -110,6 +152,34 @@ namespace gfx {
     return 0;
   }
 
+  // base alignment of a uniform in a std140 block
+  uint16_t get_std140_alignment(UniformType type) {
+    switch (type) {
+    case UniformType::FLOAT: return 4;
+    case UniformType::FLOAT2: return 8;
+    case UniformType::FLOAT3: return 16;
+    case UniformType::FLOAT4: return 16;
+    case UniformType::MAT2: return 16;
+    case UniformType::MAT3: return 16;
+    case UniformType::MAT4: return 16;
+    }
+    return 0;
+  }
+
+  // size of a uniform in a std140 block, matrix columns are padded to a vec4
+  uint16_t get_std140_size(UniformType type) {
+    switch (type) {
+    case UniformType::FLOAT: return 4;
+    case UniformType::FLOAT2: return 8;
+    case UniformType::FLOAT3: return 12;
+    case UniformType::FLOAT4: return 16;
+    case UniformType::MAT2: return 32;
+    case UniformType::MAT3: return 48;
+    case UniformType::MAT4: return 64;
+    }
+    return 0;
+  }
+
   GLenum get_gl_cull_mode(CullMode mode) {
     switch (mode) {
     case CullMode::NONE: return GL_NONE;
@@ -0,0 +1,32 @@
+#include "handle_pool.h"
+
+namespace gfx {
+  void HandlePool::init(uint32_t size) {
+    slots.init(size);
+    generations.assign(size, 0);
+    live.assign(size, false);
+  }
+
+  uint32_t HandlePool::alloc() {
+    uint32_t index = slots.alloc_index();
+    if (index == 0)
+      return INVALID_HANDLE;
+    live[index] = true;
+    return make_handle(index, generations[index]);
+  }
+
+  void HandlePool::invalidate(uint32_t handle) {
+    uint32_t index = handle_index(handle);
+    ++generations[index];
+    live[index] = false;
+  }
+
+  void HandlePool::release(uint32_t handle) {
+    slots.free_index(handle_index(handle));
+  }
+
+  bool HandlePool::valid(uint32_t handle) const {
+    uint32_t index = handle_index(handle);
+    return index > 0 && index < slots.size && live[index] && generations[index] == handle_generation(handle);
+  }
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include "gfx/renderer.h"
+#include "../pool.h"
+
+#include <stdint.h>
+#include <vector>
+
+namespace gfx {
+  /*!
+  * Hands out the generational handles of a resource table.
+  * Slots come from a core::Pool free list, each slot has a generation bumped when its handle is invalidated
+  * so a handle kept after destruction never matches the resource reusing the slot.
+  * Only the slots holding a handed out handle are live: a raw index of a free slot never validates, whatever its generation.
+  * Slot 0 is never allocated, INVALID_HANDLE is returned when the table is full.
+  */
+  struct HandlePool {
+    void init(uint32_t size);
+    uint32_t alloc();
+    // the handle stops being valid but its slot is not reused until release()
+    void invalidate(uint32_t handle);
+    void release(uint32_t handle);
+    bool valid(uint32_t handle) const;
+
+    core::Pool slots;
+    std::vector<uint16_t> generations;
+    std::vector<bool> live;
+  };
+}
@@ -0,0 +1,298 @@
+#include "null_renderer.h"
+
+#include <iostream>
+#include <algorithm>
+
+namespace gfx {
+  // same alignment as the appends of the GL backend
+  constexpr uint32_t APPEND_ALIGNMENT = 16;
+
+  template<size_t N>
+  bool NullRenderer::check_handle(const std::array<uint32_t, N>& live_handles, uint32_t handle, const char* type) {
+    if (handle != INVALID_HANDLE && handle_index(handle) < N && live_handles[handle_index(handle)] == handle)
+      return true;
+
+    std::cout << "Null backend: invalid " << type << " handle " << handle << std::endl;
+    ++_stats.invalid_calls;
+    return false;
+  }
+
+  bool NullRenderer::check_call(bool valid, const char* error) {
+    if (!valid) {
+      std::cout << "Null backend: " << error << std::endl;
+      ++_stats.invalid_calls;
+    }
+    return valid;
+  }
+
+  void NullRenderer::init(const InitInfo&) {
+    _buffers.fill(INVALID_HANDLE);
+    _textures.fill(INVALID_HANDLE);
+    _shaders.fill(INVALID_HANDLE);
+    _render_passes.fill(INVALID_HANDLE);
+    _pipelines.fill(INVALID_HANDLE);
+    _samplers.fill(INVALID_HANDLE);
+    _stream_buffers.clear();
+    _stats = {};
+
+    _in_pass = false;
+    _pipeline = INVALID_HANDLE;
+    _has_bindings = false;
+  }
+
+  void NullRenderer::shutdown() {
+    _stream_buffers.clear();
+  }
+
+  void NullRenderer::begin_render_pass(std::optional<RenderPass> pass, const PassAction&) {
+    check_call(!_in_pass, "begin_render_pass called inside a render pass");
+    if (pass)
+      check_handle(_render_passes, pass.value(), "render pass");
+
+    _in_pass = true;
+    ++_stats.commands;
+    ++_stats.passes;
+  }
+
+  void NullRenderer::end_render_pass() {
+    check_call(_in_pass, "end_render_pass called outside of a render pass");
+
+    _in_pass = false;
+    ++_stats.commands;
+  }
+
+  void NullRenderer::set_pipeline(Pipeline pipe) {
+    if (!check_handle(_pipelines, pipe, "pipeline"))
+      return;
+
+    ++_stats.commands;
+    if (pipe != _pipeline) {
+      ++_stats.pipeline_changes;
+      // the vertex layout depends on the pipeline
+      _has_bindings = false;
+    }
+    _pipeline = pipe;
+  }
+
+  void NullRenderer::set_bindings(Bindings bind) {
+    check_call(_pipeline != INVALID_HANDLE, "set_bindings called without pipeline");
+    check_handle(_buffers, bind.vertex_buffer, "buffer");
+    if (bind.index_buffer)
+      check_handle(_buffers, bind.index_buffer.value(), "buffer");
+    if (bind.instance_buffer)
+      check_handle(_buffers, bind.instance_buffer.value(), "buffer");
+    for (const TextureBinding& tex : bind.textures) {
+      check_handle(_textures, tex.texture, "texture");
+      if (tex.sampler != INVALID_HANDLE)
+        check_handle(_samplers, tex.sampler, "sampler");
+    }
+
+    _has_bindings = true;
+    ++_stats.commands;
+    ++_stats.bindings_changes;
+  }
+
+  void NullRenderer::set_uniforms(const Memory& mem) {
+    check_call(_pipeline != INVALID_HANDLE, "set_uniforms called without pipeline");
+
+    ++_stats.commands;
+    ++_stats.uniform_updates;
+    _stats.bytes_uploaded += mem.size;
+  }
+
+  void NullRenderer::draw(uint32_t, uint32_t, uint32_t num_instances, int32_t) {
+    check_call(_in_pass, "draw called outside of a render pass");
+    check_call(_pipeline != INVALID_HANDLE && _has_bindings, "draw called without pipeline or bindings");
+
+    ++_stats.commands;
+    ++_stats.draws;
+    _stats.instances += num_instances;
+  }
+
+  void NullRenderer::multi_draw_indirect(Buffer args, uint32_t, uint32_t draw_count, uint32_t) {
+    check_call(_in_pass, "multi_draw_indirect called outside of a render pass");
+    check_call(_pipeline != INVALID_HANDLE && _has_bindings, "multi_draw_indirect called without pipeline or bindings");
+    check_handle(_buffers, args, "buffer");
+
+    ++_stats.commands;
+    _stats.draws += draw_count;
+  }
+
+  void NullRenderer::set_viewport(const Rect&) {
+    ++_stats.commands;
+    ++_stats.viewport_changes;
+  }
+
+  void NullRenderer::set_scissor(const Rect&) {
+    ++_stats.commands;
+    ++_stats.viewport_changes;
+  }
+
+  void NullRenderer::submit() {
+    check_call(!_in_pass, "submit called inside a render pass");
+
+    ++_stats.frames;
+    for (Buffer h : _stream_buffers) {
+      _buffer_infos[handle_index(h)].append_offset = 0;
+    }
+
+    // like the GL backend, the state does not survive the frame
+    _pipeline = INVALID_HANDLE;
+    _has_bindings = false;
+  }
+
+  bool NullRenderer::new_buffer(Buffer h, const BufferDesc& desc) {
+    if (!check_call(desc.usage != BufferUsage::IMMUTABLE || desc.mem.data, "IMMUTABLE buffers must be created with their data"))
+      return false;
+
+    _buffers[handle_index(h)] = h;
+    _buffer_infos[handle_index(h)] = NullBuffer{
+      .usage = desc.usage,
+      .size = (uint32_t)desc.mem.size,
+      .append_offset = 0,
+    };
+    if (desc.usage != BufferUsage::IMMUTABLE)
+      _stream_buffers.push_back(h);
+
+    if (desc.mem.data)
+      _stats.bytes_uploaded += desc.mem.size;
+    return true;
+  }
+
+  bool NullRenderer::update_buffer(Buffer h, const Memory& mem) {
+    if (!check_handle(_buffers, h, "buffer"))
+      return false;
+    const NullBuffer& buffer = _buffer_infos[handle_index(h)];
+    if (!check_call(buffer.usage != BufferUsage::IMMUTABLE, "IMMUTABLE buffers can't be updated") ||
+      !check_call(mem.size <= buffer.size, "update_buffer is larger than the buffer")) {
+      return false;
+    }
+
+    _stats.bytes_uploaded += mem.size;
+    return true;
+  }
+
+  std::optional<uint32_t> NullRenderer::append_buffer(Buffer h, const Memory& mem) {
+    if (!check_handle(_buffers, h, "buffer"))
+      return std::nullopt;
+    NullBuffer& buffer = _buffer_infos[handle_index(h)];
+    if (!check_call(buffer.usage != BufferUsage::IMMUTABLE, "IMMUTABLE buffers can't be appended to"))
+      return std::nullopt;
+
+    // a full buffer is not an error, the caller gets nullopt like with the other backends
+    uint32_t offset = (buffer.append_offset + APPEND_ALIGNMENT - 1) / APPEND_ALIGNMENT * APPEND_ALIGNMENT;
+    if (offset + mem.size > buffer.size)
+      return std::nullopt;
+
+    buffer.append_offset = offset + (uint32_t)mem.size;
+    _stats.bytes_uploaded += mem.size;
+    return offset;
+  }
+
+  bool NullRenderer::new_texture(Texture h, const TextureDesc& desc) {
+    _textures[handle_index(h)] = h;
+    _texture_infos[handle_index(h)] = NullTexture{
+      .width = desc.width,
+      .height = std::max(desc.height, 1u),
+      .depth = std::max(desc.depth, 1u),
+    };
+
+    if (desc.mem.data)
+      _stats.bytes_uploaded += desc.mem.size;
+    return true;
+  }
+
+  bool NullRenderer::update_texture(Texture h, const TextureRegion& region, uint32_t mip, const Memory& mem) {
+    if (!check_handle(_textures, h, "texture"))
+      return false;
+
+    const NullTexture& texture = _texture_infos[handle_index(h)];
+    uint32_t width = std::max(texture.width >> mip, 1u);
+    uint32_t height = std::max(texture.height >> mip, 1u);
+    uint32_t depth = std::max(texture.depth >> mip, 1u);
+    if (!check_call(region.x + region.width <= width && region.y + region.height <= height && region.z + region.depth <= depth,
+      "update_texture region is outside of the mip level")) {
+      return false;
+    }
+
+    _stats.bytes_uploaded += mem.size;
+    return true;
+  }
+
+  bool NullRenderer::new_shader(Shader h, const ShaderDesc&) {
+    _shaders[handle_index(h)] = h;
+    return true;
+  }
+
+  bool NullRenderer::new_render_pass(RenderPass h, const RenderPassDesc& desc) {
+    for (Texture color : desc.colors) {
+      if (!check_handle(_textures, color, "texture"))
+        return false;
+    }
+    if (desc.depth && !check_handle(_textures, desc.depth.value(), "texture"))
+      return false;
+
+    _render_passes[handle_index(h)] = h;
+    return true;
+  }
+
+  bool NullRenderer::new_pipeline(Pipeline h, const PipelineDesc& desc) {
+    if (!check_handle(_shaders, desc.shader, "shader"))
+      return false;
+    if (desc.fallback != INVALID_HANDLE && !check_handle(_pipelines, desc.fallback, "pipeline"))
+      return false;
+
+    _pipelines[handle_index(h)] = h;
+    return true;
+  }
+
+  bool NullRenderer::new_sampler(Sampler h, const SamplerDesc&) {
+    _samplers[handle_index(h)] = h;
+    return true;
+  }
+
+  bool NullRenderer::is_shader_ready(Shader h) {
+    // nothing to compile
+    return check_handle(_shaders, h, "shader");
+  }
+
+  bool NullRenderer::is_pipeline_ready(Pipeline h) {
+    return check_handle(_pipelines, h, "pipeline");
+  }
+
+  void NullRenderer::destroy_buffer(Buffer h) {
+    if (!check_handle(_buffers, h, "buffer"))
+      return;
+    if (_buffer_infos[handle_index(h)].usage != BufferUsage::IMMUTABLE)
+      std::erase(_stream_buffers, h);
+    _buffers[handle_index(h)] = INVALID_HANDLE;
+  }
+
+  void NullRenderer::destroy_texture(Texture h) {
+    if (check_handle(_textures, h, "texture"))
+      _textures[handle_index(h)] = INVALID_HANDLE;
+  }
+
+  void NullRenderer::destroy_shader(Shader h) {
+    if (check_handle(_shaders, h, "shader"))
+      _shaders[handle_index(h)] = INVALID_HANDLE;
+  }
+
+  void NullRenderer::destroy_render_pass(RenderPass h) {
+    if (check_handle(_render_passes, h, "render pass"))
+      _render_passes[handle_index(h)] = INVALID_HANDLE;
+  }
+
+  void NullRenderer::destroy_pipeline(Pipeline h) {
+    if (!check_handle(_pipelines, h, "pipeline"))
+      return;
+    if (_pipeline == h)
+      _pipeline = INVALID_HANDLE;
+    _pipelines[handle_index(h)] = INVALID_HANDLE;
+  }
+
+  void NullRenderer::destroy_sampler(Sampler h) {
+    if (check_handle(_samplers, h, "sampler"))
+      _samplers[handle_index(h)] = INVALID_HANDLE;
+  }
+}
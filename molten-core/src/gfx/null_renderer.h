@@ -0,0 +1,92 @@
+#pragma once
+
+#include "gfx/renderer.h"
+
+#include <array>
+#include <vector>
+#include <optional>
+
+namespace gfx {
+  /*!
+  * Backend without driver, selected with GFX_USE_NULL.
+  * Resources are only tracked to validate the handles and the order of the calls,
+  * the counters measure the work done by the engine and the renderer front end, see get_null_stats.
+  */
+  class NullRenderer {
+  public:
+    void init(const InitInfo& info);
+    void shutdown();
+    void begin_render_pass(std::optional<RenderPass> pass, const PassAction& action);
+    void end_render_pass();
+    void set_pipeline(Pipeline pipe);
+    void set_bindings(Bindings bind);
+    void set_uniforms(const Memory& mem);
+    void draw(uint32_t first_element, uint32_t num_elements, uint32_t num_instances, int32_t base_vertex);
+    void multi_draw_indirect(Buffer args, uint32_t offset, uint32_t draw_count, uint32_t stride);
+    void set_viewport(const Rect& rect);
+    void set_scissor(const Rect& rect);
+    void submit();
+
+    bool new_buffer(Buffer h, const BufferDesc& desc);
+    bool update_buffer(Buffer h, const Memory& mem);
+    std::optional<uint32_t> append_buffer(Buffer h, const Memory& mem);
+    bool new_texture(Texture h, const TextureDesc& desc);
+    bool update_texture(Texture h, const TextureRegion& region, uint32_t mip, const Memory& mem);
+    bool new_shader(Shader h, const ShaderDesc& desc);
+    bool new_render_pass(RenderPass h, const RenderPassDesc& desc);
+    bool new_pipeline(Pipeline h, const PipelineDesc& desc);
+    bool new_sampler(Sampler h, const SamplerDesc& desc);
+    bool is_shader_ready(Shader h);
+    bool is_pipeline_ready(Pipeline h);
+    void destroy_buffer(Buffer h);
+    void destroy_texture(Texture h);
+    void destroy_shader(Shader h);
+    void destroy_render_pass(RenderPass h);
+    void destroy_pipeline(Pipeline h);
+    void destroy_sampler(Sampler h);
+
+    // nothing runs on a GPU, the timings stay empty
+    const std::vector<PassTiming>& pass_timings() const { return _pass_timings; }
+
+    const NullStats& stats() const { return _stats; }
+    void reset_stats() { _stats = {}; }
+
+  private:
+    struct NullBuffer {
+      BufferUsage usage;
+      uint32_t size;
+      uint32_t append_offset;
+    };
+
+    struct NullTexture {
+      uint32_t width;
+      uint32_t height;
+      uint32_t depth;
+    };
+
+    // counts and reports the calls made with a handle that was never created or is already destroyed
+    template<size_t N>
+    bool check_handle(const std::array<uint32_t, N>& live_handles, uint32_t handle, const char* type);
+    // counts and reports the calls made out of order
+    bool check_call(bool valid, const char* error);
+
+    // live handle of each slot, INVALID_HANDLE when the slot is free
+    std::array<uint32_t, MAX_BUFFERS> _buffers;
+    std::array<uint32_t, MAX_TEXTURES> _textures;
+    std::array<uint32_t, MAX_SHADERS> _shaders;
+    std::array<uint32_t, MAX_RENDER_PASSES> _render_passes;
+    std::array<uint32_t, MAX_PIPELINES> _pipelines;
+    std::array<uint32_t, MAX_SAMPLERS> _samplers;
+    std::array<NullBuffer, MAX_BUFFERS> _buffer_infos;
+    std::array<NullTexture, MAX_TEXTURES> _texture_infos;
+    std::vector<Buffer> _stream_buffers;
+
+    NullStats _stats;
+    std::vector<PassTiming> _pass_timings;
+
+    // current state
+    bool _in_pass;
+    Pipeline _pipeline;
+    bool _has_bindings;
+  };
+}
@@ -1,90 +1,505 @@
 #pragma once
 #include "gfx/renderer.h"
+#include "gfx/command_buffer.h"
+#include "gfx/command_list.h"
 
 #include "gl_renderer.h"
 #include "vk_renderer.h"
+#include "null_renderer.h"
+#include "soft_renderer.h"
+#include "handle_pool.h"
+
+#include <iostream>
+#include <assert.h>
 
 namespace gfx {
-#if !(defined(GFX_USE_OPENGL) || defined(GFX_USE_VULKAN))
-#error "Please select a backend with GFX_USE_OPENGL or GFX_USE_VULKAN"
+#if !(defined(GFX_USE_OPENGL) || defined(GFX_USE_VULKAN) || defined(GFX_USE_NULL) || defined(GFX_USE_SOFTWARE))
+#error "Please select a backend with GFX_USE_OPENGL, GFX_USE_VULKAN, GFX_USE_NULL or GFX_USE_SOFTWARE"
 #endif
 
-#if defined(GFX_USE_OPENGL)
+#if defined(GFX_USE_NULL)
+  static NullRenderer ctx;
+#elif defined(GFX_USE_SOFTWARE)
+  static SoftRenderer ctx;
+#elif defined(GFX_USE_OPENGL)
   static GLRenderer ctx;
 #elif defined(GFX_USE_VULKAN)
   static VKRenderer ctx;
 #endif
 
+  // commands recorded in SubmitMode::DEFERRED, replayed at submit
+  static CommandBuffer frame_commands;
+
+  static HandlePool buffer_handles;
+  static HandlePool texture_handles;
+  static HandlePool shader_handles;
+  static HandlePool render_pass_handles;
+  static HandlePool pipeline_handles;
+  static HandlePool sampler_handles;
+
+  enum class ResourceType {
+    BUFFER,
+    TEXTURE,
+    SHADER,
+    RENDER_PASS,
+    PIPELINE,
+    SAMPLER,
+  };
+
+  // resources destroyed by the user, released once the GPU is done with their last frame
+  struct PendingDestroy {
+    ResourceType type;
+    uint32_t handle;
+    uint64_t frame;
+  };
+
+  static std::vector<PendingDestroy> pending_destroys;
+  static uint64_t frame_number = 0;
+
+  static void check_handle(const HandlePool& handles, uint32_t handle, const char* type) {
+#ifndef NDEBUG
+    if (!handles.valid(handle)) {
+      std::cout << "Stale " << type << " handle, slot " << handle_index(handle) << " generation " << handle_generation(handle) << std::endl;
+      assert(false && "Stale handle");
+    }
+#endif
+  }
+
+  static void check_bindings(const Bindings& bind) {
+    check_handle(buffer_handles, bind.vertex_buffer, "buffer");
+    if (bind.index_buffer.has_value())
+      check_handle(buffer_handles, bind.index_buffer.value(), "buffer");
+    if (bind.instance_buffer.has_value())
+      check_handle(buffer_handles, bind.instance_buffer.value(), "buffer");
+    for (const TextureBinding& tex : bind.textures) {
+      check_handle(texture_handles, tex.texture, "texture");
+      if (tex.sampler != INVALID_HANDLE)
+        check_handle(sampler_handles, tex.sampler, "sampler");
+    }
+  }
+
+  static void release_resource(const PendingDestroy& pending) {
+    switch (pending.type) {
+      using enum ResourceType;
+      case BUFFER: {
+        ctx.destroy_buffer(pending.handle);
+        buffer_handles.release(pending.handle);
+      }
+      break;
+      case TEXTURE: {
+        ctx.destroy_texture(pending.handle);
+        texture_handles.release(pending.handle);
+      }
+      break;
+      case SHADER: {
+        ctx.destroy_shader(pending.handle);
+        shader_handles.release(pending.handle);
+      }
+      break;
+      case RENDER_PASS: {
+        ctx.destroy_render_pass(pending.handle);
+        render_pass_handles.release(pending.handle);
+      }
+      break;
+      case PIPELINE: {
+        ctx.destroy_pipeline(pending.handle);
+        pipeline_handles.release(pending.handle);
+      }
+      break;
+      case SAMPLER: {
+        ctx.destroy_sampler(pending.handle);
+        sampler_handles.release(pending.handle);
+      }
+      break;
+    }
+  }
+
+  static void destroy_resource(HandlePool& handles, ResourceType type, uint32_t handle, const char* type_name) {
+    check_handle(handles, handle, type_name);
+    if (!handles.valid(handle))
+      return;
+    handles.invalidate(handle);
+    pending_destroys.push_back(PendingDestroy{ type, handle, frame_number });
+  }
+
+  static void replay_commands(const CommandBuffer& cb) {
+    std::optional<Pipeline> current_pip;
+    const BindingsCommand* current_bind = nullptr;
+    Bindings bind;
+
+    for (const Command& cmd : cb.commands()) {
+      switch (cmd.type) {
+        using enum CommandType;
+        case BEGIN_PASS: {
+          std::optional<RenderPass> pass;
+          if (!cmd.pass.is_default)
+            pass = cmd.pass.pass;
+          ctx.begin_render_pass(pass, *cmd.pass.action);
+          // a new pass does not inherit the state of the previous one
+          current_pip.reset();
+          current_bind = nullptr;
+        }
+        break;
+        case END_PASS: {
+          ctx.end_render_pass();
+        }
+        break;
+        case SET_VIEWPORT: {
+          ctx.set_viewport(Rect(cmd.rect.x, cmd.rect.y, cmd.rect.width, cmd.rect.height));
+        }
+        break;
+        case SET_SCISSOR: {
+          ctx.set_scissor(Rect(cmd.rect.x, cmd.rect.y, cmd.rect.width, cmd.rect.height));
+        }
+        break;
+        case DRAW: {
+          const DrawCommand& draw = cmd.draw;
+          if (current_pip != draw.pipeline) {
+            ctx.set_pipeline(draw.pipeline);
+            current_pip = draw.pipeline;
+            // vertex layout depends on the pipeline
+            current_bind = nullptr;
+          }
+          // bindings recorded by different lists can still be equal
+          if (!current_bind || !same_bindings(*current_bind, *draw.bindings)) {
+            const BindingsCommand& bind_cmd = *draw.bindings;
+            bind.vertex_buffer = bind_cmd.vertex_buffer;
+            bind.index_buffer = bind_cmd.has_index_buffer ? std::optional<Buffer>(bind_cmd.index_buffer) : std::nullopt;
+            bind.textures.assign(bind_cmd.textures, bind_cmd.textures + bind_cmd.num_textures);
+            bind.vertex_buffer_offset = bind_cmd.vertex_buffer_offset;
+            bind.index_buffer_offset = bind_cmd.index_buffer_offset;
+            bind.instance_buffer = bind_cmd.has_instance_buffer ? std::optional<Buffer>(bind_cmd.instance_buffer) : std::nullopt;
+            bind.instance_buffer_offset = bind_cmd.instance_buffer_offset;
+            ctx.set_bindings(bind);
+            current_bind = draw.bindings;
+          }
+          if (draw.uniforms_size > 0) {
+            ctx.set_uniforms(Memory{ const_cast<void*>(draw.uniforms), draw.uniforms_size });
+          }
+          if (draw.indirect) {
+            ctx.multi_draw_indirect(draw.indirect->args, draw.indirect->offset, draw.indirect->draw_count, draw.indirect->stride);
+          } else {
+            ctx.draw(draw.first_element, draw.num_elements, draw.num_instances, draw.base_vertex);
+          }
+        }
+        break;
+      }
+    }
+  }
+
   void Renderer::init(const InitInfo& info) {
+    _submit_mode = info.submit_mode;
+    buffer_handles.init(MAX_BUFFERS);
+    texture_handles.init(MAX_TEXTURES);
+    shader_handles.init(MAX_SHADERS);
+    render_pass_handles.init(MAX_RENDER_PASSES);
+    pipeline_handles.init(MAX_PIPELINES);
+    sampler_handles.init(MAX_SAMPLERS);
     ctx.init(info);
   }
 
   void Renderer::shutdown() {
+    for (const PendingDestroy& pending : pending_destroys) {
+      release_resource(pending);
+    }
+    pending_destroys.clear();
     ctx.shutdown();
   }
 
-  void Renderer::draw(uint32_t first_element, uint32_t num_elements, uint32_t num_instances) {
-    ctx.draw(first_element, num_elements, num_instances);
+  void Renderer::draw(uint32_t first_element, uint32_t num_elements, uint32_t num_instances, int32_t base_vertex) {
+    if (_submit_mode == SubmitMode::DEFERRED) {
+      frame_commands.draw(first_element, num_elements, num_instances, base_vertex);
+      return;
+    }
+    ctx.draw(first_element, num_elements, num_instances, base_vertex);
+  }
+
+  void Renderer::draw_indirect(Buffer args, uint32_t offset) {
+    multi_draw_indirect(args, offset, 1, 0);
+  }
+
+  void Renderer::multi_draw_indirect(Buffer args, uint32_t offset, uint32_t draw_count, uint32_t stride) {
+    check_handle(buffer_handles, args, "buffer");
+    if (_submit_mode == SubmitMode::DEFERRED) {
+      frame_commands.multi_draw_indirect(args, offset, draw_count, stride);
+      return;
+    }
+    ctx.multi_draw_indirect(args, offset, draw_count, stride);
   }
 
   void Renderer::set_viewport(const Rect& rect) {
+    if (_submit_mode == SubmitMode::DEFERRED) {
+      frame_commands.set_viewport(rect);
+      return;
+    }
     ctx.set_viewport(rect);
   }
 
   void Renderer::set_scissor(const Rect& rect) {
+    if (_submit_mode == SubmitMode::DEFERRED) {
+      frame_commands.set_scissor(rect);
+      return;
+    }
     ctx.set_scissor(rect);
   }
 
   void Renderer::begin_default_render_pass(const PassAction& action) {
+    if (_submit_mode == SubmitMode::DEFERRED) {
+      frame_commands.begin_render_pass(std::nullopt, action);
+      return;
+    }
     ctx.begin_render_pass(std::nullopt, action);
   }
 
   void Renderer::begin_render_pass(RenderPass pass, const PassAction& action) {
+    check_handle(render_pass_handles, pass, "render pass");
+    if (_submit_mode == SubmitMode::DEFERRED) {
+      frame_commands.begin_render_pass(pass, action);
+      return;
+    }
     ctx.begin_render_pass(pass, action);
   }
 
   void Renderer::end_render_pass() {
+    if (_submit_mode == SubmitMode::DEFERRED) {
+      frame_commands.end_render_pass();
+      return;
+    }
     ctx.end_render_pass();
   }
 
   void Renderer::set_pipeline(Pipeline pipe) {
+    check_handle(pipeline_handles, pipe, "pipeline");
+    if (_submit_mode == SubmitMode::DEFERRED) {
+      frame_commands.set_pipeline(pipe);
+      return;
+    }
     ctx.set_pipeline(pipe);
   }
 
   void Renderer::set_bindings(Bindings bind) {
+    check_bindings(bind);
+    if (_submit_mode == SubmitMode::DEFERRED) {
+      frame_commands.set_bindings(bind);
+      return;
+    }
     ctx.set_bindings(bind);
   }
 
   void Renderer::set_uniforms(const Memory& mem) {
+    if (_submit_mode == SubmitMode::DEFERRED) {
+      frame_commands.set_uniforms(mem);
+      return;
+    }
     ctx.set_uniforms(mem);
   }
 
+  void Renderer::execute_command_list(CommandList& list) {
+    if (_submit_mode == SubmitMode::DEFERRED) {
+      // merged into the frame at submit, the list can still be recorded until then
+      frame_commands.execute(list._buffer);
+      return;
+    }
+#if defined(GFX_USE_VULKAN)
+    // recorded in parallel with the other lists of the pass
+    ctx.execute_command_list([&list]() {
+      list._buffer.sort();
+      replay_commands(list._buffer);
+      list._buffer.clear();
+    });
+#else
+    list._buffer.sort();
+    replay_commands(list._buffer);
+    list._buffer.clear();
+#endif
+  }
+
   void Renderer::submit() {
+    if (_submit_mode == SubmitMode::DEFERRED) {
+      frame_commands.sort();
+      replay_commands(frame_commands);
+      frame_commands.clear();
+    }
     ctx.submit();
+
+    // the frames in flight after this submit are done with the resources destroyed before them
+    ++frame_number;
+    std::erase_if(pending_destroys, [](const PendingDestroy& pending) {
+      if (pending.frame + MAX_FRAMES_IN_FLIGHT > frame_number)
+        return false;
+      release_resource(pending);
+      return true;
+    });
   }
 
   Buffer Renderer::new_buffer(const BufferDesc& desc) {
-    ctx.new_buffer(_buffer_id, desc);
-    return _buffer_id++;
+    Buffer h = buffer_handles.alloc();
+    if (h == INVALID_HANDLE) {
+      std::cout << "Too many buffers, MAX_BUFFERS is " << MAX_BUFFERS << std::endl;
+      return INVALID_HANDLE;
+    }
+    if (!ctx.new_buffer(h, desc)) {
+      buffer_handles.invalidate(h);
+      buffer_handles.release(h);
+      return INVALID_HANDLE;
+    }
+    return h;
+  }
+
+  bool Renderer::update_buffer(Buffer buffer, const Memory& mem) {
+    check_handle(buffer_handles, buffer, "buffer");
+    return ctx.update_buffer(buffer, mem);
+  }
+
+  std::optional<uint32_t> Renderer::append_buffer(Buffer buffer, const Memory& mem) {
+    check_handle(buffer_handles, buffer, "buffer");
+    return ctx.append_buffer(buffer, mem);
   }
 
   Texture Renderer::new_texture(const TextureDesc& desc) {
-    ctx.new_texture(_texture_id, desc);
-    return _texture_id++;
+    Texture h = texture_handles.alloc();
+    if (h == INVALID_HANDLE) {
+      std::cout << "Too many textures, MAX_TEXTURES is " << MAX_TEXTURES << std::endl;
+      return INVALID_HANDLE;
+    }
+    if (!ctx.new_texture(h, desc)) {
+      texture_handles.invalidate(h);
+      texture_handles.release(h);
+      return INVALID_HANDLE;
+    }
+    return h;
+  }
+
+  bool Renderer::update_texture(Texture texture, const TextureRegion& region, uint32_t mip, const Memory& mem) {
+    check_handle(texture_handles, texture, "texture");
+    return ctx.update_texture(texture, region, mip, mem);
   }
    
   Shader Renderer::new_shader(const ShaderDesc& desc) {
-    ctx.new_shader(_shader_id, desc);
-    return _shader_id++;
+    Shader h = shader_handles.alloc();
+    if (h == INVALID_HANDLE) {
+      std::cout << "Too many shaders, MAX_SHADERS is " << MAX_SHADERS << std::endl;
+      return INVALID_HANDLE;
+    }
+    if (!ctx.new_shader(h, desc)) {
+      shader_handles.invalidate(h);
+      shader_handles.release(h);
+      return INVALID_HANDLE;
+    }
+    return h;
+  }
+
+  Sampler Renderer::new_sampler(const SamplerDesc& desc) {
+    Sampler h = sampler_handles.alloc();
+    if (h == INVALID_HANDLE) {
+      std::cout << "Too many samplers, MAX_SAMPLERS is " << MAX_SAMPLERS << std::endl;
+      return INVALID_HANDLE;
+    }
+    if (!ctx.new_sampler(h, desc)) {
+      sampler_handles.invalidate(h);
+      sampler_handles.release(h);
+      return INVALID_HANDLE;
+    }
+    return h;
   }
 
   RenderPass Renderer::new_render_pass(const RenderPassDesc& desc) {
-    ctx.new_render_pass(_render_pass_id, desc);
-    return _render_pass_id++;
+    for (Texture tex : desc.colors) {
+      check_handle(texture_handles, tex, "texture");
+    }
+    if (desc.depth.has_value())
+      check_handle(texture_handles, desc.depth.value(), "texture");
+
+    RenderPass h = render_pass_handles.alloc();
+    if (h == INVALID_HANDLE) {
+      std::cout << "Too many render passes, MAX_RENDER_PASSES is " << MAX_RENDER_PASSES << std::endl;
+      return INVALID_HANDLE;
+    }
+    if (!ctx.new_render_pass(h, desc)) {
+      render_pass_handles.invalidate(h);
+      render_pass_handles.release(h);
+      return INVALID_HANDLE;
+    }
+    return h;
   }
 
   Pipeline Renderer::new_pipeline(const PipelineDesc& desc) {
-    ctx.new_pipeline(_pipeline_id, desc);
-    return _pipeline_id++;
+    check_handle(shader_handles, desc.shader, "shader");
+    if (desc.fallback != INVALID_HANDLE)
+      check_handle(pipeline_handles, desc.fallback, "pipeline");
+
+    Pipeline h = pipeline_handles.alloc();
+    if (h == INVALID_HANDLE) {
+      std::cout << "Too many pipelines, MAX_PIPELINES is " << MAX_PIPELINES << std::endl;
+      return INVALID_HANDLE;
+    }
+    if (!ctx.new_pipeline(h, desc)) {
+      pipeline_handles.invalidate(h);
+      pipeline_handles.release(h);
+      return INVALID_HANDLE;
+    }
+    return h;
+  }
+
+  bool Renderer::is_shader_ready(Shader shader) {
+    check_handle(shader_handles, shader, "shader");
+    return ctx.is_shader_ready(shader);
+  }
+
+  bool Renderer::is_pipeline_ready(Pipeline pipe) {
+    check_handle(pipeline_handles, pipe, "pipeline");
+    return ctx.is_pipeline_ready(pipe);
+  }
+
+  const std::vector<PassTiming>& Renderer::get_pass_timings() {
+    return ctx.pass_timings();
+  }
+
+  void Renderer::destroy_buffer(Buffer buffer) {
+    destroy_resource(buffer_handles, ResourceType::BUFFER, buffer, "buffer");
+  }
+
+  void Renderer::destroy_texture(Texture texture) {
+    destroy_resource(texture_handles, ResourceType::TEXTURE, texture, "texture");
+  }
+
+  void Renderer::destroy_shader(Shader shader) {
+    destroy_resource(shader_handles, ResourceType::SHADER, shader, "shader");
+  }
+
+  void Renderer::destroy_render_pass(RenderPass pass) {
+    destroy_resource(render_pass_handles, ResourceType::RENDER_PASS, pass, "render pass");
+  }
+
+  void Renderer::destroy_pipeline(Pipeline pipe) {
+    destroy_resource(pipeline_handles, ResourceType::PIPELINE, pipe, "pipeline");
+  }
+
+  void Renderer::destroy_sampler(Sampler sampler) {
+    destroy_resource(sampler_handles, ResourceType::SAMPLER, sampler, "sampler");
+  }
+
+#if defined(GFX_USE_NULL)
+  const NullStats& get_null_stats() {
+    return ctx.stats();
+  }
+
+  void reset_null_stats() {
+    ctx.reset_stats();
+  }
+#endif
+
+#if defined(GFX_USE_VULKAN)
+  const PipelineCacheStats& get_pipeline_cache_stats() {
+    return ctx.pipeline_cache_stats();
   }
-}
\ No newline at end of file
+#endif
+
+#if defined(GFX_USE_SOFTWARE)
+  SoftImage get_soft_image(std::optional<Texture> texture) {
+    if (texture)
+      check_handle(texture_handles, texture.value(), "texture");
+    return ctx.image(texture);
+  }
+#endif
+}
@@ -0,0 +1,1236 @@
+#include "soft_renderer.h"
+
+#include <iostream>
+#include <algorithm>
+#include <cstring>
+#include <cmath>
+#include <limits>
+#include <bit>
+
+#include <SDL2/SDL.h>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define SOFT_USE_SSE2
+#endif
+
+namespace gfx {
+  // same alignment as the appends of the GL backend
+  constexpr uint32_t APPEND_ALIGNMENT = 16;
+  constexpr uint32_t UNIFORMS_ALIGNMENT = 16;
+  // default framebuffer without window nor InitInfo size, the size of the engine gbuffer
+  constexpr uint32_t DEFAULT_WIDTH = 1024;
+  constexpr uint32_t DEFAULT_HEIGHT = 680;
+  // vertices shaded by a task of the thread pool, smaller draws are shaded by the calling thread
+  constexpr uint32_t VERTICES_PER_TASK = 512;
+  // window positions are snapped to 1/256 of pixel so the shared edges give the same coverage
+  constexpr float SUBPIXEL_STEPS = 256.0f;
+
+  // SIMD lanes of the rasterizer, a group of pixels of a row
+#if defined(__AVX2__)
+  constexpr uint32_t LANES = 8;
+  using VFloat = __m256;
+  static inline VFloat v_set(float x) { return _mm256_set1_ps(x); }
+  static inline VFloat v_lanes() { return _mm256_setr_ps(0.0f, 1.0f, 2.0f, 3.0f, 4.0f, 5.0f, 6.0f, 7.0f); }
+  static inline VFloat v_load(const float* p) { return _mm256_loadu_ps(p); }
+  static inline void v_store(float* p, VFloat a) { _mm256_storeu_ps(p, a); }
+  static inline VFloat v_add(VFloat a, VFloat b) { return _mm256_add_ps(a, b); }
+  static inline VFloat v_mul(VFloat a, VFloat b) { return _mm256_mul_ps(a, b); }
+  static inline VFloat v_and(VFloat a, VFloat b) { return _mm256_and_ps(a, b); }
+  static inline VFloat v_lt(VFloat a, VFloat b) { return _mm256_cmp_ps(a, b, _CMP_LT_OQ); }
+  static inline VFloat v_ge(VFloat a, VFloat b) { return _mm256_cmp_ps(a, b, _CMP_GE_OQ); }
+  static inline uint32_t v_mask(VFloat a) { return (uint32_t)_mm256_movemask_ps(a); }
+#elif defined(SOFT_USE_SSE2)
+  constexpr uint32_t LANES = 4;
+  using VFloat = __m128;
+  static inline VFloat v_set(float x) { return _mm_set1_ps(x); }
+  static inline VFloat v_lanes() { return _mm_setr_ps(0.0f, 1.0f, 2.0f, 3.0f); }
+  static inline VFloat v_load(const float* p) { return _mm_loadu_ps(p); }
+  static inline void v_store(float* p, VFloat a) { _mm_storeu_ps(p, a); }
+  static inline VFloat v_add(VFloat a, VFloat b) { return _mm_add_ps(a, b); }
+  static inline VFloat v_mul(VFloat a, VFloat b) { return _mm_mul_ps(a, b); }
+  static inline VFloat v_and(VFloat a, VFloat b) { return _mm_and_ps(a, b); }
+  static inline VFloat v_lt(VFloat a, VFloat b) { return _mm_cmplt_ps(a, b); }
+  static inline VFloat v_ge(VFloat a, VFloat b) { return _mm_cmpge_ps(a, b); }
+  static inline uint32_t v_mask(VFloat a) { return (uint32_t)_mm_movemask_ps(a); }
+#else
+  // portable fallback, the compiler can still vectorize the loops
+  constexpr uint32_t LANES = 4;
+  struct VFloat {
+    float v[LANES];
+  };
+  static inline VFloat v_set(float x) { return VFloat{ { x, x, x, x } }; }
+  static inline VFloat v_lanes() { return VFloat{ { 0.0f, 1.0f, 2.0f, 3.0f } }; }
+  static inline VFloat v_load(const float* p) { VFloat r; std::memcpy(r.v, p, sizeof(r.v)); return r; }
+  static inline void v_store(float* p, VFloat a) { std::memcpy(p, a.v, sizeof(a.v)); }
+  template<typename Op>
+  static inline VFloat v_map(VFloat a, VFloat b, Op op) {
+    VFloat r;
+    for (uint32_t i = 0; i < LANES; i++)
+      r.v[i] = op(a.v[i], b.v[i]);
+    return r;
+  }
+  // comparisons return 1 or 0 per lane
+  static inline VFloat v_add(VFloat a, VFloat b) { return v_map(a, b, [](float x, float y) { return x + y; }); }
+  static inline VFloat v_mul(VFloat a, VFloat b) { return v_map(a, b, [](float x, float y) { return x * y; }); }
+  static inline VFloat v_and(VFloat a, VFloat b) { return v_map(a, b, [](float x, float y) { return (x != 0.0f && y != 0.0f) ? 1.0f : 0.0f; }); }
+  static inline VFloat v_lt(VFloat a, VFloat b) { return v_map(a, b, [](float x, float y) { return x < y ? 1.0f : 0.0f; }); }
+  static inline VFloat v_ge(VFloat a, VFloat b) { return v_map(a, b, [](float x, float y) { return x >= y ? 1.0f : 0.0f; }); }
+  static inline uint32_t v_mask(VFloat a) {
+    uint32_t mask = 0;
+    for (uint32_t i = 0; i < LANES; i++)
+      mask |= (a.v[i] != 0.0f ? 1u : 0u) << i;
+    return mask;
+  }
+#endif
+
+  static_assert(SOFT_TILE_SIZE % LANES == 0, "Tiles must hold whole groups of lanes");
+
+  static uint32_t get_texel_size(TextureFormat format) {
+    switch (format) {
+      using enum TextureFormat;
+      case R8: return 1;
+      case RGB8: return 3;
+      case RGBA8: return 4;
+      case DEPTH: return sizeof(float);
+    }
+    return 0;
+  }
+
+  static uint8_t to_unorm8(float value) {
+    // NaN gives 0
+    value = value > 0.0f ? (value < 1.0f ? value : 1.0f) : 0.0f;
+    return (uint8_t)(value * 255.0f + 0.5f);
+  }
+
+  static inline void write_texel(uint8_t* texel, TextureFormat format, const float color[4]) {
+    switch (format) {
+      using enum TextureFormat;
+      case R8: {
+        texel[0] = to_unorm8(color[0]);
+      }
+      break;
+      case RGB8: {
+        texel[0] = to_unorm8(color[0]);
+        texel[1] = to_unorm8(color[1]);
+        texel[2] = to_unorm8(color[2]);
+      }
+      break;
+      case RGBA8: {
+        texel[0] = to_unorm8(color[0]);
+        texel[1] = to_unorm8(color[1]);
+        texel[2] = to_unorm8(color[2]);
+        texel[3] = to_unorm8(color[3]);
+      }
+      break;
+      case DEPTH: {
+        std::memcpy(texel, &color[0], sizeof(float));
+      }
+      break;
+    }
+  }
+
+  // returns false when the texel is outside of the texture and reads the border color
+  static bool wrap_texel(int32_t& i, int32_t size, Wrap wrap) {
+    switch (wrap) {
+      using enum Wrap;
+      case REPEAT: {
+        i = ((i % size) + size) % size;
+      }
+      break;
+      case MIRRORED_REPEAT: {
+        int32_t period = 2 * size;
+        int32_t m = ((i % period) + period) % period;
+        i = m < size ? m : period - 1 - m;
+      }
+      break;
+      case CLAMP_TO_EDGE: {
+        i = std::clamp(i, 0, size - 1);
+      }
+      break;
+      case CLAMP_TO_BORDER: {
+        return i >= 0 && i < size;
+      }
+    }
+    return true;
+  }
+
+  void soft_fetch(const SoftTexture& texture, int32_t x, int32_t y, int32_t z, float out[4]) {
+    if (!texture.data || x < 0 || y < 0 || z < 0 ||
+      x >= (int32_t)texture.width || y >= (int32_t)texture.height || z >= (int32_t)texture.depth) {
+      out[0] = out[1] = out[2] = out[3] = 0.0f;
+      return;
+    }
+
+    size_t index = ((size_t)z * texture.height + (size_t)y) * texture.width + (size_t)x;
+    const uint8_t* texel = texture.data + index * get_texel_size(texture.format);
+    // missing channels read like GL: 0 for green and blue, 1 for alpha
+    out[1] = out[2] = 0.0f;
+    out[3] = 1.0f;
+    switch (texture.format) {
+      using enum TextureFormat;
+      case R8: {
+        out[0] = texel[0] / 255.0f;
+      }
+      break;
+      case RGB8: {
+        out[0] = texel[0] / 255.0f;
+        out[1] = texel[1] / 255.0f;
+        out[2] = texel[2] / 255.0f;
+      }
+      break;
+      case RGBA8: {
+        out[0] = texel[0] / 255.0f;
+        out[1] = texel[1] / 255.0f;
+        out[2] = texel[2] / 255.0f;
+        out[3] = texel[3] / 255.0f;
+      }
+      break;
+      case DEPTH: {
+        std::memcpy(&out[0], texel, sizeof(float));
+      }
+      break;
+    }
+  }
+
+  void soft_sample(const SoftTexture& texture, float u, float v, float w, float out[4]) {
+    uint32_t dims = texture.type == TextureType::TEXTURE_1D ? 1 : (texture.type == TextureType::TEXTURE_2D ? 2 : 3);
+    const float coords[3] = { u, v, w };
+    const int32_t sizes[3] = { (int32_t)texture.width, (int32_t)texture.height, (int32_t)texture.depth };
+    const Wrap wraps[3] = { texture.sampler.wrap_u, texture.sampler.wrap_v, texture.sampler.wrap_w };
+
+    // only the first level is stored, there is no minification to pick the min filter for
+    if (texture.sampler.mag_filter == Filter::NEAREST) {
+      int32_t texel[3] = { 0, 0, 0 };
+      for (uint32_t d = 0; d < dims; d++) {
+        texel[d] = (int32_t)std::floor(coords[d] * sizes[d]);
+        if (!wrap_texel(texel[d], sizes[d], wraps[d])) {
+          out[0] = out[1] = out[2] = out[3] = 0.0f;
+          return;
+        }
+      }
+      soft_fetch(texture, texel[0], texel[1], texel[2], out);
+      return;
+    }
+
+    // linear: weighted sum of the 2, 4 or 8 closest texels, the border color is 0
+    int32_t base[3] = { 0, 0, 0 };
+    float frac[3] = { 0.0f, 0.0f, 0.0f };
+    for (uint32_t d = 0; d < dims; d++) {
+      float coord = coords[d] * sizes[d] - 0.5f;
+      float floor_coord = std::floor(coord);
+      base[d] = (int32_t)floor_coord;
+      frac[d] = coord - floor_coord;
+    }
+
+    out[0] = out[1] = out[2] = out[3] = 0.0f;
+    for (uint32_t corner = 0; corner < (1u << dims); corner++) {
+      float weight = 1.0f;
+      int32_t texel[3] = { 0, 0, 0 };
+      bool border = false;
+      for (uint32_t d = 0; d < dims; d++) {
+        uint32_t bit = (corner >> d) & 1;
+        weight *= bit ? frac[d] : 1.0f - frac[d];
+        texel[d] = base[d] + (int32_t)bit;
+        border |= !wrap_texel(texel[d], sizes[d], wraps[d]);
+      }
+      if (border || weight == 0.0f)
+        continue;
+
+      float color[4];
+      soft_fetch(texture, texel[0], texel[1], texel[2], color);
+      for (uint32_t c = 0; c < 4; c++) {
+        out[c] += color[c] * weight;
+      }
+    }
+  }
+
+  void SoftRenderer::init(const InitInfo& info) {
+    _window = info.window;
+
+    uint32_t width = info.width > 0 ? info.width : DEFAULT_WIDTH;
+    uint32_t height = info.height > 0 ? info.height : DEFAULT_HEIGHT;
+    if (_window) {
+      int window_width = 0;
+      int window_height = 0;
+      SDL_GetWindowSize(_window, &window_width, &window_height);
+      width = (uint32_t)std::max(window_width, 1);
+      height = (uint32_t)std::max(window_height, 1);
+    }
+    _backbuffer = SoftTextureStorage{
+      .data = std::vector<uint8_t>((size_t)width * height * 4),
+      .type = TextureType::TEXTURE_2D,
+      .format = TextureFormat::RGBA8,
+      .width = width,
+      .height = height,
+      .depth = 1,
+    };
+    _backbuffer_depth.assign((size_t)width * height, 1.0f);
+
+    _pool.init(0);
+    std::cout << "Software backend: " << _pool.num_threads() << " threads, " << LANES << " lanes" << std::endl;
+
+    _in_pass = false;
+    _pipeline = nullptr;
+    _has_bindings = false;
+    _uniforms = nullptr;
+  }
+
+  void SoftRenderer::shutdown() {
+    _pool.shutdown();
+    _stream_buffers.clear();
+  }
+
+  void SoftRenderer::begin_render_pass(std::optional<RenderPass> pass, const PassAction& action) {
+    if (_in_pass) {
+      std::cout << "begin_render_pass called inside a render pass" << std::endl;
+      return;
+    }
+
+    _pass_start = std::chrono::steady_clock::now();
+    _num_colors = 0;
+    _depth = nullptr;
+    _pass_name = nullptr;
+    if (!pass) {
+      // follows the size of the window
+      if (_window) {
+        int window_width = 0;
+        int window_height = 0;
+        SDL_GetWindowSize(_window, &window_width, &window_height);
+        if ((uint32_t)window_width != _backbuffer.width || (uint32_t)window_height != _backbuffer.height) {
+          _backbuffer.width = (uint32_t)std::max(window_width, 1);
+          _backbuffer.height = (uint32_t)std::max(window_height, 1);
+          _backbuffer.data.assign((size_t)_backbuffer.width * _backbuffer.height * 4, 0);
+          _backbuffer_depth.assign((size_t)_backbuffer.width * _backbuffer.height, 1.0f);
+        }
+      }
+      _colors[_num_colors++] = SoftTarget{
+        .data = _backbuffer.data.data(),
+        .format = _backbuffer.format,
+        .texel_size = 4,
+        .row_size = _backbuffer.width * 4,
+      };
+      _depth = _backbuffer_depth.data();
+      _width = _backbuffer.width;
+      _height = _backbuffer.height;
+    } else {
+      const SoftRenderPass& rpass = _render_passes[handle_index(pass.value())];
+      _pass_name = &rpass.name;
+      for (Texture h : rpass.colors) {
+        SoftTextureStorage& texture = _textures[handle_index(h)];
+        uint32_t texel_size = get_texel_size(texture.format);
+        _colors[_num_colors++] = SoftTarget{
+          .data = texture.data.data(),
+          .format = texture.format,
+          .texel_size = texel_size,
+          .row_size = texture.width * texel_size,
+        };
+      }
+      if (rpass.depth)
+        _depth = (float*)_textures[handle_index(rpass.depth.value())].data.data();
+      _width = rpass.width;
+      _height = rpass.height;
+    }
+
+    _clear_color = action.color_action.action == Action::CLEAR;
+    const Color& color = action.color_action.color;
+    _clear_color_value[0] = color.r;
+    _clear_color_value[1] = color.g;
+    _clear_color_value[2] = color.b;
+    _clear_color_value[3] = color.a;
+    _clear_depth = action.depth_action.action == Action::CLEAR;
+    _clear_depth_value = action.depth_action.value;
+
+    // unlike GL the viewport does not outlive the pass
+    _viewport = Rect(0, 0, _width, _height);
+    _tiles_x = (_width + SOFT_TILE_SIZE - 1) / SOFT_TILE_SIZE;
+    _tiles_y = (_height + SOFT_TILE_SIZE - 1) / SOFT_TILE_SIZE;
+    if (_bins.size() < (size_t)_tiles_x * _tiles_y)
+      _bins.resize((size_t)_tiles_x * _tiles_y);
+
+    _in_pass = true;
+  }
+
+  void SoftRenderer::end_render_pass() {
+    if (!_in_pass) {
+      std::cout << "end_render_pass called outside of a render pass" << std::endl;
+      return;
+    }
+
+    // every tile is visited, even empty ones have to be cleared
+    _pool.run(_tiles_x * _tiles_y, [this](uint32_t tile) {
+      rasterize_tile(tile);
+    });
+
+    for (uint32_t i = 0; i < _tiles_x * _tiles_y; i++) {
+      _bins[i].clear();
+    }
+    _draws.clear();
+    _vertices.clear();
+    _triangles.clear();
+    _in_pass = false;
+
+    if (_frame_timings.size() < MAX_TIMED_PASSES) {
+      std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - _pass_start;
+      _frame_timings.push_back(PassTiming{
+        .name = _pass_name ? *_pass_name : DEFAULT_PASS_NAME,
+        .gpu_ms = elapsed.count(),
+      });
+    }
+  }
+
+  void SoftRenderer::set_pipeline(Pipeline pipe) {
+    const SoftPipeline* pip = &_pipelines[handle_index(pipe)];
+    if (pip != _pipeline) {
+      // the vertex layout depends on the pipeline
+      _has_bindings = false;
+      // uniforms are tied to the pipeline shader
+      _uniforms = nullptr;
+    }
+    _pipeline = pip;
+  }
+
+  void SoftRenderer::set_bindings(Bindings bind) {
+    _bindings = std::move(bind);
+    _has_bindings = true;
+  }
+
+  void SoftRenderer::set_uniforms(const Memory& mem) {
+    // the draws keep a pointer to the uniforms until the end of the frame
+    void* data = _arena.alloc(mem.size, UNIFORMS_ALIGNMENT);
+    std::memcpy(data, mem.data, mem.size);
+    _uniforms = data;
+  }
+
+  void SoftRenderer::draw(uint32_t first_element, uint32_t num_elements, uint32_t num_instances, int32_t base_vertex) {
+    draw_instances(first_element, num_elements, 0, num_instances, base_vertex);
+  }
+
+  void SoftRenderer::multi_draw_indirect(Buffer h, uint32_t offset, uint32_t draw_count, uint32_t stride) {
+    const SoftBuffer& args = _buffers[handle_index(h)];
+    if (args.type != BufferType::INDIRECT_BUFFER) {
+      std::cout << "Indirect draws need a buffer created as INDIRECT_BUFFER" << std::endl;
+      return;
+    }
+    if (!_pipeline)
+      return;
+
+    bool indexed = _pipeline->index_type != IndexType::NONE;
+    if (stride == 0)
+      stride = indexed ? sizeof(DrawIndexedIndirectArgs) : sizeof(DrawIndirectArgs);
+    size_t args_size = indexed ? sizeof(DrawIndexedIndirectArgs) : sizeof(DrawIndirectArgs);
+
+    for (uint32_t i = 0; i < draw_count; i++) {
+      size_t cmd_offset = (size_t)offset + (size_t)i * stride;
+      if (cmd_offset + args_size > args.data.size()) {
+        std::cout << "Indirect draw arguments are outside of the buffer" << std::endl;
+        return;
+      }
+      const uint8_t* cmd = args.data.data() + cmd_offset;
+      if (indexed) {
+        DrawIndexedIndirectArgs draw;
+        std::memcpy(&draw, cmd, sizeof(draw));
+        draw_instances(draw.first_element, draw.num_elements, draw.first_instance, draw.num_instances, draw.base_vertex);
+      } else {
+        DrawIndirectArgs draw;
+        std::memcpy(&draw, cmd, sizeof(draw));
+        draw_instances(draw.first_element, draw.num_elements, draw.first_instance, draw.num_instances, 0);
+      }
+    }
+  }
+
+  void SoftRenderer::draw_instances(uint32_t first_element, uint32_t num_elements, uint32_t first_instance, uint32_t num_instances, int32_t base_vertex) {
+    if (!_in_pass) {
+      std::cout << "draw called outside of a render pass" << std::endl;
+      return;
+    }
+    if (!_pipeline || !_has_bindings) {
+      std::cout << "draw called without pipeline or bindings" << std::endl;
+      return;
+    }
+    if (num_elements == 0 || num_instances == 0)
+      return;
+
+    const SoftPipeline& pip = *_pipeline;
+    if (pip.primitive_type == PrimitiveType::POINTS || pip.primitive_type == PrimitiveType::LINES) {
+      static bool s_reported = false;
+      if (!s_reported)
+        std::cout << "Software backend: points and lines are not rasterized" << std::endl;
+      s_reported = true;
+      return;
+    }
+
+    const SoftShader& shader = _shaders[handle_index(pip.shader)];
+    const SoftShaderDesc& stages = shader.desc;
+
+    // vertex and instance streams
+    const SoftBuffer& vbuffer = _buffers[handle_index(_bindings.vertex_buffer)];
+    if (_bindings.vertex_buffer_offset > vbuffer.data.size())
+      return;
+    const uint8_t* vertex_data = vbuffer.data.data() + _bindings.vertex_buffer_offset;
+    size_t vertex_data_size = vbuffer.data.size() - _bindings.vertex_buffer_offset;
+
+    const uint8_t* instance_data = nullptr;
+    size_t instance_data_size = 0;
+    if (pip.instance_stride > 0) {
+      if (!_bindings.instance_buffer) {
+        std::cout << "The pipeline has PER_INSTANCE attributes but the bindings have no instance buffer" << std::endl;
+        return;
+      }
+      const SoftBuffer& ibuffer = _buffers[handle_index(_bindings.instance_buffer.value())];
+      if (_bindings.instance_buffer_offset > ibuffer.data.size())
+        return;
+      instance_data = ibuffer.data.data() + _bindings.instance_buffer_offset;
+      instance_data_size = ibuffer.data.size() - _bindings.instance_buffer_offset;
+    }
+
+    // elements to vertex indices
+    const uint8_t* index_data = nullptr;
+    uint32_t index_size = 0;
+    if (pip.index_type != IndexType::NONE) {
+      if (!_bindings.index_buffer) {
+        std::cout << "The pipeline is indexed but the bindings have no index buffer" << std::endl;
+        return;
+      }
+      const SoftBuffer& ibuffer = _buffers[handle_index(_bindings.index_buffer.value())];
+      index_size = pip.index_type == IndexType::UINT16 ? sizeof(uint16_t) : sizeof(uint32_t);
+      size_t end = (size_t)_bindings.index_buffer_offset + ((size_t)first_element + num_elements) * index_size;
+      if (end > ibuffer.data.size()) {
+        std::cout << "Indexed draw reads past the end of the index buffer" << std::endl;
+        return;
+      }
+      index_data = ibuffer.data.data() + _bindings.index_buffer_offset + (size_t)first_element * index_size;
+    }
+    auto vertex_at = [&](uint32_t element) -> int64_t {
+      if (!index_data)
+        return (int64_t)first_element + element;
+      if (index_size == sizeof(uint16_t)) {
+        uint16_t index;
+        std::memcpy(&index, index_data + (size_t)element * index_size, sizeof(index));
+        return (int64_t)index + base_vertex;
+      }
+      uint32_t index;
+      std::memcpy(&index, index_data + (size_t)element * index_size, sizeof(index));
+      return (int64_t)index + base_vertex;
+    };
+
+    // only the vertices between the smallest and the largest index are shaded, once per instance
+    int64_t first_vertex = std::numeric_limits<int64_t>::max();
+    int64_t last_vertex = std::numeric_limits<int64_t>::min();
+    for (uint32_t i = 0; i < num_elements; i++) {
+      int64_t vertex = vertex_at(i);
+      first_vertex = std::min(first_vertex, vertex);
+      last_vertex = std::max(last_vertex, vertex);
+    }
+    if (first_vertex < 0 || (pip.vertex_stride > 0 && (size_t)(last_vertex + 1) * pip.vertex_stride > vertex_data_size)) {
+      std::cout << "Draw reads vertices outside of the vertex buffer" << std::endl;
+      return;
+    }
+    for (uint32_t i = 0; i < pip.num_attributes; i++) {
+      const SoftAttribute& attr = pip.attributes[i];
+      if (attr.per_instance && (size_t)((first_instance + num_instances - 1) / attr.step_rate + 1) * pip.instance_stride > instance_data_size) {
+        std::cout << "Draw reads instances outside of the instance buffer" << std::endl;
+        return;
+      }
+    }
+
+    // draw state, the pass is rasterized later
+    SoftDraw draw{
+      .shader = &shader,
+      .uniforms = _uniforms,
+      .num_textures = (uint32_t)std::min(_bindings.textures.size(), (size_t)MAX_SOFT_TEXTURES),
+      .vertex_size = 4 + stages.num_varyings + stages.num_flat_varyings,
+    };
+    for (uint32_t i = 0; i < draw.num_textures; i++) {
+      const TextureBinding& binding = _bindings.textures[i];
+      const SoftTextureStorage& texture = _textures[handle_index(binding.texture)];
+      draw.textures[i] = SoftTexture{
+        .data = texture.data.data(),
+        .type = texture.type,
+        .format = texture.format,
+        .width = texture.width,
+        .height = texture.height,
+        .depth = texture.depth,
+        // like the GL backend the textures are created with nearest filtering and border wrap
+        .sampler = binding.sampler != INVALID_HANDLE ? _samplers[handle_index(binding.sampler)] : SamplerDesc{
+          .wrap_u = Wrap::CLAMP_TO_BORDER,
+          .wrap_v = Wrap::CLAMP_TO_BORDER,
+          .wrap_w = Wrap::CLAMP_TO_BORDER,
+        },
+      };
+    }
+    uint32_t draw_index = (uint32_t)_draws.size();
+    _draws.push_back(draw);
+
+    // vertex stage
+    uint32_t num_vertices = (uint32_t)(last_vertex - first_vertex + 1);
+    uint32_t total_vertices = num_vertices * num_instances;
+    uint32_t vertex_size = draw.vertex_size;
+    size_t base = _vertices.size();
+    _vertices.resize(base + (size_t)total_vertices * vertex_size);
+
+    auto shade = [&](uint32_t task) {
+      uint32_t begin = task * VERTICES_PER_TASK;
+      uint32_t end = std::min(begin + VERTICES_PER_TASK, total_vertices);
+      SoftVertexIn in;
+      SoftVertexOut out;
+      in.uniforms = draw.uniforms;
+      for (uint32_t i = begin; i < end; i++) {
+        uint32_t instance = first_instance + i / num_vertices;
+        uint32_t vertex = (uint32_t)first_vertex + i % num_vertices;
+        in.vertex_id = vertex;
+        in.instance_id = instance;
+        for (uint32_t a = 0; a < pip.num_attributes; a++) {
+          const SoftAttribute& attr = pip.attributes[a];
+          const uint8_t* element = attr.per_instance ?
+            instance_data + (size_t)(instance / attr.step_rate) * pip.instance_stride :
+            vertex_data + (size_t)vertex * pip.vertex_stride;
+          in.attributes[a] = (const float*)(element + attr.offset);
+        }
+
+        stages.vertex(in, out);
+
+        float* dst = _vertices.data() + base + (size_t)i * vertex_size;
+        std::memcpy(dst, out.position, sizeof(out.position));
+        std::memcpy(dst + 4, out.varyings, stages.num_varyings * sizeof(float));
+        std::memcpy(dst + 4 + stages.num_varyings, out.flat_varyings, stages.num_flat_varyings * sizeof(float));
+      }
+    };
+    _pool.run((total_vertices + VERTICES_PER_TASK - 1) / VERTICES_PER_TASK, shade);
+
+    // primitive assembly, the last vertex of a triangle provides the flat varyings like GL
+    for (uint32_t instance = 0; instance < num_instances; instance++) {
+      size_t instance_base = base + (size_t)instance * num_vertices * vertex_size;
+      auto offset = [&](uint32_t element) {
+        return (uint32_t)(instance_base + (size_t)(vertex_at(element) - first_vertex) * vertex_size);
+      };
+
+      switch (pip.primitive_type) {
+        case PrimitiveType::TRIANGLES: {
+          for (uint32_t i = 0; i + 2 < num_elements; i += 3) {
+            add_triangle(offset(i), offset(i + 1), offset(i + 2), draw_index);
+          }
+        }
+        break;
+        case PrimitiveType::TRIANGLE_STRIP: {
+          for (uint32_t i = 0; i + 2 < num_elements; i++) {
+            // odd triangles are flipped to keep the winding
+            if (i % 2 == 0)
+              add_triangle(offset(i), offset(i + 1), offset(i + 2), draw_index);
+            else
+              add_triangle(offset(i + 1), offset(i), offset(i + 2), draw_index);
+          }
+        }
+        break;
+        case PrimitiveType::TRIANGLE_FAN: {
+          for (uint32_t i = 1; i + 1 < num_elements; i++) {
+            add_triangle(offset(0), offset(i), offset(i + 1), draw_index);
+          }
+        }
+        break;
+        default:
+        break;
+      }
+    }
+  }
+
+  uint32_t SoftRenderer::lerp_vertex(uint32_t a, uint32_t b, float t, uint32_t vertex_size) {
+    size_t offset = _vertices.size();
+    _vertices.resize(offset + vertex_size);
+    const float* va = _vertices.data() + a;
+    const float* vb = _vertices.data() + b;
+    float* dst = _vertices.data() + offset;
+    for (uint32_t i = 0; i < vertex_size; i++) {
+      dst[i] = va[i] + (vb[i] - va[i]) * t;
+    }
+    return (uint32_t)offset;
+  }
+
+  void SoftRenderer::add_triangle(uint32_t v0, uint32_t v1, uint32_t v2, uint32_t draw) {
+    // one bit per clip plane: left, right, bottom, top, near, far
+    constexpr uint32_t CLIP_NEAR = 1 << 4;
+    auto outcode = [this](uint32_t v) {
+      const float* p = _vertices.data() + v;
+      float w = p[3];
+      return (p[0] < -w ? 1u : 0u) | (p[0] > w ? 2u : 0u) | (p[1] < -w ? 4u : 0u) |
+        (p[1] > w ? 8u : 0u) | (p[2] < -w ? CLIP_NEAR : 0u) | (p[2] > w ? 32u : 0u);
+    };
+
+    uint32_t c0 = outcode(v0);
+    uint32_t c1 = outcode(v1);
+    uint32_t c2 = outcode(v2);
+    // all the vertices are on the outer side of the same plane
+    if (c0 & c1 & c2)
+      return;
+    // the other planes are handled by the bounding box and the depth test
+    if (!((c0 | c1 | c2) & CLIP_NEAR)) {
+      setup_triangle(v0, v1, v2, v2, draw);
+      return;
+    }
+
+    // clips against z = -w, the polygon keeps the winding of the triangle
+    uint32_t vertex_size = _draws[draw].vertex_size;
+    const uint32_t in[3] = { v0, v1, v2 };
+    uint32_t polygon[4];
+    uint32_t count = 0;
+    for (uint32_t i = 0; i < 3; i++) {
+      uint32_t current = in[i];
+      uint32_t next = in[(i + 1) % 3];
+      float d_current = _vertices[current + 2] + _vertices[current + 3];
+      float d_next = _vertices[next + 2] + _vertices[next + 3];
+      if (d_current >= 0.0f)
+        polygon[count++] = current;
+      if ((d_current >= 0.0f) != (d_next >= 0.0f))
+        polygon[count++] = lerp_vertex(current, next, d_current / (d_current - d_next), vertex_size);
+    }
+    for (uint32_t i = 1; i + 1 < count; i++) {
+      setup_triangle(polygon[0], polygon[i], polygon[i + 1], v2, draw);
+    }
+  }
+
+  void SoftRenderer::setup_triangle(uint32_t v0, uint32_t v1, uint32_t v2, uint32_t flat, uint32_t draw) {
+    SoftTriangle tri;
+    tri.vertices[0] = v0;
+    tri.vertices[1] = v1;
+    tri.vertices[2] = v2;
+    tri.flat = flat;
+    tri.draw = draw;
+
+    // window coordinates, y goes up like GL
+    float x[3];
+    float y[3];
+    for (uint32_t i = 0; i < 3; i++) {
+      const float* p = _vertices.data() + tri.vertices[i];
+      float inv_w = 1.0f / p[3];
+      float window_x = (p[0] * inv_w * 0.5f + 0.5f) * _viewport.width + _viewport.x;
+      float window_y = (p[1] * inv_w * 0.5f + 0.5f) * _viewport.height + _viewport.y;
+      x[i] = std::round(window_x * SUBPIXEL_STEPS) / SUBPIXEL_STEPS;
+      y[i] = std::round(window_y * SUBPIXEL_STEPS) / SUBPIXEL_STEPS;
+      tri.z[i] = p[2] * inv_w * 0.5f + 0.5f;
+      tri.inv_w[i] = inv_w;
+    }
+
+    // counter clockwise triangles are front facing like the GL default
+    float area = (x[1] - x[0]) * (y[2] - y[0]) - (x[2] - x[0]) * (y[1] - y[0]);
+    if (!(std::abs(area) > 0.0f))
+      return;
+    bool front = area > 0.0f;
+    CullMode cull = _pipeline->cull;
+    if ((cull == CullMode::BACK && !front) || (cull == CullMode::FRONT && front))
+      return;
+    if (!front) {
+      // the edge functions are positive inside counter clockwise triangles
+      std::swap(tri.vertices[1], tri.vertices[2]);
+      std::swap(x[1], x[2]);
+      std::swap(y[1], y[2]);
+      std::swap(tri.z[1], tri.z[2]);
+      std::swap(tri.inv_w[1], tri.inv_w[2]);
+      area = -area;
+    }
+
+    tri.top_left = 0;
+    for (uint32_t i = 0; i < 3; i++) {
+      uint32_t j = (i + 1) % 3;
+      uint32_t k = (i + 2) % 3;
+      tri.a[i] = y[j] - y[k];
+      tri.b[i] = x[k] - x[j];
+      tri.c[i] = x[j] * y[k] - x[k] * y[j];
+      // edges going down or left, the pixel centers on them belong to this triangle
+      if (tri.a[i] > 0.0f || (tri.a[i] == 0.0f && tri.b[i] < 0.0f))
+        tri.top_left |= 1 << i;
+    }
+    tri.inv_area = 1.0f / area;
+
+    // pixels whose center is in the bounding box, clipped by the viewport and the targets
+    float min_x = std::max((float)_viewport.x, 0.0f);
+    float min_y = std::max((float)_viewport.y, 0.0f);
+    float max_x = std::min((float)(_viewport.x + _viewport.width), (float)_width) - 1.0f;
+    float max_y = std::min((float)(_viewport.y + _viewport.height), (float)_height) - 1.0f;
+    float box_min_x = std::max(std::ceil(std::min({ x[0], x[1], x[2] }) - 0.5f), min_x);
+    float box_min_y = std::max(std::ceil(std::min({ y[0], y[1], y[2] }) - 0.5f), min_y);
+    float box_max_x = std::min(std::floor(std::max({ x[0], x[1], x[2] }) - 0.5f), max_x);
+    float box_max_y = std::min(std::floor(std::max({ y[0], y[1], y[2] }) - 0.5f), max_y);
+    if (!(box_min_x <= box_max_x && box_min_y <= box_max_y))
+      return;
+    tri.min_x = (int32_t)box_min_x;
+    tri.min_y = (int32_t)box_min_y;
+    tri.max_x = (int32_t)box_max_x;
+    tri.max_y = (int32_t)box_max_y;
+
+    uint32_t index = (uint32_t)_triangles.size();
+    _triangles.push_back(tri);
+
+    for (uint32_t ty = (uint32_t)tri.min_y / SOFT_TILE_SIZE; ty <= (uint32_t)tri.max_y / SOFT_TILE_SIZE; ty++) {
+      for (uint32_t tx = (uint32_t)tri.min_x / SOFT_TILE_SIZE; tx <= (uint32_t)tri.max_x / SOFT_TILE_SIZE; tx++) {
+        _bins[ty * _tiles_x + tx].push_back(index);
+      }
+    }
+  }
+
+  void SoftRenderer::rasterize_tile(uint32_t tile) {
+    int32_t tile_x = (int32_t)((tile % _tiles_x) * SOFT_TILE_SIZE);
+    int32_t tile_y = (int32_t)((tile / _tiles_x) * SOFT_TILE_SIZE);
+    int32_t tile_width = std::min((int32_t)SOFT_TILE_SIZE, (int32_t)_width - tile_x);
+    int32_t tile_height = std::min((int32_t)SOFT_TILE_SIZE, (int32_t)_height - tile_y);
+
+    // the depth of the tile stays in the cache of this thread until the tile is done
+    alignas(32) float depth[SOFT_TILE_SIZE * SOFT_TILE_SIZE];
+    if (_depth) {
+      for (int32_t y = 0; y < tile_height; y++) {
+        float* row = depth + y * SOFT_TILE_SIZE;
+        if (_clear_depth)
+          std::fill(row, row + tile_width, _clear_depth_value);
+        else
+          std::memcpy(row, _depth + (size_t)(tile_y + y) * _width + tile_x, tile_width * sizeof(float));
+      }
+    }
+
+    if (_clear_color) {
+      for (uint32_t c = 0; c < _num_colors; c++) {
+        const SoftTarget& target = _colors[c];
+        uint8_t clear_texel[sizeof(float) * 4];
+        write_texel(clear_texel, target.format, _clear_color_value);
+        for (int32_t y = 0; y < tile_height; y++) {
+          uint8_t* texel = target.data + (size_t)(tile_y + y) * target.row_size + (size_t)tile_x * target.texel_size;
+          for (int32_t x = 0; x < tile_width; x++, texel += target.texel_size) {
+            std::memcpy(texel, clear_texel, target.texel_size);
+          }
+        }
+      }
+    }
+
+    // the state read per fragment is kept in locals, the writes to the targets could alias the members
+    const uint32_t num_colors = _num_colors;
+    const std::array<SoftTarget, MAX_SOFT_COLOR_TARGETS> colors = _colors;
+    const bool has_depth = _depth != nullptr;
+    const float* vertex_data = _vertices.data();
+
+    const VFloat lanes = v_lanes();
+    const float tie = std::numeric_limits<float>::denorm_min();
+    float varyings[MAX_SOFT_VARYINGS];
+    alignas(32) float l0[LANES];
+    alignas(32) float l1[LANES];
+    alignas(32) float l2[LANES];
+    alignas(32) float z[LANES];
+    SoftFragmentOut out;
+
+    for (uint32_t index : _bins[tile]) {
+      const SoftTriangle& tri = _triangles[index];
+      const SoftDraw& draw = _draws[tri.draw];
+      const SoftShaderDesc& stages = draw.shader->desc;
+      const SoftFragmentShader* fragment = stages.fragment ? &stages.fragment : nullptr;
+      const uint32_t num_varyings = stages.num_varyings;
+
+      int32_t min_x = std::max(tri.min_x, tile_x);
+      int32_t min_y = std::max(tri.min_y, tile_y);
+      int32_t max_x = std::min(tri.max_x, tile_x + tile_width - 1);
+      int32_t max_y = std::min(tri.max_y, tile_y + tile_height - 1);
+
+      VFloat a[3];
+      VFloat b[3];
+      VFloat c[3];
+      // pixel centers on an edge are covered by the top left edges only
+      VFloat bias[3];
+      for (uint32_t i = 0; i < 3; i++) {
+        a[i] = v_set(tri.a[i]);
+        b[i] = v_set(tri.b[i]);
+        c[i] = v_set(tri.c[i]);
+        bias[i] = v_set((tri.top_left >> i) & 1 ? 0.0f : tie);
+      }
+      const VFloat inv_area = v_set(tri.inv_area);
+      const VFloat z0 = v_set(tri.z[0]);
+      const VFloat z1 = v_set(tri.z[1]);
+      const VFloat z2 = v_set(tri.z[2]);
+      const VFloat range_min = v_set((float)min_x);
+      const VFloat range_max = v_set((float)(max_x + 1));
+      const float inv_w0 = tri.inv_w[0];
+      const float inv_w1 = tri.inv_w[1];
+      const float inv_w2 = tri.inv_w[2];
+
+      const float* varyings0 = vertex_data + tri.vertices[0] + 4;
+      const float* varyings1 = vertex_data + tri.vertices[1] + 4;
+      const float* varyings2 = vertex_data + tri.vertices[2] + 4;
+      SoftFragmentIn in{
+        .varyings = varyings,
+        .flat_varyings = vertex_data + tri.flat + 4 + num_varyings,
+        .uniforms = draw.uniforms,
+        .textures = draw.textures.data(),
+        .num_textures = draw.num_textures,
+      };
+
+      // groups of lanes start on a multiple of LANES inside the tile so the depth loads stay in the tile
+      int32_t start_x = tile_x + ((min_x - tile_x) & ~(int32_t)(LANES - 1));
+      for (int32_t y = min_y; y <= max_y; y++) {
+        VFloat center_y = v_set((float)y + 0.5f);
+        VFloat row[3];
+        for (uint32_t i = 0; i < 3; i++) {
+          row[i] = v_add(v_mul(b[i], center_y), c[i]);
+        }
+        float* depth_row = depth + (y - tile_y) * SOFT_TILE_SIZE;
+
+        for (int32_t x = start_x; x <= max_x; x += (int32_t)LANES) {
+          VFloat center_x = v_add(v_set((float)x + 0.5f), lanes);
+          VFloat e0 = v_add(v_mul(a[0], center_x), row[0]);
+          VFloat e1 = v_add(v_mul(a[1], center_x), row[1]);
+          VFloat e2 = v_add(v_mul(a[2], center_x), row[2]);
+          VFloat inside = v_and(v_and(v_ge(e0, bias[0]), v_ge(e1, bias[1])), v_ge(e2, bias[2]));
+          inside = v_and(inside, v_and(v_ge(center_x, range_min), v_lt(center_x, range_max)));
+          uint32_t mask = v_mask(inside);
+          if (!mask)
+            continue;
+
+          VFloat b0 = v_mul(e0, inv_area);
+          VFloat b1 = v_mul(e1, inv_area);
+          VFloat b2 = v_mul(e2, inv_area);
+          VFloat pixel_z = v_add(v_add(v_mul(b0, z0), v_mul(b1, z1)), v_mul(b2, z2));
+          if (has_depth) {
+            // early depth test, the depth is only written by the fragments that are not discarded
+            mask &= v_mask(v_lt(pixel_z, v_load(depth_row + (x - tile_x))));
+            if (!mask)
+              continue;
+          }
+
+          v_store(z, pixel_z);
+          if (!fragment) {
+            for (; mask; mask &= mask - 1) {
+              uint32_t lane = (uint32_t)std::countr_zero(mask);
+              depth_row[x - tile_x + (int32_t)lane] = z[lane];
+            }
+            continue;
+          }
+
+          v_store(l0, b0);
+          v_store(l1, b1);
+          v_store(l2, b2);
+          for (; mask; mask &= mask - 1) {
+            uint32_t lane = (uint32_t)std::countr_zero(mask);
+            int32_t pixel_x = x + (int32_t)lane;
+
+            // perspective correct weights
+            float w0 = l0[lane] * inv_w0;
+            float w1 = l1[lane] * inv_w1;
+            float w2 = l2[lane] * inv_w2;
+            float inv_w = w0 + w1 + w2;
+            float scale = 1.0f / inv_w;
+            w0 *= scale;
+            w1 *= scale;
+            w2 *= scale;
+            for (uint32_t i = 0; i < num_varyings; i++) {
+              varyings[i] = varyings0[i] * w0 + varyings1[i] * w1 + varyings2[i] * w2;
+            }
+
+            in.frag_coord[0] = (float)pixel_x + 0.5f;
+            in.frag_coord[1] = (float)y + 0.5f;
+            in.frag_coord[2] = z[lane];
+            in.frag_coord[3] = inv_w;
+            if (!(*fragment)(in, out))
+              continue;
+
+            if (has_depth)
+              depth_row[pixel_x - tile_x] = z[lane];
+            for (uint32_t t = 0; t < num_colors; t++) {
+              const SoftTarget& target = colors[t];
+              write_texel(target.data + (size_t)y * target.row_size + (size_t)pixel_x * target.texel_size, target.format, out.colors[t]);
+            }
+          }
+        }
+      }
+    }
+
+    if (_depth) {
+      for (int32_t y = 0; y < tile_height; y++) {
+        std::memcpy(_depth + (size_t)(tile_y + y) * _width + tile_x, depth + y * SOFT_TILE_SIZE, tile_width * sizeof(float));
+      }
+    }
+  }
+
+  void SoftRenderer::set_viewport(const Rect& rect) {
+    _viewport = rect;
+  }
+
+  void SoftRenderer::set_scissor(const Rect&) {
+    // the GL backend does not enable the scissor test either
+  }
+
+  void SoftRenderer::present() {
+    SDL_Surface* surface = SDL_GetWindowSurface(_window);
+    if (!surface) {
+      static bool s_reported = false;
+      if (!s_reported)
+        std::cout << "Software backend: can't present to the window. Error: " << SDL_GetError() << std::endl;
+      s_reported = true;
+      return;
+    }
+
+    uint32_t width = std::min((uint32_t)surface->w, _backbuffer.width);
+    uint32_t height = std::min((uint32_t)surface->h, _backbuffer.height);
+    if (SDL_MUSTLOCK(surface))
+      SDL_LockSurface(surface);
+    // the backbuffer rows go up, the window rows go down
+    for (uint32_t y = 0; y < height; y++) {
+      const uint8_t* src = _backbuffer.data.data() + (size_t)(_backbuffer.height - 1 - y) * _backbuffer.width * 4;
+      uint8_t* dst = (uint8_t*)surface->pixels + (size_t)y * surface->pitch;
+      SDL_ConvertPixels((int)width, 1, SDL_PIXELFORMAT_RGBA32, src, (int)_backbuffer.width * 4, surface->format->format, dst, surface->pitch);
+    }
+    if (SDL_MUSTLOCK(surface))
+      SDL_UnlockSurface(surface);
+    SDL_UpdateWindowSurface(_window);
+  }
+
+  void SoftRenderer::submit() {
+    if (_in_pass) {
+      std::cout << "submit called inside a render pass" << std::endl;
+      return;
+    }
+
+    if (_window)
+      present();
+
+    // the passes are done when they end, their timings are available right away
+    std::swap(_pass_timings, _frame_timings);
+    _frame_timings.clear();
+
+    for (Buffer h : _stream_buffers) {
+      _buffers[handle_index(h)].append_offset = 0;
+    }
+    _arena.reset();
+
+    // like the GL backend, the state does not survive the frame
+    _pipeline = nullptr;
+    _has_bindings = false;
+    _uniforms = nullptr;
+  }
+
+  bool SoftRenderer::new_buffer(Buffer h, const BufferDesc& desc) {
+    if (desc.usage == BufferUsage::IMMUTABLE && !desc.mem.data) {
+      std::cout << "IMMUTABLE buffers must be created with their data" << std::endl;
+      return false;
+    }
+
+    SoftBuffer& buffer = _buffers[handle_index(h)];
+    buffer.data.assign(desc.mem.size, 0);
+    if (desc.mem.data)
+      std::memcpy(buffer.data.data(), desc.mem.data, desc.mem.size);
+    buffer.type = desc.type;
+    buffer.usage = desc.usage;
+    buffer.append_offset = 0;
+    if (desc.usage != BufferUsage::IMMUTABLE)
+      _stream_buffers.push_back(h);
+    return true;
+  }
+
+  bool SoftRenderer::update_buffer(Buffer h, const Memory& mem) {
+    SoftBuffer& buffer = _buffers[handle_index(h)];
+    if (buffer.usage == BufferUsage::IMMUTABLE) {
+      std::cout << "IMMUTABLE buffers can't be updated" << std::endl;
+      return false;
+    }
+    if (mem.size > buffer.data.size()) {
+      std::cout << "update_buffer is larger than the buffer" << std::endl;
+      return false;
+    }
+
+    // the vertex stage already ran for the previous draws, they keep the old data
+    std::memcpy(buffer.data.data(), mem.data, mem.size);
+    buffer.append_offset = (uint32_t)mem.size;
+    return true;
+  }
+
+  std::optional<uint32_t> SoftRenderer::append_buffer(Buffer h, const Memory& mem) {
+    SoftBuffer& buffer = _buffers[handle_index(h)];
+    if (buffer.usage == BufferUsage::IMMUTABLE) {
+      std::cout << "IMMUTABLE buffers can't be appended to" << std::endl;
+      return std::nullopt;
+    }
+
+    uint32_t offset = (buffer.append_offset + APPEND_ALIGNMENT - 1) / APPEND_ALIGNMENT * APPEND_ALIGNMENT;
+    if (offset + mem.size > buffer.data.size())
+      return std::nullopt;
+
+    std::memcpy(buffer.data.data() + offset, mem.data, mem.size);
+    buffer.append_offset = offset + (uint32_t)mem.size;
+    return offset;
+  }
+
+  bool SoftRenderer::new_texture(Texture h, const TextureDesc& desc) {
+    SoftTextureStorage& texture = _textures[handle_index(h)];
+    texture.type = desc.type;
+    texture.format = desc.format;
+    texture.width = std::max(desc.width, 1u);
+    texture.height = desc.type == TextureType::TEXTURE_1D ? 1 : std::max(desc.height, 1u);
+    texture.depth = desc.type == TextureType::TEXTURE_3D ? std::max(desc.depth, 1u) : 1;
+
+    // mip maps are not generated, the software samplers read the first level only
+    size_t size = (size_t)texture.width * texture.height * texture.depth * get_texel_size(desc.format);
+    texture.data.assign(size, 0);
+    if (desc.mem.data)
+      std::memcpy(texture.data.data(), desc.mem.data, std::min(desc.mem.size, size));
+    if (desc.format == TextureFormat::DEPTH && !desc.mem.data) {
+      float* depth = (float*)texture.data.data();
+      std::fill(depth, depth + (size_t)texture.width * texture.height * texture.depth, 1.0f);
+    }
+    return true;
+  }
+
+  bool SoftRenderer::update_texture(Texture h, const TextureRegion& region, uint32_t mip, const Memory& mem) {
+    SoftTextureStorage& texture = _textures[handle_index(h)];
+    uint32_t width = std::max(texture.width >> mip, 1u);
+    uint32_t height = std::max(texture.height >> mip, 1u);
+    uint32_t depth = std::max(texture.depth >> mip, 1u);
+    uint32_t region_height = texture.type == TextureType::TEXTURE_1D ? 1 : region.height;
+    uint32_t region_depth = texture.type == TextureType::TEXTURE_3D ? region.depth : 1;
+    if (region.x + region.width > width || region.y + region_height > height || region.z + region_depth > depth) {
+      std::cout << "update_texture region is outside of the mip level" << std::endl;
+      return false;
+    }
+
+    uint32_t texel_size = get_texel_size(texture.format);
+    size_t row_size = (size_t)region.width * texel_size;
+    if (mem.size < row_size * region_height * region_depth) {
+      std::cout << "update_texture memory is smaller than the region" << std::endl;
+      return false;
+    }
+    // the other levels are never sampled
+    if (mip > 0)
+      return true;
+
+    const uint8_t* src = (const uint8_t*)mem.data;
+    for (uint32_t z = 0; z < region_depth; z++) {
+      for (uint32_t y = 0; y < region_height; y++) {
+        size_t dst = (((size_t)(region.z + z) * texture.height + region.y + y) * texture.width + region.x) * texel_size;
+        std::memcpy(texture.data.data() + dst, src, row_size);
+        src += row_size;
+      }
+    }
+    return true;
+  }
+
+  bool SoftRenderer::new_shader(Shader h, const ShaderDesc& desc) {
+    if (!desc.soft.vertex) {
+      std::cout << "Software backend: the shader has no SoftShaderDesc::vertex stage" << std::endl;
+      return false;
+    }
+    if (desc.soft.num_varyings > MAX_SOFT_VARYINGS || desc.soft.num_flat_varyings > MAX_SOFT_FLAT_VARYINGS) {
+      std::cout << "Software backend: too many varyings, MAX_SOFT_VARYINGS is " << MAX_SOFT_VARYINGS
+        << " and MAX_SOFT_FLAT_VARYINGS is " << MAX_SOFT_FLAT_VARYINGS << std::endl;
+      return false;
+    }
+
+    _shaders[handle_index(h)].desc = desc.soft;
+    return true;
+  }
+
+  bool SoftRenderer::new_render_pass(RenderPass h, const RenderPassDesc& desc) {
+    if (desc.colors.size() > MAX_SOFT_COLOR_TARGETS) {
+      std::cout << "Software backend: too many color targets, MAX_SOFT_COLOR_TARGETS is " << MAX_SOFT_COLOR_TARGETS << std::endl;
+      return false;
+    }
+    if (desc.depth && _textures[handle_index(desc.depth.value())].format != TextureFormat::DEPTH) {
+      std::cout << "The depth target of a render pass must be a DEPTH texture" << std::endl;
+      return false;
+    }
+
+    SoftRenderPass& rpass = _render_passes[handle_index(h)];
+    rpass.colors = desc.colors;
+    rpass.depth = desc.depth;
+    rpass.name = desc.name;
+    // the pass covers the area shared by all its targets
+    rpass.width = std::numeric_limits<uint32_t>::max();
+    rpass.height = std::numeric_limits<uint32_t>::max();
+    for (Texture color : desc.colors) {
+      rpass.width = std::min(rpass.width, _textures[handle_index(color)].width);
+      rpass.height = std::min(rpass.height, _textures[handle_index(color)].height);
+    }
+    if (desc.depth) {
+      rpass.width = std::min(rpass.width, _textures[handle_index(desc.depth.value())].width);
+      rpass.height = std::min(rpass.height, _textures[handle_index(desc.depth.value())].height);
+    }
+    if (desc.colors.empty() && !desc.depth) {
+      rpass.width = 0;
+      rpass.height = 0;
+    }
+    return true;
+  }
+
+  bool SoftRenderer::new_pipeline(Pipeline h, const PipelineDesc& desc) {
+    SoftPipeline& pipe = _pipelines[handle_index(h)];
+    pipe.shader = desc.shader;
+    pipe.index_type = desc.index_type;
+    pipe.primitive_type = desc.primitive_type;
+    pipe.cull = desc.cull;
+
+    // per-vertex and per-instance attributes are interleaved in their own buffer, like the GL backend
+    pipe.vertex_stride = 0;
+    pipe.instance_stride = 0;
+    pipe.num_attributes = 0;
+    for (uint32_t i = 0; i < MAX_ATTRIBUTES; i++) {
+      const VertexAttribute& attr = desc.layout.attributes[i];
+      if (attr.format == AttributeFormat::NONE)
+        break;
+      bool per_instance = attr.step == VertexStep::PER_INSTANCE;
+      uint32_t& stride = per_instance ? pipe.instance_stride : pipe.vertex_stride;
+      pipe.attributes[i] = SoftAttribute{
+        .offset = stride,
+        .per_instance = per_instance,
+        .step_rate = std::max(attr.step_rate, 1u),
+      };
+      uint32_t components = attr.format == AttributeFormat::FLOAT2 ? 2 : (attr.format == AttributeFormat::FLOAT3 ? 3 : 4);
+      stride += components * sizeof(float);
+      ++pipe.num_attributes;
+    }
+    return true;
+  }
+
+  bool SoftRenderer::new_sampler(Sampler h, const SamplerDesc& desc) {
+    _samplers[handle_index(h)] = desc;
+    return true;
+  }
+
+  bool SoftRenderer::is_shader_ready(Shader) {
+    // nothing to compile
+    return true;
+  }
+
+  bool SoftRenderer::is_pipeline_ready(Pipeline) {
+    return true;
+  }
+
+  void SoftRenderer::destroy_buffer(Buffer h) {
+    SoftBuffer& buffer = _buffers[handle_index(h)];
+    if (buffer.usage != BufferUsage::IMMUTABLE)
+      std::erase(_stream_buffers, h);
+    buffer.data = {};
+  }
+
+  void SoftRenderer::destroy_texture(Texture h) {
+    _textures[handle_index(h)].data = {};
+  }
+
+  void SoftRenderer::destroy_shader(Shader h) {
+    _shaders[handle_index(h)].desc = {};
+  }
+
+  void SoftRenderer::destroy_render_pass(RenderPass h) {
+    _render_passes[handle_index(h)].colors.clear();
+  }
+
+  void SoftRenderer::destroy_pipeline(Pipeline h) {
+    if (_pipeline == &_pipelines[handle_index(h)])
+      _pipeline = nullptr;
+  }
+
+  void SoftRenderer::destroy_sampler(Sampler) {
+  }
+
+  SoftImage SoftRenderer::image(std::optional<Texture> texture) const {
+    const SoftTextureStorage& storage = texture ? _textures[handle_index(texture.value())] : _backbuffer;
+    return SoftImage{
+      .data = storage.data.data(),
+      .format = storage.format,
+      .width = storage.width,
+      .height = storage.height,
+    };
+  }
+}
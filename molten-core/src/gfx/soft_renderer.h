@@ -0,0 +1,199 @@
+#pragma once
+
+#include "gfx/renderer.h"
+#include "gfx/software.h"
+#include "gfx/arena.h"
+#include "thread_pool.h"
+
+#include <array>
+#include <vector>
+#include <optional>
+#include <functional>
+#include <chrono>
+
+namespace gfx {
+  // square tiles of pixels rasterized by one thread, a multiple of the SIMD width
+  constexpr uint32_t SOFT_TILE_SIZE = 64;
+
+  struct SoftBuffer {
+    std::vector<uint8_t> data;
+    BufferType type;
+    BufferUsage usage;
+    uint32_t append_offset;
+  };
+
+  struct SoftTextureStorage {
+    std::vector<uint8_t> data;
+    TextureType type;
+    TextureFormat format;
+    uint32_t width;
+    uint32_t height;
+    uint32_t depth;
+  };
+
+  struct SoftShader {
+    SoftShaderDesc desc;
+  };
+
+  struct SoftRenderPass {
+    std::vector<Texture> colors;
+    std::optional<Texture> depth;
+    std::string name;
+    uint32_t width;
+    uint32_t height;
+  };
+
+  struct SoftAttribute {
+    uint32_t offset;
+    bool per_instance;
+    uint32_t step_rate;
+  };
+
+  struct SoftPipeline {
+    Shader shader;
+    IndexType index_type;
+    PrimitiveType primitive_type;
+    CullMode cull;
+    std::array<SoftAttribute, MAX_ATTRIBUTES> attributes;
+    uint32_t num_attributes;
+    uint32_t vertex_stride;
+    uint32_t instance_stride;
+  };
+
+  // render target being drawn, the color targets point into their texture storage
+  struct SoftTarget {
+    uint8_t* data;
+    TextureFormat format;
+    uint32_t texel_size;
+    uint32_t row_size; // in bytes
+  };
+
+  // state of the draws of a pass, captured at draw time since the pass is rasterized at its end
+  struct SoftDraw {
+    const SoftShader* shader;
+    const void* uniforms;
+    std::array<SoftTexture, MAX_SOFT_TEXTURES> textures;
+    uint32_t num_textures;
+    uint32_t vertex_size; // in floats: position, varyings then flat varyings
+  };
+
+  // triangle in window coordinates, set up for the rasterizer
+  struct SoftTriangle {
+    uint32_t vertices[3]; // offsets of the vertices in the pass vertex data
+    uint32_t flat; // offset of the vertex providing the flat varyings
+    uint32_t draw;
+    // edge functions a * x + b * y + c, positive inside, edge i is opposite to vertex i
+    float a[3];
+    float b[3];
+    float c[3];
+    float inv_area;
+    float z[3];
+    float inv_w[3];
+    uint8_t top_left; // bit i is set when edge i owns the pixels centered on it
+    // pixels covered by the bounding box, inclusive
+    int32_t min_x;
+    int32_t min_y;
+    int32_t max_x;
+    int32_t max_y;
+  };
+
+  /*!
+  * Backend rasterizing on the CPU, selected with GFX_USE_SOFTWARE.
+  * The vertex stage runs when a draw is issued and its triangles are binned in tiles,
+  * the tiles are rasterized by a thread pool with SIMD edge functions when the pass ends.
+  * Shading is done by the SoftShaderDesc callables of the shaders.
+  */
+  class SoftRenderer {
+  public:
+    void init(const InitInfo& info);
+    void shutdown();
+    void begin_render_pass(std::optional<RenderPass> pass, const PassAction& action);
+    void end_render_pass();
+    void set_pipeline(Pipeline pipe);
+    void set_bindings(Bindings bind);
+    void set_uniforms(const Memory& mem);
+    void draw(uint32_t first_element, uint32_t num_elements, uint32_t num_instances, int32_t base_vertex);
+    void multi_draw_indirect(Buffer args, uint32_t offset, uint32_t draw_count, uint32_t stride);
+    void set_viewport(const Rect& rect);
+    void set_scissor(const Rect& rect);
+    void submit();
+
+    bool new_buffer(Buffer h, const BufferDesc& desc);
+    bool update_buffer(Buffer h, const Memory& mem);
+    std::optional<uint32_t> append_buffer(Buffer h, const Memory& mem);
+    bool new_texture(Texture h, const TextureDesc& desc);
+    bool update_texture(Texture h, const TextureRegion& region, uint32_t mip, const Memory& mem);
+    bool new_shader(Shader h, const ShaderDesc& desc);
+    bool new_render_pass(RenderPass h, const RenderPassDesc& desc);
+    bool new_pipeline(Pipeline h, const PipelineDesc& desc);
+    bool new_sampler(Sampler h, const SamplerDesc& desc);
+    bool is_shader_ready(Shader h);
+    bool is_pipeline_ready(Pipeline h);
+    void destroy_buffer(Buffer h);
+    void destroy_texture(Texture h);
+    void destroy_shader(Shader h);
+    void destroy_render_pass(RenderPass h);
+    void destroy_pipeline(Pipeline h);
+    void destroy_sampler(Sampler h);
+
+    // CPU time of the passes, from begin_render_pass to the end of their rasterization
+    const std::vector<PassTiming>& pass_timings() const { return _pass_timings; }
+
+    SoftImage image(std::optional<Texture> texture) const;
+
+  private:
+    void draw_instances(uint32_t first_element, uint32_t num_elements, uint32_t first_instance, uint32_t num_instances, int32_t base_vertex);
+    // clips a triangle against the near plane then sets up and bins the resulting triangles
+    void add_triangle(uint32_t v0, uint32_t v1, uint32_t v2, uint32_t draw);
+    // appends the vertex between a and b at t, returns its offset
+    uint32_t lerp_vertex(uint32_t a, uint32_t b, float t, uint32_t vertex_size);
+    void setup_triangle(uint32_t v0, uint32_t v1, uint32_t v2, uint32_t flat, uint32_t draw);
+    void rasterize_tile(uint32_t tile);
+    void present();
+
+    std::array<SoftBuffer, MAX_BUFFERS> _buffers;
+    std::array<SoftTextureStorage, MAX_TEXTURES> _textures;
+    std::array<SoftShader, MAX_SHADERS> _shaders;
+    std::array<SoftRenderPass, MAX_RENDER_PASSES> _render_passes;
+    std::array<SoftPipeline, MAX_PIPELINES> _pipelines;
+    std::array<SamplerDesc, MAX_SAMPLERS> _samplers;
+    std::vector<Buffer> _stream_buffers;
+
+    SDL_Window* _window = nullptr;
+    SoftTextureStorage _backbuffer;
+    std::vector<float> _backbuffer_depth;
+
+    ThreadPool _pool;
+
+    // current state
+    bool _in_pass = false;
+    const SoftPipeline* _pipeline = nullptr;
+    Bindings _bindings;
+    bool _has_bindings = false;
+    const void* _uniforms = nullptr;
+    Rect _viewport = Rect(0, 0, 0, 0);
+
+    // current pass, rasterized by end_render_pass
+    bool _clear_color = false;
+    float _clear_color_value[4] = {};
+    bool _clear_depth = false;
+    float _clear_depth_value = 1.0f;
+    std::array<SoftTarget, MAX_SOFT_COLOR_TARGETS> _colors;
+    uint32_t _num_colors = 0;
+    float* _depth = nullptr;
+    uint32_t _width = 0;
+    uint32_t _height = 0;
+    uint32_t _tiles_x = 0;
+    uint32_t _tiles_y = 0;
+    Arena _arena; // uniforms of the draws
+    std::vector<SoftDraw> _draws;
+    std::vector<float> _vertices;
+    std::vector<SoftTriangle> _triangles;
+    std::vector<std::vector<uint32_t>> _bins; // triangles of each tile, in draw order
+    const std::string* _pass_name = nullptr;
+    std::chrono::steady_clock::time_point _pass_start;
+
+    std::vector<PassTiming> _frame_timings; // passes of the frame being recorded
+    std::vector<PassTiming> _pass_timings; // passes of the last submitted frame
+  };
+}
@@ -0,0 +1,88 @@
+#include "thread_pool.h"
+
+#include <algorithm>
+
+namespace gfx {
+  static thread_local uint32_t s_thread_index = 0;
+
+  void ThreadPool::init(uint32_t num_threads) {
+    if (num_threads == 0)
+      num_threads = std::max(std::thread::hardware_concurrency(), 1u);
+
+    _stop = false;
+    // the calling thread is thread 0
+    for (uint32_t i = 1; i < num_threads; i++) {
+      _threads.emplace_back(&ThreadPool::run_worker, this, i);
+    }
+  }
+
+  void ThreadPool::shutdown() {
+    {
+      std::lock_guard<std::mutex> lock(_mutex);
+      _stop = true;
+    }
+    _wake.notify_all();
+    for (std::thread& thread : _threads) {
+      thread.join();
+    }
+    _threads.clear();
+  }
+
+  void ThreadPool::run(uint32_t count, const std::function<void(uint32_t)>& task) {
+    if (_threads.empty() || count <= 1) {
+      for (uint32_t i = 0; i < count; i++) {
+        task(i);
+      }
+      return;
+    }
+
+    {
+      std::lock_guard<std::mutex> lock(_mutex);
+      _task = &task;
+      _count = count;
+      _next = 0;
+      _active = (uint32_t)_threads.size();
+      ++_loop;
+    }
+    _wake.notify_all();
+
+    for (uint32_t i = _next++; i < count; i = _next++) {
+      task(i);
+    }
+
+    // the task is on the caller stack, wait for all the workers to leave it
+    std::unique_lock<std::mutex> lock(_mutex);
+    _done.wait(lock, [this]() { return _active == 0; });
+    _task = nullptr;
+  }
+
+  uint32_t ThreadPool::thread_index() {
+    return s_thread_index;
+  }
+
+  void ThreadPool::run_worker(uint32_t index) {
+    s_thread_index = index;
+    uint64_t loop = 0;
+    while (true) {
+      const std::function<void(uint32_t)>* task = nullptr;
+      uint32_t count = 0;
+      {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _wake.wait(lock, [this, loop]() { return _stop || _loop != loop; });
+        if (_stop)
+          return;
+        loop = _loop;
+        task = _task;
+        count = _count;
+      }
+
+      for (uint32_t i = _next++; i < count; i = _next++) {
+        (*task)(i);
+      }
+
+      std::lock_guard<std::mutex> lock(_mutex);
+      if (--_active == 0)
+        _done.notify_one();
+    }
+  }
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+#include <functional>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+
+namespace gfx {
+  /*!
+  * Runs the tasks of a parallel loop on the worker threads and the calling thread.
+  */
+  class ThreadPool {
+  public:
+    // 0 uses one thread per core
+    void init(uint32_t num_threads);
+    void shutdown();
+    // calls task(i) for each i in [0, count) then returns, the calls are spread on all the threads
+    void run(uint32_t count, const std::function<void(uint32_t)>& task);
+    uint32_t num_threads() const { return (uint32_t)_threads.size() + 1; }
+    // index in [0, num_threads()) of the thread running a task, 0 for the thread calling run
+    // the tasks use it to pick the per-thread resources they write without lock
+    static uint32_t thread_index();
+
+  private:
+    void run_worker(uint32_t index);
+
+    std::vector<std::thread> _threads;
+    std::mutex _mutex;
+    std::condition_variable _wake;
+    std::condition_variable _done;
+    const std::function<void(uint32_t)>* _task = nullptr;
+    uint32_t _count = 0;
+    std::atomic<uint32_t> _next = 0;
+    uint32_t _active = 0; // workers still running the current loop
+    uint64_t _loop = 0; // incremented by each run to wake the workers
+    bool _stop = false;
+  };
+}
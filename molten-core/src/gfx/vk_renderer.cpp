@@ -1,5 +1,6 @@
 #include "vk_renderer.h"
 #include "vk_utils.h"
+#include "profiler.h"
 
 #include "VkBootstrap.h"
 #include <SDL2/SDL_vulkan.h>
@@ -8,6 +9,12 @@
 #include "vk_mem_alloc.h"
 
 #include <iostream>
+#include <algorithm>
+#include <cstring>
+#include <cmath>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
 
 #define VK_CHECK(x)                                                        \
   do {                                                                     \
@@ -15,12 +22,284 @@
       assert(res == VK_SUCCESS);                                           \
   } while (0)
 
+static VkFormat get_vk_texture_format(gfx::TextureFormat format) {
+  switch (format) {
+  case gfx::TextureFormat::R8: return VK_FORMAT_R8_UNORM;
+  // 3 bytes formats are rarely supported for sampling and rendering, the texels are expanded when staged
+  case gfx::TextureFormat::RGB8: return VK_FORMAT_R8G8B8A8_UNORM;
+  case gfx::TextureFormat::RGBA8: return VK_FORMAT_R8G8B8A8_UNORM;
+  case gfx::TextureFormat::DEPTH: return VK_FORMAT_D32_SFLOAT;
+  }
+  return VK_FORMAT_UNDEFINED;
+}
+
+static VkImageType get_vk_image_type(gfx::TextureType type) {
+  switch (type) {
+  case gfx::TextureType::TEXTURE_1D: return VK_IMAGE_TYPE_1D;
+  case gfx::TextureType::TEXTURE_2D: return VK_IMAGE_TYPE_2D;
+  case gfx::TextureType::TEXTURE_3D: return VK_IMAGE_TYPE_3D;
+  }
+  return VK_IMAGE_TYPE_2D;
+}
+
+static VkImageViewType get_vk_image_view_type(gfx::TextureType type) {
+  switch (type) {
+  case gfx::TextureType::TEXTURE_1D: return VK_IMAGE_VIEW_TYPE_1D;
+  case gfx::TextureType::TEXTURE_2D: return VK_IMAGE_VIEW_TYPE_2D;
+  case gfx::TextureType::TEXTURE_3D: return VK_IMAGE_VIEW_TYPE_3D;
+  }
+  return VK_IMAGE_VIEW_TYPE_2D;
+}
+
+static VkFormat get_vk_attribute_format(gfx::AttributeFormat format) {
+  switch (format) {
+  case gfx::AttributeFormat::NONE: return VK_FORMAT_UNDEFINED;
+  case gfx::AttributeFormat::FLOAT2: return VK_FORMAT_R32G32_SFLOAT;
+  case gfx::AttributeFormat::FLOAT3: return VK_FORMAT_R32G32B32_SFLOAT;
+  case gfx::AttributeFormat::FLOAT4: return VK_FORMAT_R32G32B32A32_SFLOAT;
+  }
+  return VK_FORMAT_UNDEFINED;
+}
+
+static uint32_t get_vk_attribute_size(gfx::AttributeFormat format) {
+  switch (format) {
+  case gfx::AttributeFormat::NONE: return 0;
+  case gfx::AttributeFormat::FLOAT2: return 2 * sizeof(float);
+  case gfx::AttributeFormat::FLOAT3: return 3 * sizeof(float);
+  case gfx::AttributeFormat::FLOAT4: return 4 * sizeof(float);
+  }
+  return 0;
+}
+
+static VkPrimitiveTopology get_vk_topology(gfx::PrimitiveType type) {
+  switch (type) {
+  case gfx::PrimitiveType::POINTS: return VK_PRIMITIVE_TOPOLOGY_POINT_LIST;
+  case gfx::PrimitiveType::LINES: return VK_PRIMITIVE_TOPOLOGY_LINE_LIST;
+  case gfx::PrimitiveType::TRIANGLES: return VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+  case gfx::PrimitiveType::TRIANGLE_FAN: return VK_PRIMITIVE_TOPOLOGY_TRIANGLE_FAN;
+  case gfx::PrimitiveType::TRIANGLE_STRIP: return VK_PRIMITIVE_TOPOLOGY_TRIANGLE_STRIP;
+  }
+  return VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+}
+
+static VkCullModeFlags get_vk_cull_mode(gfx::CullMode mode) {
+  switch (mode) {
+  case gfx::CullMode::NONE: return VK_CULL_MODE_NONE;
+  case gfx::CullMode::FRONT: return VK_CULL_MODE_FRONT_BIT;
+  case gfx::CullMode::BACK: return VK_CULL_MODE_BACK_BIT;
+  }
+  return VK_CULL_MODE_NONE;
+}
+
+static VkFilter get_vk_filter(gfx::Filter filter) {
+  return filter == gfx::Filter::LINEAR ? VK_FILTER_LINEAR : VK_FILTER_NEAREST;
+}
+
+static VkSamplerAddressMode get_vk_wrap(gfx::Wrap wrap) {
+  switch (wrap) {
+  case gfx::Wrap::REPEAT: return VK_SAMPLER_ADDRESS_MODE_REPEAT;
+  case gfx::Wrap::MIRRORED_REPEAT: return VK_SAMPLER_ADDRESS_MODE_MIRRORED_REPEAT;
+  case gfx::Wrap::CLAMP_TO_EDGE: return VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+  case gfx::Wrap::CLAMP_TO_BORDER: return VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_BORDER;
+  }
+  return VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+}
+
+static VkDeviceSize align_up(VkDeviceSize value, VkDeviceSize alignment) {
+  return (value + alignment - 1) / alignment * alignment;
+}
+
+void gfx::VKRenderer::DeletionQueue::flush(VkDevice device, VmaAllocator allocator) {
+  for (VkPipeline pipeline : pipelines) {
+    vkDestroyPipeline(device, pipeline, nullptr);
+  }
+  for (VkPipelineLayout layout : pipeline_layouts) {
+    vkDestroyPipelineLayout(device, layout, nullptr);
+  }
+  for (VkShaderModule module : shader_modules) {
+    vkDestroyShaderModule(device, module, nullptr);
+  }
+  for (VkImageView view : image_views) {
+    vkDestroyImageView(device, view, nullptr);
+  }
+  for (const ImageAllocation& image : images) {
+    vmaDestroyImage(allocator, image.image, image.allocation);
+  }
+  for (const BufferAllocation& buffer : buffers) {
+    vmaDestroyBuffer(allocator, buffer.buffer, buffer.allocation);
+  }
+
+  // clear keeps the capacity, the next frames append without allocating
+  pipelines.clear();
+  pipeline_layouts.clear();
+  shader_modules.clear();
+  image_views.clear();
+  images.clear();
+  buffers.clear();
+}
+
+void gfx::VKRenderer::BufferRing::create(VmaAllocator allocator, VkBufferUsageFlags usage, VkDeviceSize seg_size, VkDeviceSize align, uint32_t num_segments, VkDeviceSize padding) {
+  alignment = align;
+  segment_size = align_up(seg_size, align);
+  frame = 0;
+  offset = 0;
+
+  VkBufferCreateInfo buffer_info = {};
+  buffer_info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+  buffer_info.size = segment_size * num_segments + padding;
+  buffer_info.usage = usage;
+
+  // written sequentially by the CPU, mapped once
+  VmaAllocationCreateInfo alloc_info = {};
+  alloc_info.usage = VMA_MEMORY_USAGE_AUTO;
+  alloc_info.flags = VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT | VMA_ALLOCATION_CREATE_MAPPED_BIT;
+
+  VmaAllocationInfo info;
+  VK_CHECK(vmaCreateBuffer(allocator, &buffer_info, &alloc_info, &buffer, &allocation, &info));
+  mapped = (uint8_t*)info.pMappedData;
+}
+
+std::optional<VkDeviceSize> gfx::VKRenderer::BufferRing::alloc(VkDeviceSize size) {
+  VkDeviceSize start = align_up(offset, alignment);
+  if (start + size > segment_size)
+    return std::nullopt;
+  offset = start + size;
+  return segment_offset() + start;
+}
+
+void gfx::VKRenderer::BufferRing::flush(VmaAllocator allocator) const {
+  // no-op on coherent memory
+  if (offset > 0)
+    vmaFlushAllocation(allocator, allocation, segment_offset(), offset);
+}
+
+void gfx::VKRenderer::BufferRing::begin_frame(uint32_t new_frame) {
+  frame = new_frame;
+  offset = 0;
+}
+
+VkDescriptorSet gfx::VKRenderer::DescriptorAllocator::allocate(VkDevice device, VkDescriptorSetLayout layout) {
+  // a second try with a new pool when the current one is full
+  for (int attempt = 0; attempt < 2; attempt++) {
+    if (!current) {
+      if (!free.empty()) {
+        current = free.back();
+        free.pop_back();
+      } else {
+        // the per draw sets only hold textures, the uniforms use the dynamic uniform set
+        VkDescriptorPoolSize pool_size = { VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_DESCRIPTOR_POOL_SETS * 4 };
+        VkDescriptorPoolCreateInfo pool_info = {};
+        pool_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+        pool_info.maxSets = VK_DESCRIPTOR_POOL_SETS;
+        pool_info.poolSizeCount = 1;
+        pool_info.pPoolSizes = &pool_size;
+        if (vkCreateDescriptorPool(device, &pool_info, nullptr, &current) != VK_SUCCESS) {
+          std::cout << "Failed to create a descriptor pool" << std::endl;
+          current = VK_NULL_HANDLE;
+          return VK_NULL_HANDLE;
+        }
+      }
+    }
+
+    VkDescriptorSetAllocateInfo alloc_info = {};
+    alloc_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+    alloc_info.descriptorPool = current;
+    alloc_info.descriptorSetCount = 1;
+    alloc_info.pSetLayouts = &layout;
+
+    VkDescriptorSet set = VK_NULL_HANDLE;
+    VkResult result = vkAllocateDescriptorSets(device, &alloc_info, &set);
+    if (result == VK_SUCCESS)
+      return set;
+    if (result != VK_ERROR_OUT_OF_POOL_MEMORY && result != VK_ERROR_FRAGMENTED_POOL)
+      break;
+    full.push_back(current);
+    current = VK_NULL_HANDLE;
+  }
+  std::cout << "Failed to allocate a descriptor set" << std::endl;
+  return VK_NULL_HANDLE;
+}
+
+void gfx::VKRenderer::DescriptorAllocator::reset(VkDevice device) {
+  if (current)
+    full.push_back(current);
+  current = VK_NULL_HANDLE;
+  for (VkDescriptorPool pool : full) {
+    VK_CHECK(vkResetDescriptorPool(device, pool, 0));
+    free.push_back(pool);
+  }
+  full.clear();
+}
+
+void gfx::VKRenderer::DescriptorAllocator::destroy(VkDevice device) {
+  reset(device);
+  for (VkDescriptorPool pool : free) {
+    vkDestroyDescriptorPool(device, pool, nullptr);
+  }
+  free.clear();
+}
+
+VkDescriptorSetLayout gfx::VKRenderer::DescriptorLayoutCache::get(VkDevice device, const std::vector<VkDescriptorSetLayoutBinding>& bindings) {
+  auto it = layouts.find(bindings);
+  if (it != layouts.end())
+    return it->second;
+
+  VkDescriptorSetLayoutCreateInfo set_info = {};
+  set_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+  set_info.bindingCount = (uint32_t)bindings.size();
+  set_info.pBindings = bindings.data();
+  VkDescriptorSetLayout layout = VK_NULL_HANDLE;
+  VK_CHECK(vkCreateDescriptorSetLayout(device, &set_info, nullptr, &layout));
+  layouts.emplace(bindings, layout);
+  return layout;
+}
+
+void gfx::VKRenderer::DescriptorLayoutCache::destroy(VkDevice device) {
+  for (auto& [bindings, layout] : layouts) {
+    vkDestroyDescriptorSetLayout(device, layout, nullptr);
+  }
+  layouts.clear();
+}
+
+size_t gfx::VKRenderer::DescriptorLayoutCache::BindingsHash::operator()(const std::vector<VkDescriptorSetLayoutBinding>& bindings) const {
+  uint64_t hash = 14695981039346656037ull;
+  auto hash_value = [&hash](uint64_t value) {
+    hash = (hash ^ value) * 1099511628211ull;
+  };
+  for (const VkDescriptorSetLayoutBinding& binding : bindings) {
+    hash_value(binding.binding);
+    hash_value((uint64_t)binding.descriptorType);
+    hash_value(binding.descriptorCount);
+    hash_value(binding.stageFlags);
+  }
+  return (size_t)hash;
+}
+
+// the immutable samplers are not used, the sets take their samplers from the bindings
+bool gfx::VKRenderer::DescriptorLayoutCache::BindingsEqual::operator()(const std::vector<VkDescriptorSetLayoutBinding>& a, const std::vector<VkDescriptorSetLayoutBinding>& b) const {
+  return std::equal(a.begin(), a.end(), b.begin(), b.end(), [](const VkDescriptorSetLayoutBinding& x, const VkDescriptorSetLayoutBinding& y) {
+    return x.binding == y.binding && x.descriptorType == y.descriptorType && x.descriptorCount == y.descriptorCount && x.stageFlags == y.stageFlags;
+  });
+}
+
 void gfx::VKRenderer::init(const InitInfo& info) {
   if (_is_initialized) {
     std::cout << "Failed to init the VKRenderer. The VKRenderer is already initialized" << std::endl;
     return;
   }
 
+  if (info.frames_in_flight < 1 || info.frames_in_flight > MAX_FRAMES_IN_FLIGHT)
+    std::cout << "frames_in_flight must be in [1, " << MAX_FRAMES_IN_FLIGHT << "], " << info.frames_in_flight << " is clamped" << std::endl;
+  _frames_in_flight = std::clamp(info.frames_in_flight, 1u, MAX_FRAMES_IN_FLIGHT);
+  if (!(info.render_scale > 0.0f))
+    std::cout << "render_scale must be positive, " << info.render_scale << " is replaced by 1" << std::endl;
+  _render_scale = info.render_scale > 0.0f ? info.render_scale : 1.0f;
+  switch (info.present_mode) {
+    case PresentMode::FIFO: _present_mode = VK_PRESENT_MODE_FIFO_KHR; break;
+    case PresentMode::MAILBOX: _present_mode = VK_PRESENT_MODE_MAILBOX_KHR; break;
+    case PresentMode::IMMEDIATE: _present_mode = VK_PRESENT_MODE_IMMEDIATE_KHR; break;
+  }
+
   vkb::InstanceBuilder builder;
 
   // create the instance
@@ -43,6 +322,7 @@ void gfx::VKRenderer::init(const InitInfo& info) {
   // vulkan 1.2 features
   const VkPhysicalDeviceVulkan12Features features12{
     .descriptorIndexing = true,
+    .timelineSemaphore = true,
     .bufferDeviceAddress = true,
   };
 
@@ -58,19 +338,47 @@ void gfx::VKRenderer::init(const InitInfo& info) {
     .set_minimum_version(1, 3)
     .set_required_features_12(features12)
     .set_required_features_13(features)
+    .add_desired_extension(VK_EXT_DEPTH_CLIP_CONTROL_EXTENSION_NAME)
     .set_surface(_surface)
     .select()
     .value();
 
+  // optional features, enabled when the device has them
+  VkPhysicalDeviceFeatures supported_features;
+  vkGetPhysicalDeviceFeatures(physicalDevice.physical_device, &supported_features);
+  physicalDevice.features.multiDrawIndirect = supported_features.multiDrawIndirect;
+  physicalDevice.features.drawIndirectFirstInstance = supported_features.drawIndirectFirstInstance;
+  physicalDevice.features.samplerAnisotropy = supported_features.samplerAnisotropy;
+  _multi_draw_indirect = supported_features.multiDrawIndirect;
+
+  // the engine projections use the GL clip space, the depth goes from -1 to 1
+  VkPhysicalDeviceDepthClipControlFeaturesEXT depth_clip_features = {};
+  depth_clip_features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DEPTH_CLIP_CONTROL_FEATURES_EXT;
+  std::vector<std::string> extensions = physicalDevice.get_extensions();
+  _depth_clip_control = false;
+  if (std::find(extensions.begin(), extensions.end(), VK_EXT_DEPTH_CLIP_CONTROL_EXTENSION_NAME) != extensions.end()) {
+    VkPhysicalDeviceFeatures2 features2 = {};
+    features2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+    features2.pNext = &depth_clip_features;
+    vkGetPhysicalDeviceFeatures2(physicalDevice.physical_device, &features2);
+    _depth_clip_control = depth_clip_features.depthClipControl;
+  }
+  if (!_depth_clip_control)
+    std::cout << "VK_EXT_depth_clip_control is not supported, the depths between -1 and 0 are clipped" << std::endl;
 
   // create the device
   vkb::DeviceBuilder deviceBuilder{ physicalDevice };
+  if (_depth_clip_control)
+    deviceBuilder.add_pNext(&depth_clip_features);
 
   vkb::Device vkbDevice = deviceBuilder.build().value();
 
   _device = vkbDevice.device;
   _chosen_gpu = physicalDevice.physical_device;
 
+  const VkPhysicalDeviceLimits& limits = physicalDevice.properties.limits;
+  _max_anisotropy = supported_features.samplerAnisotropy ? limits.maxSamplerAnisotropy : 1.0f;
+
   // init the VMA allocator
   VmaAllocatorCreateInfo allocatorInfo = {};
   allocatorInfo.physicalDevice = _chosen_gpu;
@@ -79,49 +387,99 @@ void gfx::VKRenderer::init(const InitInfo& info) {
   allocatorInfo.flags = VMA_ALLOCATOR_CREATE_BUFFER_DEVICE_ADDRESS_BIT;
   vmaCreateAllocator(&allocatorInfo, &_allocator);
 
-  // add the allocator to deletion queue
-  _main_deletion_queue.push_function([&]() {
-    vmaDestroyAllocator(_allocator);
-  });
+  // upload and uniform rings, one segment per frame
+  _staging_ring.create(_allocator, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_STAGING_RING_FRAME_SIZE, VK_STREAM_BUFFER_ALIGNMENT, _frames_in_flight);
+  // the padding keeps the range of the dynamic uniform descriptor inside the buffer for the last allocations
+  _uniform_ring.create(_allocator, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VK_UNIFORM_RING_FRAME_SIZE, limits.minUniformBufferOffsetAlignment, _frames_in_flight, VK_MAX_UNIFORM_SIZE);
+  _main_deletion_queue.buffers.push_back({ _staging_ring.buffer, _staging_ring.allocation });
+  _main_deletion_queue.buffers.push_back({ _uniform_ring.buffer, _uniform_ring.allocation });
 
   // create the swapchain
-  init_swapchain(info.window);
+  _window = info.window;
+  init_swapchain();
+  init_draw_images();
 
   // get a queue of graphics type
   _graphics_queue = vkbDevice.get_queue(vkb::QueueType::graphics).value();
   // and queue family
   _graphics_queue_family = vkbDevice.get_queue_index(vkb::QueueType::graphics).value();
 
+  // the command lists are recorded by the calling thread and up to VK_MAX_RECORDING_THREADS - 1 workers
+  _recording_pool.init(std::min(std::max(std::thread::hardware_concurrency(), 1u), VK_MAX_RECORDING_THREADS));
   init_commands();
   init_sync_structures();
+  init_descriptors();
+  init_pipeline_cache(info.shader_cache_dir);
+
+  // textures bound without sampler are sampled like the GL textures
+  _default_sampler = get_sampler(SamplerDesc{
+    .wrap_u = Wrap::CLAMP_TO_BORDER,
+    .wrap_v = Wrap::CLAMP_TO_BORDER,
+    .wrap_w = Wrap::CLAMP_TO_BORDER,
+  });
 
+  _state = {};
   _is_initialized = true;
+  begin_frame();
 }
 
 void gfx::VKRenderer::shutdown() {
   if (_is_initialized) {
     // wait for the device to finish its work
     vkDeviceWaitIdle(_device);
+    _recording_pool.shutdown();
 
-    _main_deletion_queue.flush();
+    // resources still alive are released with the frame queues
+    for (uint32_t i = 0; i < MAX_BUFFERS; i++) {
+      if (_buffers[i].buffer)
+        destroy_buffer(i);
+    }
+    for (uint32_t i = 0; i < MAX_TEXTURES; i++) {
+      if (_textures[i].image.image)
+        destroy_texture(i);
+    }
+    for (uint32_t i = 0; i < MAX_PIPELINES; i++) {
+      destroy_pipeline(i);
+    }
+    for (uint32_t i = 0; i < MAX_SHADERS; i++) {
+      if (_shaders[i].layout)
+        destroy_shader(i);
+    }
+    for (auto& [desc, sampler] : _sampler_cache) {
+      vkDestroySampler(_device, sampler, nullptr);
+    }
+    _sampler_cache.clear();
 
-    for (int i = 0; i < FRAME_OVERLAP; i++) {
+    for (uint32_t i = 0; i < _frames_in_flight; i++) {
+      _frames[i].deletion_queue.flush(_device, _allocator);
+    }
+
+    destroy_draw_images();
+    _main_deletion_queue.flush(_device, _allocator);
+    vmaDestroyAllocator(_allocator);
+
+    save_pipeline_cache();
+    vkDestroyPipelineCache(_device, _pipeline_cache, nullptr);
+
+    for (uint32_t i = 0; i < _frames_in_flight; i++) {
       // command pool
       vkDestroyCommandPool(_device, _frames[i].command_pool, nullptr);
 
+      vkDestroyQueryPool(_device, _frames[i].timestamp_pool, nullptr);
+      _frames[i].descriptors.destroy(_device);
+      for (ThreadFrameData& thread : _frames[i].threads) {
+        vkDestroyCommandPool(_device, thread.command_pool, nullptr);
+        thread.descriptors.destroy(_device);
+      }
+
       // sync objects
-      vkDestroyFence(_device, _frames[i].render_fence, nullptr);
-      vkDestroySemaphore(_device, _frames[i].render_semaphore, nullptr);
       vkDestroySemaphore(_device, _frames[i].present_semaphore, nullptr);
     }
+    vkDestroySemaphore(_device, _frame_timeline, nullptr);
+    vkDestroyDescriptorPool(_device, _uniform_pool, nullptr);
+    _layout_cache.destroy(_device);
 
-    // swapchain
-    vkDestroySwapchainKHR(_device, _swapchain.swapchain, nullptr);
-
-    // swapchain resources
-    for (VkImageView iv : _swapchain.image_views) {
-      vkDestroyImageView(_device, iv, nullptr);
-    }
+    destroy_swapchain();
 
     // surface
     vkDestroySurfaceKHR(_instance, _surface, nullptr);
@@ -131,166 +489,1462 @@ void gfx::VKRenderer::shutdown() {
     vkb::destroy_debug_utils_messenger(_instance, _debug_messenger);
     // instance
     vkDestroyInstance(_instance, nullptr);
-  } 
+    _is_initialized = false;
+  }
 }
 
 void gfx::VKRenderer::begin_render_pass(std::optional<RenderPass> pass, const PassAction& action) {
+  PROFILE_ZONE("VKRenderer::begin_render_pass");
+  VkCommandBuffer cmd = get_command_buffer();
+
+  const Action color_action = action.color_action.action;
+  const Action depth_action = action.depth_action.action;
+  const Color& color = action.color_action.color;
+  VkClearValue color_value = {};
+  color_value.color = { { color.r, color.g, color.b, color.a } };
+  VkClearValue depth_value = {};
+  depth_value.depthStencil = { action.depth_action.value, 0 };
+
+  auto attachment = [](VkImageView view, VkImageLayout layout, Action action, const VkClearValue& value) {
+    VkRenderingAttachmentInfo att = {};
+    att.sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO;
+    att.imageView = view;
+    att.imageLayout = layout;
+    switch (action) {
+      case Action::NOTHING: att.loadOp = VK_ATTACHMENT_LOAD_OP_LOAD; break;
+      case Action::CLEAR: att.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR; break;
+      case Action::DONT_CARE: att.loadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE; break;
+    }
+    att.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+    att.clearValue = value;
+    return att;
+  };
+  // cleared attachments and attachments without a load drop their content in the transition
+  bool discard_color = color_action != Action::NOTHING;
+  bool discard_depth = depth_action != Action::NOTHING;
+
+  // all the transitions of the pass go in one barrier: the targets of the previous passes this one does not write
+  // become sampled textures, the targets of this pass already in an attachment layout only wait for the previous writes
+  std::vector<VkImageMemoryBarrier2> barriers;
+  _state.color_attachments.clear();
+  _state.depth_attachment = std::nullopt;
+  _state.color_formats.clear();
+  _state.depth_format = VK_FORMAT_UNDEFINED;
+
+  const VKRenderPass* rpass = pass ? &_render_passes[handle_index(pass.value())] : nullptr;
+  std::erase_if(_attachment_textures, [&](Texture h) {
+    if (rpass && (std::find(rpass->colors.begin(), rpass->colors.end(), h) != rpass->colors.end() || rpass->depth == h))
+      return false;
+    VKTexture& texture = _textures[handle_index(h)];
+    barriers.push_back(vkutil::layout_barrier(texture.image.image, texture.aspect, texture.layout, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL));
+    texture.layout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    return true;
+  });
+  auto attach_texture = [&](Texture h, VkImageLayout layout, bool discard) {
+    VKTexture& texture = _textures[handle_index(h)];
+    barriers.push_back(vkutil::layout_barrier(texture.image.image, texture.aspect, texture.layout, layout, discard));
+    if (texture.layout == VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL)
+      _attachment_textures.push_back(h);
+    texture.layout = layout;
+    return &texture;
+  };
+
+  if (!rpass) {
+    begin_timed_pass(cmd, DEFAULT_PASS_NAME);
+    barriers.push_back(vkutil::layout_barrier(_draw_image.image, VK_IMAGE_ASPECT_COLOR_BIT, _draw_image_layout, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, discard_color));
+    barriers.push_back(vkutil::layout_barrier(_depth_image.image, VK_IMAGE_ASPECT_DEPTH_BIT, _depth_image_layout, VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL, discard_depth));
+    _draw_image_layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+    _depth_image_layout = VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL;
+    _state.color_attachments.push_back(attachment(_draw_image.image_view, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, color_action, color_value));
+    _state.depth_attachment = attachment(_depth_image.image_view, VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL, depth_action, depth_value);
+    _state.color_formats.push_back(_draw_image.image_format);
+    _state.depth_format = _depth_image.image_format;
+    _state.extent = _draw_extent;
+  } else {
+    begin_timed_pass(cmd, rpass->name.c_str());
+    for (Texture h : rpass->colors) {
+      const VKTexture* texture = attach_texture(h, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, discard_color);
+      _state.color_attachments.push_back(attachment(texture->image.image_view, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, color_action, color_value));
+      _state.color_formats.push_back(texture->image.image_format);
+    }
+    if (rpass->depth) {
+      const VKTexture* texture = attach_texture(rpass->depth.value(), VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL, discard_depth);
+      _state.depth_attachment = attachment(texture->image.image_view, VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL, depth_action, depth_value);
+      _state.depth_format = texture->image.image_format;
+    }
+    _state.extent = rpass->extent;
+  }
+
+  VkDependencyInfo dep_info = {};
+  dep_info.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO;
+  dep_info.imageMemoryBarrierCount = (uint32_t)barriers.size();
+  dep_info.pImageMemoryBarriers = barriers.data();
+  vkCmdPipelineBarrier2(cmd, &dep_info);
+
+  _state.pass = pass;
+  _state.in_pass = true;
+  _state.rendered = false;
+  // the rendering instance begins with the first command, its contents depend on it
+  _state.rendering = false;
+  _state.recorder.pipeline = nullptr;
+  _state.recorder.vk_pipeline = VK_NULL_HANDLE;
 }
 
 void gfx::VKRenderer::end_render_pass() {
+  PROFILE_ZONE("VKRenderer::end_render_pass");
+  if (!_state.in_pass)
+    return;
+  VkCommandBuffer cmd = get_command_buffer();
+  record_command_lists();
+  // an empty pass still clears its attachments
+  if (!_state.rendered)
+    begin_rendering(false);
+  vkCmdEndRendering(cmd);
+  _state.rendering = false;
+  end_timed_pass(cmd);
+
+  // the targets stay attachments, the next pass moves them to the shader read layout if it does not write them
+
+  _state.pass = std::nullopt;
+  _state.in_pass = false;
+  _state.recorder.pipeline = nullptr;
+  _state.recorder.vk_pipeline = VK_NULL_HANDLE;
 }
 
 void gfx::VKRenderer::set_pipeline(Pipeline pipe) {
+  PROFILE_ZONE("VKRenderer::set_pipeline");
+  VKRecorder& rec = current_recorder();
+  VKPipeline* pip = &_pipelines[handle_index(pipe)];
+  // draws with the fallback when the shader could not be created, the draws are skipped without fallback
+  if (!_shaders[handle_index(pip->shader)].layout) {
+    VKPipeline* fallback = pip->fallback != INVALID_HANDLE ? &_pipelines[handle_index(pip->fallback)] : nullptr;
+    pip = fallback && _shaders[handle_index(fallback->shader)].layout ? fallback : nullptr;
+  }
+  rec.pipeline = nullptr;
+  rec.vk_pipeline = VK_NULL_HANDLE;
+  if (!pip)
+    return;
+  if (!_state.in_pass) {
+    std::cout << "Pipelines are set inside a render pass" << std::endl;
+    return;
+  }
+
+  VkPipeline vk_pipeline = get_pipeline_variant(*pip);
+  if (!vk_pipeline)
+    return;
+  rec.pipeline = pip;
+  rec.vk_pipeline = vk_pipeline;
+  vkCmdBindPipeline(rec.cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, vk_pipeline);
 }
 
 void gfx::VKRenderer::set_bindings(Bindings bind) {
+  PROFILE_ZONE("VKRenderer::set_bindings");
+  VKRecorder& rec = current_recorder();
+  const VKPipeline* pip = rec.pipeline;
+  if (!pip)
+    return;
+  const VKShader& shader = _shaders[handle_index(pip->shader)];
+
+  bool use_instance_buffer = pip->num_bindings > 1;
+  if (use_instance_buffer && !bind.instance_buffer.has_value()) {
+    std::cout << "Pipeline has per-instance attributes but the bindings have no instance buffer" << std::endl;
+    return;
+  }
+
+  const VKBuffer& vertex_buffer = _buffers[handle_index(bind.vertex_buffer)];
+  VkBuffer buffers[2] = { vertex_buffer.buffer, VK_NULL_HANDLE };
+  VkDeviceSize offsets[2] = { vertex_buffer.base_offset() + bind.vertex_buffer_offset, 0 };
+  if (use_instance_buffer) {
+    const VKBuffer& instance_buffer = _buffers[handle_index(bind.instance_buffer.value())];
+    buffers[1] = instance_buffer.buffer;
+    offsets[1] = instance_buffer.base_offset() + bind.instance_buffer_offset;
+  }
+  vkCmdBindVertexBuffers(rec.cmd, 0, pip->num_bindings, buffers, offsets);
+
+  if (bind.index_buffer.has_value() && pip->index_size > 0) {
+    const VKBuffer& index_buffer = _buffers[handle_index(bind.index_buffer.value())];
+    rec.index_buffer = index_buffer.buffer;
+    rec.index_base = index_buffer.base_offset();
+    rec.index_offset = bind.index_buffer_offset;
+    vkCmdBindIndexBuffer(rec.cmd, index_buffer.buffer, rec.index_base + rec.index_offset, pip->index_type);
+  }
+
+  if (bind.textures.size() > shader.num_textures) {
+    std::cout << "Bindings texture count and shader definition dit not match" << std::endl;
+    return;
+  }
+  if (bind.textures.empty())
+    return;
+
+  VkDescriptorSet set = rec.descriptors->allocate(_device, shader.set_layouts[1]);
+  if (!set)
+    return;
+
+  std::array<VkDescriptorImageInfo, VK_MAX_SHADER_TEXTURES> image_infos;
+  std::array<VkWriteDescriptorSet, VK_MAX_SHADER_TEXTURES> writes;
+  for (uint32_t i = 0; i < bind.textures.size(); i++) {
+    const TextureBinding& tex = bind.textures[i];
+    const VKTexture& texture = _textures[handle_index(tex.texture)];
+    VkSampler sampler = tex.sampler != INVALID_HANDLE ? _samplers[handle_index(tex.sampler)].sampler : _default_sampler;
+    image_infos[i] = VkDescriptorImageInfo{ sampler, texture.image.image_view, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL };
+
+    writes[i] = {};
+    writes[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    writes[i].dstSet = set;
+    writes[i].dstBinding = i;
+    writes[i].descriptorCount = 1;
+    writes[i].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    writes[i].pImageInfo = &image_infos[i];
+  }
+  vkUpdateDescriptorSets(_device, (uint32_t)bind.textures.size(), writes.data(), 0, nullptr);
+  vkCmdBindDescriptorSets(rec.cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, shader.layout, 1, 1, &set, 0, nullptr);
 }
 
 void gfx::VKRenderer::set_uniforms(const Memory& mem) {
-}
+  PROFILE_ZONE("VKRenderer::set_uniforms");
+  VKRecorder& rec = current_recorder();
+  if (!rec.pipeline)
+    return;
+  const VKShader& shader = _shaders[handle_index(rec.pipeline->shader)];
+  if (!shader.use_uniforms || mem.size == 0)
+    return;
+  if (mem.size > VK_MAX_UNIFORM_SIZE) {
+    std::cout << "Uniform blocks can't be larger than " << VK_MAX_UNIFORM_SIZE << " bytes" << std::endl;
+    return;
+  }
 
-void gfx::VKRenderer::draw(uint32_t first_element, uint32_t num_elements, uint32_t num_instances) {
-  // wait for the gpu to finish rendering the frame before starting recording new commands for this frame
-  VK_CHECK(vkWaitForFences(_device, 1, &get_current_frame().render_fence, true, 1000000000));
-  // reset the fence
-  VK_CHECK(vkResetFences(_device, 1, &get_current_frame().render_fence));
+  std::optional<VkDeviceSize> offset = alloc_uniforms(*rec.uniforms, mem.size);
+  if (!offset) {
+    std::cout << "Uniform ring is full, increase VK_UNIFORM_RING_FRAME_SIZE" << std::endl;
+    return;
+  }
+  std::memcpy(_uniform_ring.mapped + offset.value(), mem.data, mem.size);
 
-  get_current_frame().deletion_queue.flush();
+  // the set is the same for every draw, only the dynamic offset changes
+  uint32_t dynamic_offset = (uint32_t)offset.value();
+  vkCmdBindDescriptorSets(rec.cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, shader.layout, 0, 1, &_uniform_set, 1, &dynamic_offset);
+}
 
-  // request image index from the swapchain
-  // we set the present_semaphore to be signaled when the image is ready
-  uint32_t sc_image_idx;
-  VK_CHECK(vkAcquireNextImageKHR(_device, _swapchain.swapchain, 1000000000, get_current_frame().present_semaphore, nullptr, &sc_image_idx));
+void gfx::VKRenderer::draw(uint32_t first_element, uint32_t num_elements, uint32_t num_instances, int32_t base_vertex) {
+  PROFILE_ZONE("VKRenderer::draw");
+  VKRecorder& rec = current_recorder();
+  if (!rec.pipeline || num_instances == 0)
+    return;
 
-  // get frame's command buffer
-  VkCommandBuffer cmd = get_current_frame().main_command_buffer;
+  if (rec.pipeline->index_size == 0) {
+    vkCmdDraw(rec.cmd, num_elements, num_instances, first_element, 0);
+  } else {
+    vkCmdDrawIndexed(rec.cmd, num_elements, num_instances, first_element, base_vertex, 0);
+  }
+}
 
-  // reset it
-  VK_CHECK(vkResetCommandBuffer(cmd, 0));
+void gfx::VKRenderer::multi_draw_indirect(Buffer h, uint32_t offset, uint32_t draw_count, uint32_t stride) {
+  PROFILE_ZONE("VKRenderer::multi_draw_indirect");
+  VKRecorder& rec = current_recorder();
+  const VKPipeline* pip = rec.pipeline;
+  if (!pip)
+    return;
+  const VKBuffer& args = _buffers[handle_index(h)];
+  if (args.type != BufferType::INDIRECT_BUFFER) {
+    std::cout << "Indirect draws need a buffer created as INDIRECT_BUFFER" << std::endl;
+    return;
+  }
+  bool indexed = pip->index_size > 0;
+  if (indexed && !rec.index_buffer) {
+    std::cout << "Indexed indirect draws need an index buffer" << std::endl;
+    return;
+  }
+  if (stride == 0)
+    stride = indexed ? sizeof(DrawIndexedIndirectArgs) : sizeof(DrawIndirectArgs);
+
+  // the first element of the arguments is relative to the start of the index buffer
+  if (indexed)
+    vkCmdBindIndexBuffer(rec.cmd, rec.index_buffer, rec.index_base, pip->index_type);
+
+  // without multiDrawIndirect the arguments are drawn one call each
+  uint32_t draws_per_call = _multi_draw_indirect ? draw_count : 1;
+  VkDeviceSize args_offset = args.base_offset() + offset;
+  for (uint32_t i = 0; i < draw_count; i += draws_per_call) {
+    VkDeviceSize call_offset = args_offset + (VkDeviceSize)i * stride;
+    uint32_t count = std::min(draws_per_call, draw_count - i);
+    if (indexed) {
+      vkCmdDrawIndexedIndirect(rec.cmd, args.buffer, call_offset, count, stride);
+    } else {
+      vkCmdDrawIndirect(rec.cmd, args.buffer, call_offset, count, stride);
+    }
+  }
 
-  // begin command buffer
-  VkCommandBufferBeginInfo cmd_begin_info = {};
-  cmd_begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-  cmd_begin_info.pNext = nullptr;
-  cmd_begin_info.pInheritanceInfo = nullptr;
-  cmd_begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT; // tells the driver we will submit this command buffer only once
+  if (indexed)
+    vkCmdBindIndexBuffer(rec.cmd, rec.index_buffer, rec.index_base + rec.index_offset, pip->index_type);
+}
 
-  _draw_extent.width = _draw_image.image_extent.width;
-  _draw_extent.height = _draw_image.image_extent.height;
+void gfx::VKRenderer::execute_command_list(std::function<void()> record) {
+  PROFILE_ZONE("VKRenderer::execute_command_list");
+  if (!_state.in_pass) {
+    std::cout << "Command lists are executed inside a render pass" << std::endl;
+    return;
+  }
+  // recorded with the lists executed right after it, by the next command of the renderer thread
+  _command_lists.push_back(std::move(record));
+}
 
-  VK_CHECK(vkBeginCommandBuffer(cmd, &cmd_begin_info));
+void gfx::VKRenderer::set_viewport(const Rect& rect) {
+  PROFILE_ZONE("VKRenderer::set_viewport");
+  // the command lists executed before keep the previous viewport
+  if (_state.in_pass)
+    record_command_lists();
+  // the rows are in GL order, the rect needs no flip
+  _state.viewport = VkViewport{ (float)rect.x, (float)rect.y, (float)rect.width, (float)rect.height, 0.0f, 1.0f };
+  // set when the next rendering instance begins otherwise
+  if (_state.rendering && !_state.rendering_secondary)
+    vkCmdSetViewport(get_command_buffer(), 0, 1, &_state.viewport.value());
+}
 
-  // transition our main draw image into general layout so we can write into it
-  // we use VK_IMAGE_LAYOUT_UNDEFINED because we will overwrite it all so we dont care about what was the older layout
-  vkutil::transition_image(cmd, _draw_image.image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL);
+void gfx::VKRenderer::set_scissor(const Rect&) {
+  PROFILE_ZONE("VKRenderer::set_scissor");
+  // the GL backend never enables the scissor test, the passes keep a scissor covering their attachments
+}
 
-  draw_background(cmd);
+void gfx::VKRenderer::submit() {
+  PROFILE_ZONE("VKRenderer::submit");
+  FrameData& frame = get_current_frame();
+  VkCommandBuffer cmd = get_command_buffer();
 
-  // transition the draw image and the swapchain image into their correct transfer layouts
-  // src for the _draw_image
-  // dst for the swapchain image
-  vkutil::transition_image(cmd, _draw_image.image, VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL);
-  vkutil::transition_image(cmd, _swapchain.images[sc_image_idx], VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
+  // request image index from the swapchain
+  // we set the present_semaphore to be signaled when the image is ready
+  uint32_t sc_image_idx;
+  VkResult acquired = vkAcquireNextImageKHR(_device, _swapchain.swapchain, 1000000000, frame.present_semaphore, nullptr, &sc_image_idx);
+  // an out of date swapchain drops the image of the frame
+  bool present = acquired == VK_SUCCESS || acquired == VK_SUBOPTIMAL_KHR;
+  if (acquired == VK_ERROR_OUT_OF_DATE_KHR || acquired == VK_SUBOPTIMAL_KHR)
+    _swapchain_dirty = true;
+
+  // the uploads of the next frames expect every texture in the shader read layout
+  std::vector<VkImageMemoryBarrier2> barriers;
+  for (Texture h : _attachment_textures) {
+    VKTexture& texture = _textures[handle_index(h)];
+    barriers.push_back(vkutil::layout_barrier(texture.image.image, texture.aspect, texture.layout, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL));
+    texture.layout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+  }
+  _attachment_textures.clear();
+
+  VkDependencyInfo dep_info = {};
+  dep_info.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO;
+  if (present) {
+    VkImage sc_image = _swapchain.images[sc_image_idx];
+    // the swapchain transition waits for the acquire semaphore, waited at the transfer stage
+    barriers.push_back(vkutil::layout_barrier(_draw_image.image, VK_IMAGE_ASPECT_COLOR_BIT, _draw_image_layout, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL));
+    barriers.push_back(vkutil::layout_barrier(sc_image, VK_IMAGE_ASPECT_COLOR_BIT, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL));
+    barriers.back().srcStageMask = VK_PIPELINE_STAGE_2_ALL_TRANSFER_BIT;
+    _draw_image_layout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+  }
+  if (!barriers.empty()) {
+    dep_info.imageMemoryBarrierCount = (uint32_t)barriers.size();
+    dep_info.pImageMemoryBarriers = barriers.data();
+    vkCmdPipelineBarrier2(cmd, &dep_info);
+  }
 
-  // execute a copy from the draw image into the swapchain image
-  vkutil::copy_image_to_image(cmd, _draw_image.image, _swapchain.images[sc_image_idx], _draw_extent, _swapchain.extent);
+  if (present) {
+    VkImage sc_image = _swapchain.images[sc_image_idx];
 
-  // transition swapchain image layout to Present so we can show it on the screen
-  vkutil::transition_image(cmd, _swapchain.images[sc_image_idx], VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_PRESENT_SRC_KHR);
+    // the draw image rows are in GL order, bottom row first
+    // the blit filters linearly when the render scale makes the draw image smaller or larger than the window
+    vkutil::copy_image_to_image(cmd, _draw_image.image, sc_image, _draw_extent, _swapchain.extent, true);
+
+    // transition swapchain image layout to Present so we can show it on the screen
+    VkImageMemoryBarrier2 to_present = vkutil::layout_barrier(sc_image, VK_IMAGE_ASPECT_COLOR_BIT, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_PRESENT_SRC_KHR);
+    dep_info.imageMemoryBarrierCount = 1;
+    dep_info.pImageMemoryBarriers = &to_present;
+    vkCmdPipelineBarrier2(cmd, &dep_info);
+  }
 
   // finalize the command buffer (we can no longer add commands, but it can now be executed)
   VK_CHECK(vkEndCommandBuffer(cmd));
-
-  // command buffer submit preparation
-  VkCommandBufferSubmitInfo cmd_buffer_submit_info{};
-  cmd_buffer_submit_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_SUBMIT_INFO;
-  cmd_buffer_submit_info.pNext = nullptr;
-  cmd_buffer_submit_info.commandBuffer = cmd;
-  cmd_buffer_submit_info.deviceMask = 0;
+  _state.recording = false;
+
+  // the staging copies of the frame run before its commands, in the same submit
+  VkCommandBufferSubmitInfo cmd_infos[2] = {};
+  uint32_t num_cmds = 0;
+  if (record_uploads(frame.upload_command_buffer)) {
+    cmd_infos[num_cmds].sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_SUBMIT_INFO;
+    cmd_infos[num_cmds++].commandBuffer = frame.upload_command_buffer;
+  }
+  cmd_infos[num_cmds].sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_SUBMIT_INFO;
+  cmd_infos[num_cmds++].commandBuffer = cmd;
+  _staging_ring.flush(_allocator);
+  _uniform_ring.flush(_allocator);
 
   // our wait semaphore will be the present_semaphore which is signaled when the swapchain is ready
   VkSemaphoreSubmitInfo wait_info{};
   wait_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_SUBMIT_INFO;
   wait_info.pNext = nullptr;
-  wait_info.semaphore = get_current_frame().present_semaphore;
-  wait_info.stageMask = VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT_KHR;
+  wait_info.semaphore = frame.present_semaphore;
+  wait_info.stageMask = VK_PIPELINE_STAGE_2_ALL_TRANSFER_BIT;
   wait_info.deviceIndex = 0;
   wait_info.value = 1;
 
-  // our signal semaphore will be the render_semaphore which is signaled when rendering is finished
-  VkSemaphoreSubmitInfo signal_info = wait_info;
-  signal_info.semaphore = get_current_frame().render_semaphore;
-  signal_info.stageMask = VK_PIPELINE_STAGE_2_ALL_GRAPHICS_BIT;
+  // the timeline tells begin_frame when the resources of the frame are free again,
+  // the render semaphore of the image tells the presentation when rendering is finished
+  frame.timeline_value = _frame_number + 1;
+  VkSemaphoreSubmitInfo signal_infos[2] = {};
+  signal_infos[0].sType = VK_STRUCTURE_TYPE_SEMAPHORE_SUBMIT_INFO;
+  signal_infos[0].semaphore = _frame_timeline;
+  signal_infos[0].value = frame.timeline_value;
+  signal_infos[0].stageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT;
+  if (present) {
+    signal_infos[1] = signal_infos[0];
+    signal_infos[1].semaphore = _swapchain.render_semaphores[sc_image_idx];
+    signal_infos[1].value = 0;
+  }
 
   // submit info
   VkSubmitInfo2 submit_info = {};
   submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO_2;
   submit_info.pNext = nullptr;
-  submit_info.waitSemaphoreInfoCount = 1;
+  submit_info.waitSemaphoreInfoCount = present ? 1 : 0;
   submit_info.pWaitSemaphoreInfos = &wait_info;
-  submit_info.signalSemaphoreInfoCount = 1;
-  submit_info.pSignalSemaphoreInfos = &signal_info;
-  submit_info.commandBufferInfoCount = 1;
-  submit_info.pCommandBufferInfos = &cmd_buffer_submit_info;
+  submit_info.signalSemaphoreInfoCount = present ? 2 : 1;
+  submit_info.pSignalSemaphoreInfos = signal_infos;
+  submit_info.commandBufferInfoCount = num_cmds;
+  submit_info.pCommandBufferInfos = cmd_infos;
 
   // submit command buffer to the queue
-  VK_CHECK(vkQueueSubmit2(_graphics_queue, 1, &submit_info, get_current_frame().render_fence));
-
-  // prepare present
-  VkPresentInfoKHR present_info = {};
-  present_info.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
-  present_info.pNext = nullptr;
-  present_info.pSwapchains = &_swapchain.swapchain;
-  present_info.swapchainCount = 1;
-  // wait semaphore is render_semaphore, so we wait for queue submit to end before presenting the image to the screen 
-  present_info.pWaitSemaphores = &get_current_frame().render_semaphore;
-  present_info.waitSemaphoreCount = 1;
-
-  present_info.pImageIndices = &sc_image_idx;
+  VK_CHECK(vkQueueSubmit2(_graphics_queue, 1, &submit_info, VK_NULL_HANDLE));
+
+  if (present) {
+    // prepare present
+    VkPresentInfoKHR present_info = {};
+    present_info.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
+    present_info.pNext = nullptr;
+    present_info.pSwapchains = &_swapchain.swapchain;
+    present_info.swapchainCount = 1;
+    // wait semaphore is the render semaphore of the image, so we wait for queue submit to end before presenting the image to the screen
+    present_info.pWaitSemaphores = &_swapchain.render_semaphores[sc_image_idx];
+    present_info.waitSemaphoreCount = 1;
+
+    present_info.pImageIndices = &sc_image_idx;
+
+    // an out of date swapchain drops the frame
+    VkResult presented = vkQueuePresentKHR(_graphics_queue, &present_info);
+    if (presented == VK_ERROR_OUT_OF_DATE_KHR || presented == VK_SUBOPTIMAL_KHR)
+      _swapchain_dirty = true;
+  }
 
-  VK_CHECK(vkQueuePresentKHR(_graphics_queue, &present_info));
+  // some platforms never report an out of date swapchain, the window size is checked too
+  VkExtent2D extent = window_extent();
+  if (_swapchain_dirty || extent.width != _swapchain.window_extent.width || extent.height != _swapchain.window_extent.height)
+    recreate_swapchain();
 
   _frame_number++;
+  begin_frame();
 }
 
-void gfx::VKRenderer::set_viewport(const Rect& rect) {
-  // todo
-}
+bool gfx::VKRenderer::new_buffer(Buffer h, const BufferDesc& desc) {
+  PROFILE_ZONE("VKRenderer::new_buffer");
+  if (desc.usage == BufferUsage::IMMUTABLE && !desc.mem.data) {
+    std::cout << "IMMUTABLE buffers must be created with their data" << std::endl;
+    return false;
+  }
+  if (desc.mem.size == 0) {
+    std::cout << "Buffers can't be empty" << std::endl;
+    return false;
+  }
+
+  VKBuffer& buffer = _buffers[handle_index(h)];
+  buffer.type = desc.type;
+  buffer.usage = desc.usage;
+  buffer.size = (uint32_t)desc.mem.size;
+  // the segments start aligned for the appends
+  buffer.segment_size = (uint32_t)align_up(buffer.size, VK_STREAM_BUFFER_ALIGNMENT);
+  buffer.append_offset = 0;
+  buffer.frame = (uint32_t)(_frame_number % _frames_in_flight);
+  buffer.mapped = nullptr;
+
+  VkBufferCreateInfo buffer_info = {};
+  buffer_info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+  buffer_info.size = desc.usage == BufferUsage::STREAM ? (VkDeviceSize)buffer.segment_size * _frames_in_flight : buffer.size;
+  buffer_info.usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+  switch (desc.type) {
+    using enum BufferType;
+    case VERTEX_BUFFER: buffer_info.usage |= VK_BUFFER_USAGE_VERTEX_BUFFER_BIT; break;
+    case INDEX_BUFFER: buffer_info.usage |= VK_BUFFER_USAGE_INDEX_BUFFER_BIT; break;
+    case INDIRECT_BUFFER: buffer_info.usage |= VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT; break;
+  }
 
-void gfx::VKRenderer::set_scissor(const Rect& rect) {
-  // todo
+  VmaAllocationCreateInfo alloc_info = {};
+  if (desc.usage == BufferUsage::STREAM) {
+    alloc_info.usage = VMA_MEMORY_USAGE_AUTO;
+    alloc_info.flags = VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT | VMA_ALLOCATION_CREATE_MAPPED_BIT;
+  } else {
+    alloc_info.usage = VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE;
+  }
+
+  VmaAllocationInfo info;
+  if (vmaCreateBuffer(_allocator, &buffer_info, &alloc_info, &buffer.buffer, &buffer.allocation, &info) != VK_SUCCESS) {
+    std::cout << "Failed to create a buffer of " << buffer.size << " bytes" << std::endl;
+    buffer = {};
+    return false;
+  }
+  buffer.mapped = desc.usage == BufferUsage::STREAM ? (uint8_t*)info.pMappedData : nullptr;
+
+  if (buffer.usage != BufferUsage::IMMUTABLE)
+    _stream_buffers.push_back(h);
+
+  if (desc.mem.data) {
+    if (buffer.usage == BufferUsage::STREAM) {
+      update_buffer(h, desc.mem);
+    } else {
+      queue_buffer_upload(buffer, 0, desc.mem);
+    }
+  }
+
+  return true;
 }
 
-void gfx::VKRenderer::submit() {
-  // todo
+bool gfx::VKRenderer::update_buffer(Buffer h, const Memory& mem) {
+  PROFILE_ZONE("VKRenderer::update_buffer");
+  VKBuffer& buffer = _buffers[handle_index(h)];
+  if (buffer.usage == BufferUsage::IMMUTABLE) {
+    std::cout << "Can't update an IMMUTABLE buffer" << std::endl;
+    return false;
+  }
+  if (mem.size > buffer.size) {
+    std::cout << "Buffer update of " << mem.size << " bytes is bigger than the buffer size " << buffer.size << std::endl;
+    return false;
+  }
+
+  if (buffer.usage == BufferUsage::STREAM) {
+    // rewrites the segment of the current frame
+    write_stream_buffer(buffer, buffer.base_offset(), mem);
+  } else {
+    queue_buffer_upload(buffer, 0, mem);
+  }
+  buffer.append_offset = (uint32_t)mem.size;
+  return true;
 }
 
-bool gfx::VKRenderer::new_buffer(Buffer h, const BufferDesc& desc) {
-  // todo
-  return false;
+std::optional<uint32_t> gfx::VKRenderer::append_buffer(Buffer h, const Memory& mem) {
+  PROFILE_ZONE("VKRenderer::append_buffer");
+  VKBuffer& buffer = _buffers[handle_index(h)];
+  if (buffer.usage == BufferUsage::IMMUTABLE) {
+    std::cout << "Can't append to an IMMUTABLE buffer" << std::endl;
+    return std::nullopt;
+  }
+
+  uint32_t offset = (uint32_t)align_up(buffer.append_offset, VK_STREAM_BUFFER_ALIGNMENT);
+  if (offset + mem.size > buffer.size) {
+    const char* usage = buffer.usage == BufferUsage::STREAM ? "STREAM" : "DYNAMIC";
+    std::cout << usage << " buffer of " << buffer.size << " bytes is full for this frame" << std::endl;
+    return std::nullopt;
+  }
+
+  if (buffer.usage == BufferUsage::STREAM) {
+    write_stream_buffer(buffer, buffer.base_offset() + offset, mem);
+  } else {
+    queue_buffer_upload(buffer, offset, mem);
+  }
+  buffer.append_offset = offset + (uint32_t)mem.size;
+  return offset;
 }
 
 bool gfx::VKRenderer::new_texture(Texture h, const TextureDesc& desc) {
-  // todo
-  return false;
+  PROFILE_ZONE("VKRenderer::new_texture");
+  VKTexture& texture = _textures[handle_index(h)];
+  texture.type = desc.type;
+  texture.format = desc.format;
+  texture.aspect = desc.format == TextureFormat::DEPTH ? VK_IMAGE_ASPECT_DEPTH_BIT : VK_IMAGE_ASPECT_COLOR_BIT;
+  texture.texel_size = desc.format == TextureFormat::R8 ? 1 : 4;
+  texture.layout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+
+  VkExtent3D extent = {
+    std::max(desc.width, 1u),
+    desc.type != TextureType::TEXTURE_1D ? std::max(desc.height, 1u) : 1u,
+    desc.type == TextureType::TEXTURE_3D ? std::max(desc.depth, 1u) : 1u,
+  };
+
+  // the mips are built from the data, the render targets only have their first level
+  bool generate_mips = desc.generate_mip_maps && desc.mem.data && desc.format != TextureFormat::DEPTH;
+  texture.mip_levels = 1;
+  if (generate_mips)
+    texture.mip_levels = (uint32_t)std::floor(std::log2(std::max({ extent.width, extent.height, extent.depth }))) + 1;
+
+  VkImageUsageFlags usage = VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+  if (desc.type == TextureType::TEXTURE_2D)
+    usage |= desc.format == TextureFormat::DEPTH ? VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT : VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
+
+  VkFormat format = get_vk_texture_format(desc.format);
+  VkImageCreateInfo image_info = vkutil::image_create_info(format, usage, extent);
+  image_info.imageType = get_vk_image_type(desc.type);
+  image_info.mipLevels = texture.mip_levels;
+
+  VmaAllocationCreateInfo alloc_info = {};
+  alloc_info.usage = VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE;
+
+  if (vmaCreateImage(_allocator, &image_info, &alloc_info, &texture.image.image, &texture.image.allocation, nullptr) != VK_SUCCESS) {
+    std::cout << "Failed to create a texture of " << extent.width << "x" << extent.height << "x" << extent.depth << std::endl;
+    texture = {};
+    return false;
+  }
+
+  VkImageViewCreateInfo view_info = vkutil::imageview_create_info(format, texture.image.image, texture.aspect);
+  view_info.viewType = get_vk_image_view_type(desc.type);
+  view_info.subresourceRange.levelCount = texture.mip_levels;
+  VK_CHECK(vkCreateImageView(_device, &view_info, nullptr, &texture.image.image_view));
+
+  texture.image.image_extent = extent;
+  texture.image.image_format = format;
+
+  queue_texture_transition(texture, false, generate_mips);
+  if (desc.mem.data)
+    queue_texture_upload(texture, TextureRegion{ .width = extent.width, .height = extent.height, .depth = extent.depth }, 0, desc.mem.data);
+
+  return true;
+}
+
+bool gfx::VKRenderer::update_texture(Texture h, const TextureRegion& region, uint32_t mip, const Memory& mem) {
+  PROFILE_ZONE("VKRenderer::update_texture");
+  const VKTexture& texture = _textures[handle_index(h)];
+  if (mip >= texture.mip_levels) {
+    std::cout << "Texture has no mip level " << mip << std::endl;
+    return false;
+  }
+
+  TextureRegion texels = region;
+  if (texture.type != TextureType::TEXTURE_3D) {
+    texels.z = 0;
+    texels.depth = 1;
+  }
+  if (texture.type == TextureType::TEXTURE_1D) {
+    texels.y = 0;
+    texels.height = 1;
+  }
+
+  const VkExtent3D& extent = texture.image.image_extent;
+  uint32_t mip_width = std::max(extent.width >> mip, 1u);
+  uint32_t mip_height = std::max(extent.height >> mip, 1u);
+  uint32_t mip_depth = std::max(extent.depth >> mip, 1u);
+  if (texels.x + texels.width > mip_width || texels.y + texels.height > mip_height || texels.z + texels.depth > mip_depth) {
+    std::cout << "Texture update region is outside of mip level " << mip << std::endl;
+    return false;
+  }
+
+  // the client texels of RGB8 textures are 3 bytes
+  uint32_t src_texel_size = texture.format == TextureFormat::RGB8 ? 3 : texture.texel_size;
+  size_t size = (size_t)texels.width * texels.height * texels.depth * src_texel_size;
+  if (mem.size < size) {
+    std::cout << "Texture update of " << mem.size << " bytes is smaller than its region of " << size << " bytes" << std::endl;
+    return false;
+  }
+  if (size == 0)
+    return true;
+
+  // copied by the upload command buffer of the frame, before the draws of the frame
+  queue_texture_transition(texture, true, false);
+  queue_texture_upload(texture, texels, mip, mem.data);
+  return true;
 }
 
 bool gfx::VKRenderer::new_shader(Shader h, const ShaderDesc& desc) {
-  // todo
-  return false;
+  PROFILE_ZONE("VKRenderer::new_shader");
+  if (!desc.vertex_binary.vk_spirv || !desc.fragment_binary.vk_spirv) {
+    std::cout << "The Vulkan backend needs the SPIR-V modules of the shaders, see molten_embed_shaders" << std::endl;
+    return false;
+  }
+  if (desc.texture_names.size() > VK_MAX_SHADER_TEXTURES) {
+    std::cout << "Shaders can't have more than " << VK_MAX_SHADER_TEXTURES << " textures" << std::endl;
+    return false;
+  }
+
+  auto create_module = [this](const ShaderBinary& binary) {
+    VkShaderModuleCreateInfo module_info = {};
+    module_info.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+    module_info.codeSize = binary.vk_spirv_size;
+    module_info.pCode = binary.vk_spirv;
+    VkShaderModule module = VK_NULL_HANDLE;
+    if (vkCreateShaderModule(_device, &module_info, nullptr, &module) != VK_SUCCESS)
+      std::cout << "Failed to create a shader module" << std::endl;
+    return module;
+  };
+
+  VKShader& shader = _shaders[handle_index(h)];
+  shader.vertex = create_module(desc.vertex_binary);
+  shader.fragment = create_module(desc.fragment_binary);
+  if (!shader.vertex || !shader.fragment) {
+    vkDestroyShaderModule(_device, shader.vertex, nullptr);
+    vkDestroyShaderModule(_device, shader.fragment, nullptr);
+    shader = {};
+    return false;
+  }
+  shader.use_uniforms = !desc.uniforms_layout.uniforms.empty();
+  shader.num_textures = (uint32_t)desc.texture_names.size();
+
+  // set 0 holds the uniform block and set 1 the textures, the sets are empty when the shader has none
+  // the layouts come from the cache, the shaders with the same textures share them
+  std::vector<VkDescriptorSetLayoutBinding> texture_bindings(shader.num_textures);
+  for (uint32_t i = 0; i < shader.num_textures; i++) {
+    texture_bindings[i] = {};
+    texture_bindings[i].binding = i;
+    texture_bindings[i].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    texture_bindings[i].descriptorCount = 1;
+    texture_bindings[i].stageFlags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT;
+  }
+  shader.set_layouts[0] = shader.use_uniforms ? _uniform_set_layout : _layout_cache.get(_device, {});
+  shader.set_layouts[1] = _layout_cache.get(_device, texture_bindings);
+
+  VkPipelineLayoutCreateInfo layout_info = {};
+  layout_info.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+  layout_info.setLayoutCount = (uint32_t)shader.set_layouts.size();
+  layout_info.pSetLayouts = shader.set_layouts.data();
+  VK_CHECK(vkCreatePipelineLayout(_device, &layout_info, nullptr, &shader.layout));
+
+  return true;
 }
 
 bool gfx::VKRenderer::new_render_pass(RenderPass h, const RenderPassDesc& desc) {
-  // todo
-  return false;
+  PROFILE_ZONE("VKRenderer::new_render_pass");
+  std::optional<Texture> first = !desc.colors.empty() ? std::optional<Texture>(desc.colors[0]) : desc.depth;
+  if (!first) {
+    std::cout << "Render passes need at least one attachment" << std::endl;
+    return false;
+  }
+
+  std::vector<Texture> attachments = desc.colors;
+  if (desc.depth)
+    attachments.push_back(desc.depth.value());
+  for (Texture att : attachments) {
+    const VKTexture& texture = _textures[handle_index(att)];
+    if (texture.type != TextureType::TEXTURE_2D || texture.mip_levels > 1) {
+      std::cout << "Render pass attachments must be 2D textures without mips" << std::endl;
+      return false;
+    }
+  }
+
+  VKRenderPass& pass = _render_passes[handle_index(h)];
+  pass.colors = desc.colors;
+  pass.depth = desc.depth;
+  pass.name = desc.name;
+  const VkExtent3D& extent = _textures[handle_index(first.value())].image.image_extent;
+  pass.extent = VkExtent2D{ extent.width, extent.height };
+
+  return true;
 }
 
 bool gfx::VKRenderer::new_pipeline(Pipeline h, const PipelineDesc& desc) {
-  // todo
-  return false;
+  PROFILE_ZONE("VKRenderer::new_pipeline");
+  VKPipeline& pipe = _pipelines[handle_index(h)];
+  pipe.shader = desc.shader;
+  pipe.fallback = desc.fallback;
+  pipe.index_type = desc.index_type == IndexType::UINT32 ? VK_INDEX_TYPE_UINT32 : VK_INDEX_TYPE_UINT16;
+  pipe.index_size = desc.index_type == IndexType::NONE ? 0 : desc.index_type == IndexType::UINT16 ? 2 : 4;
+  pipe.topology = get_vk_topology(desc.primitive_type);
+  pipe.cull_mode = get_vk_cull_mode(desc.cull);
+  pipe.variants.clear();
+
+  // per-vertex and per-instance attributes are interleaved in their own buffer, the location of an attribute is its index
+  uint32_t vertex_stride = 0;
+  uint32_t instance_stride = 0;
+  bool use_instance_buffer = false;
+  bool use_step_rate = false;
+  pipe.num_attributes = 0;
+  for (uint32_t i = 0; i < MAX_ATTRIBUTES; i++) {
+    const VertexAttribute& attr = desc.layout.attributes[i];
+    if (attr.format == AttributeFormat::NONE)
+      break;
+    bool per_instance = attr.step == VertexStep::PER_INSTANCE;
+    uint32_t& stride = per_instance ? instance_stride : vertex_stride;
+    pipe.attributes[i] = VkVertexInputAttributeDescription{
+      .location = i,
+      .binding = per_instance ? 1u : 0u,
+      .format = get_vk_attribute_format(attr.format),
+      .offset = stride,
+    };
+    stride += get_vk_attribute_size(attr.format);
+    use_instance_buffer |= per_instance;
+    use_step_rate |= per_instance && attr.step_rate > 1;
+    ++pipe.num_attributes;
+  }
+  if (use_step_rate)
+    std::cout << "The Vulkan backend steps the per-instance attributes every instance, step_rate is ignored" << std::endl;
+
+  pipe.bindings[0] = VkVertexInputBindingDescription{ 0, vertex_stride, VK_VERTEX_INPUT_RATE_VERTEX };
+  pipe.bindings[1] = VkVertexInputBindingDescription{ 1, instance_stride, VK_VERTEX_INPUT_RATE_INSTANCE };
+  pipe.num_bindings = use_instance_buffer ? 2 : 1;
+
+  return true;
+}
+
+bool gfx::VKRenderer::new_sampler(Sampler h, const SamplerDesc& desc) {
+  PROFILE_ZONE("VKRenderer::new_sampler");
+  VKSampler& sampler = _samplers[handle_index(h)];
+  sampler.sampler = get_sampler(desc);
+  return sampler.sampler != VK_NULL_HANDLE;
+}
+
+void gfx::VKRenderer::destroy_buffer(Buffer h) {
+  PROFILE_ZONE("VKRenderer::destroy_buffer");
+  VKBuffer& buffer = _buffers[handle_index(h)];
+  if (buffer.usage != BufferUsage::IMMUTABLE)
+    std::erase(_stream_buffers, h);
+  if (_state.recorder.index_buffer == buffer.buffer)
+    _state.recorder.index_buffer = VK_NULL_HANDLE;
+
+  // released once the frames in flight are done with the buffer
+  get_current_frame().deletion_queue.buffers.push_back({ buffer.buffer, buffer.allocation });
+  buffer = {};
+}
+
+void gfx::VKRenderer::destroy_texture(Texture h) {
+  PROFILE_ZONE("VKRenderer::destroy_texture");
+  VKTexture& texture = _textures[handle_index(h)];
+  std::erase(_attachment_textures, h);
+  DeletionQueue& queue = get_current_frame().deletion_queue;
+  queue.image_views.push_back(texture.image.image_view);
+  queue.images.push_back({ texture.image.image, texture.image.allocation });
+  texture = {};
+}
+
+bool gfx::VKRenderer::is_shader_ready(Shader h) {
+  PROFILE_ZONE("VKRenderer::is_shader_ready");
+  // the modules are created by new_shader, there is nothing to wait for
+  return _shaders[handle_index(h)].layout != VK_NULL_HANDLE;
+}
+
+bool gfx::VKRenderer::is_pipeline_ready(Pipeline h) {
+  PROFILE_ZONE("VKRenderer::is_pipeline_ready");
+  return is_shader_ready(_pipelines[handle_index(h)].shader);
+}
+
+void gfx::VKRenderer::destroy_shader(Shader h) {
+  PROFILE_ZONE("VKRenderer::destroy_shader");
+  VKShader& shader = _shaders[handle_index(h)];
+  DeletionQueue& queue = get_current_frame().deletion_queue;
+  queue.pipeline_layouts.push_back(shader.layout);
+  queue.shader_modules.push_back(shader.vertex);
+  queue.shader_modules.push_back(shader.fragment);
+  shader = {};
+}
+
+void gfx::VKRenderer::destroy_render_pass(RenderPass h) {
+  PROFILE_ZONE("VKRenderer::destroy_render_pass");
+  _render_passes[handle_index(h)] = {};
+}
+
+void gfx::VKRenderer::destroy_pipeline(Pipeline h) {
+  PROFILE_ZONE("VKRenderer::destroy_pipeline");
+  VKPipeline& pipe = _pipelines[handle_index(h)];
+  if (_state.recorder.pipeline == &pipe) {
+    _state.recorder.pipeline = nullptr;
+    _state.recorder.vk_pipeline = VK_NULL_HANDLE;
+  }
+  for (const VKPipelineVariant& variant : pipe.variants) {
+    get_current_frame().deletion_queue.pipelines.push_back(variant.pipeline);
+  }
+  pipe = {};
+}
+
+void gfx::VKRenderer::destroy_sampler(Sampler h) {
+  PROFILE_ZONE("VKRenderer::destroy_sampler");
+  // the sampler object stays in the cache for the samplers sharing it
+  _samplers[handle_index(h)] = {};
+}
+
+size_t gfx::VKRenderer::SamplerDescHash::operator()(const SamplerDesc& desc) const {
+  uint64_t hash = 14695981039346656037ull;
+  auto hash_value = [&hash](uint64_t value) {
+    hash = (hash ^ value) * 1099511628211ull;
+  };
+  hash_value((uint64_t)desc.min_filter);
+  hash_value((uint64_t)desc.mag_filter);
+  hash_value((uint64_t)desc.mip_filter);
+  hash_value((uint64_t)desc.wrap_u);
+  hash_value((uint64_t)desc.wrap_v);
+  hash_value((uint64_t)desc.wrap_w);
+  hash_value(desc.max_anisotropy);
+  return (size_t)hash;
+}
+
+VkSampler gfx::VKRenderer::get_sampler(const SamplerDesc& desc) {
+  auto it = _sampler_cache.find(desc);
+  if (it != _sampler_cache.end())
+    return it->second;
+
+  VkSamplerCreateInfo sampler_info = {};
+  sampler_info.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+  sampler_info.magFilter = get_vk_filter(desc.mag_filter);
+  sampler_info.minFilter = get_vk_filter(desc.min_filter);
+  sampler_info.mipmapMode = desc.mip_filter == MipmapFilter::LINEAR ? VK_SAMPLER_MIPMAP_MODE_LINEAR : VK_SAMPLER_MIPMAP_MODE_NEAREST;
+  sampler_info.addressModeU = get_vk_wrap(desc.wrap_u);
+  sampler_info.addressModeV = get_vk_wrap(desc.wrap_v);
+  sampler_info.addressModeW = get_vk_wrap(desc.wrap_w);
+  // border of the GL textures
+  sampler_info.borderColor = VK_BORDER_COLOR_FLOAT_TRANSPARENT_BLACK;
+  // without mip filter only the first level is sampled
+  sampler_info.maxLod = desc.mip_filter == MipmapFilter::NONE ? 0.0f : VK_LOD_CLAMP_NONE;
+  if (desc.max_anisotropy > 1 && _max_anisotropy > 1.0f) {
+    sampler_info.anisotropyEnable = VK_TRUE;
+    sampler_info.maxAnisotropy = std::min((float)desc.max_anisotropy, _max_anisotropy);
+  }
+
+  VkSampler sampler = VK_NULL_HANDLE;
+  if (vkCreateSampler(_device, &sampler_info, nullptr, &sampler) != VK_SUCCESS) {
+    std::cout << "Failed to create a sampler" << std::endl;
+    return VK_NULL_HANDLE;
+  }
+  _sampler_cache.emplace(desc, sampler);
+  return sampler;
+}
+
+VkPipeline gfx::VKRenderer::get_pipeline_variant(VKPipeline& pip) {
+  // the recording threads look up and add the variants of the same pipelines
+  std::lock_guard<std::mutex> lock(_pipeline_mutex);
+  for (const VKPipelineVariant& variant : pip.variants) {
+    if (variant.color_formats == _state.color_formats && variant.depth_format == _state.depth_format)
+      return variant.pipeline;
+  }
+
+  const VKShader& shader = _shaders[handle_index(pip.shader)];
+  VkPipelineShaderStageCreateInfo stages[2] = {};
+  stages[0].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+  stages[0].stage = VK_SHADER_STAGE_VERTEX_BIT;
+  stages[0].module = shader.vertex;
+  stages[0].pName = "main";
+  stages[1] = stages[0];
+  stages[1].stage = VK_SHADER_STAGE_FRAGMENT_BIT;
+  stages[1].module = shader.fragment;
+
+  VkPipelineVertexInputStateCreateInfo vertex_input = {};
+  vertex_input.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+  vertex_input.vertexBindingDescriptionCount = pip.num_bindings;
+  vertex_input.pVertexBindingDescriptions = pip.bindings.data();
+  vertex_input.vertexAttributeDescriptionCount = pip.num_attributes;
+  vertex_input.pVertexAttributeDescriptions = pip.attributes.data();
+
+  VkPipelineInputAssemblyStateCreateInfo input_assembly = {};
+  input_assembly.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
+  input_assembly.topology = pip.topology;
+
+  // the viewport is not flipped: the images keep the GL row order and are flipped when presented
+  VkPipelineViewportDepthClipControlCreateInfoEXT depth_clip = {};
+  depth_clip.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_DEPTH_CLIP_CONTROL_CREATE_INFO_EXT;
+  depth_clip.negativeOneToOne = VK_TRUE;
+  VkPipelineViewportStateCreateInfo viewport_state = {};
+  viewport_state.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
+  viewport_state.pNext = _depth_clip_control ? &depth_clip : nullptr;
+  viewport_state.viewportCount = 1;
+  viewport_state.scissorCount = 1;
+
+  // with the GL row order the counter-clockwise GL front faces are clockwise
+  VkPipelineRasterizationStateCreateInfo rasterization = {};
+  rasterization.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
+  rasterization.polygonMode = VK_POLYGON_MODE_FILL;
+  rasterization.cullMode = pip.cull_mode;
+  rasterization.frontFace = VK_FRONT_FACE_CLOCKWISE;
+  rasterization.lineWidth = 1.0f;
+
+  VkPipelineMultisampleStateCreateInfo multisample = {};
+  multisample.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
+  multisample.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
+
+  bool has_depth = _state.depth_format != VK_FORMAT_UNDEFINED;
+  VkPipelineDepthStencilStateCreateInfo depth_stencil = {};
+  depth_stencil.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
+  depth_stencil.depthTestEnable = has_depth;
+  depth_stencil.depthWriteEnable = has_depth;
+  depth_stencil.depthCompareOp = VK_COMPARE_OP_LESS;
+
+  // no blending, like the GL backend
+  VkPipelineColorBlendAttachmentState blend_attachment = {};
+  blend_attachment.colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
+  std::vector<VkPipelineColorBlendAttachmentState> blend_attachments(_state.color_formats.size(), blend_attachment);
+  VkPipelineColorBlendStateCreateInfo color_blend = {};
+  color_blend.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
+  color_blend.attachmentCount = (uint32_t)blend_attachments.size();
+  color_blend.pAttachments = blend_attachments.data();
+
+  VkDynamicState dynamic_states[] = { VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR };
+  VkPipelineDynamicStateCreateInfo dynamic_state = {};
+  dynamic_state.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
+  dynamic_state.dynamicStateCount = 2;
+  dynamic_state.pDynamicStates = dynamic_states;
+
+  VkPipelineRenderingCreateInfo rendering_info = {};
+  rendering_info.sType = VK_STRUCTURE_TYPE_PIPELINE_RENDERING_CREATE_INFO;
+  rendering_info.colorAttachmentCount = (uint32_t)_state.color_formats.size();
+  rendering_info.pColorAttachmentFormats = _state.color_formats.data();
+  rendering_info.depthAttachmentFormat = _state.depth_format;
+
+  VkGraphicsPipelineCreateInfo pipeline_info = {};
+  pipeline_info.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+  pipeline_info.pNext = &rendering_info;
+  pipeline_info.stageCount = 2;
+  pipeline_info.pStages = stages;
+  pipeline_info.pVertexInputState = &vertex_input;
+  pipeline_info.pInputAssemblyState = &input_assembly;
+  pipeline_info.pViewportState = &viewport_state;
+  pipeline_info.pRasterizationState = &rasterization;
+  pipeline_info.pMultisampleState = &multisample;
+  pipeline_info.pDepthStencilState = &depth_stencil;
+  pipeline_info.pColorBlendState = &color_blend;
+  pipeline_info.pDynamicState = &dynamic_state;
+  pipeline_info.layout = shader.layout;
+
+  // the driver reports whether the pipeline came from the cache
+  VkPipelineCreationFeedback feedback = {};
+  VkPipelineCreationFeedbackCreateInfo feedback_info = {};
+  feedback_info.sType = VK_STRUCTURE_TYPE_PIPELINE_CREATION_FEEDBACK_CREATE_INFO;
+  feedback_info.pPipelineCreationFeedback = &feedback;
+  rendering_info.pNext = &feedback_info;
+
+  VkPipeline pipeline = VK_NULL_HANDLE;
+  auto begin = std::chrono::steady_clock::now();
+  VkResult res = vkCreateGraphicsPipelines(_device, _pipeline_cache, 1, &pipeline_info, nullptr, &pipeline);
+  _pipeline_cache_stats.creation_ms += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count();
+  if (res != VK_SUCCESS) {
+    std::cout << "Failed to create a graphics pipeline" << std::endl;
+    return VK_NULL_HANDLE;
+  }
+  bool hit = (feedback.flags & VK_PIPELINE_CREATION_FEEDBACK_VALID_BIT) && (feedback.flags & VK_PIPELINE_CREATION_FEEDBACK_APPLICATION_PIPELINE_CACHE_HIT_BIT);
+  ++(hit ? _pipeline_cache_stats.hits : _pipeline_cache_stats.misses);
+  pip.variants.push_back(VKPipelineVariant{ _state.color_formats, _state.depth_format, pipeline });
+  return pipeline;
+}
+
+std::optional<VkDeviceSize> gfx::VKRenderer::alloc_uniforms(UniformBlock& block, VkDeviceSize size) {
+  VkDeviceSize start = align_up(block.offset, _uniform_ring.alignment);
+  if (start + size > block.end) {
+    // a new block from the ring, shared by the recording threads
+    std::lock_guard<std::mutex> lock(_uniform_mutex);
+    std::optional<VkDeviceSize> new_block = _uniform_ring.alloc(std::max<VkDeviceSize>(size, VK_UNIFORM_BLOCK_SIZE));
+    if (!new_block)
+      return std::nullopt;
+    start = new_block.value();
+    block.end = start + std::max<VkDeviceSize>(size, VK_UNIFORM_BLOCK_SIZE);
+  }
+  block.offset = start + size;
+  return start;
+}
+
+gfx::VKRenderer::StagingAlloc gfx::VKRenderer::stage(VkDeviceSize size) {
+  std::optional<VkDeviceSize> offset = _staging_ring.alloc(size);
+  if (offset)
+    return StagingAlloc{ _staging_ring.buffer, offset.value(), _staging_ring.mapped + offset.value() };
+
+  // the ring is full for this frame: dedicated buffer released with the frame
+  VkBufferCreateInfo buffer_info = {};
+  buffer_info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+  buffer_info.size = size;
+  buffer_info.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+
+  // coherent: the writes need no flush
+  VmaAllocationCreateInfo alloc_info = {};
+  alloc_info.usage = VMA_MEMORY_USAGE_AUTO;
+  alloc_info.flags = VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT | VMA_ALLOCATION_CREATE_MAPPED_BIT;
+  alloc_info.requiredFlags = VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+
+  VkBuffer buffer;
+  VmaAllocation allocation;
+  VmaAllocationInfo info;
+  VK_CHECK(vmaCreateBuffer(_allocator, &buffer_info, &alloc_info, &buffer, &allocation, &info));
+  get_current_frame().deletion_queue.buffers.push_back({ buffer, allocation });
+  return StagingAlloc{ buffer, 0, (uint8_t*)info.pMappedData };
+}
+
+void gfx::VKRenderer::queue_buffer_upload(const VKBuffer& buffer, VkDeviceSize offset, const Memory& mem) {
+  if (mem.size == 0)
+    return;
+  StagingAlloc staging = stage(mem.size);
+  std::memcpy(staging.data, mem.data, mem.size);
+  _buffer_uploads.push_back(BufferUpload{ staging.buffer, buffer.buffer, VkBufferCopy{ staging.offset, offset, mem.size } });
+}
+
+void gfx::VKRenderer::queue_texture_upload(const VKTexture& texture, const TextureRegion& region, uint32_t mip, const void* texels) {
+  size_t num_texels = (size_t)region.width * region.height * region.depth;
+  StagingAlloc staging = stage(num_texels * texture.texel_size);
+  if (texture.format == TextureFormat::RGB8) {
+    const uint8_t* src = (const uint8_t*)texels;
+    for (size_t i = 0; i < num_texels; i++) {
+      staging.data[i * 4 + 0] = src[i * 3 + 0];
+      staging.data[i * 4 + 1] = src[i * 3 + 1];
+      staging.data[i * 4 + 2] = src[i * 3 + 2];
+      staging.data[i * 4 + 3] = 255;
+    }
+  } else {
+    std::memcpy(staging.data, texels, num_texels * texture.texel_size);
+  }
+
+  VkBufferImageCopy copy = {};
+  copy.bufferOffset = staging.offset;
+  copy.imageSubresource = VkImageSubresourceLayers{ texture.aspect, mip, 0, 1 };
+  copy.imageOffset = VkOffset3D{ (int32_t)region.x, (int32_t)region.y, (int32_t)region.z };
+  copy.imageExtent = VkExtent3D{ region.width, region.height, region.depth };
+  _texture_uploads.push_back(TextureUpload{ staging.buffer, texture.image.image, copy });
+}
+
+void gfx::VKRenderer::queue_texture_transition(const VKTexture& texture, bool initialized, bool generate_mips) {
+  for (TextureTransition& transition : _texture_transitions) {
+    if (transition.image == texture.image.image) {
+      transition.generate_mips |= generate_mips;
+      return;
+    }
+  }
+  _texture_transitions.push_back(TextureTransition{
+    .image = texture.image.image,
+    .aspect = texture.aspect,
+    .extent = texture.image.image_extent,
+    .mip_levels = texture.mip_levels,
+    .initialized = initialized,
+    .generate_mips = generate_mips,
+  });
+}
+
+void gfx::VKRenderer::write_stream_buffer(VKBuffer& buffer, VkDeviceSize offset, const Memory& mem) {
+  if (mem.size == 0)
+    return;
+  std::memcpy(buffer.mapped + offset, mem.data, mem.size);
+  vmaFlushAllocation(_allocator, buffer.allocation, offset, mem.size);
+}
+
+bool gfx::VKRenderer::record_uploads(VkCommandBuffer cmd) {
+  if (_buffer_uploads.empty() && _texture_uploads.empty() && _texture_transitions.empty())
+    return false;
+
+  VK_CHECK(vkResetCommandBuffer(cmd, 0));
+  VkCommandBufferBeginInfo cmd_begin_info = {};
+  cmd_begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+  cmd_begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+  VK_CHECK(vkBeginCommandBuffer(cmd, &cmd_begin_info));
+
+  // one barrier before the copies: the previous frames are done reading the buffers and the images move to the transfer layout
+  VkMemoryBarrier2 before_copies = {};
+  before_copies.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER_2;
+  before_copies.srcStageMask = VK_PIPELINE_STAGE_2_VERTEX_ATTRIBUTE_INPUT_BIT | VK_PIPELINE_STAGE_2_INDEX_INPUT_BIT | VK_PIPELINE_STAGE_2_DRAW_INDIRECT_BIT;
+  before_copies.dstStageMask = VK_PIPELINE_STAGE_2_ALL_TRANSFER_BIT;
+  before_copies.dstAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT;
+
+  std::vector<VkImageMemoryBarrier2> image_barriers;
+  for (const TextureTransition& transition : _texture_transitions) {
+    VkImageLayout layout = transition.initialized ? VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL : VK_IMAGE_LAYOUT_UNDEFINED;
+    image_barriers.push_back(vkutil::layout_barrier(transition.image, transition.aspect, layout, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL));
+  }
+
+  VkDependencyInfo dep_info = {};
+  dep_info.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO;
+  dep_info.memoryBarrierCount = 1;
+  dep_info.pMemoryBarriers = &before_copies;
+  dep_info.imageMemoryBarrierCount = (uint32_t)image_barriers.size();
+  dep_info.pImageMemoryBarriers = image_barriers.data();
+  vkCmdPipelineBarrier2(cmd, &dep_info);
+
+  // copies writing a region already written by the batch wait for the previous copies
+  VkMemoryBarrier2 between_copies = {};
+  between_copies.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER_2;
+  between_copies.srcStageMask = VK_PIPELINE_STAGE_2_ALL_TRANSFER_BIT;
+  between_copies.srcAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT;
+  between_copies.dstStageMask = VK_PIPELINE_STAGE_2_ALL_TRANSFER_BIT;
+  between_copies.dstAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT;
+  VkDependencyInfo between_info = {};
+  between_info.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO;
+  between_info.memoryBarrierCount = 1;
+  between_info.pMemoryBarriers = &between_copies;
+
+  std::vector<const BufferUpload*> written_buffers;
+  for (const BufferUpload& upload : _buffer_uploads) {
+    for (const BufferUpload* written : written_buffers) {
+      if (written->dst == upload.dst && written->region.dstOffset < upload.region.dstOffset + upload.region.size
+        && upload.region.dstOffset < written->region.dstOffset + written->region.size) {
+        vkCmdPipelineBarrier2(cmd, &between_info);
+        written_buffers.clear();
+        break;
+      }
+    }
+    vkCmdCopyBuffer(cmd, upload.src, upload.dst, 1, &upload.region);
+    written_buffers.push_back(&upload);
+  }
+
+  auto overlap = [](int32_t a_offset, uint32_t a_size, int32_t b_offset, uint32_t b_size) {
+    return a_offset < b_offset + (int32_t)b_size && b_offset < a_offset + (int32_t)a_size;
+  };
+  std::vector<const TextureUpload*> written_images;
+  for (const TextureUpload& upload : _texture_uploads) {
+    const VkBufferImageCopy& region = upload.region;
+    for (const TextureUpload* written : written_images) {
+      const VkBufferImageCopy& other = written->region;
+      if (written->dst == upload.dst && other.imageSubresource.mipLevel == region.imageSubresource.mipLevel
+        && overlap(region.imageOffset.x, region.imageExtent.width, other.imageOffset.x, other.imageExtent.width)
+        && overlap(region.imageOffset.y, region.imageExtent.height, other.imageOffset.y, other.imageExtent.height)
+        && overlap(region.imageOffset.z, region.imageExtent.depth, other.imageOffset.z, other.imageExtent.depth)) {
+        vkCmdPipelineBarrier2(cmd, &between_info);
+        written_images.clear();
+        break;
+      }
+    }
+    vkCmdCopyBufferToImage(cmd, upload.src, upload.dst, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
+    written_images.push_back(&upload);
+  }
+
+  // mips: each level is blitted from the previous one, the levels end in the transfer source layout
+  image_barriers.clear();
+  for (const TextureTransition& transition : _texture_transitions) {
+    if (!transition.generate_mips || transition.mip_levels == 1) {
+      image_barriers.push_back(vkutil::layout_barrier(transition.image, transition.aspect, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL));
+      continue;
+    }
+
+    VkImageMemoryBarrier2 level_barrier = vkutil::layout_barrier(transition.image, transition.aspect, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL);
+    level_barrier.subresourceRange.levelCount = 1;
+    VkDependencyInfo level_info = {};
+    level_info.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO;
+    level_info.imageMemoryBarrierCount = 1;
+    level_info.pImageMemoryBarriers = &level_barrier;
+
+    VkExtent3D extent = transition.extent;
+    for (uint32_t level = 1; level < transition.mip_levels; level++) {
+      level_barrier.subresourceRange.baseMipLevel = level - 1;
+      vkCmdPipelineBarrier2(cmd, &level_info);
+
+      VkExtent3D level_extent = { std::max(extent.width >> 1, 1u), std::max(extent.height >> 1, 1u), std::max(extent.depth >> 1, 1u) };
+      VkImageBlit2 blit = {};
+      blit.sType = VK_STRUCTURE_TYPE_IMAGE_BLIT_2;
+      blit.srcSubresource = VkImageSubresourceLayers{ transition.aspect, level - 1, 0, 1 };
+      blit.srcOffsets[1] = VkOffset3D{ (int32_t)extent.width, (int32_t)extent.height, (int32_t)extent.depth };
+      blit.dstSubresource = VkImageSubresourceLayers{ transition.aspect, level, 0, 1 };
+      blit.dstOffsets[1] = VkOffset3D{ (int32_t)level_extent.width, (int32_t)level_extent.height, (int32_t)level_extent.depth };
+
+      VkBlitImageInfo2 blit_info = {};
+      blit_info.sType = VK_STRUCTURE_TYPE_BLIT_IMAGE_INFO_2;
+      blit_info.srcImage = transition.image;
+      blit_info.srcImageLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+      blit_info.dstImage = transition.image;
+      blit_info.dstImageLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+      blit_info.regionCount = 1;
+      blit_info.pRegions = &blit;
+      blit_info.filter = VK_FILTER_LINEAR;
+      vkCmdBlitImage2(cmd, &blit_info);
+      extent = level_extent;
+    }
+    level_barrier.subresourceRange.baseMipLevel = transition.mip_levels - 1;
+    vkCmdPipelineBarrier2(cmd, &level_info);
+
+    image_barriers.push_back(vkutil::layout_barrier(transition.image, transition.aspect, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL));
+  }
+
+  // one barrier after the copies: the draws of the frame read the buffers and sample the images
+  VkMemoryBarrier2 after_copies = {};
+  after_copies.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER_2;
+  after_copies.srcStageMask = VK_PIPELINE_STAGE_2_ALL_TRANSFER_BIT;
+  after_copies.srcAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT;
+  after_copies.dstStageMask = VK_PIPELINE_STAGE_2_VERTEX_ATTRIBUTE_INPUT_BIT | VK_PIPELINE_STAGE_2_INDEX_INPUT_BIT | VK_PIPELINE_STAGE_2_DRAW_INDIRECT_BIT;
+  after_copies.dstAccessMask = VK_ACCESS_2_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_2_INDEX_READ_BIT | VK_ACCESS_2_INDIRECT_COMMAND_READ_BIT;
+
+  dep_info.pMemoryBarriers = &after_copies;
+  dep_info.imageMemoryBarrierCount = (uint32_t)image_barriers.size();
+  dep_info.pImageMemoryBarriers = image_barriers.data();
+  vkCmdPipelineBarrier2(cmd, &dep_info);
+
+  VK_CHECK(vkEndCommandBuffer(cmd));
+
+  _buffer_uploads.clear();
+  _texture_uploads.clear();
+  _texture_transitions.clear();
+  return true;
+}
+
+void gfx::VKRenderer::begin_frame() {
+  FrameData& frame = get_current_frame();
+  // wait for the gpu to finish the last commands using the resources of this frame,
+  // the CPU runs at most _frames_in_flight frames ahead of the GPU
+  VkSemaphoreWaitInfo wait_info = {};
+  wait_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO;
+  wait_info.semaphoreCount = 1;
+  wait_info.pSemaphores = &_frame_timeline;
+  wait_info.pValues = &frame.timeline_value;
+  {
+    PROFILE_ZONE("VKRenderer::wait_frame");
+    VkResult result;
+    while ((result = vkWaitSemaphores(_device, &wait_info, 1000000000)) == VK_TIMEOUT) {
+      std::cout << "Frame " << frame.timeline_value << " not done after 1s, waiting again" << std::endl;
+    }
+    // the pools and rings of the frame can't be reset while the gpu may still use them
+    if (result != VK_SUCCESS) {
+      std::cout << "Failed to wait for frame " << frame.timeline_value << ": " << result << std::endl;
+      std::exit(1);
+    }
+  }
+
+  frame.deletion_queue.flush(_device, _allocator);
+  // the frame is done on the gpu, its timestamps are ready
+  read_pass_timings(frame);
+  frame.descriptors.reset(_device);
+  for (ThreadFrameData& thread : frame.threads) {
+    VK_CHECK(vkResetCommandPool(_device, thread.command_pool, 0));
+    thread.descriptors.reset(_device);
+    thread.used_secondaries = 0;
+    thread.uniforms = {};
+  }
+
+  uint32_t frame_index = (uint32_t)(_frame_number % _frames_in_flight);
+  _staging_ring.begin_frame(frame_index);
+  _uniform_ring.begin_frame(frame_index);
+  _state.uniforms = {};
+  for (Buffer h : _stream_buffers) {
+    VKBuffer& buffer = _buffers[handle_index(h)];
+    buffer.append_offset = 0;
+    buffer.frame = frame_index;
+  }
+}
+
+VkCommandBuffer gfx::VKRenderer::get_command_buffer() {
+  FrameData& frame = get_current_frame();
+  VkCommandBuffer cmd = frame.main_command_buffer;
+  if (_state.recording)
+    return cmd;
+
+  // reset it
+  VK_CHECK(vkResetCommandBuffer(cmd, 0));
+
+  // begin command buffer
+  VkCommandBufferBeginInfo cmd_begin_info = {};
+  cmd_begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+  cmd_begin_info.pNext = nullptr;
+  cmd_begin_info.pInheritanceInfo = nullptr;
+  cmd_begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT; // tells the driver we will submit this command buffer only once
+  VK_CHECK(vkBeginCommandBuffer(cmd, &cmd_begin_info));
+
+  vkCmdResetQueryPool(cmd, frame.timestamp_pool, 0, MAX_TIMED_PASSES * 2);
+  _state.recording = true;
+  _state.recorder.cmd = cmd;
+  _state.recorder.descriptors = &frame.descriptors;
+  _state.recorder.uniforms = &_state.uniforms;
+  return cmd;
+}
+
+// set while a recording thread replays a command list
+static thread_local gfx::VKRenderer::VKRecorder* t_recorder = nullptr;
+
+gfx::VKRenderer::VKRecorder& gfx::VKRenderer::current_recorder() {
+  if (t_recorder)
+    return *t_recorder;
+
+  get_command_buffer();
+  if (_state.in_pass) {
+    record_command_lists();
+    begin_rendering(false);
+  }
+  return _state.recorder;
+}
+
+void gfx::VKRenderer::begin_rendering(bool secondary) {
+  if (_state.rendering && _state.rendering_secondary == secondary)
+    return;
+
+  VkCommandBuffer cmd = get_command_buffer();
+  if (_state.rendering)
+    vkCmdEndRendering(cmd);
+
+  // the instances after the first one continue the pass: the attachments are loaded instead of cleared
+  if (_state.rendered) {
+    for (VkRenderingAttachmentInfo& att : _state.color_attachments) {
+      att.loadOp = VK_ATTACHMENT_LOAD_OP_LOAD;
+    }
+    if (_state.depth_attachment)
+      _state.depth_attachment->loadOp = VK_ATTACHMENT_LOAD_OP_LOAD;
+  }
+
+  VkRenderingInfo rendering_info = {};
+  rendering_info.sType = VK_STRUCTURE_TYPE_RENDERING_INFO;
+  rendering_info.flags = secondary ? VK_RENDERING_CONTENTS_SECONDARY_COMMAND_BUFFERS_BIT : 0;
+  rendering_info.renderArea = VkRect2D{ { 0, 0 }, _state.extent };
+  rendering_info.layerCount = 1;
+  rendering_info.colorAttachmentCount = (uint32_t)_state.color_attachments.size();
+  rendering_info.pColorAttachments = _state.color_attachments.data();
+  rendering_info.pDepthAttachment = _state.depth_attachment ? &_state.depth_attachment.value() : nullptr;
+  vkCmdBeginRendering(cmd, &rendering_info);
+
+  _state.rendering = true;
+  _state.rendering_secondary = secondary;
+  _state.rendered = true;
+
+  if (!secondary) {
+    // the passes cover their attachments until set_viewport is called, the scissor test is never enabled like on GL
+    VkViewport viewport = _state.viewport.value_or(VkViewport{ 0.0f, 0.0f, (float)_state.extent.width, (float)_state.extent.height, 0.0f, 1.0f });
+    vkCmdSetViewport(cmd, 0, 1, &viewport);
+    VkRect2D scissor = { { 0, 0 }, _state.extent };
+    vkCmdSetScissor(cmd, 0, 1, &scissor);
+  }
+  // the state of the main command buffer is undefined after secondary command buffers, nothing is bound in a new instance
+  _state.recorder.pipeline = nullptr;
+  _state.recorder.vk_pipeline = VK_NULL_HANDLE;
+  _state.recorder.index_buffer = VK_NULL_HANDLE;
 }
 
-void gfx::VKRenderer::init_swapchain(SDL_Window* window) {
+void gfx::VKRenderer::record_command_lists() {
+  if (_command_lists.empty())
+    return;
+  PROFILE_ZONE("VKRenderer::record_command_lists");
+
+  FrameData& frame = get_current_frame();
+  VkViewport viewport = _state.viewport.value_or(VkViewport{ 0.0f, 0.0f, (float)_state.extent.width, (float)_state.extent.height, 0.0f, 1.0f });
+  VkRect2D scissor = { { 0, 0 }, _state.extent };
+
+  VkCommandBufferInheritanceRenderingInfo inheritance_rendering = {};
+  inheritance_rendering.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_RENDERING_INFO;
+  inheritance_rendering.colorAttachmentCount = (uint32_t)_state.color_formats.size();
+  inheritance_rendering.pColorAttachmentFormats = _state.color_formats.data();
+  inheritance_rendering.depthAttachmentFormat = _state.depth_format;
+  inheritance_rendering.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
+  VkCommandBufferInheritanceInfo inheritance = {};
+  inheritance.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+  inheritance.pNext = &inheritance_rendering;
+
+  // each list is replayed by one thread into a secondary command buffer of the thread pool
+  _secondaries.resize(_command_lists.size());
+  _recording_pool.run((uint32_t)_command_lists.size(), [&](uint32_t i) {
+    PROFILE_THREAD_NAME("vk recording");
+    ThreadFrameData& thread = frame.threads[ThreadPool::thread_index()];
+    VkCommandBuffer cmd = get_secondary_command_buffer(thread);
+
+    VkCommandBufferBeginInfo begin_info = {};
+    begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT | VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT;
+    begin_info.pInheritanceInfo = &inheritance;
+    VK_CHECK(vkBeginCommandBuffer(cmd, &begin_info));
+    // the dynamic state is not inherited
+    vkCmdSetViewport(cmd, 0, 1, &viewport);
+    vkCmdSetScissor(cmd, 0, 1, &scissor);
+
+    VKRecorder recorder = {};
+    recorder.cmd = cmd;
+    recorder.descriptors = &thread.descriptors;
+    recorder.uniforms = &thread.uniforms;
+    t_recorder = &recorder;
+    _command_lists[i]();
+    t_recorder = nullptr;
+
+    VK_CHECK(vkEndCommandBuffer(cmd));
+    _secondaries[i] = cmd;
+  });
+
+  // executed in the order of the lists
+  begin_rendering(true);
+  vkCmdExecuteCommands(get_command_buffer(), (uint32_t)_secondaries.size(), _secondaries.data());
+  _command_lists.clear();
+}
+
+VkCommandBuffer gfx::VKRenderer::get_secondary_command_buffer(ThreadFrameData& thread) {
+  if (thread.used_secondaries == thread.secondaries.size()) {
+    VkCommandBufferAllocateInfo alloc_info = {};
+    alloc_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    alloc_info.commandPool = thread.command_pool;
+    alloc_info.commandBufferCount = 1;
+    alloc_info.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+    VkCommandBuffer cmd;
+    VK_CHECK(vkAllocateCommandBuffers(_device, &alloc_info, &cmd));
+    thread.secondaries.push_back(cmd);
+  }
+  return thread.secondaries[thread.used_secondaries++];
+}
+
+void gfx::VKRenderer::init_swapchain() {
   vkb::SwapchainBuilder swapchainBuilder{
     _chosen_gpu,
     _device,
@@ -299,30 +1953,44 @@ void gfx::VKRenderer::init_swapchain(SDL_Window* window) {
 
   _swapchain.image_format = VK_FORMAT_B8G8R8A8_UNORM;
 
-  int w, h;
-  SDL_GetWindowSize(window, &w, &h);
+  VkExtent2D extent = window_extent();
 
   vkb::Swapchain vkbSwapchain = swapchainBuilder
     //.use_default_format_selection()
     .set_desired_format(VkSurfaceFormatKHR{ .format = _swapchain.image_format, .colorSpace = VK_COLOR_SPACE_SRGB_NONLINEAR_KHR })
-    // use vsync present mode
-    .set_desired_present_mode(VK_PRESENT_MODE_FIFO_KHR)
-    .set_desired_extent(w, h)
+    .set_desired_present_mode(_present_mode)
+    .set_desired_extent(extent.width, extent.height)
     .add_image_usage_flags(VK_IMAGE_USAGE_TRANSFER_DST_BIT)
     .build()
     .value();
 
   _swapchain.extent = vkbSwapchain.extent;
+  _swapchain.window_extent = extent;
   // store swapchain and its related images
   _swapchain.swapchain = vkbSwapchain.swapchain;
   _swapchain.images = vkbSwapchain.get_images().value();
   _swapchain.image_views = vkbSwapchain.get_image_views().value();
+  if (vkbSwapchain.present_mode != _present_mode)
+    std::cout << "The surface does not support the requested present mode, using FIFO" << std::endl;
+
+  // an image is acquired again once its presentation is done, one semaphore per image is never signaled twice
+  VkSemaphoreCreateInfo semaphore_info = {};
+  semaphore_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+  _swapchain.render_semaphores.resize(_swapchain.images.size());
+  for (VkSemaphore& semaphore : _swapchain.render_semaphores) {
+    VK_CHECK(vkCreateSemaphore(_device, &semaphore_info, nullptr, &semaphore));
+  }
+  _swapchain_dirty = false;
+}
+
+void gfx::VKRenderer::init_draw_images() {
+  _draw_extent = scaled_extent(window_extent());
 
   // render target creation
   // todo: move this part to VKImage
   VkExtent3D draw_image_extent = {
-    _swapchain.extent.width,
-    _swapchain.extent.height,
+    _draw_extent.width,
+    _draw_extent.height,
     1
   };
 
@@ -350,11 +2018,70 @@ void gfx::VKRenderer::init_swapchain(SDL_Window* window) {
 
   VK_CHECK(vkCreateImageView(_device, &rview_info, nullptr, &_draw_image.image_view));
 
-  // add to deletion queues
-  _main_deletion_queue.push_function([=]() {
-    vkDestroyImageView(_device, _draw_image.image_view, nullptr);
-    vmaDestroyImage(_allocator, _draw_image.image, _draw_image.allocation);
-  });
+  // depth of the default render pass
+  _depth_image.image_format = VK_FORMAT_D32_SFLOAT;
+  _depth_image.image_extent = draw_image_extent;
+
+  VkImageCreateInfo dimg_info = vkutil::image_create_info(_depth_image.image_format, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT, draw_image_extent);
+  vmaCreateImage(_allocator, &dimg_info, &rimg_allocinfo, &_depth_image.image, &_depth_image.allocation, nullptr);
+
+  VkImageViewCreateInfo dview_info = vkutil::imageview_create_info(_depth_image.image_format, _depth_image.image, VK_IMAGE_ASPECT_DEPTH_BIT);
+  VK_CHECK(vkCreateImageView(_device, &dview_info, nullptr, &_depth_image.image_view));
+
+  _draw_image_layout = VK_IMAGE_LAYOUT_UNDEFINED;
+  _depth_image_layout = VK_IMAGE_LAYOUT_UNDEFINED;
+}
+
+void gfx::VKRenderer::destroy_swapchain() {
+  vkDestroySwapchainKHR(_device, _swapchain.swapchain, nullptr);
+  for (VkImageView iv : _swapchain.image_views) {
+    vkDestroyImageView(_device, iv, nullptr);
+  }
+  for (VkSemaphore semaphore : _swapchain.render_semaphores) {
+    vkDestroySemaphore(_device, semaphore, nullptr);
+  }
+  _swapchain.image_views.clear();
+  _swapchain.render_semaphores.clear();
+}
+
+void gfx::VKRenderer::destroy_draw_images() {
+  vkDestroyImageView(_device, _draw_image.image_view, nullptr);
+  vmaDestroyImage(_allocator, _draw_image.image, _draw_image.allocation);
+  vkDestroyImageView(_device, _depth_image.image_view, nullptr);
+  vmaDestroyImage(_allocator, _depth_image.image, _depth_image.allocation);
+}
+
+void gfx::VKRenderer::recreate_swapchain() {
+  PROFILE_ZONE("VKRenderer::recreate_swapchain");
+  // a minimized window has no size, the frames are not presented until it is restored
+  VkExtent2D extent = window_extent();
+  if (extent.width == 0 || extent.height == 0)
+    return;
+
+  // resizes are rare, waiting for the device frees the old images right away
+  vkDeviceWaitIdle(_device);
+  destroy_swapchain();
+  init_swapchain();
+
+  // the draw images keep their content when only the swapchain was out of date
+  VkExtent2D draw_extent = scaled_extent(extent);
+  if (draw_extent.width != _draw_extent.width || draw_extent.height != _draw_extent.height) {
+    destroy_draw_images();
+    init_draw_images();
+  }
+}
+
+VkExtent2D gfx::VKRenderer::window_extent() const {
+  int w, h;
+  SDL_Vulkan_GetDrawableSize(_window, &w, &h);
+  return VkExtent2D{ (uint32_t)std::max(w, 0), (uint32_t)std::max(h, 0) };
+}
+
+VkExtent2D gfx::VKRenderer::scaled_extent(VkExtent2D window) const {
+  return VkExtent2D{
+    std::max((uint32_t)std::lround(window.width * _render_scale), 1u),
+    std::max((uint32_t)std::lround(window.height * _render_scale), 1u),
+  };
 }
 
 void gfx::VKRenderer::init_commands() {
@@ -364,7 +2091,7 @@ void gfx::VKRenderer::init_commands() {
   commandPoolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
   commandPoolInfo.queueFamilyIndex = _graphics_queue_family;
 
-  for (int i = 0; i < FRAME_OVERLAP; i++) {
+  for (uint32_t i = 0; i < _frames_in_flight; i++) {
     // command pool
     VK_CHECK(
       vkCreateCommandPool(
@@ -375,7 +2102,7 @@ void gfx::VKRenderer::init_commands() {
       )
     );
 
-    // command buffer
+    // command buffers
     VkCommandBufferAllocateInfo cmdAllocInfo = {};
     cmdAllocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
     cmdAllocInfo.pNext = nullptr;
@@ -385,40 +2112,206 @@ void gfx::VKRenderer::init_commands() {
 
     VK_CHECK(
       vkAllocateCommandBuffers(
-        _device, 
-        &cmdAllocInfo, 
+        _device,
+        &cmdAllocInfo,
         &_frames[i].main_command_buffer
       )
     );
+    VK_CHECK(vkAllocateCommandBuffers(_device, &cmdAllocInfo, &_frames[i].upload_command_buffer));
+
+    // timestamp queries
+    VkQueryPoolCreateInfo queryPoolInfo = {};
+    queryPoolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+    queryPoolInfo.pNext = nullptr;
+    queryPoolInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+    queryPoolInfo.queryCount = MAX_TIMED_PASSES * 2;
+
+    VK_CHECK(vkCreateQueryPool(_device, &queryPoolInfo, nullptr, &_frames[i].timestamp_pool));
+
+    // the secondary command buffers of the recording threads, the pools are reset with the frame
+    VkCommandPoolCreateInfo threadPoolInfo = commandPoolInfo;
+    threadPoolInfo.flags = 0;
+    _frames[i].threads.resize(_recording_pool.num_threads());
+    for (ThreadFrameData& thread : _frames[i].threads) {
+      VK_CHECK(vkCreateCommandPool(_device, &threadPoolInfo, nullptr, &thread.command_pool));
+    }
   }
+
+  VkPhysicalDeviceProperties properties;
+  vkGetPhysicalDeviceProperties(_chosen_gpu, &properties);
+  _timestamp_period = properties.limits.timestampComputeAndGraphics ? properties.limits.timestampPeriod : 0.0f;
 }
 
 void gfx::VKRenderer::init_sync_structures() {
-  VkFenceCreateInfo fence_info = {};
-  fence_info.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
-  fence_info.pNext = nullptr;
-  fence_info.flags = VK_FENCE_CREATE_SIGNALED_BIT;
+  // one timeline paces all the frames, a frame waits for the value signaled by its previous submit
+  VkSemaphoreTypeCreateInfo timeline_info = {};
+  timeline_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO;
+  timeline_info.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE;
+  timeline_info.initialValue = 0;
 
   VkSemaphoreCreateInfo semaphore_info = {};
   semaphore_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
-  semaphore_info.pNext = nullptr;
+  semaphore_info.pNext = &timeline_info;
   semaphore_info.flags = 0;
+  VK_CHECK(vkCreateSemaphore(_device, &semaphore_info, nullptr, &_frame_timeline));
 
-  for (int i = 0; i < FRAME_OVERLAP; i++) {
-    VK_CHECK(vkCreateFence(_device, &fence_info, nullptr, &_frames[i].render_fence));
-
+  // the swapchain only takes binary semaphores
+  semaphore_info.pNext = nullptr;
+  for (uint32_t i = 0; i < _frames_in_flight; i++) {
     VK_CHECK(vkCreateSemaphore(_device, &semaphore_info, nullptr, &_frames[i].present_semaphore));
-    VK_CHECK(vkCreateSemaphore(_device, &semaphore_info, nullptr, &_frames[i].render_semaphore));
+    _frames[i].timeline_value = 0;
   }
 }
 
-void gfx::VKRenderer::draw_background(VkCommandBuffer cmd) {
-  VkClearColorValue clearValue;
-  float flash = std::abs(std::sin(_frame_number / 120.f));
-  clearValue = { { 0.0f, 0.0f, flash, 1.0f } };
+void gfx::VKRenderer::init_descriptors() {
+  // the texture sets come from the descriptor allocators of the frames, their pools are created on first use
+
+  // the uniforms of all the shaders go through one set, the dynamic offset selects the block in the uniform ring
+  VkDescriptorSetLayoutBinding uniform_binding = {};
+  uniform_binding.binding = 0;
+  uniform_binding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+  uniform_binding.descriptorCount = 1;
+  uniform_binding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT;
+  _uniform_set_layout = _layout_cache.get(_device, { uniform_binding });
+
+  VkDescriptorPoolSize pool_size = { VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, 1 };
+  VkDescriptorPoolCreateInfo pool_info = {};
+  pool_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+  pool_info.maxSets = 1;
+  pool_info.poolSizeCount = 1;
+  pool_info.pPoolSizes = &pool_size;
+  VK_CHECK(vkCreateDescriptorPool(_device, &pool_info, nullptr, &_uniform_pool));
+
+  VkDescriptorSetAllocateInfo alloc_info = {};
+  alloc_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+  alloc_info.descriptorPool = _uniform_pool;
+  alloc_info.descriptorSetCount = 1;
+  alloc_info.pSetLayouts = &_uniform_set_layout;
+  VK_CHECK(vkAllocateDescriptorSets(_device, &alloc_info, &_uniform_set));
+
+  VkDescriptorBufferInfo buffer_info = { _uniform_ring.buffer, 0, VK_MAX_UNIFORM_SIZE };
+  VkWriteDescriptorSet write = {};
+  write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+  write.dstSet = _uniform_set;
+  write.dstBinding = 0;
+  write.descriptorCount = 1;
+  write.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+  write.pBufferInfo = &buffer_info;
+  vkUpdateDescriptorSets(_device, 1, &write, 0, nullptr);
+}
 
-  VkImageSubresourceRange clearRange = vkutil::image_subresource_range(VK_IMAGE_ASPECT_COLOR_BIT);
+void gfx::VKRenderer::init_pipeline_cache(const std::string& directory) {
+  _pipeline_cache_stats = {};
+  _pipeline_cache_path.clear();
+  std::vector<char> data;
+
+  if (!directory.empty()) {
+    std::error_code error;
+    std::filesystem::create_directories(directory, error);
+    if (error) {
+      std::cout << "Can't create the shader cache directory " << directory << ": " << error.message() << std::endl;
+    } else {
+      _pipeline_cache_path = (std::filesystem::path(directory) / "vk_pipeline_cache.bin").string();
+      std::ifstream file(_pipeline_cache_path, std::ios::binary | std::ios::ate);
+      if (file) {
+        data.resize((size_t)file.tellg());
+        file.seekg(0);
+        if (!file.read(data.data(), data.size()))
+          data.clear();
+      }
+    }
+  }
 
-  //clear image
-  vkCmdClearColorImage(cmd, _draw_image.image, VK_IMAGE_LAYOUT_GENERAL, &clearValue, 1, &clearRange);
+  // the data is only valid for the device and the driver that produced it, the other files are dropped
+  if (!data.empty()) {
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(_chosen_gpu, &properties);
+    VkPipelineCacheHeaderVersionOne header;
+    bool valid = data.size() >= sizeof(header);
+    if (valid) {
+      std::memcpy(&header, data.data(), sizeof(header));
+      valid = header.headerSize >= sizeof(header) && header.headerVersion == VK_PIPELINE_CACHE_HEADER_VERSION_ONE
+        && header.vendorID == properties.vendorID && header.deviceID == properties.deviceID
+        && std::memcmp(header.pipelineCacheUUID, properties.pipelineCacheUUID, VK_UUID_SIZE) == 0;
+    }
+    if (!valid) {
+      std::cout << "Pipeline cache " << _pipeline_cache_path << " was written by another device or driver, it is rebuilt" << std::endl;
+      data.clear();
+    }
+  }
+
+  VkPipelineCacheCreateInfo cache_info = {};
+  cache_info.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+  cache_info.initialDataSize = data.size();
+  cache_info.pInitialData = data.empty() ? nullptr : data.data();
+  if (vkCreatePipelineCache(_device, &cache_info, nullptr, &_pipeline_cache) != VK_SUCCESS) {
+    // the driver rejected the data, starts empty
+    cache_info.initialDataSize = 0;
+    cache_info.pInitialData = nullptr;
+    VK_CHECK(vkCreatePipelineCache(_device, &cache_info, nullptr, &_pipeline_cache));
+  }
+}
+
+void gfx::VKRenderer::save_pipeline_cache() {
+  if (_pipeline_cache_path.empty())
+    return;
+
+  size_t size = 0;
+  if (vkGetPipelineCacheData(_device, _pipeline_cache, &size, nullptr) != VK_SUCCESS || size == 0)
+    return;
+  std::vector<char> data(size);
+  if (vkGetPipelineCacheData(_device, _pipeline_cache, &size, data.data()) != VK_SUCCESS)
+    return;
+
+  // written next to the final file then renamed so a crash never leaves a truncated cache
+  std::filesystem::path path = _pipeline_cache_path;
+  std::filesystem::path tmp_path = path;
+  tmp_path += ".tmp";
+  {
+    std::ofstream file(tmp_path, std::ios::binary | std::ios::trunc);
+    if (!file.write(data.data(), size)) {
+      std::cout << "Can't write the pipeline cache file " << tmp_path.string() << std::endl;
+      return;
+    }
+  }
+  std::error_code error;
+  std::filesystem::rename(tmp_path, path, error);
+}
+
+void gfx::VKRenderer::begin_timed_pass(VkCommandBuffer cmd, const char* name) {
+  FrameData& frame = get_current_frame();
+  if (_timestamp_period == 0.0f || frame.timed_passes.size() == MAX_TIMED_PASSES)
+    return;
+  uint32_t query = (uint32_t)frame.timed_passes.size() * 2;
+  vkCmdWriteTimestamp2(cmd, VK_PIPELINE_STAGE_2_TOP_OF_PIPE_BIT, frame.timestamp_pool, query);
+  frame.timed_passes.emplace_back(name);
+  _timing_pass = true;
+}
+
+void gfx::VKRenderer::end_timed_pass(VkCommandBuffer cmd) {
+  FrameData& frame = get_current_frame();
+  // the passes past MAX_TIMED_PASSES have no begin timestamp, their end would overwrite the previous pass
+  if (!_timing_pass)
+    return;
+  uint32_t query = (uint32_t)frame.timed_passes.size() * 2 - 1;
+  vkCmdWriteTimestamp2(cmd, VK_PIPELINE_STAGE_2_BOTTOM_OF_PIPE_BIT, frame.timestamp_pool, query);
+  _timing_pass = false;
+}
+
+void gfx::VKRenderer::read_pass_timings(FrameData& frame) {
+  if (frame.timed_passes.empty())
+    return;
+
+  // no wait flag: the frame is done on the GPU so the results are there, VK_NOT_READY keeps the previous timings
+  uint64_t timestamps[MAX_TIMED_PASSES * 2];
+  uint32_t count = (uint32_t)frame.timed_passes.size() * 2;
+  VkResult res = vkGetQueryPoolResults(_device, frame.timestamp_pool, 0, count, sizeof(timestamps), timestamps, sizeof(uint64_t), VK_QUERY_RESULT_64_BIT);
+  if (res == VK_SUCCESS) {
+    _pass_timings.resize(frame.timed_passes.size());
+    for (size_t i = 0; i < frame.timed_passes.size(); i++) {
+      _pass_timings[i].name = frame.timed_passes[i];
+      _pass_timings[i].gpu_ms = (double)(timestamps[i * 2 + 1] - timestamps[i * 2]) * _timestamp_period / 1e6;
+    }
+  }
+  frame.timed_passes.clear();
 }
@@ -3,35 +3,60 @@
 #include "gfx/renderer.h"
 #include <vulkan/vulkan.h>
 #include "vk_mem_alloc.h"
+#include "thread_pool.h"
 
+#include <array>
 #include <vector>
-#include <deque>
-#include <functional>
 #include <optional>
+#include <string>
+#include <functional>
+#include <mutex>
+#include <unordered_map>
 
 namespace gfx {
 
-  constexpr uint32_t FRAME_OVERLAP = 2;
   constexpr uint32_t MAX_IMAGES = 4096;
+  // per frame segments of the staging and uniform rings
+  constexpr uint32_t VK_STAGING_RING_FRAME_SIZE = 16 * 1024 * 1024;
+  constexpr uint32_t VK_UNIFORM_RING_FRAME_SIZE = 4 * 1024 * 1024;
+  // texture sets per pool of the descriptor allocators, a full pool is followed by another one
+  constexpr uint32_t VK_DESCRIPTOR_POOL_SETS = 1024;
+  // range of the dynamic uniform buffer descriptor, the minimum maxUniformBufferRange
+  constexpr uint32_t VK_MAX_UNIFORM_SIZE = 16 * 1024;
+  constexpr uint32_t VK_MAX_SHADER_TEXTURES = 16;
+  constexpr uint32_t VK_STREAM_BUFFER_ALIGNMENT = 16;
+  // threads recording the command lists into secondary command buffers, the calling thread included
+  constexpr uint32_t VK_MAX_RECORDING_THREADS = 8;
+  // uniform ring memory taken at once by a recording thread
+  constexpr uint32_t VK_UNIFORM_BLOCK_SIZE = 64 * 1024;
 
   class VKRenderer {
   public:
-    struct DeletionQueue
-    {
-      std::deque<std::function<void()>> deletors;
+    /*!
+    * Vulkan objects waiting for the GPU to be done with them, one vector per type.
+    * Queuing a destroy is one append and the vectors keep their capacity across the frames,
+    * the flush destroys each type in a tight loop.
+    */
+    struct DeletionQueue {
+      struct BufferAllocation {
+        VkBuffer buffer;
+        VmaAllocation allocation;
+      };
 
-      void push_function(std::function<void()>&& function) {
-        deletors.push_back(function);
-      }
+      struct ImageAllocation {
+        VkImage image;
+        VmaAllocation allocation;
+      };
 
-      void flush() {
-        // reverse iteration
-        for (auto it = deletors.rbegin(); it != deletors.rend(); it++) {
-          (*it)();
-        }
+      std::vector<VkPipeline> pipelines;
+      std::vector<VkPipelineLayout> pipeline_layouts;
+      std::vector<VkShaderModule> shader_modules;
+      std::vector<VkImageView> image_views;
+      std::vector<ImageAllocation> images;
+      std::vector<BufferAllocation> buffers;
 
-        deletors.clear();
-      }
+      // the users are destroyed before what they reference: pipelines before their layouts, views before their images
+      void flush(VkDevice device, VmaAllocator allocator);
     };
 
     struct Swapchain {
@@ -40,15 +65,69 @@ namespace gfx {
       std::vector<VkImage> images;
       std::vector<VkImageView> image_views;
       VkExtent2D extent;
+      VkExtent2D window_extent; // size of the window when the swapchain was created, can differ from extent
+      std::vector<VkSemaphore> render_semaphores; // one per image, signaled by the submit and waited by the presentation of the image
+    };
+
+    /*!
+    * Descriptor pools of one thread for one frame. A full pool is kept aside and the next allocations take a free pool
+    * or a new one, reset() gives all the pools back at once when the frame starts again.
+    */
+    struct DescriptorAllocator {
+      // returns VK_NULL_HANDLE when no pool can be created
+      VkDescriptorSet allocate(VkDevice device, VkDescriptorSetLayout layout);
+      void reset(VkDevice device);
+      void destroy(VkDevice device);
+
+      VkDescriptorPool current = VK_NULL_HANDLE;
+      std::vector<VkDescriptorPool> full;
+      std::vector<VkDescriptorPool> free;
+    };
+
+    /*!
+    * Descriptor set layouts shared by the shaders declaring the same bindings, kept until shutdown.
+    * The sets allocated with a layout can be bound with any pipeline layout using it.
+    */
+    struct DescriptorLayoutCache {
+      VkDescriptorSetLayout get(VkDevice device, const std::vector<VkDescriptorSetLayoutBinding>& bindings);
+      void destroy(VkDevice device);
+
+      struct BindingsHash {
+        size_t operator()(const std::vector<VkDescriptorSetLayoutBinding>& bindings) const;
+      };
+      struct BindingsEqual {
+        bool operator()(const std::vector<VkDescriptorSetLayoutBinding>& a, const std::vector<VkDescriptorSetLayoutBinding>& b) const;
+      };
+
+      std::unordered_map<std::vector<VkDescriptorSetLayoutBinding>, VkDescriptorSetLayout, BindingsHash, BindingsEqual> layouts;
+    };
+
+    // part of the uniform ring segment of the frame owned by one recording thread
+    struct UniformBlock {
+      VkDeviceSize offset;
+      VkDeviceSize end;
+    };
+
+    // resources of a recording thread for one frame, only touched by that thread while the lists are recorded
+    struct ThreadFrameData {
+      VkCommandPool command_pool;
+      std::vector<VkCommandBuffer> secondaries; // reused every time the frame comes back
+      uint32_t used_secondaries;
+      DescriptorAllocator descriptors;
+      UniformBlock uniforms;
     };
 
     struct FrameData {
       VkCommandPool command_pool;
       VkCommandBuffer main_command_buffer;
+      VkCommandBuffer upload_command_buffer; // staging copies of the frame, submitted before the main command buffer
+      DescriptorAllocator descriptors; // texture sets of the main command buffer
       VkSemaphore present_semaphore; // render commands wait on the swapchain image request
-      VkSemaphore render_semaphore; // presentation sync
-      VkFence render_fence; // signal when gpu finishes rendering the frame
-      DeletionQueue deletion_queue;
+      uint64_t timeline_value; // value of the frame timeline signaled by the last submit of the frame
+      DeletionQueue deletion_queue; // flushed once timeline_value is reached
+      VkQueryPool timestamp_pool; // begin and end timestamps of the timed passes
+      std::vector<std::string> timed_passes;
+      std::vector<ThreadFrameData> threads; // indexed by ThreadPool::thread_index
     };
 
     struct VKImage {
@@ -59,6 +138,118 @@ namespace gfx {
       VkFormat image_format;
     };
 
+    /*!
+    * Host visible buffer split in one segment per frame in flight, persistently mapped.
+    * A segment is written again once the GPU is done with its frame.
+    */
+    struct BufferRing {
+      // padding bytes follow the last segment, for the descriptors reading past an allocation
+      void create(VmaAllocator allocator, VkBufferUsageFlags usage, VkDeviceSize segment_size, VkDeviceSize alignment, uint32_t num_segments, VkDeviceSize padding = 0);
+      // reserves size bytes in the segment of the current frame, returns the offset in the buffer
+      std::optional<VkDeviceSize> alloc(VkDeviceSize size);
+      // makes the writes of the current segment visible to the GPU
+      void flush(VmaAllocator allocator) const;
+      void begin_frame(uint32_t frame);
+      VkDeviceSize segment_offset() const { return (VkDeviceSize)frame * segment_size; }
+
+      VkBuffer buffer;
+      VmaAllocation allocation;
+      uint8_t* mapped;
+      VkDeviceSize segment_size;
+      VkDeviceSize alignment;
+      uint32_t frame;
+      VkDeviceSize offset;
+    };
+
+    // IMMUTABLE and DYNAMIC buffers are device local and written through the staging ring,
+    // STREAM buffers are host visible with one segment per frame in flight
+    struct VKBuffer {
+      // start of the data of the current frame
+      VkDeviceSize base_offset() const { return usage == BufferUsage::STREAM ? (VkDeviceSize)frame * segment_size : 0; }
+
+      VkBuffer buffer;
+      VmaAllocation allocation;
+      BufferType type;
+      BufferUsage usage;
+      uint32_t size;
+      uint32_t segment_size;
+      uint32_t append_offset;
+      uint32_t frame;
+      uint8_t* mapped; // STREAM buffers only
+    };
+
+    // textures are in VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL out of the passes rendering to them
+    struct VKTexture {
+      VKImage image;
+      TextureType type;
+      TextureFormat format;
+      VkImageAspectFlags aspect;
+      uint32_t texel_size; // RGB8 texels are stored as RGBA8
+      uint32_t mip_levels;
+      VkImageLayout layout; // layout in the main command buffer, the uploads start and end in the shader read layout
+    };
+
+    struct VKSampler {
+      VkSampler sampler; // shared by the samplers with the same description
+    };
+
+    // set 0 holds the uniform block, set 1 the textures, see TEXTURE_BINDING in the shaders
+    struct VKShader {
+      VkShaderModule vertex;
+      VkShaderModule fragment;
+      std::array<VkDescriptorSetLayout, 2> set_layouts;
+      VkPipelineLayout layout;
+      uint32_t num_textures;
+      bool use_uniforms;
+    };
+
+    struct VKRenderPass {
+      std::vector<Texture> colors;
+      std::optional<Texture> depth;
+      std::string name;
+      VkExtent2D extent;
+    };
+
+    // dynamic rendering bakes the attachment formats in the pipelines: one VkPipeline per formats of the passes using it
+    struct VKPipelineVariant {
+      std::vector<VkFormat> color_formats;
+      VkFormat depth_format;
+      VkPipeline pipeline;
+    };
+
+    struct VKPipeline {
+      Shader shader;
+      Pipeline fallback; // used when the shader could not be created
+      std::array<VkVertexInputAttributeDescription, MAX_ATTRIBUTES> attributes;
+      uint32_t num_attributes;
+      std::array<VkVertexInputBindingDescription, 2> bindings; // per vertex, per instance
+      uint32_t num_bindings;
+      VkIndexType index_type;
+      uint32_t index_size; // 0 without index buffer
+      VkPrimitiveTopology topology;
+      VkCullModeFlags cull_mode;
+      std::vector<VKPipelineVariant> variants;
+    };
+
+    // command buffer being recorded with the state bound in it: the main command buffer or a secondary of a command list
+    struct VKRecorder {
+      VkCommandBuffer cmd;
+      DescriptorAllocator* descriptors;
+      UniformBlock* uniforms;
+      VKPipeline* pipeline;
+      VkPipeline vk_pipeline;
+      VkBuffer index_buffer;
+      VkDeviceSize index_base; // start of the current frame data of the index buffer
+      VkDeviceSize index_offset; // Bindings::index_buffer_offset
+    };
+
+    // memory written by the CPU and copied by the upload command buffer of the frame
+    struct StagingAlloc {
+      VkBuffer buffer;
+      VkDeviceSize offset;
+      uint8_t* data;
+    };
+
     void init(const InitInfo& info);
     void shutdown();
     void begin_render_pass(std::optional<RenderPass> pass, const PassAction& action);
@@ -66,44 +257,205 @@ namespace gfx {
     void set_pipeline(Pipeline pipe);
     void set_bindings(Bindings bind);
     void set_uniforms(const Memory& mem);
-    void draw(uint32_t first_element, uint32_t num_elements, uint32_t num_instances);
+    void draw(uint32_t first_element, uint32_t num_elements, uint32_t num_instances, int32_t base_vertex);
+    void multi_draw_indirect(Buffer args, uint32_t offset, uint32_t draw_count, uint32_t stride);
     void set_viewport(const Rect& rect);
     void set_scissor(const Rect& rect);
+    // record() replays a command list, it is called by a worker thread recording into a secondary command buffer
+    // the lists executed one after the other are recorded in parallel and executed in order by the next command
+    void execute_command_list(std::function<void()> record);
     void submit();
 
     bool new_buffer(Buffer h, const BufferDesc& desc);
+    bool update_buffer(Buffer h, const Memory& mem);
+    std::optional<uint32_t> append_buffer(Buffer h, const Memory& mem);
     bool new_texture(Texture h, const TextureDesc& desc);
+    bool update_texture(Texture h, const TextureRegion& region, uint32_t mip, const Memory& mem);
     bool new_shader(Shader h, const ShaderDesc& desc);
     bool new_render_pass(RenderPass h, const RenderPassDesc&);
     bool new_pipeline(Pipeline h, const PipelineDesc& desc);
+    bool new_sampler(Sampler h, const SamplerDesc& desc);
+    bool is_shader_ready(Shader h);
+    bool is_pipeline_ready(Pipeline h);
+    void destroy_buffer(Buffer h);
+    void destroy_texture(Texture h);
+    void destroy_shader(Shader h);
+    void destroy_render_pass(RenderPass h);
+    void destroy_pipeline(Pipeline h);
+    void destroy_sampler(Sampler h);
+
+    FrameData& get_current_frame() { return _frames[_frame_number % _frames_in_flight]; };
 
-    FrameData& get_current_frame() { return _frames[_frame_number % FRAME_OVERLAP]; };
+    const std::vector<PassTiming>& pass_timings() const { return _pass_timings; }
+    const PipelineCacheStats& pipeline_cache_stats() const { return _pipeline_cache_stats; }
 
   private:
     // some init functions to break initialisation in several parts
-    void init_swapchain(SDL_Window* window);
+    void init_swapchain();
+    // color and depth of the default render pass, sized by the window and the render scale
+    void init_draw_images();
+    void destroy_swapchain();
+    void destroy_draw_images();
+    // called after a present once the window changed size or the swapchain is out of date, waits for the device
+    void recreate_swapchain();
+    // size of the window in pixels
+    VkExtent2D window_extent() const;
+    // size of the draw image for a window size
+    VkExtent2D scaled_extent(VkExtent2D window) const;
     void init_commands();
     void init_sync_structures();
+    void init_descriptors();
+    // seeds the pipeline cache with the file of the previous run when it was written by the same device and driver
+    void init_pipeline_cache(const std::string& directory);
+    void save_pipeline_cache();
+
+    // waits for the GPU to release the current frame then recycles its resources
+    void begin_frame();
+    // the main command buffer of the frame is started by the first command recorded
+    VkCommandBuffer get_command_buffer();
+    // recorder of the calling thread, on the thread owning the renderer the command lists waiting are recorded first
+    VKRecorder& current_recorder();
+    // begins a rendering instance of the current pass if the one in progress does not have these contents,
+    // the instances after the first one load the attachments
+    void begin_rendering(bool secondary);
+    // records the command lists waiting on the recording threads and executes their secondary command buffers
+    void record_command_lists();
+    VkCommandBuffer get_secondary_command_buffer(ThreadFrameData& thread);
+    // records the staging copies of the frame, returns false when there is nothing to upload
+    bool record_uploads(VkCommandBuffer cmd);
+
+    StagingAlloc stage(VkDeviceSize size);
+    void queue_buffer_upload(const VKBuffer& buffer, VkDeviceSize offset, const Memory& mem);
+    void queue_texture_upload(const VKTexture& texture, const TextureRegion& region, uint32_t mip, const void* texels);
+    // moves the image to the transfer layout for the copies of the batch and back to the shader layout after them,
+    // images not initialized yet come from VK_IMAGE_LAYOUT_UNDEFINED
+    void queue_texture_transition(const VKTexture& texture, bool initialized, bool generate_mips);
+    void write_stream_buffer(VKBuffer& buffer, VkDeviceSize offset, const Memory& mem);
+    std::optional<VkDeviceSize> alloc_uniforms(UniformBlock& block, VkDeviceSize size);
+    VkSampler get_sampler(const SamplerDesc& desc);
+    VkPipeline get_pipeline_variant(VKPipeline& pip);
 
-    void draw_background(VkCommandBuffer cmd);
+    // timestamps around the passes, written in the query pool of the current frame
+    void begin_timed_pass(VkCommandBuffer cmd, const char* name);
+    void end_timed_pass(VkCommandBuffer cmd);
+    // reads the timestamps of a frame once the GPU is done with it
+    void read_pass_timings(FrameData& frame);
 
     VkInstance _instance;
     VkDebugUtilsMessengerEXT _debug_messenger;
     VkPhysicalDevice _chosen_gpu;
     VkDevice _device;
     VkSurfaceKHR _surface;
+    SDL_Window* _window;
     Swapchain _swapchain;
-    FrameData _frames[FRAME_OVERLAP];
+    bool _swapchain_dirty; // out of date or suboptimal, recreated after the present
+    FrameData _frames[MAX_FRAMES_IN_FLIGHT]; // the first _frames_in_flight are used
+    uint32_t _frames_in_flight;
+    VkPresentModeKHR _present_mode; // requested mode, the swapchain falls back to FIFO
+    VkSemaphore _frame_timeline; // timeline semaphore, the submit of frame n signals n + 1
     VkQueue _graphics_queue;
     uint32_t _graphics_queue_family;
     VmaAllocator _allocator;
 
     VKImage _draw_image;
-    VkExtent2D _draw_extent;
+    VKImage _depth_image; // depth of the default render pass
+    VkExtent2D _draw_extent; // the window size times _render_scale, independent from the swapchain extent
+    float _render_scale;
+    VkImageLayout _draw_image_layout;
+    VkImageLayout _depth_image_layout;
+    // targets of the offscreen passes still in an attachment layout, moved to the shader read layout
+    // by the first pass not writing them or at submit
+    std::vector<Texture> _attachment_textures;
+
+    std::array<VKBuffer, MAX_BUFFERS> _buffers;
+    std::array<VKTexture, MAX_TEXTURES> _textures;
+    std::array<VKShader, MAX_SHADERS> _shaders;
+    std::array<VKRenderPass, MAX_RENDER_PASSES> _render_passes;
+    std::array<VKPipeline, MAX_PIPELINES> _pipelines;
+    std::array<VKSampler, MAX_SAMPLERS> _samplers;
+    std::vector<Buffer> _stream_buffers;
+
+    // sampler objects are created once per description and kept until shutdown
+    struct SamplerDescHash {
+      size_t operator()(const SamplerDesc& desc) const;
+    };
+
+    std::unordered_map<SamplerDesc, VkSampler, SamplerDescHash> _sampler_cache;
+    VkSampler _default_sampler; // textures bound without sampler, same parameters as the GL textures
+    float _max_anisotropy;
+
+    BufferRing _staging_ring;
+    BufferRing _uniform_ring;
+    DescriptorLayoutCache _layout_cache;
+    // one dynamic uniform buffer descriptor over the whole uniform ring, set_uniforms only binds it with a new offset
+    VkDescriptorSetLayout _uniform_set_layout;
+    VkDescriptorPool _uniform_pool;
+    VkDescriptorSet _uniform_set;
+
+    // copies and layout transitions waiting for the upload command buffer of the frame
+    struct BufferUpload {
+      VkBuffer src;
+      VkBuffer dst;
+      VkBufferCopy region;
+    };
+
+    struct TextureUpload {
+      VkBuffer src;
+      VkImage dst;
+      VkBufferImageCopy region;
+    };
+
+    struct TextureTransition {
+      VkImage image;
+      VkImageAspectFlags aspect;
+      VkExtent3D extent;
+      uint32_t mip_levels;
+      bool initialized; // in VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL already
+      bool generate_mips;
+    };
+
+    std::vector<BufferUpload> _buffer_uploads;
+    std::vector<TextureUpload> _texture_uploads;
+    std::vector<TextureTransition> _texture_transitions;
+
+    // Current command state
+    struct VKState {
+      VKRecorder recorder; // main command buffer
+      UniformBlock uniforms;
+      std::optional<RenderPass> pass;
+      bool in_pass;
+      std::vector<VkFormat> color_formats;
+      VkFormat depth_format;
+      std::vector<VkRenderingAttachmentInfo> color_attachments;
+      std::optional<VkRenderingAttachmentInfo> depth_attachment;
+      VkExtent2D extent;
+      bool rendering; // a rendering instance of the pass is in progress
+      bool rendering_secondary; // its contents are secondary command buffers
+      bool rendered; // the attachments have been cleared by a previous instance of the pass
+      std::optional<VkViewport> viewport; // kept across the passes like the GL viewport
+      bool recording; // the main command buffer of the frame is started
+    };
+
+    VKState _state;
+    ThreadPool _recording_pool;
+    std::vector<std::function<void()>> _command_lists; // waiting to be recorded
+    std::vector<VkCommandBuffer> _secondaries;
+    std::mutex _pipeline_mutex; // variants created by the recording threads
+    std::mutex _uniform_mutex; // uniform blocks taken by the recording threads
+    bool _depth_clip_control; // GL depth range, without it the depths below 0 are clipped
+    bool _multi_draw_indirect; // several draws per indirect call
+
+    VkPipelineCache _pipeline_cache;
+    std::string _pipeline_cache_path; // empty when the cache is not persisted
+    PipelineCacheStats _pipeline_cache_stats;
+
+    DeletionQueue _main_deletion_queue; // objects living until shutdown
 
-    DeletionQueue _main_deletion_queue;
+    float _timestamp_period; // nanoseconds per timestamp tick, 0 when the queue can't write timestamps
+    std::vector<PassTiming> _pass_timings;
+    bool _timing_pass = false; // the current pass has a begin timestamp
 
-    uint32_t _frame_number = 0;
+    uint64_t _frame_number = 0;
     bool _is_initialized = false;
   };
 }
@@ -34,7 +34,54 @@ void vkutil::transition_image(VkCommandBuffer cmd, VkImage image, VkImageLayout
   vkCmdPipelineBarrier2(cmd, &depInfo);
 }
 
-void vkutil::copy_image_to_image(VkCommandBuffer cmd, VkImage source, VkImage destination, VkExtent2D srcSize, VkExtent2D dstSize) {
+static void layout_scope(VkImageLayout layout, VkPipelineStageFlags2& stage, VkAccessFlags2& access) {
+  switch (layout) {
+  case VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL:
+    stage = VK_PIPELINE_STAGE_2_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT;
+    access = VK_ACCESS_2_SHADER_SAMPLED_READ_BIT;
+    break;
+  case VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL:
+    stage = VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT;
+    access = VK_ACCESS_2_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT;
+    break;
+  case VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL:
+    stage = VK_PIPELINE_STAGE_2_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_2_LATE_FRAGMENT_TESTS_BIT;
+    access = VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+    break;
+  case VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL:
+    stage = VK_PIPELINE_STAGE_2_ALL_TRANSFER_BIT;
+    access = VK_ACCESS_2_TRANSFER_READ_BIT;
+    break;
+  case VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL:
+    stage = VK_PIPELINE_STAGE_2_ALL_TRANSFER_BIT;
+    access = VK_ACCESS_2_TRANSFER_WRITE_BIT;
+    break;
+  default:
+    // undefined and present: the presentation engine is synchronized with the semaphores
+    stage = VK_PIPELINE_STAGE_2_NONE;
+    access = VK_ACCESS_2_NONE;
+    break;
+  }
+}
+
+VkImageMemoryBarrier2 vkutil::layout_barrier(VkImage image, VkImageAspectFlags aspectMask, VkImageLayout currentLayout, VkImageLayout newLayout, bool discard) {
+  VkImageMemoryBarrier2 imageBarrier{ .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2 };
+  imageBarrier.pNext = nullptr;
+
+  layout_scope(currentLayout, imageBarrier.srcStageMask, imageBarrier.srcAccessMask);
+  layout_scope(newLayout, imageBarrier.dstStageMask, imageBarrier.dstAccessMask);
+
+  imageBarrier.oldLayout = discard ? VK_IMAGE_LAYOUT_UNDEFINED : currentLayout;
+  imageBarrier.newLayout = newLayout;
+  imageBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  imageBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  imageBarrier.subresourceRange = image_subresource_range(aspectMask);
+  imageBarrier.image = image;
+
+  return imageBarrier;
+}
+
+void vkutil::copy_image_to_image(VkCommandBuffer cmd, VkImage source, VkImage destination, VkExtent2D srcSize, VkExtent2D dstSize, bool flipY) {
   VkImageBlit2 blitRegion{ .sType = VK_STRUCTURE_TYPE_IMAGE_BLIT_2, .pNext = nullptr };
 
   blitRegion.srcOffsets[1].x = srcSize.width;
@@ -45,6 +92,11 @@ void vkutil::copy_image_to_image(VkCommandBuffer cmd, VkImage source, VkImage de
   blitRegion.dstOffsets[1].y = dstSize.height;
   blitRegion.dstOffsets[1].z = 1;
 
+  if (flipY) {
+    blitRegion.dstOffsets[0].y = dstSize.height;
+    blitRegion.dstOffsets[1].y = 0;
+  }
+
   blitRegion.srcSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
   blitRegion.srcSubresource.baseArrayLayer = 0;
   blitRegion.srcSubresource.layerCount = 1;
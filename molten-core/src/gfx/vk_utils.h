@@ -6,8 +6,11 @@ namespace vkutil {
   // image manipulation helper functions
   // transition image from a layout to another
   void transition_image(VkCommandBuffer cmd, VkImage image, VkImageLayout currentLayout, VkImageLayout newLayout);
-  // copy an image to another
-  void copy_image_to_image(VkCommandBuffer cmd, VkImage source, VkImage destination, VkExtent2D srcSize, VkExtent2D dstSize);
+  // barrier moving an image from a layout to another, the stages and accesses are the ones of the renderer for each layout
+  // discard transitions from VK_IMAGE_LAYOUT_UNDEFINED: the content is dropped but the previous uses are still waited on
+  VkImageMemoryBarrier2 layout_barrier(VkImage image, VkImageAspectFlags aspectMask, VkImageLayout currentLayout, VkImageLayout newLayout, bool discard = false);
+  // copy an image to another, flipY mirrors the rows
+  void copy_image_to_image(VkCommandBuffer cmd, VkImage source, VkImage destination, VkExtent2D srcSize, VkExtent2D dstSize, bool flipY = false);
   //------------------------------------
   // 
   // Init helper functions for images
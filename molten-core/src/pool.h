@@ -1,3 +1,6 @@
+#pragma once
+
+#include <stdint.h>
 #include <vector>
 
 namespace core {
@@ -0,0 +1,141 @@
+#include "profiler.h"
+
+#include <iostream>
+#include <fstream>
+#include <iomanip>
+#include <algorithm>
+#include <chrono>
+#include <atomic>
+#include <mutex>
+#include <memory>
+#include <vector>
+
+namespace core {
+#if defined(MOLTEN_PROFILE)
+  struct ProfileThread {
+    std::unique_ptr<ProfileEvent[]> events;
+    std::atomic<uint64_t> count = 0; // zones recorded since the thread started, only written by the thread
+    std::atomic<const char*> name = nullptr;
+    uint32_t id = 0;
+  };
+
+  // the rings outlive their threads so the zones of the finished threads stay in the trace
+  static std::mutex s_threads_mutex;
+  static std::vector<std::unique_ptr<ProfileThread>> s_threads;
+  static thread_local ProfileThread* s_thread = nullptr;
+  static const std::chrono::steady_clock::time_point s_start = std::chrono::steady_clock::now();
+
+  static uint64_t now_ns() {
+    return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - s_start).count();
+  }
+
+  static ProfileThread& current_thread() {
+    if (!s_thread) {
+      auto thread = std::make_unique<ProfileThread>();
+      thread->events = std::make_unique<ProfileEvent[]>(PROFILE_RING_SIZE);
+      std::lock_guard lock(s_threads_mutex);
+      thread->id = (uint32_t)s_threads.size();
+      s_thread = thread.get();
+      s_threads.push_back(std::move(thread));
+    }
+    return *s_thread;
+  }
+
+  static void write_json_string(std::ostream& out, const char* str) {
+    out << '"';
+    for (const char* c = str; *c; c++) {
+      if (*c == '"' || *c == '\\')
+        out << '\\';
+      out << *c;
+    }
+    out << '"';
+  }
+
+  ProfileZone::ProfileZone(const char* name) : _name(name), _begin_ns(now_ns()) {
+  }
+
+  ProfileZone::~ProfileZone() {
+    uint64_t end_ns = now_ns();
+    ProfileThread& thread = current_thread();
+    uint64_t count = thread.count.load(std::memory_order_relaxed);
+    thread.events[count % PROFILE_RING_SIZE] = ProfileEvent{ _name, _begin_ns, end_ns };
+    // publishes the zone to write_profile_trace
+    thread.count.store(count + 1, std::memory_order_release);
+  }
+
+  void set_profile_thread_name(const char* name) {
+    current_thread().name.store(name, std::memory_order_release);
+  }
+
+  bool write_profile_trace(const char* path) {
+    std::ofstream file(path);
+    if (!file) {
+      std::cout << "Failed to open the profile trace " << path << std::endl;
+      return false;
+    }
+
+    file << std::fixed << std::setprecision(3);
+    file << "{\"traceEvents\":[";
+    bool first = true;
+    std::vector<ProfileEvent> events;
+    // threads starting their first zone wait for the end of the dump
+    std::lock_guard lock(s_threads_mutex);
+    for (const std::unique_ptr<ProfileThread>& thread : s_threads) {
+      // copies the ring then drops the zones the thread may have overwritten during the copy,
+      // the zone being written when the copy ends included
+      uint64_t end = thread->count.load(std::memory_order_acquire);
+      uint64_t begin = end > PROFILE_RING_SIZE ? end - PROFILE_RING_SIZE : 0;
+      events.assign(end - begin, ProfileEvent{});
+      for (uint64_t i = begin; i < end; i++) {
+        events[i - begin] = thread->events[i % PROFILE_RING_SIZE];
+      }
+      std::atomic_thread_fence(std::memory_order_acquire);
+      uint64_t written = thread->count.load(std::memory_order_relaxed);
+      uint64_t first_valid = written + 1 > PROFILE_RING_SIZE ? written + 1 - PROFILE_RING_SIZE : 0;
+
+      file << (first ? "\n" : ",\n");
+      first = false;
+      file << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":" << thread->id << ",\"args\":{\"name\":";
+      if (const char* name = thread->name.load(std::memory_order_acquire)) {
+        write_json_string(file, name);
+      } else {
+        file << "\"thread " << thread->id << "\"";
+      }
+      file << "}}";
+
+      for (uint64_t i = std::max(begin, first_valid); i < end; i++) {
+        const ProfileEvent& event = events[i - begin];
+        file << ",\n{\"name\":";
+        write_json_string(file, event.name);
+        file << ",\"ph\":\"X\",\"pid\":0,\"tid\":" << thread->id
+          << ",\"ts\":" << (double)event.begin_ns / 1000.0
+          << ",\"dur\":" << (double)(event.end_ns - event.begin_ns) / 1000.0 << "}";
+      }
+    }
+    file << "\n]}\n";
+
+    if (!file) {
+      std::cout << "Failed to write the profile trace " << path << std::endl;
+      return false;
+    }
+    return true;
+  }
+#else
+  ProfileZone::ProfileZone(const char* name) : _name(name), _begin_ns(0) {
+  }
+
+  ProfileZone::~ProfileZone() {
+    // keeps clang from reporting the fields as unused
+    (void)_name;
+    (void)_begin_ns;
+  }
+
+  void set_profile_thread_name(const char*) {
+  }
+
+  bool write_profile_trace(const char*) {
+    std::cout << "The profiler is compiled out, build in Debug or RelWithDebInfo or with MOLTEN_PROFILER=ON to record a trace" << std::endl;
+    return false;
+  }
+#endif
+}
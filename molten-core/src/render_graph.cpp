@@ -0,0 +1,365 @@
+#include "render_graph.h"
+#include "profiler.h"
+
+#include <iostream>
+#include <algorithm>
+#include <cstdint>
+
+namespace core {
+  RGTexture RGPassBuilder::create(const RGTextureDesc& desc) {
+    return _graph.add_resource(
+      RenderGraph::Resource{
+        .desc = desc,
+        .imported = false,
+        .texture = gfx::INVALID_HANDLE,
+        .first_pass = std::nullopt,
+        .last_pass = 0,
+      }
+    );
+  }
+
+  // the setup of a pass runs before the next pass is added, its textures are the last ones of the flat vectors
+  void RGPassBuilder::read(RGTexture texture) {
+    _graph._pass_reads.push_back(texture);
+    _graph._passes[_pass].reads_end++;
+  }
+
+  void RGPassBuilder::write(RGTexture texture) {
+    RenderGraph::Pass& pass = _graph._passes[_pass];
+    if (pass.colors_end - pass.colors_begin == RG_MAX_COLOR_ATTACHMENTS) {
+      std::cout << "Render graph pass " << pass.name << " writes more than " << RG_MAX_COLOR_ATTACHMENTS << " color attachments" << std::endl;
+      return;
+    }
+    _graph._pass_colors.push_back(texture);
+    pass.colors_end++;
+  }
+
+  void RGPassBuilder::write_depth(RGTexture texture) {
+    _graph._passes[_pass].depth = texture;
+  }
+
+  void RGPassBuilder::side_effect() {
+    _graph._passes[_pass].side_effect = true;
+  }
+
+  void RenderGraph::init(gfx::Renderer& renderer) {
+    _renderer = &renderer;
+    _passes.reserve(16);
+    _pass_reads.reserve(32);
+    _pass_colors.reserve(32);
+    _resources.reserve(32);
+    reset();
+  }
+
+  void RenderGraph::shutdown() {
+    for (const auto& [key, cached] : _render_passes) {
+      _renderer->destroy_render_pass(cached.pass);
+    }
+    for (const PooledTexture& pooled : _pool) {
+      _renderer->destroy_texture(pooled.texture);
+    }
+    _render_passes.clear();
+    _pool.clear();
+    _resources.clear();
+    _passes.clear();
+    _pass_reads.clear();
+    _pass_colors.clear();
+    _arena.reset();
+  }
+
+  RGTexture RenderGraph::import(gfx::Texture texture) {
+    return add_resource(
+      Resource{
+        .desc = RGTextureDesc{},
+        .imported = true,
+        .texture = texture,
+        .first_pass = std::nullopt,
+        .last_pass = 0,
+      }
+    );
+  }
+
+  uint32_t RenderGraph::begin_pass(const char* name, const gfx::PassAction& action, PassCallback execute) {
+    _passes.push_back(
+      Pass{
+        .name = name,
+        .action = action,
+        .reads_begin = (uint32_t)_pass_reads.size(),
+        .reads_end = (uint32_t)_pass_reads.size(),
+        .colors_begin = (uint32_t)_pass_colors.size(),
+        .colors_end = (uint32_t)_pass_colors.size(),
+        .depth = std::nullopt,
+        .side_effect = false,
+        .alive = false,
+        .execute = execute,
+      }
+    );
+    return (uint32_t)_passes.size() - 1;
+  }
+
+  gfx::Texture RenderGraph::texture(RGTexture texture) const {
+    return _resources[texture].texture;
+  }
+
+  RGTexture RenderGraph::add_resource(const Resource& resource) {
+    _resources.push_back(resource);
+    return (RGTexture)_resources.size() - 1;
+  }
+
+  void RenderGraph::cull() {
+    // walks the passes backward from the ones with side effects, a pass is alive when a later alive pass reads what it writes
+    _needed.assign(_resources.size(), false);
+    for (size_t i = _passes.size(); i-- > 0;) {
+      Pass& pass = _passes[i];
+      const RGTexture* colors_begin = _pass_colors.data() + pass.colors_begin;
+      const RGTexture* colors_end = _pass_colors.data() + pass.colors_end;
+      // the backbuffer and the imported textures are read outside of the graph
+      auto external = [&](RGTexture t) { return t == RG_BACKBUFFER || _resources[t].imported; };
+      auto used = [&](RGTexture t) { return _needed[t] || external(t); };
+      pass.alive = pass.side_effect || std::any_of(colors_begin, colors_end, used) || (pass.depth && used(pass.depth.value()));
+      if (!pass.alive)
+        continue;
+
+      // the attachments the pass loads need the previous writes, the others hide them
+      bool load_colors = pass.action.color_action.action == gfx::Action::NOTHING;
+      bool load_depth = pass.action.depth_action.action == gfx::Action::NOTHING;
+      for (const RGTexture* t = colors_begin; t != colors_end; t++) {
+        _needed[*t] = load_colors;
+      }
+      if (pass.depth)
+        _needed[pass.depth.value()] = load_depth;
+      for (uint32_t r = pass.reads_begin; r < pass.reads_end; r++) {
+        _needed[_pass_reads[r]] = true;
+      }
+    }
+  }
+
+  bool RenderGraph::compute_lifetimes() {
+    _written.assign(_resources.size(), false);
+    for (uint32_t i = 0; i < _passes.size(); i++) {
+      const Pass& pass = _passes[i];
+      if (!pass.alive)
+        continue;
+      const RGTexture* colors_begin = _pass_colors.data() + pass.colors_begin;
+      const RGTexture* colors_end = _pass_colors.data() + pass.colors_end;
+      if (std::find(colors_begin, colors_end, RG_BACKBUFFER) != colors_end && (pass.colors_end - pass.colors_begin > 1 || pass.depth)) {
+        std::cout << "Render graph pass " << pass.name << " writes the backbuffer with other attachments" << std::endl;
+        return false;
+      }
+
+      auto use = [&](RGTexture t) {
+        Resource& resource = _resources[t];
+        if (!resource.first_pass)
+          resource.first_pass = i;
+        resource.last_pass = i;
+      };
+      for (uint32_t r = pass.reads_begin; r < pass.reads_end; r++) {
+        RGTexture t = _pass_reads[r];
+        if (!_written[t] && !_resources[t].imported) {
+          std::cout << "Render graph pass " << pass.name << " reads a texture no previous pass writes" << std::endl;
+          return false;
+        }
+        use(t);
+      }
+      for (const RGTexture* t = colors_begin; t != colors_end; t++) {
+        use(*t);
+        _written[*t] = true;
+      }
+      if (pass.depth) {
+        use(pass.depth.value());
+        _written[pass.depth.value()] = true;
+      }
+    }
+    return true;
+  }
+
+  void RenderGraph::allocate() {
+    for (PooledTexture& pooled : _pool) {
+      pooled.last_pass = std::nullopt;
+    }
+
+    // greedy in the order of the first passes: a pooled texture is free for a resource once the last pass of its previous resource is done
+    _transients.clear();
+    for (RGTexture t = RG_BACKBUFFER + 1; t < _resources.size(); t++) {
+      if (!_resources[t].imported && _resources[t].first_pass)
+        _transients.push_back(t);
+    }
+    // insertion sort, stable and without the temporary buffer of std::stable_sort
+    for (size_t i = 1; i < _transients.size(); i++) {
+      RGTexture t = _transients[i];
+      size_t j = i;
+      for (; j > 0 && _resources[_transients[j - 1]].first_pass.value() > _resources[t].first_pass.value(); j--) {
+        _transients[j] = _transients[j - 1];
+      }
+      _transients[j] = t;
+    }
+    _stats.transient_textures = (uint32_t)_transients.size();
+
+    for (RGTexture t : _transients) {
+      Resource& resource = _resources[t];
+
+      auto free = std::find_if(_pool.begin(), _pool.end(), [&](const PooledTexture& pooled) {
+        return pooled.desc == resource.desc && (!pooled.last_pass || pooled.last_pass.value() < resource.first_pass.value());
+      });
+      if (free == _pool.end()) {
+        gfx::Texture texture = _renderer->new_texture(
+          gfx::TextureDesc{
+            .mem = gfx::Memory{},
+            .type = gfx::TextureType::TEXTURE_2D,
+            .format = resource.desc.format,
+            .generate_mip_maps = false,
+            .width = resource.desc.width,
+            .height = resource.desc.height,
+            .depth = 1,
+          }
+        );
+        _pool.push_back(PooledTexture{ .desc = resource.desc, .texture = texture, .last_pass = std::nullopt });
+        free = _pool.end() - 1;
+      }
+      if (!free->last_pass)
+        _stats.physical_textures++;
+      free->last_pass = resource.last_pass;
+      resource.texture = free->texture;
+    }
+  }
+
+  size_t RenderGraph::RenderPassKeyHash::operator()(const RenderPassKey& key) const {
+    // FNV-1a of the pass index, its name and its attachments
+    uint64_t hash = 14695981039346656037ull;
+    auto hash_value = [&hash](uint64_t value) {
+      hash = (hash ^ value) * 1099511628211ull;
+    };
+    hash_value(key.pass);
+    hash_value((uint64_t)(uintptr_t)key.name);
+    hash_value(key.num_colors);
+    for (uint32_t i = 0; i < key.num_colors; i++) {
+      hash_value(key.colors[i]);
+    }
+    hash_value(key.depth);
+    return (size_t)hash;
+  }
+
+  gfx::RenderPass RenderGraph::render_pass(uint32_t pass_index) {
+    const Pass& pass = _passes[pass_index];
+    RenderPassKey key{
+      .pass = pass_index,
+      .name = pass.name,
+      .num_colors = pass.colors_end - pass.colors_begin,
+      .colors = {},
+      .depth = pass.depth ? _resources[pass.depth.value()].texture : gfx::INVALID_HANDLE,
+    };
+    for (uint32_t i = 0; i < key.num_colors; i++) {
+      key.colors[i] = _resources[_pass_colors[pass.colors_begin + i]].texture;
+    }
+
+    auto it = _render_passes.find(key);
+    if (it != _render_passes.end()) {
+      it->second.last_frame = _frame;
+      return it->second.pass;
+    }
+
+    gfx::RenderPass rpass = _renderer->new_render_pass(
+      gfx::RenderPassDesc{
+        .colors = std::vector<gfx::Texture>(key.colors.begin(), key.colors.begin() + key.num_colors),
+        .depth = pass.depth ? std::optional<gfx::Texture>(key.depth) : std::nullopt,
+        .name = pass.name,
+      }
+    );
+    _render_passes.emplace(key, CachedRenderPass{ .pass = rpass, .last_frame = _frame });
+    return rpass;
+  }
+
+  void RenderGraph::evict() {
+    // the graph changed, for instance the targets follow the window size: what it no longer uses would leak
+    // erase_if keeps the order of the pool, the next frames alias the same textures as this one
+    std::erase_if(_pool, [this](const PooledTexture& pooled) {
+      if (pooled.last_pass)
+        return false;
+      _renderer->destroy_texture(pooled.texture);
+      return true;
+    });
+    for (auto it = _render_passes.begin(); it != _render_passes.end();) {
+      if (it->second.last_frame == _frame) {
+        ++it;
+        continue;
+      }
+      _renderer->destroy_render_pass(it->second.pass);
+      it = _render_passes.erase(it);
+    }
+  }
+
+  bool RenderGraph::execute() {
+    PROFILE_ZONE("RenderGraph::execute");
+    _frame++;
+    _stats = RenderGraphStats{
+      .passes = (uint32_t)_passes.size(),
+      .culled_passes = 0,
+      .transient_textures = 0,
+      .physical_textures = 0,
+    };
+
+    cull();
+    if (!compute_lifetimes()) {
+      reset();
+      return false;
+    }
+    allocate();
+
+    for (uint32_t i = 0; i < _passes.size(); i++) {
+      const Pass& pass = _passes[i];
+      if (!pass.alive) {
+        _stats.culled_passes++;
+        continue;
+      }
+
+      const RGTexture* colors_begin = _pass_colors.data() + pass.colors_begin;
+      const RGTexture* colors_end = _pass_colors.data() + pass.colors_end;
+      uint32_t num_colors = pass.colors_end - pass.colors_begin;
+
+      // passes without attachments record outside of a render pass
+      if (num_colors == 0 && !pass.depth) {
+        pass.execute.invoke(pass.execute.data, *_renderer, *this);
+        continue;
+      }
+
+      // the content of a transient texture is undefined before its first pass, there is nothing to load
+      auto first_write = [&](RGTexture t) { return !_resources[t].imported && t != RG_BACKBUFFER && _resources[t].first_pass == i; };
+      gfx::PassAction action = pass.action;
+      if (action.color_action.action == gfx::Action::NOTHING && num_colors > 0 && std::all_of(colors_begin, colors_end, first_write))
+        action.color_action.action = gfx::Action::DONT_CARE;
+      if (action.depth_action.action == gfx::Action::NOTHING && pass.depth && first_write(pass.depth.value()))
+        action.depth_action.action = gfx::Action::DONT_CARE;
+
+      if (num_colors == 1 && *colors_begin == RG_BACKBUFFER) {
+        _renderer->begin_default_render_pass(action);
+      } else {
+        _renderer->begin_render_pass(render_pass(i), action);
+      }
+      pass.execute.invoke(pass.execute.data, *_renderer, *this);
+      _renderer->end_render_pass();
+    }
+
+    evict();
+    reset();
+    return true;
+  }
+
+  void RenderGraph::reset() {
+    // clear keeps the capacity, the next frame reuses the storage
+    _passes.clear();
+    _pass_reads.clear();
+    _pass_colors.clear();
+    _resources.clear();
+    _arena.reset();
+    // RG_BACKBUFFER
+    _resources.push_back(
+      Resource{
+        .desc = RGTextureDesc{},
+        .imported = false,
+        .texture = gfx::INVALID_HANDLE,
+        .first_pass = std::nullopt,
+        .last_pass = 0,
+      }
+    );
+  }
+}
@@ -0,0 +1,191 @@
+#pragma once
+
+#include "gfx/renderer.h"
+#include "gfx/arena.h"
+
+#include <vector>
+#include <array>
+#include <unordered_map>
+#include <optional>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace core {
+  // texture of the render graph, valid until the end of the next execute
+  using RGTexture = uint32_t;
+
+  // the default framebuffer, written by the passes presenting their result
+  constexpr RGTexture RG_BACKBUFFER = 0;
+  constexpr uint32_t RG_MAX_COLOR_ATTACHMENTS = 8;
+
+  struct RGTextureDesc {
+    gfx::TextureFormat format = gfx::TextureFormat::RGBA8;
+    uint32_t width = 0;
+    uint32_t height = 0;
+
+    bool operator==(const RGTextureDesc& other) const = default;
+  };
+
+  struct RenderGraphStats {
+    uint32_t passes = 0;
+    uint32_t culled_passes = 0;
+    uint32_t transient_textures = 0;
+    // textures backing the transient textures of the last frame, fewer than the transient textures when they are aliased
+    uint32_t physical_textures = 0;
+  };
+
+  class RenderGraph;
+
+  /*!
+  * Declares the textures a pass reads and writes, given to the setup callback of RenderGraph::add_pass.
+  */
+  class RGPassBuilder {
+  public:
+    // transient texture, it only lives between its first and its last pass
+    RGTexture create(const RGTextureDesc& desc);
+    // sampled by the pass
+    void read(RGTexture texture);
+    // color attachment of the pass, in the order of the outputs of its shaders
+    void write(RGTexture texture);
+    void write_depth(RGTexture texture);
+    // the pass is executed even when nothing reads what it writes
+    void side_effect();
+
+  private:
+    friend class RenderGraph;
+    RGPassBuilder(RenderGraph& graph, uint32_t pass) : _graph(graph), _pass(pass) {}
+
+    RenderGraph& _graph;
+    uint32_t _pass;
+  };
+
+  /*!
+  * Frame graph of render passes, declared again every frame and run by execute.
+  * The passes nothing reads are culled, the others run in declaration order inside the render pass of their attachments.
+  * Transient textures with the same description share a texture when their lifetimes do not overlap,
+  * the barriers between the passes are inserted by the backend when the passes begin.
+  * The passes and their callbacks are kept in storage reused by the next frames, a frame allocates nothing once warm.
+  */
+  class RenderGraph {
+  public:
+    void init(gfx::Renderer& renderer);
+    void shutdown();
+
+    // texture owned by the caller, its content is kept between the frames
+    RGTexture import(gfx::Texture texture);
+    // setup(RGPassBuilder&) declares the textures of the pass, it is called right away
+    // execute(gfx::Renderer&, const RenderGraph&) records the commands of the pass once the graph is compiled,
+    // it is copied in an arena and never destroyed: capture references or trivially destructible values
+    // the name is not copied: use a string literal
+    // the attachments of the pass are bound by the graph, the color action NOTHING of a first write becomes DONT_CARE
+    template<typename Setup, typename Execute>
+    void add_pass(const char* name, const gfx::PassAction& action, Setup&& setup, Execute&& execute) {
+      using Callback = std::decay_t<Execute>;
+      static_assert(std::is_trivially_destructible_v<Callback>, "the execute callbacks of the render graph are never destroyed");
+      void* storage = _arena.alloc(sizeof(Callback), alignof(Callback));
+      Callback* callback = new (storage) Callback(std::forward<Execute>(execute));
+      auto invoke = [](void* data, gfx::Renderer& renderer, const RenderGraph& graph) {
+        (*static_cast<Callback*>(data))(renderer, graph);
+      };
+
+      uint32_t pass = begin_pass(name, action, PassCallback{ callback, invoke });
+      RGPassBuilder builder(*this, pass);
+      setup(builder);
+    }
+    // culls, allocates and runs the passes declared since the previous execute
+    // returns false and runs nothing when a pass reads a texture no previous pass writes
+    bool execute();
+
+    // texture behind a render graph texture, only valid in the execute callbacks
+    gfx::Texture texture(RGTexture texture) const;
+    const RenderGraphStats& stats() const { return _stats; }
+
+  private:
+    friend class RGPassBuilder;
+
+    struct Resource {
+      RGTextureDesc desc;
+      bool imported = false;
+      gfx::Texture texture = gfx::INVALID_HANDLE;
+      // alive passes using the texture
+      std::optional<uint32_t> first_pass;
+      uint32_t last_pass = 0;
+    };
+
+    struct PassCallback {
+      void* data;
+      void (*invoke)(void* data, gfx::Renderer& renderer, const RenderGraph& graph);
+    };
+
+    // the textures of a pass are ranges of _pass_reads and _pass_colors, appended by its setup
+    struct Pass {
+      const char* name;
+      gfx::PassAction action;
+      uint32_t reads_begin;
+      uint32_t reads_end;
+      uint32_t colors_begin;
+      uint32_t colors_end;
+      std::optional<RGTexture> depth;
+      bool side_effect;
+      bool alive;
+      PassCallback execute;
+    };
+
+    // texture backing the transient textures with its description, destroyed after a frame not using it
+    struct PooledTexture {
+      RGTextureDesc desc;
+      gfx::Texture texture;
+      // last pass of the frame using it
+      std::optional<uint32_t> last_pass;
+    };
+
+    // render passes by declaration index, name and attachments,
+    // the aliasing gives the same textures to the same graph every frame
+    struct RenderPassKey {
+      uint32_t pass;
+      const char* name;
+      uint32_t num_colors;
+      std::array<gfx::Texture, RG_MAX_COLOR_ATTACHMENTS> colors;
+      gfx::Texture depth;
+
+      bool operator==(const RenderPassKey& other) const = default;
+    };
+
+    struct RenderPassKeyHash {
+      size_t operator()(const RenderPassKey& key) const;
+    };
+
+    // destroyed after a frame not using it, like the pooled textures of its attachments
+    struct CachedRenderPass {
+      gfx::RenderPass pass;
+      uint64_t last_frame;
+    };
+
+    RGTexture add_resource(const Resource& resource);
+    uint32_t begin_pass(const char* name, const gfx::PassAction& action, PassCallback execute);
+    void cull();
+    bool compute_lifetimes();
+    void allocate();
+    gfx::RenderPass render_pass(uint32_t pass);
+    // destroys the pooled textures and the render passes the frame did not use
+    void evict();
+    void reset();
+
+    gfx::Renderer* _renderer = nullptr;
+    std::vector<Resource> _resources;
+    std::vector<Pass> _passes;
+    std::vector<RGTexture> _pass_reads;
+    std::vector<RGTexture> _pass_colors;
+    gfx::Arena _arena;
+    // scratch of the compilation
+    std::vector<bool> _needed;
+    std::vector<bool> _written;
+    std::vector<RGTexture> _transients;
+
+    std::vector<PooledTexture> _pool;
+    std::unordered_map<RenderPassKey, CachedRenderPass, RenderPassKeyHash> _render_passes;
+    uint64_t _frame = 0;
+    RenderGraphStats _stats;
+  };
+}
@@ -1,4 +1,5 @@
 #include "shader.h"
+#include "profiler.h"
 
 #include <fstream>
 #include <sstream>
@@ -6,6 +7,7 @@
 
 namespace core {
   Shader load_shader(const char* path) {
+    PROFILE_ZONE("load_shader");
     std::ifstream shader_file;
     // ensure ifstream object can throw exceptions:
     shader_file.exceptions(std::ifstream::failbit | std::ifstream::badbit);
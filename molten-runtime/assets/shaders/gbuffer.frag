@@ -1,21 +1,36 @@
 #version 330 core
 
+// explicit locations and bindings when compiled to SPIR-V at build time (molten-core/cmake/shaders.cmake)
+#if defined(VULKAN) || defined(GL_SPIRV)
+#extension GL_ARB_separate_shader_objects : enable
+#extension GL_ARB_shading_language_420pack : enable
+#define LOCATION(n) layout (location = n)
+#else
+#define LOCATION(n)
+#endif
+#if defined(VULKAN)
+#define TEXTURE_BINDING(n) layout (set = 1, binding = n)
+#elif defined(GL_SPIRV)
+#define TEXTURE_BINDING(n) layout (binding = n)
+#else
+#define TEXTURE_BINDING(n)
+#endif
+
 const int MAX_RAY_STEPS = 64;
 
 layout (location = 0) out vec3 o_pos;
 layout (location = 1) out vec3 o_normal;
 layout (location = 2) out vec3 o_color;
 
-in vec2 io_uv;
-in vec3 io_pos;
-in vec3 io_normal;
-in vec3 io_ray_pos;
-in vec3 io_ray_dir;
+LOCATION(2) in vec2 io_uv;
+LOCATION(0) in vec3 io_pos;
+LOCATION(3) in vec3 io_normal;
+LOCATION(4) in vec3 io_ray_pos;
+LOCATION(5) in vec3 io_ray_dir;
+LOCATION(6) flat in mat4 io_model;
+LOCATION(10) flat in vec3 io_model_dim;
 
-uniform sampler3D u_vox_model;
-uniform mat4 u_model;
-uniform mat4 u_view;
-uniform vec3 u_model_dim;
+TEXTURE_BINDING(0) uniform sampler3D u_vox_model;
 
 struct Ray {
   vec3 pos;
@@ -72,7 +87,7 @@ bool ray_box_intersection(Ray ray, Box box, inout float t_min, inout float t_max
 }
 
 vec3 to_tex_coord(ivec3 voxel_coord) {
-  return (voxel_coord * 2 + 1) / (2 * u_model_dim);
+  return (voxel_coord * 2 + 1) / (2 * io_model_dim);
 }
 
 void main() {
@@ -83,7 +98,7 @@ void main() {
 
   Box box = Box(
     vec3(0.),
-    u_model_dim
+    io_model_dim
   );
 
   float t_min_box = 0.;
@@ -116,8 +131,8 @@ void main() {
 	}
 
   if (hit) {  
-    o_normal = vec3(u_model * vec4(vec3(mask), 1.0));
-    o_pos = vec3(u_model * vec4(to_tex_coord(map_pos), 1.0));
+    o_normal = vec3(io_model * vec4(vec3(mask), 1.0));
+    o_pos = vec3(io_model * vec4(to_tex_coord(map_pos), 1.0));
     o_color = voxel_color.rgb * 100;
   }
   else
@@ -1,33 +1,54 @@
 #version 330 core
 
+// explicit locations and bindings when compiled to SPIR-V at build time (molten-core/cmake/shaders.cmake)
+#if defined(VULKAN) || defined(GL_SPIRV)
+#extension GL_ARB_separate_shader_objects : enable
+#extension GL_ARB_shading_language_420pack : enable
+#define LOCATION(n) layout (location = n)
+#else
+#define LOCATION(n)
+#endif
+#if defined(VULKAN) || defined(GL_SPIRV)
+#define UNIFORM_BLOCK layout (std140, binding = 0)
+#else
+#define UNIFORM_BLOCK layout (std140)
+#endif
+
 layout (location = 0) in vec3 a_pos;
 layout (location = 1) in vec4 a_color;
 layout (location = 2) in vec2 a_uv;
 layout (location = 3) in vec3 a_normal;
+// per instance
+layout (location = 4) in mat4 a_model;
+layout (location = 8) in vec3 a_model_dim;
 
-out vec3 io_pos;
-out vec4 io_color;
-out vec2 io_uv;
-out vec3 io_normal;
-out vec3 io_ray_pos;
-out vec3 io_ray_dir;
+LOCATION(0) out vec3 io_pos;
+LOCATION(1) out vec4 io_color;
+LOCATION(2) out vec2 io_uv;
+LOCATION(3) out vec3 io_normal;
+LOCATION(4) out vec3 io_ray_pos;
+LOCATION(5) out vec3 io_ray_dir;
+LOCATION(6) flat out mat4 io_model;
+LOCATION(10) flat out vec3 io_model_dim;
 
-uniform mat4 u_model;
-uniform mat4 u_view;
-uniform mat4 u_proj;
-uniform vec3 u_model_dim;
+UNIFORM_BLOCK uniform GBufferUniforms {
+  mat4 u_view;
+  mat4 u_proj;
+};
 
 void main() {
   io_color = a_color;
   io_uv = a_uv;
   io_pos = a_pos.xyz;
+  io_model = a_model;
+  io_model_dim = a_model_dim;
 
   vec4 cam_pos = vec4(-u_view[3][0], -u_view[3][1], -u_view[3][2], 1.0);
-  io_ray_pos = (vec3(inverse(u_model) * cam_pos) + vec3(0.5)) * u_model_dim;
-  io_ray_dir = ((a_pos + vec3(0.5)) * u_model_dim) - io_ray_pos;
+  io_ray_pos = (vec3(inverse(a_model) * cam_pos) + vec3(0.5)) * a_model_dim;
+  io_ray_dir = ((a_pos + vec3(0.5)) * a_model_dim) - io_ray_pos;
 
-  mat3 normal_mat = transpose(inverse(mat3(u_model)));
+  mat3 normal_mat = transpose(inverse(mat3(a_model)));
   io_normal = normal_mat * a_normal;
 
-  gl_Position = u_proj * u_view * u_model * vec4(a_pos, 1.0);
+  gl_Position = u_proj * u_view * a_model * vec4(a_pos, 1.0);
 }
\ No newline at end of file
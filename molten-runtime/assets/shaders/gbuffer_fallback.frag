@@ -0,0 +1,34 @@
+#version 330 core
+
+// explicit locations and bindings when compiled to SPIR-V at build time (molten-core/cmake/shaders.cmake)
+#if defined(VULKAN) || defined(GL_SPIRV)
+#extension GL_ARB_separate_shader_objects : enable
+#extension GL_ARB_shading_language_420pack : enable
+#define LOCATION(n) layout (location = n)
+#else
+#define LOCATION(n)
+#endif
+#if defined(VULKAN)
+#define TEXTURE_BINDING(n) layout (set = 1, binding = n)
+#elif defined(GL_SPIRV)
+#define TEXTURE_BINDING(n) layout (binding = n)
+#else
+#define TEXTURE_BINDING(n)
+#endif
+
+// drawn while gbuffer.frag compiles: the cube proxies facing the camera, without ray marching
+
+layout (location = 0) out vec3 o_pos;
+layout (location = 1) out vec3 o_normal;
+layout (location = 2) out vec3 o_color;
+
+LOCATION(5) in vec3 io_ray_dir;
+
+// same bindings as gbuffer.frag, the fallback draws with its textures
+TEXTURE_BINDING(0) uniform sampler3D u_vox_model;
+
+void main() {
+  o_pos = vec3(0.0);
+  o_normal = -normalize(io_ray_dir);
+  o_color = vec3(0.5 + 0.5 * texture(u_vox_model, vec3(0.5)).r);
+}
@@ -1,7 +1,23 @@
 #version 330 core
-in vec2 io_uv;
-out vec4 FragColor;
-uniform sampler2D u_tex;
+
+// explicit locations and bindings when compiled to SPIR-V at build time (molten-core/cmake/shaders.cmake)
+#if defined(VULKAN) || defined(GL_SPIRV)
+#extension GL_ARB_separate_shader_objects : enable
+#extension GL_ARB_shading_language_420pack : enable
+#define LOCATION(n) layout (location = n)
+#else
+#define LOCATION(n)
+#endif
+#if defined(VULKAN)
+#define TEXTURE_BINDING(n) layout (set = 1, binding = n)
+#elif defined(GL_SPIRV)
+#define TEXTURE_BINDING(n) layout (binding = n)
+#else
+#define TEXTURE_BINDING(n)
+#endif
+LOCATION(0) in vec2 io_uv;
+LOCATION(0) out vec4 FragColor;
+TEXTURE_BINDING(0) uniform sampler2D u_tex;
 
 void main() {
    FragColor = texture(u_tex, io_uv);
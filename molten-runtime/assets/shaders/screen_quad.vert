@@ -1,7 +1,16 @@
 #version 330 core
+
+// explicit locations and bindings when compiled to SPIR-V at build time (molten-core/cmake/shaders.cmake)
+#if defined(VULKAN) || defined(GL_SPIRV)
+#extension GL_ARB_separate_shader_objects : enable
+#extension GL_ARB_shading_language_420pack : enable
+#define LOCATION(n) layout (location = n)
+#else
+#define LOCATION(n)
+#endif
 layout (location = 0) in vec3 a_pos;
 layout (location = 1) in vec2 a_uv;
-out vec2 io_uv;
+LOCATION(0) out vec2 io_uv;
 
 void main() {
    io_uv = a_uv;
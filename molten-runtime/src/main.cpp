@@ -1,15 +1,45 @@
 #include <iostream>
 #include <chrono>
 #include <thread>
+#include <cstring>
+#include <cstdlib>
 
 #define SDL_MAIN_HANDLED
 #include <SDL2/SDL.h>
 
 #include "engine.h"
+#include "profiler.h"
+#include "gfx/renderer.h"
 
+// molten-runtime-vk is built with GFX_USE_VULKAN, see MoltenCoreVk
+#if !defined(GFX_USE_VULKAN)
 #define USE_OPENGL
+#endif
+
+int main(int argc, char** argv) {
+  // --frames-in-flight N and --present-mode fifo|mailbox|immediate trade latency against throughput,
+  // --render-scale S renders the frames at S times the window size on Vulkan
+  core::InitInfo engine_info;
+  for (int i = 1; i + 1 < argc; i += 2) {
+    if (std::strcmp(argv[i], "--frames-in-flight") == 0) {
+      engine_info.frames_in_flight = (uint32_t)std::atoi(argv[i + 1]);
+    } else if (std::strcmp(argv[i], "--render-scale") == 0) {
+      engine_info.render_scale = (float)std::atof(argv[i + 1]);
+    } else if (std::strcmp(argv[i], "--present-mode") == 0) {
+      if (std::strcmp(argv[i + 1], "fifo") == 0) {
+        engine_info.present_mode = gfx::PresentMode::FIFO;
+      } else if (std::strcmp(argv[i + 1], "mailbox") == 0) {
+        engine_info.present_mode = gfx::PresentMode::MAILBOX;
+      } else if (std::strcmp(argv[i + 1], "immediate") == 0) {
+        engine_info.present_mode = gfx::PresentMode::IMMEDIATE;
+      } else {
+        std::cerr << "Unknown present mode " << argv[i + 1] << ", expected fifo, mailbox or immediate" << std::endl;
+      }
+    } else {
+      std::cerr << "Unknown option " << argv[i] << std::endl;
+    }
+  }
 
-int main(int, char**) {
   SDL_SetMainReady();
   if (SDL_Init(SDL_INIT_VIDEO) < 0) {
     std::cerr << "Failed to initialize SDL. Error: " << SDL_GetError() << std::endl;
@@ -48,12 +78,21 @@ int main(int, char**) {
     std::cerr << "Failed to initialize GL context. Error: " << SDL_GetError() << std::endl;
     return 1;
   }
-  // vsync
-  SDL_GL_SetSwapInterval(1);
+  // vsync, GL has no mailbox mode
+  SDL_GL_SetSwapInterval(engine_info.present_mode == gfx::PresentMode::IMMEDIATE ? 0 : 1);
 #endif
 
   core::Engine engine;
-  engine.init(core::InitInfo { window });
+  engine_info.window = window;
+  if (!engine.init(engine_info)) {
+    std::cerr << "Failed to initialize the engine" << std::endl;
+#ifdef USE_OPENGL
+    SDL_GL_DeleteContext(gl_context);
+#endif
+    SDL_DestroyWindow(window);
+    SDL_Quit();
+    return 1;
+  }
 
   bool should_close = false;
   bool stop_rendering = false;
@@ -79,6 +118,14 @@ int main(int, char**) {
       }
       break;
 
+      case SDL_KEYDOWN: {
+        // dumps the last frames, open the file with chrome://tracing or Perfetto
+        if (event.key.keysym.sym == SDLK_F9 && core::write_profile_trace("molten-trace.json")) {
+          std::cout << "Profile trace written to molten-trace.json" << std::endl;
+        }
+      }
+      break;
+
       default:
         break;
       }
@@ -98,6 +145,13 @@ int main(int, char**) {
 
   engine.shutdown();
 
+#if defined(GFX_USE_VULKAN)
+  // a warm start hits the cache for every pipeline
+  const gfx::PipelineCacheStats& pipeline_stats = gfx::get_pipeline_cache_stats();
+  std::cout << "Pipeline cache: " << pipeline_stats.hits << " hits, " << pipeline_stats.misses << " misses, "
+    << pipeline_stats.creation_ms << " ms creating pipelines" << std::endl;
+#endif
+
 #ifdef USE_OPENGL
   SDL_GL_DeleteContext(gl_context);
 #endif